@@ -0,0 +1,39 @@
+// include: bmi-compare.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_COMPARE_H
+#define _BMI_INTERNAL_COMPARE_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+
+// Compares two BMI buffers of the same size and format, storing whether their
+// pixels are equal and, if not, the first point where they differ
+int bmi_buffer_compare(const bmi_buffer* a, const bmi_buffer* b, int* equal,
+                       bmi_point* first);
+
+// Allocates a new BMI buffer holding the absolute difference of each channel
+// of two BMI buffers, storing the bounds of the differing pixels
+bmi_buffer* bmi_buffer_diff(const bmi_buffer* a, const bmi_buffer* b,
+                            bmi_rect* changed);
+
+// Computes the mean squared error over every channel of two BMI buffers
+int bmi_buffer_mse(const bmi_buffer* a, const bmi_buffer* b, double* mse);
+
+// Computes the peak signal-to-noise ratio, in decibels, of two BMI buffers
+int bmi_buffer_psnr(const bmi_buffer* a, const bmi_buffer* b, double* psnr);
+
+#endif /* _BMI_INTERNAL_COMPARE_H */
@@ -20,15 +20,31 @@
 #include "bmi-file.h"
 #include "bmi-geometry.h"
 #include "bmi-color.h"
+#include "bmi-mask.h"
 
 // Draws a pixel at the specified coordinates
 void bmi_buffer_draw_point(bmi_buffer* buffer, bmi_point point,
                            bmi_pixel pixel);
 
+// Draws a pixel at each of the specified points, skipping those outside of the
+// buffer
+void bmi_buffer_draw_points(bmi_buffer* buffer, const bmi_point* points,
+                            size_t count, bmi_pixel pixel);
+
+// Draws the corresponding pixel at each of the specified points, skipping those
+// outside of the buffer
+void bmi_buffer_draw_colored_points(bmi_buffer* buffer, const bmi_point* points,
+                                    const bmi_pixel* pixels, size_t count);
+
 // Fills a rectangle in the specified bounds
 void bmi_buffer_fill_rect(bmi_buffer* buffer, bmi_rect bounds,
                           bmi_pixel pixel);
 
+// Fills the part of a rectangle in the specified bounds where the mask, which
+// is in the buffer's coordinates, is set
+void bmi_buffer_fill_rect_masked(bmi_buffer* buffer, bmi_rect bounds,
+                                 bmi_pixel pixel, const bmi_mask* mask);
+
 // Strokes a rectangle in the specified bounds with specified thickness
 void bmi_buffer_stroke_rect(bmi_buffer* buffer, bmi_rect bounds,
                             uint32_t thickness, bmi_pixel pixel);
@@ -41,8 +57,28 @@ void bmi_buffer_fill_ellipse(bmi_buffer* buffer, bmi_rect bounds,
 void bmi_buffer_stroke_line(bmi_buffer* buffer, bmi_point start, bmi_point end,
                             uint32_t thickness, bmi_pixel pixel);
 
+// Strokes connected one pixel wide lines through the specified points
+void bmi_buffer_stroke_polyline(bmi_buffer* buffer, const bmi_point* points,
+                                size_t count, bmi_pixel pixel);
+
+typedef enum {
+    BMI_CONNECTIVITY_4 = 4,
+    BMI_CONNECTIVITY_8 = 8
+} bmi_connectivity;
+
+// Fills the region connected to the seed whose pixels are within tolerance of
+// the seed's color in every channel
+int bmi_buffer_flood_fill(bmi_buffer* buffer, bmi_point seed, bmi_pixel pixel,
+                          bmi_connectivity connectivity, uint32_t tolerance);
+
 // Draws a BMI buffer in the specified bounds of another BMI buffer
 int bmi_buffer_overdraw_buffer(bmi_buffer* buffer, bmi_rect region,
                                const bmi_buffer* layer);
 
+// Draws a BMI buffer in the specified bounds of another BMI buffer where the
+// mask, which is in the coordinates of the latter, is set
+int bmi_buffer_overdraw_buffer_masked(bmi_buffer* buffer, bmi_rect region,
+                                      const bmi_buffer* layer,
+                                      const bmi_mask* mask);
+
 #endif /* _BMI_INTERNAL_DRAW_H */
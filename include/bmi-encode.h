@@ -0,0 +1,37 @@
+// include: bmi-encode.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_ENCODE_H
+#define _BMI_INTERNAL_ENCODE_H
+
+#include "bmi-file.h"
+#include <stdio.h>
+
+typedef enum {
+    BMI_ENCODE_BMI,
+    BMI_ENCODE_PPM,
+    BMI_ENCODE_BMP
+} bmi_encode_format;
+
+// Saves the BMI buffer to a file in the given format, the same as the matching
+// bmi_buffer_to_* function. Bands of rows are encoded on parallel threads and
+// written straight to their place in the file, so that at most a band per
+// thread is held in memory. Files that cannot be written at an offset, such as
+// pipes, are written in order instead.
+int bmi_buffer_encode(FILE* dest, const bmi_buffer* buffer,
+                      bmi_encode_format format);
+
+#endif /* _BMI_INTERNAL_ENCODE_H */
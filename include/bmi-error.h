@@ -35,11 +35,63 @@ const char* bmi_last_error(void);
 #define _BMI_SELECT(x, y, ...) _BMI_THIRD(__VA_ARGS__, x, y, ~)
 
 #define _BMI_IS_FAILABLE_bmi_buffer_overdraw_buffer ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_get_pixels ~, ~
 #define _BMI_IS_FAILABLE_bmi_buffer_new ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_convert ~, ~
 #define _BMI_IS_FAILABLE_bmi_buffer_from_file ~, ~
 #define _BMI_IS_FAILABLE_bmi_buffer_to_file ~, ~
 #define _BMI_IS_FAILABLE_bmi_buffer_to_ppm ~, ~
 #define _BMI_IS_FAILABLE_bmi_buffer_to_bmp ~, ~
+#define _BMI_IS_FAILABLE_bmi_font_new ~, ~
+#define _BMI_IS_FAILABLE_bmi_font_from_bdf ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_draw_text ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_draw_text_box ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_flood_fill ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_histogram ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_histogram_rect ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_stats ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_stats_rect ~, ~
+#define _BMI_IS_FAILABLE_bmi_histogram_stats ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_compare ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_diff ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_mse ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_psnr ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_transpose ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_rotate ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_flip ~, ~
+#define _BMI_IS_FAILABLE_bmi_pipeline_new ~, ~
+#define _BMI_IS_FAILABLE_bmi_pipeline_submit ~, ~
+#define _BMI_IS_FAILABLE_bmi_pipeline_flush ~, ~
+#define _BMI_IS_FAILABLE_bmi_sequence_writer_new ~, ~
+#define _BMI_IS_FAILABLE_bmi_sequence_writer_from_file ~, ~
+#define _BMI_IS_FAILABLE_bmi_sequence_write_frame ~, ~
+#define _BMI_IS_FAILABLE_bmi_sequence_writer_free ~, ~
+#define _BMI_IS_FAILABLE_bmi_sequence_reader_from_file ~, ~
+#define _BMI_IS_FAILABLE_bmi_sequence_read_frame ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_snapshot ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_unshare ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_fill_linear_gradient ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_fill_radial_gradient ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_from_ppm ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_from_bmp ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_crop ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_resize ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_set_palette ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_quantize ~, ~
+#define _BMI_IS_FAILABLE_bmi_mask_new ~, ~
+#define _BMI_IS_FAILABLE_bmi_mask_from_buffer ~, ~
+#define _BMI_IS_FAILABLE_bmi_mask_to_buffer ~, ~
+#define _BMI_IS_FAILABLE_bmi_mask_and ~, ~
+#define _BMI_IS_FAILABLE_bmi_mask_or ~, ~
+#define _BMI_IS_FAILABLE_bmi_mask_xor ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_overdraw_buffer_masked ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_build_pyramid ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_encode ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_apply_lut ~, ~
+#define _BMI_IS_FAILABLE_bmi_buffer_apply_lut_rect ~, ~
+#define _BMI_IS_FAILABLE_bmi_lut_gamma ~, ~
+#define _BMI_IS_FAILABLE_bmi_lut_levels ~, ~
+#define _BMI_IS_FAILABLE_bmi_lut_curve ~, ~
 
 #define BMI_IS_FAILABLE(func) _BMI_SELECT(1, 0, _BMI_IS_FAILABLE_##func)
 
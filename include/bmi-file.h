@@ -42,9 +42,25 @@
 const char* bmi_version_string(const uint8_t version);
 
 typedef enum {
-    BMI_FL_IS_GRAYSCALE = 1 << 0
+    BMI_FL_IS_GRAYSCALE = 1 << 0,
+    BMI_FL_HAS_CHECKSUM = 1 << 1,
+    BMI_FL_IS_TILED = 1 << 2,
+    BMI_FL_IS_MAPPED = 1 << 3,
+    BMI_FL_IS_SEQUENCE = 1 << 4,
+    BMI_FL_IS_SHARED = 1 << 5,
+    BMI_FL_IS_PALETTE = 1 << 6
 } bmi_flags;
 
+// Files with BMI_FL_HAS_CHECKSUM end with the little-endian bmi_buffer_hash of
+// their contents, which for BMI_FL_IS_PALETTE includes the palette before them
+#define BMI_CHECKSUM_SIZE 8
+
+// Buffers with BMI_FL_IS_TILED keep their pixels in square tiles of this many
+// pixels a side, each stored contiguously in row-major order, so that pixels
+// close in either direction share cache lines and pages. Files are always
+// row-major, so the flag is never saved.
+#define BMI_TILE_SIZE 64
+
 typedef struct {
     uint8_t header[3];
     uint8_t version[1];
@@ -58,17 +74,47 @@ typedef struct {
                                    && (buffer).header[1] == BMI_HEADER_1 \
                                    && (buffer).header[2] == BMI_HEADER_2)
 
-// Returns the total size, in bytes, of the BMI's contents
+// Returns the total size, in bytes, of the BMI's contents, which for tiled
+// buffers includes the padding of partial tiles
 size_t bmi_buffer_content_size(const bmi_buffer* buffer);
 
 #ifdef _BMI_USE_INTERNAL
-#define BMI_COMPONENT_SIZE_FROM_FL(fl) (((fl) & BMI_FL_IS_GRAYSCALE) ? 1 : 3)
+// Flags describing how a buffer is kept in memory, which are never saved
+#define BMI_FL_MEMORY_MASK (BMI_FL_IS_TILED | BMI_FL_IS_MAPPED \
+                            | BMI_FL_IS_SHARED)
+
+#define BMI_COMPONENT_SIZE_FROM_FL(fl) \
+    (((fl) & (BMI_FL_IS_GRAYSCALE | BMI_FL_IS_PALETTE)) ? 1 : 3)
 
 #define bmi_buffer_component_size(buffer) \
     BMI_COMPONENT_SIZE_FROM_FL(buffer->flags)
 
+#define BMI_TILE_SHIFT 6
+#define BMI_TILE_MASK (BMI_TILE_SIZE - 1)
+
+// The number of tiles needed to cover the given number of pixels
+#define BMI_TILE_COUNT(n) (((size_t)(n) + BMI_TILE_MASK) >> BMI_TILE_SHIFT)
+
+// The number of pixels stored for the given dimensions and flags
+#define BMI_PIXEL_COUNT_FROM_FL(width, height, fl) \
+    (((fl) & BMI_FL_IS_TILED) \
+     ? BMI_TILE_COUNT(width) * BMI_TILE_COUNT(height) << (2 * BMI_TILE_SHIFT) \
+     : (size_t)(width) * (height))
+
+#define BMI_TILED_INDEX(width, x, y) \
+    (((((size_t)(y) >> BMI_TILE_SHIFT) * BMI_TILE_COUNT(width) \
+       + ((size_t)(x) >> BMI_TILE_SHIFT)) << (2 * BMI_TILE_SHIFT)) \
+     | (((size_t)(y) & BMI_TILE_MASK) << BMI_TILE_SHIFT) \
+     | ((size_t)(x) & BMI_TILE_MASK))
+
+// The index of the pixel at the given coordinates in the buffer's layout
+#define BMI_PIXEL_INDEX(buffer, x, y) \
+    (((buffer)->flags & BMI_FL_IS_TILED) \
+     ? BMI_TILED_INDEX((buffer)->width, x, y) \
+     : (size_t)(buffer)->width * (y) + (x))
+
 #define BMI_GET_INDEX(buffer, x, y) \
-    (((buffer)->width * (y) + (x)) * bmi_buffer_component_size(buffer))
+    (BMI_PIXEL_INDEX(buffer, x, y) * bmi_buffer_component_size(buffer))
 
 #endif
 
@@ -45,6 +45,10 @@ void bmi_clip_point(bmi_point* point, const bmi_rect bounds);
 // Clips the specified rectangle to the given bounds
 void bmi_clip_rect(bmi_rect* rect, const bmi_rect bounds);
 
+// Clips the line between the specified points to the pixels inside the given
+// bounds without changing its slope, returning zero if no part of it remains
+int bmi_clip_line(bmi_point* start, bmi_point* end, const bmi_rect bounds);
+
 typedef enum {
     BMI_RECT_EDGE_LEFT,
     BMI_RECT_EDGE_RIGHT,
@@ -64,4 +68,22 @@ void bmi_inset_rect(bmi_rect* rect, uint32_t delta, bmi_rect_edge edge);
 // Sets the specified edge of the specified rectangle to the given amount
 void bmi_set_rect(bmi_rect* rect, uint32_t width, bmi_rect_edge edge);
 
+#ifdef _BMI_USE_INTERNAL
+#define BMI_INDEX_INVALID ((size_t)-1)
+
+// Returns an allocated, stable ordering of the in-bounds points by row band, or
+// NULL if the points are too few to be worth sorting (or allocation failed),
+// in which case they should be visited in order. The number of in-bounds points
+// is stored in valid.
+size_t* bmi_bin_points(const bmi_point* points, size_t count, uint32_t width,
+                       uint32_t height, size_t* valid);
+
+// Computes the pixel index of count points in the layout selected by flags,
+// either taken in sequence or through the given ordering, writing
+// BMI_INDEX_INVALID for points outside of the given dimensions
+void bmi_index_points(const bmi_point* points, const size_t* order,
+                      size_t count, uint32_t width, uint32_t height,
+                      uint32_t flags, size_t* indices);
+#endif
+
 #endif /* _BMI_INTERNAL_GEOMETRY_H */
@@ -0,0 +1,51 @@
+// include: bmi-gradient.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_GRADIENT_H
+#define _BMI_INTERNAL_GRADIENT_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+#include "bmi-color.h"
+#include <stddef.h>
+
+// A color at a position along a gradient, from 0 at its start to 1 at its end
+typedef struct {
+    double offset;
+    bmi_pixel pixel;
+} bmi_gradient_stop;
+
+typedef enum {
+    BMI_DITHER_NONE,
+    BMI_DITHER_ORDERED
+} bmi_dither;
+
+// Fills a rectangle with colors ramping through the stops, in order of
+// increasing offset, from the start point to the end point. Pixels before the
+// start or past the end take the color of the first or last stop.
+int bmi_buffer_fill_linear_gradient(bmi_buffer* buffer, bmi_rect bounds,
+                                    bmi_point start, bmi_point end,
+                                    const bmi_gradient_stop* stops,
+                                    size_t count, bmi_dither dither);
+
+// Fills a rectangle with colors ramping through the stops, in order of
+// increasing offset, outwards from the center to the given radius
+int bmi_buffer_fill_radial_gradient(bmi_buffer* buffer, bmi_rect bounds,
+                                    bmi_point center, uint32_t radius,
+                                    const bmi_gradient_stop* stops,
+                                    size_t count, bmi_dither dither);
+
+#endif /* _BMI_INTERNAL_GRADIENT_H */
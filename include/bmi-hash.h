@@ -0,0 +1,42 @@
+// include: bmi-hash.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_HASH_H
+#define _BMI_INTERNAL_HASH_H
+
+#include "bmi-file.h"
+
+// Returns a fast non-cryptographic 64-bit hash of the BMI buffer's pixel data,
+// and palette if it has one, which is the same value stored as its checksum
+// when saved
+uint64_t bmi_buffer_hash(const bmi_buffer* buffer);
+
+#ifdef _BMI_USE_INTERNAL
+typedef struct {
+    uint64_t lanes[4];
+    uint64_t total;
+    uint8_t pending[32];
+    uint32_t pending_size;
+} bmi_hash_state;
+
+// Streaming XXH64 with a seed of zero
+void bmi_hash_init(bmi_hash_state* state);
+void bmi_hash_update(bmi_hash_state* state, const void* data, size_t size);
+uint64_t bmi_hash_digest(const bmi_hash_state* state);
+
+#endif
+
+#endif /* _BMI_INTERNAL_HASH_H */
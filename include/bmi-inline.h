@@ -0,0 +1,164 @@
+// include: bmi-inline.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+// Defining BMI_INLINE_FASTPATH before including bmi.h, or this header, adds
+// static inline versions of the hottest per-pixel operations, so that callers
+// drawing or reading one pixel at a time avoid a call per pixel and loops over
+// them can be optimized as a whole. They check neither bounds nor arguments.
+// Palette and shared buffers, whose pixels need the library to translate or
+// copy them, are handed on to the out-of-line functions.
+#ifdef BMI_INLINE_FASTPATH
+#ifndef _BMI_INTERNAL_INLINE_H
+#define _BMI_INTERNAL_INLINE_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+#include "bmi-color.h"
+#include "bmi-util.h"
+#include "bmi-draw.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// The flags of buffers the inline functions pass on to the library
+#define BMI_INLINE_DEFERRED (BMI_FL_IS_PALETTE | BMI_FL_IS_SHARED)
+
+// Returns the size, in bytes, of one pixel of the buffer
+static inline size_t bmi_inline_pixel_size(const bmi_buffer* buffer) {
+    return (buffer->flags & (BMI_FL_IS_GRAYSCALE | BMI_FL_IS_PALETTE)) ? 1 : 3;
+}
+
+// Returns the same as bmi_buffer_content_size
+static inline size_t bmi_inline_content_size(const bmi_buffer* buffer) {
+    size_t columns = buffer->width;
+    size_t rows = buffer->height;
+    if (buffer->flags & BMI_FL_IS_TILED) {
+        columns = (columns + BMI_TILE_SIZE - 1) / BMI_TILE_SIZE * BMI_TILE_SIZE;
+        rows = (rows + BMI_TILE_SIZE - 1) / BMI_TILE_SIZE * BMI_TILE_SIZE;
+    }
+    return columns * rows * bmi_inline_pixel_size(buffer);
+}
+
+// Returns the index, in pixels, of the given point in the buffer's contents
+static inline size_t bmi_inline_index(const bmi_buffer* buffer, uint32_t x,
+                                      uint32_t y) {
+    if (!(buffer->flags & BMI_FL_IS_TILED)) {
+        return (size_t)buffer->width * y + x;
+    }
+    const size_t tiles = ((size_t)buffer->width + BMI_TILE_SIZE - 1)
+                         / BMI_TILE_SIZE;
+    return ((y / BMI_TILE_SIZE) * tiles + x / BMI_TILE_SIZE)
+           * BMI_TILE_SIZE * BMI_TILE_SIZE
+           + (y % BMI_TILE_SIZE) * BMI_TILE_SIZE + x % BMI_TILE_SIZE;
+}
+
+// Returns the pixel at the given point, which must lie within the buffer
+static inline bmi_pixel bmi_inline_get_pixel(const bmi_buffer* buffer,
+                                             bmi_point point) {
+    if (buffer->flags & BMI_INLINE_DEFERRED) {
+        return bmi_buffer_get_pixel(buffer, point);
+    }
+    const size_t size = bmi_inline_pixel_size(buffer);
+    const uint8_t* src = buffer->contents
+                         + bmi_inline_index(buffer, point.x, point.y) * size;
+    return size == 1 ? BMI_GRY(src[0])
+                     : BMI_RGB((bmi_pixel)src[0], (bmi_pixel)src[1],
+                               (bmi_pixel)src[2]);
+}
+
+// Draws a pixel at the given point, which must lie within the buffer
+static inline void bmi_inline_draw_point(bmi_buffer* buffer, bmi_point point,
+                                         bmi_pixel pixel) {
+    if (buffer->flags & BMI_INLINE_DEFERRED) {
+        bmi_buffer_draw_point(buffer, point, pixel);
+        return;
+    }
+    const size_t size = bmi_inline_pixel_size(buffer);
+    uint8_t* dst = buffer->contents
+                   + bmi_inline_index(buffer, point.x, point.y) * size;
+    dst[0] = (uint8_t)BMI_RGB_R(pixel);
+    if (size == 3) {
+        dst[1] = (uint8_t)BMI_RGB_G(pixel);
+        dst[2] = (uint8_t)BMI_RGB_B(pixel);
+    }
+}
+
+// Returns how many of the count pixels from the given column onwards in a row
+// are contiguous in memory
+static inline size_t bmi_inline_run(const bmi_buffer* buffer, uint32_t x,
+                                    size_t count) {
+    const size_t room = BMI_TILE_SIZE - x % BMI_TILE_SIZE;
+    return (buffer->flags & BMI_FL_IS_TILED) && count > room ? room : count;
+}
+
+// Writes count copies of a pixel along a row from the given point, all of
+// which must lie within the buffer
+static inline void bmi_inline_fill_span(bmi_buffer* buffer, uint32_t x,
+                                        uint32_t y, size_t count,
+                                        bmi_pixel pixel) {
+    if (buffer->flags & BMI_INLINE_DEFERRED) {
+        bmi_buffer_fill_rect(buffer, BMI_RECT(x, y, (uint32_t)count, 1),
+                             pixel);
+        return;
+    }
+    const size_t size = bmi_inline_pixel_size(buffer);
+    while (count > 0) {
+        const size_t run = bmi_inline_run(buffer, x, count);
+        uint8_t* dst = buffer->contents + bmi_inline_index(buffer, x, y) * size;
+        if (size == 1) {
+            memset(dst, (int)BMI_GRY_V(pixel), run);
+        } else {
+            for (size_t i = 0; i < run; i++) {
+                dst[3 * i] = (uint8_t)BMI_RGB_R(pixel);
+                dst[3 * i + 1] = (uint8_t)BMI_RGB_G(pixel);
+                dst[3 * i + 2] = (uint8_t)BMI_RGB_B(pixel);
+            }
+        }
+        x += (uint32_t)run;
+        count -= run;
+    }
+}
+
+// Reads count pixels along a row from the given point, all of which must lie
+// within the buffer
+static inline void bmi_inline_load_span(const bmi_buffer* buffer, uint32_t x,
+                                        uint32_t y, bmi_pixel* pixels,
+                                        size_t count) {
+    if (buffer->flags & BMI_INLINE_DEFERRED) {
+        for (size_t i = 0; i < count; i++) {
+            pixels[i] = bmi_buffer_get_pixel(buffer,
+                                             BMI_POINT(x + (uint32_t)i, y));
+        }
+        return;
+    }
+    const size_t size = bmi_inline_pixel_size(buffer);
+    while (count > 0) {
+        const size_t run = bmi_inline_run(buffer, x, count);
+        const uint8_t* src = buffer->contents
+                             + bmi_inline_index(buffer, x, y) * size;
+        for (size_t i = 0; i < run; i++) {
+            pixels[i] = size == 1 ? BMI_GRY(src[i])
+                : BMI_RGB((bmi_pixel)src[3 * i], (bmi_pixel)src[3 * i + 1],
+                          (bmi_pixel)src[3 * i + 2]);
+        }
+        pixels += run;
+        x += (uint32_t)run;
+        count -= run;
+    }
+}
+
+#endif /* _BMI_INTERNAL_INLINE_H */
+#endif
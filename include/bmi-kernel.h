@@ -0,0 +1,116 @@
+// include: bmi-kernel.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_KERNEL_H
+#define _BMI_INTERNAL_KERNEL_H
+
+#ifdef _BMI_USE_INTERNAL
+
+#include "bmi-file.h"
+#include "bmi-color.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// A set of pixel kernels specialized for a single pixel format. Every pointer
+// passed to a kernel addresses the first pixel it operates on.
+typedef struct {
+    // The size, in bytes, of one pixel
+    size_t size;
+    
+    // Writes one pixel
+    void (*point)(uint8_t* dst, bmi_pixel pixel);
+    
+    // Writes count copies of one pixel
+    void (*span)(uint8_t* dst, size_t count, bmi_pixel pixel);
+    
+    // Copies count pixels of the same format
+    void (*blit)(uint8_t* dst, const uint8_t* src, size_t count);
+    
+    // Reads one pixel
+    bmi_pixel (*read)(const uint8_t* src);
+    
+    // Reads count pixels into an array
+    void (*load)(bmi_pixel* dst, const uint8_t* src, size_t count);
+    
+    // Writes count pixels from an array
+    void (*store)(uint8_t* dst, const bmi_pixel* src, size_t count);
+} bmi_kernels;
+
+// The flags that select the pixel format, and so the kernel set, of a buffer
+#define BMI_FL_FORMAT_MASK (BMI_FL_IS_GRAYSCALE | BMI_FL_IS_PALETTE)
+
+#define BMI_FORMAT_FROM_FL(fl) ((fl) & BMI_FL_FORMAT_MASK)
+
+// Kernel sets are indexed by the format flags packed into consecutive bits
+#define BMI_KERNEL_SLOT(fl) \
+    (((fl) & BMI_FL_IS_GRAYSCALE) | ((fl) & BMI_FL_IS_PALETTE) >> 5)
+#define BMI_KERNEL_SLOTS 4
+
+// One kernel set per pixel format, indexed by BMI_KERNEL_SLOT. The pixels of
+// palette buffers are their indices, and kernels never see their colors.
+extern const bmi_kernels bmi_kernel_table[BMI_KERNEL_SLOTS];
+
+#define bmi_buffer_kernels(buffer) \
+    (&bmi_kernel_table[BMI_KERNEL_SLOT((buffer)->flags)])
+
+// Returns the address of the pixel at the given coordinates using the size
+// from an already selected kernel set
+#define BMI_KERNEL_ADDRESS(buffer, kernels, x, y) \
+    ((buffer)->contents + BMI_PIXEL_INDEX(buffer, x, y) * (kernels)->size)
+
+// Returns how many of the count pixels from the given column onwards in a row
+// are contiguous in memory, which is all of them unless the buffer is tiled
+#define BMI_KERNEL_RUN(buffer, x, count) \
+    (((buffer)->flags & BMI_FL_IS_TILED) \
+     && (size_t)(count) > (size_t)(BMI_TILE_SIZE - ((x) & BMI_TILE_MASK)) \
+     ? (size_t)(BMI_TILE_SIZE - ((x) & BMI_TILE_MASK)) : (size_t)(count))
+
+// The number of pixels loaded to or stored from the stack at once by kernels
+// converting between formats
+#define BMI_KERNEL_CHUNK 256
+
+// Writes count copies of one pixel along a row from the given point, split
+// wherever the layout of the buffer breaks the row. These writers copy the
+// tiles of shared buffers first, and if that fails write nothing and return
+// BMI_FAILURE without setting an error, which the caller reports.
+int bmi_kernel_span(bmi_buffer* buffer, const bmi_kernels* kernels,
+                    uint32_t x, uint32_t y, size_t count, bmi_pixel pixel);
+
+// Fills a rectangle lying within the buffer with one pixel, merging rows that
+// are contiguous in memory into a single span
+int bmi_kernel_fill(bmi_buffer* buffer, const bmi_kernels* kernels,
+                    uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                    bmi_pixel pixel);
+
+// Copies count pixels of the buffer's format along a row from the given point
+int bmi_kernel_blit(bmi_buffer* buffer, const bmi_kernels* kernels,
+                    uint32_t x, uint32_t y, const uint8_t* src, size_t count);
+
+// Copies count pixels along a row from the given point out to linear memory
+void bmi_kernel_gather(const bmi_buffer* buffer, const bmi_kernels* kernels,
+                       uint32_t x, uint32_t y, uint8_t* dst, size_t count);
+
+// Finds the stretch of at most limit pixels, starting at the given position in
+// row-major order, that is contiguous in memory. Returns its length in pixels
+// and stores its address, so that callers can stream a buffer in file order
+// whatever its layout.
+size_t bmi_kernel_segment(const bmi_buffer* buffer, const bmi_kernels* kernels,
+                          uint64_t position, size_t limit,
+                          const uint8_t** address);
+
+#endif
+
+#endif /* _BMI_INTERNAL_KERNEL_H */
@@ -0,0 +1,58 @@
+// include: bmi-lut.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_LUT_H
+#define _BMI_INTERNAL_LUT_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+#include "bmi-stats.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// A table of the new value of every value of each channel, of which grayscale
+// buffers only use the first
+typedef struct {
+    uint8_t tables[BMI_MAX_CHANNELS][256];
+} bmi_lut;
+
+// Replaces every channel of every pixel in the BMI buffer with its entry in
+// the table of that channel. Palette buffers have their palette transformed
+// instead.
+int bmi_buffer_apply_lut(bmi_buffer* buffer, const bmi_lut* lut);
+
+// Replaces every channel of every pixel in the specified region of the BMI
+// buffer with its entry in the table of that channel. Pixels of palette
+// buffers take the nearest color to their transformed one.
+int bmi_buffer_apply_lut_rect(bmi_buffer* buffer, bmi_rect region,
+                              const bmi_lut* lut);
+
+// Fills a table that raises each value, as a fraction of 255, to the power of
+// one over gamma, so that a gamma above one brightens the midtones
+int bmi_lut_gamma(uint8_t* table, double gamma);
+
+// Fills a table that maps the input range onto the output range, which may be
+// reversed, clamping the values outside of it and correcting the midtones by
+// gamma as bmi_lut_gamma does
+int bmi_lut_levels(uint8_t* table, uint8_t in_low, uint8_t in_high,
+                   double gamma, uint8_t out_low, uint8_t out_high);
+
+// Fills a table with a smooth curve through the given points, taking each x
+// to its y, which never overshoots between them and is flat beyond the ends.
+// The x of each point must exceed that of the one before it.
+int bmi_lut_curve(uint8_t* table, const bmi_point* points, size_t count);
+
+#endif /* _BMI_INTERNAL_LUT_H */
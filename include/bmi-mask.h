@@ -0,0 +1,81 @@
+// include: bmi-mask.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_MASK_H
+#define _BMI_INTERNAL_MASK_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// A mask of one bit per pixel, set where drawing is allowed. Each row starts
+// on a new 64-bit word with its first pixel in the lowest bit, and the bits
+// past the width are always clear.
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint64_t words[];
+} bmi_mask;
+
+// The number of words in each row of a mask of the given width
+#define BMI_MASK_STRIDE(width) (((size_t)(width) + 63) >> 6)
+
+// Evaluates to the first word of a row of a mask
+#define bmi_mask_row(mask, y) \
+    ((mask)->words + (size_t)(y) * BMI_MASK_STRIDE((mask)->width))
+
+// Allocates a new mask to be freed with every bit clear
+bmi_mask* bmi_mask_new(uint32_t width, uint32_t height);
+
+// Frees a mask
+void bmi_mask_free(bmi_mask* mask);
+
+// Allocates a new mask to be freed of the same size as a BMI buffer, set where
+// its gray level, or the luma of its color, is at least the threshold
+bmi_mask* bmi_mask_from_buffer(const bmi_buffer* buffer, uint8_t threshold);
+
+// Allocates a new grayscale BMI buffer to be freed that is white where the
+// mask is set and black elsewhere
+bmi_buffer* bmi_mask_to_buffer(const bmi_mask* mask);
+
+// Returns whether the bit at the given point is set, which it never is outside
+// of the mask
+int bmi_mask_get(const bmi_mask* mask, bmi_point point);
+
+// Sets or clears every bit in the specified bounds
+void bmi_mask_set_rect(bmi_mask* mask, bmi_rect bounds, int value);
+
+// Combines a mask into another of the same size, bit by bit
+int bmi_mask_and(bmi_mask* dst, const bmi_mask* src);
+int bmi_mask_or(bmi_mask* dst, const bmi_mask* src);
+int bmi_mask_xor(bmi_mask* dst, const bmi_mask* src);
+
+// Flips every bit of the mask
+void bmi_mask_not(bmi_mask* mask);
+
+// Returns the number of set bits
+uint64_t bmi_mask_count(const bmi_mask* mask);
+
+#ifdef _BMI_USE_INTERNAL
+// Finds the first run of set bits in a row of a mask that lies at or after x
+// and before end, storing where it starts and returning its length, or zero
+// when there is none. Whole clear and set words are skipped at once.
+size_t bmi_mask_next_run(const uint64_t* row, uint32_t x, uint32_t end,
+                         uint32_t* start);
+#endif
+
+#endif /* _BMI_INTERNAL_MASK_H */
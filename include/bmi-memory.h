@@ -0,0 +1,43 @@
+// include: bmi-memory.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_MEMORY_H
+#define _BMI_INTERNAL_MEMORY_H
+
+#include "bmi-file.h"
+
+// Releases a BMI buffer allocated by the library, however it is kept in memory
+void bmi_buffer_free(bmi_buffer* buffer);
+
+// Faults in every page of a new BMI buffer from the parallel threads, so that
+// on NUMA systems each band of the image is placed near a thread working on it
+void bmi_buffer_prefault(bmi_buffer* buffer);
+
+#ifdef _BMI_USE_INTERNAL
+// Returns the total size, in bytes, of a buffer with the given attributes, or
+// zero if it does not fit in memory
+size_t bmi_buffer_storage_size(uint32_t width, uint32_t height,
+                               uint32_t flags);
+
+// Maps zeroed memory of the given size directly from the system, backed by huge
+// pages where possible
+void* bmi_map_pages(size_t size);
+
+// Unmaps memory of the given size returned by bmi_map_pages
+void bmi_unmap_pages(void* pages, size_t size);
+#endif
+
+#endif /* _BMI_INTERNAL_MEMORY_H */
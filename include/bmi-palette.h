@@ -0,0 +1,131 @@
+// include: bmi-palette.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_PALETTE_H
+#define _BMI_INTERNAL_PALETTE_H
+
+#include "bmi-file.h"
+#include "bmi-color.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// The most colors a buffer with BMI_FL_IS_PALETTE holds, each of its pixels
+// being an 8-bit index into them. New buffers start out with a 6x6x6 color
+// cube followed by a ramp of grays.
+#define BMI_PALETTE_CAPACITY 256
+
+// Replaces the colors of a palette buffer. Pixels keep their indices, so those
+// already drawn take on the new colors.
+int bmi_buffer_set_palette(bmi_buffer* buffer, const bmi_pixel* colors,
+                           uint32_t count);
+
+// Copies the colors of a palette buffer, of which there are at most
+// BMI_PALETTE_CAPACITY, and returns how many there are
+uint32_t bmi_buffer_get_palette(const bmi_buffer* buffer, bmi_pixel* colors);
+
+// Allocates a new palette buffer to be freed holding the given buffer reduced
+// to at most count colors. Buffers with that few colors keep them exactly,
+// and the rest are reduced by median cut.
+bmi_buffer* bmi_buffer_quantize(const bmi_buffer* buffer, uint32_t count);
+
+#ifdef _BMI_USE_INTERNAL
+// Colors recently matched to an index are remembered in this many slots
+#define BMI_PALETTE_CACHE_SHIFT 9
+#define BMI_PALETTE_CACHE_SIZE (1 << BMI_PALETTE_CACHE_SHIFT)
+
+// The palette of a buffer, kept after its pixels. Each cache slot holds a
+// color and its index, and is read and written atomically, so drawing from
+// several threads at once at worst repeats a search.
+typedef struct {
+    uint32_t count;
+    bmi_pixel colors[BMI_PALETTE_CAPACITY];
+    uint64_t cache[BMI_PALETTE_CACHE_SIZE];
+} bmi_palette;
+
+// Palettes are stored in files right after the header, as a little-endian
+// count followed by that many RGB triples
+#define BMI_PALETTE_BLOCK_SIZE(count) (4 + 3 * (size_t)(count))
+#define BMI_PALETTE_BLOCK_MAX BMI_PALETTE_BLOCK_SIZE(BMI_PALETTE_CAPACITY)
+
+// The offset of the palette from the start of a buffer with the given
+// attributes, past its pixels of one byte each and aligned for the cache
+#define BMI_PALETTE_OFFSET(width, height, fl) \
+    ((sizeof(bmi_buffer) + BMI_PIXEL_COUNT_FROM_FL(width, height, fl) + 7) \
+     & ~(size_t)7)
+
+#define bmi_buffer_palette(buffer) \
+    ((bmi_palette*)((uint8_t*)(buffer) \
+                    + BMI_PALETTE_OFFSET((buffer)->width, (buffer)->height, \
+                                         (buffer)->flags)))
+
+// Evaluates to the pixel drawn for a color, which for palette buffers is the
+// index of the nearest color in the palette
+#define BMI_PALETTE_INDEX(buffer, pixel) \
+    (((buffer)->flags & BMI_FL_IS_PALETTE) \
+     ? bmi_palette_index(bmi_buffer_palette(buffer), pixel) : (pixel))
+
+// Evaluates to the color of a pixel read from a buffer
+#define BMI_PALETTE_COLOR(buffer, pixel) \
+    (((buffer)->flags & BMI_FL_IS_PALETTE) \
+     ? bmi_buffer_palette(buffer)->colors[pixel] : (pixel))
+
+// Expanded colors of a palette, as RGB bytes padded to four so that each
+// pixel is expanded with a single load and store
+typedef struct {
+    uint8_t rgb[BMI_PALETTE_CAPACITY][4];
+} bmi_palette_table;
+
+// Fills in the default palette and empties the cache
+void bmi_palette_init(bmi_palette* palette);
+
+// Returns the index of the nearest color in the palette, through the cache
+bmi_pixel bmi_palette_index(bmi_palette* palette, bmi_pixel color);
+
+// Replaces count colors with their indices in the palette
+void bmi_palette_map(bmi_palette* palette, bmi_pixel* pixels, size_t count);
+
+// Copies the palette of one buffer to another, which does nothing unless both
+// are palette buffers
+void bmi_palette_copy(bmi_buffer* dst, const bmi_buffer* src);
+
+// Returns whether two palette buffers have the same colors
+int bmi_palette_equal(const bmi_buffer* a, const bmi_buffer* b);
+
+// Writes the palette in its file form, returning the size written, which is
+// at most BMI_PALETTE_BLOCK_MAX
+size_t bmi_palette_encode(const bmi_palette* palette, uint8_t* block);
+
+// Reads the count at the start of a palette block, returning zero if it is
+// out of range
+uint32_t bmi_palette_block_count(const uint8_t* block);
+
+// Reads a palette from its file form, whose count has been checked
+void bmi_palette_decode(bmi_palette* palette, const uint8_t* block);
+
+// Builds the expansion table of a palette
+void bmi_palette_table_init(const bmi_palette* palette,
+                            bmi_palette_table* table);
+
+// Expands count indices to packed RGB
+void bmi_palette_expand(const bmi_palette_table* table, uint8_t* dst,
+                        const uint8_t* src, size_t count);
+
+// Quantizes a buffer into a new palette buffer with the given flags
+bmi_buffer* bmi_palette_quantize(const bmi_buffer* buffer, uint32_t flags,
+                                 uint32_t count);
+#endif
+
+#endif /* _BMI_INTERNAL_PALETTE_H */
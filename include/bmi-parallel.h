@@ -0,0 +1,42 @@
+// include: bmi-parallel.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_PARALLEL_H
+#define _BMI_INTERNAL_PARALLEL_H
+
+#include <stdint.h>
+
+// Sets the number of threads parallel operations may use, where 0 selects one
+// per online processor
+void bmi_set_thread_count(uint32_t count);
+
+// Returns the number of threads parallel operations may use
+uint32_t bmi_thread_count(void);
+
+#ifdef _BMI_USE_INTERNAL
+typedef void (*bmi_parallel_task)(void* context, uint32_t index);
+
+// Runs the task once for every index below count, spread across up to
+// bmi_thread_count() threads including the calling one, and returns once all
+// have finished. Indices are handed out in increasing order.
+void bmi_parallel_for(uint32_t count, bmi_parallel_task task, void* context);
+
+// Returns how many parts to split work of the given size into so that every
+// thread has a few to balance load, without making parts smaller than grain
+uint32_t bmi_parallel_parts(uint64_t size, uint64_t grain);
+#endif
+
+#endif /* _BMI_INTERNAL_PARALLEL_H */
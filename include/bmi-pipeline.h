@@ -0,0 +1,63 @@
+// include: bmi-pipeline.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_PIPELINE_H
+#define _BMI_INTERNAL_PIPELINE_H
+
+#include "bmi-file.h"
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    BMI_PIPELINE_BMI,
+    BMI_PIPELINE_PPM
+} bmi_pipeline_format;
+
+// Called once each frame has been written, one frame at a time and in the
+// order the frames were submitted. The status is all that is reported: the
+// threads writing frames share the error indicator, so bmi_last_error may
+// describe another frame or nothing at all.
+typedef void (*bmi_pipeline_callback)(void* context, uint64_t frame,
+                                      FILE* dest, int status);
+
+// A pool of frame buffers along with the threads writing them out
+typedef struct bmi_pipeline bmi_pipeline;
+
+// Allocates a new pipeline to be freed that writes frames of the given
+// attributes from a pool of depth buffers using the given number of threads
+bmi_pipeline* bmi_pipeline_new(uint32_t width, uint32_t height, uint32_t flags,
+                               uint32_t depth, uint32_t threads,
+                               bmi_pipeline_format format,
+                               bmi_pipeline_callback callback, void* context);
+
+// Returns a buffer from the pool to draw the next frame into, waiting while
+// every buffer is still queued or being written
+bmi_buffer* bmi_pipeline_acquire(bmi_pipeline* pipeline);
+
+// Queues a buffer returned by bmi_pipeline_acquire to be written to the file
+// in the background, returning the buffer to the pool afterwards
+int bmi_pipeline_submit(bmi_pipeline* pipeline, bmi_buffer* buffer,
+                        FILE* dest);
+
+// Waits until every submitted frame has been written and reported, failing
+// with its own error if any frame could not be written
+int bmi_pipeline_flush(bmi_pipeline* pipeline);
+
+// Waits for every submitted frame and frees the pipeline along with its
+// buffers
+void bmi_pipeline_free(bmi_pipeline* pipeline);
+
+#endif /* _BMI_INTERNAL_PIPELINE_H */
@@ -0,0 +1,41 @@
+// include: bmi-pyramid.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_PYRAMID_H
+#define _BMI_INTERNAL_PYRAMID_H
+
+#include "bmi-file.h"
+#include <stdint.h>
+
+// Every power-of-two reduction of an image, each level half the size of the
+// one before it, rounded up, down to a single pixel. The levels are kept back
+// to back in the same allocation as the pyramid and must not be freed on their
+// own.
+typedef struct {
+    uint32_t count;
+    bmi_buffer* levels[];
+} bmi_pyramid;
+
+// Allocates a new pyramid to be freed holding every reduction of a BMI buffer
+// by a 2x2 box filter, reading the buffer only once. Levels of grayscale
+// buffers are grayscale, those of others are RGB, and they are tiled if the
+// buffer is.
+bmi_pyramid* bmi_buffer_build_pyramid(const bmi_buffer* buffer);
+
+// Frees a pyramid along with its levels
+void bmi_pyramid_free(bmi_pyramid* pyramid);
+
+#endif /* _BMI_INTERNAL_PYRAMID_H */
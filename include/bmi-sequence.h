@@ -0,0 +1,66 @@
+// include: bmi-sequence.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_SEQUENCE_H
+#define _BMI_INTERNAL_SEQUENCE_H
+
+#include "bmi-file.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Sequence files start with a header like that of a single BMI file, with
+// BMI_FL_IS_SEQUENCE set, followed by one record per frame and an index of
+// where each record starts. A frame is either a keyframe holding every row or
+// a delta holding only the ranges of rows that differ from its keyframe.
+
+// Adds frames to the end of a sequence file
+typedef struct bmi_sequence_writer bmi_sequence_writer;
+
+// Reads any frame of a sequence file
+typedef struct bmi_sequence_reader bmi_sequence_reader;
+
+// Allocates a writer starting a new sequence of frames of the given attributes
+// in an empty file, storing at least every interval-th frame whole
+bmi_sequence_writer* bmi_sequence_writer_new(FILE* dest, uint32_t width,
+                                             uint32_t height, uint32_t flags,
+                                             uint32_t interval);
+
+// Allocates a writer adding frames to the end of the sequence in a file opened
+// for both reading and writing
+bmi_sequence_writer* bmi_sequence_writer_from_file(FILE* file,
+                                                   uint32_t interval);
+
+// Adds a frame of the sequence's size and format to the end of the sequence
+int bmi_sequence_write_frame(bmi_sequence_writer* writer,
+                             const bmi_buffer* frame);
+
+// Writes the index of the sequence and frees the writer
+int bmi_sequence_writer_free(bmi_sequence_writer* writer);
+
+// Allocates a reader for the sequence in the given file
+bmi_sequence_reader* bmi_sequence_reader_from_file(FILE* source);
+
+// Returns the number of frames in the sequence
+uint64_t bmi_sequence_frame_count(const bmi_sequence_reader* reader);
+
+// Reads in and allocates a new BMI buffer holding the given frame
+bmi_buffer* bmi_sequence_read_frame(bmi_sequence_reader* reader,
+                                    uint64_t frame);
+
+// Frees the reader
+void bmi_sequence_reader_free(bmi_sequence_reader* reader);
+
+#endif /* _BMI_INTERNAL_SEQUENCE_H */
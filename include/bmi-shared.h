@@ -0,0 +1,67 @@
+// include: bmi-shared.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_SHARED_H
+#define _BMI_INTERNAL_SHARED_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+#include "bmi-error.h"
+
+// Returns a new handle onto the contents of a buffer with BMI_FL_IS_SHARED,
+// without copying any pixels. The buffer and every snapshot of it share their
+// tiles until one of them is drawn on, and then only the tiles drawn on are
+// copied, so each keeps the contents it had when the snapshot was taken.
+// Handles may be passed to and freed from any thread, but each handle should
+// only be drawn on by one thread at a time.
+bmi_buffer* bmi_buffer_snapshot(bmi_buffer* buffer);
+
+// Gives a shared buffer its own copy of every tile overlapping the given
+// region, which must be done before writing to its contents directly rather
+// than through the drawing functions. Does nothing for other buffers.
+int bmi_buffer_unshare(bmi_buffer* buffer, bmi_rect region);
+
+#ifdef _BMI_USE_INTERNAL
+// Evaluates to whether the pixel at the given offset into the contents of a
+// buffer, in pixels, may be written to, copying its tiles if needed
+#define BMI_SHARED_TOUCH(buffer, index) \
+    (!((buffer)->flags & BMI_FL_IS_SHARED) \
+     || bmi_shared_touch(buffer, index) == BMI_SUCCESS)
+
+// Evaluates to whether the given region of a buffer, which must lie within
+// it, may be written to, copying its tiles if needed
+#define BMI_SHARED_PREPARE(buffer, x, y, width, height) \
+    (!((buffer)->flags & BMI_FL_IS_SHARED) \
+     || bmi_shared_prepare(buffer, x, y, width, height) == BMI_SUCCESS)
+
+// Allocates the header and tiles of a new shared buffer, returning NULL when
+// there is not enough memory
+bmi_buffer* bmi_shared_new(uint32_t width, uint32_t height, uint32_t flags);
+
+// Releases a shared buffer, and the tiles no other handle still uses
+void bmi_shared_free(bmi_buffer* buffer);
+
+// Makes the tile holding the pixel at the given offset writable. These fail
+// without setting an error when a tile cannot be copied, so that each public
+// function reports it under its own name.
+int bmi_shared_touch(bmi_buffer* buffer, size_t index);
+
+// Makes every tile overlapping the given region writable
+int bmi_shared_prepare(bmi_buffer* buffer, uint32_t x, uint32_t y,
+                       uint32_t width, uint32_t height);
+#endif
+
+#endif /* _BMI_INTERNAL_SHARED_H */
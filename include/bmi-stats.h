@@ -0,0 +1,62 @@
+// include: bmi-stats.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_STATS_H
+#define _BMI_INTERNAL_STATS_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+#include "bmi-color.h"
+#include <stdint.h>
+
+// The most channels a pixel has, which are ordered red, green and blue for RGB
+// while grayscale only uses the first
+#define BMI_MAX_CHANNELS 3
+
+typedef struct {
+    uint32_t channels;
+    uint64_t counts[BMI_MAX_CHANNELS][256];
+} bmi_histogram;
+
+typedef struct {
+    uint32_t channels;
+    uint64_t pixels;
+    bmi_channel min[BMI_MAX_CHANNELS];
+    bmi_channel max[BMI_MAX_CHANNELS];
+    double mean[BMI_MAX_CHANNELS];
+    double variance[BMI_MAX_CHANNELS];
+} bmi_stats;
+
+// Counts the occurrences of each value of each channel in the BMI buffer
+int bmi_buffer_histogram(const bmi_buffer* buffer, bmi_histogram* histogram);
+
+// Counts the occurrences of each value of each channel in the specified region
+// of the BMI buffer
+int bmi_buffer_histogram_rect(const bmi_buffer* buffer, bmi_rect region,
+                              bmi_histogram* histogram);
+
+// Computes the range, mean and variance of each channel in the BMI buffer
+int bmi_buffer_stats(const bmi_buffer* buffer, bmi_stats* stats);
+
+// Computes the range, mean and variance of each channel in the specified
+// region of the BMI buffer
+int bmi_buffer_stats_rect(const bmi_buffer* buffer, bmi_rect region,
+                          bmi_stats* stats);
+
+// Computes the range, mean and variance of each channel from a histogram
+int bmi_histogram_stats(const bmi_histogram* histogram, bmi_stats* stats);
+
+#endif /* _BMI_INTERNAL_STATS_H */
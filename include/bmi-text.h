@@ -0,0 +1,54 @@
+// include: bmi-text.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_TEXT_H
+#define _BMI_INTERNAL_TEXT_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+#include "bmi-color.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// A bitmap font along with the glyph atlases rendered from it
+typedef struct bmi_font bmi_font;
+
+// Allocates the built-in 6 by 10 pixel fixed-width ASCII font
+bmi_font* bmi_font_new(void);
+
+// Reads in and allocates a font from the given BDF file
+bmi_font* bmi_font_from_bdf(FILE* source);
+
+// Frees the font along with its glyph atlases
+void bmi_font_free(bmi_font* font);
+
+// Returns the height, in pixels, of one line of text
+uint32_t bmi_font_line_height(const bmi_font* font);
+
+// Returns the size of the box the given text is drawn in
+bmi_rect bmi_font_measure(const bmi_font* font, const char* text);
+
+// Draws the text with its top left corner at the specified point
+int bmi_buffer_draw_text(bmi_buffer* buffer, bmi_font* font, bmi_point origin,
+                         const char* text, bmi_pixel pixel);
+
+// Draws the text with its top left corner at the specified point, filling the
+// rest of each character cell with the background
+int bmi_buffer_draw_text_box(bmi_buffer* buffer, bmi_font* font,
+                             bmi_point origin, const char* text,
+                             bmi_pixel pixel, bmi_pixel background);
+
+#endif /* _BMI_INTERNAL_TEXT_H */
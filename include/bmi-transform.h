@@ -0,0 +1,54 @@
+// include: bmi-transform.h
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _BMI_INTERNAL_TRANSFORM_H
+#define _BMI_INTERNAL_TRANSFORM_H
+
+#include "bmi-file.h"
+#include "bmi-geometry.h"
+
+typedef enum {
+    BMI_ROTATE_90 = 90,
+    BMI_ROTATE_180 = 180,
+    BMI_ROTATE_270 = 270
+} bmi_rotation;
+
+typedef enum {
+    BMI_FLIP_HORIZONTAL,
+    BMI_FLIP_VERTICAL
+} bmi_flip_axis;
+
+// Allocates a new BMI buffer to be freed holding the given one mirrored along
+// its main diagonal
+bmi_buffer* bmi_buffer_transpose(const bmi_buffer* buffer);
+
+// Allocates a new BMI buffer to be freed holding the given one rotated
+// clockwise
+bmi_buffer* bmi_buffer_rotate(const bmi_buffer* buffer, bmi_rotation rotation);
+
+// Mirrors the BMI buffer in place along the given axis
+int bmi_buffer_flip(bmi_buffer* buffer, bmi_flip_axis axis);
+
+// Allocates a new BMI buffer to be freed holding the given region of another,
+// clipped to it
+bmi_buffer* bmi_buffer_crop(const bmi_buffer* buffer, bmi_rect region);
+
+// Allocates a new BMI buffer to be freed holding the given one scaled to the
+// given size, filtered so that shrinking averages every source pixel
+bmi_buffer* bmi_buffer_resize(const bmi_buffer* buffer, uint32_t width,
+                              uint32_t height);
+
+#endif /* _BMI_INTERNAL_TRANSFORM_H */
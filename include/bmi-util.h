@@ -25,9 +25,17 @@
 // Returns the pixel at the given point in the BMI buffer
 bmi_pixel bmi_buffer_get_pixel(const bmi_buffer* buffer, bmi_point point);
 
+// Reads the pixel at each of the given points in the BMI buffer
+int bmi_buffer_get_pixels(const bmi_buffer* buffer, const bmi_point* points,
+                          bmi_pixel* pixels, size_t count);
+
 // Allocates a new BMI buffer to be freed initialized with the given attributes
 bmi_buffer* bmi_buffer_new(uint32_t width, uint32_t height, uint32_t flags);
 
+// Allocates a new BMI buffer to be freed holding the pixels of the given one
+// in the format and layout selected by flags
+bmi_buffer* bmi_buffer_convert(const bmi_buffer* buffer, uint32_t flags);
+
 // Reads in and allocates a new BMI buffer from the given file
 bmi_buffer* bmi_buffer_from_file(FILE* source);
 
@@ -40,4 +48,38 @@ int bmi_buffer_to_ppm(FILE* dest, const bmi_buffer* buffer);
 // Saves the BMI buffer to a file as a BMP
 int bmi_buffer_to_bmp(FILE* dest, const bmi_buffer* buffer);
 
+// Reads in and allocates a new BMI buffer from a binary PPM or PGM file
+bmi_buffer* bmi_buffer_from_ppm(FILE* source);
+
+// Reads in and allocates a new BMI buffer from an uncompressed BMP file
+bmi_buffer* bmi_buffer_from_bmp(FILE* source);
+
+#ifdef _BMI_USE_INTERNAL
+#include "bmi-kernel.h"
+
+// BMP headers are little-endian, with a 14 byte file header followed by a
+// BITMAPINFOHEADER, and for indexed images a palette of 256 colors
+#define BMI_BMP_FILE_HEADER_SIZE 14
+#define BMI_BMP_INFO_HEADER_SIZE 40
+#define BMI_BMP_HEADER_SIZE (BMI_BMP_FILE_HEADER_SIZE \
+                             + BMI_BMP_INFO_HEADER_SIZE)
+#define BMI_BMP_PALETTE_SIZE (256 * 4)
+#define BMI_BMP_HEADER_MAX (BMI_BMP_HEADER_SIZE + BMI_BMP_PALETTE_SIZE)
+
+// The size, in bytes, of a row of a BMP file, which is padded to four
+#define BMI_BMP_STRIDE(buffer) \
+    (((uint64_t)(buffer)->width * bmi_buffer_component_size(buffer) + 3) \
+     / 4 * 4)
+
+// Fills in the header of a BMP file holding the buffer, of at most
+// BMI_BMP_HEADER_MAX bytes, and returns its size, or zero if the image is too
+// large for a BMP
+size_t bmi_bmp_header(const bmi_buffer* buffer, uint8_t* header);
+
+// Writes the i-th row of a BMP file holding the buffer, counted from the
+// bottom, in BGR order and padded with zeros
+void bmi_bmp_row(const bmi_buffer* buffer, const bmi_kernels* kernels,
+                 uint32_t i, uint8_t* row);
+#endif
+
 #endif /* _BMI_INTERNAL_UTIL_H */
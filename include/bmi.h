@@ -21,7 +21,24 @@
 #include "bmi-error.h"
 #include "bmi-geometry.h"
 #include "bmi-color.h"
+#include "bmi-palette.h"
+#include "bmi-mask.h"
 #include "bmi-draw.h"
+#include "bmi-gradient.h"
 #include "bmi-util.h"
+#include "bmi-encode.h"
+#include "bmi-text.h"
+#include "bmi-stats.h"
+#include "bmi-lut.h"
+#include "bmi-compare.h"
+#include "bmi-transform.h"
+#include "bmi-pyramid.h"
+#include "bmi-hash.h"
+#include "bmi-memory.h"
+#include "bmi-shared.h"
+#include "bmi-pipeline.h"
+#include "bmi-sequence.h"
+#include "bmi-parallel.h"
+#include "bmi-inline.h"
 
 #endif /* _BMI_BMI_H */
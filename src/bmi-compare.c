@@ -0,0 +1,492 @@
+// src: bmi-compare.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-compare.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_new, bmi_buffer_convert
+#include "bmi-util.h"
+
+// bmi_buffer_kernels, BMI_FORMAT_FROM_FL, BMI_KERNEL_ADDRESS, BMI_KERNEL_RUN
+#include "bmi-kernel.h"
+
+// bmi_parallel_for, bmi_parallel_parts
+#include "bmi-parallel.h"
+
+// bmi_palette_equal
+#include "bmi-palette.h"
+
+// malloc, calloc, free
+#include <stdlib.h>
+
+// memcmp
+#include <string.h>
+
+// log10, INFINITY
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Rows are split into parts of at least this many bytes
+#define BMI_COMPARE_GRAIN (1u << 18)
+
+// Comparison checks for an earlier difference found by another thread after
+// this many bytes
+#define BMI_COMPARE_CHUNK (1u << 16)
+
+// Squared errors are summed in 32 bits over at most this many bytes
+#define BMI_MSE_CHUNK 4096
+
+static int bmi_buffers_match(const bmi_buffer* a, const bmi_buffer* b,
+                             const char* error) {
+    if (a->width != b->width || a->height != b->height
+        || BMI_FORMAT_FROM_FL(a->flags) != BMI_FORMAT_FROM_FL(b->flags)) {
+        bmi_set_error(error);
+        return 0;
+    }
+    return 1;
+}
+
+// Expands two palette buffers to RGB, so that they compare by color, returning
+// zero when out of memory
+static int bmi_expand_pair(const bmi_buffer* a, const bmi_buffer* b,
+                           bmi_buffer** rgb_a, bmi_buffer** rgb_b,
+                           const char* error) {
+    *rgb_a = bmi_buffer_convert(a, 0);
+    *rgb_b = bmi_buffer_convert(b, 0);
+    if (*rgb_a == NULL || *rgb_b == NULL) {
+        free(*rgb_a);
+        free(*rgb_b);
+        bmi_set_error(error);
+        return 0;
+    }
+    return 1;
+}
+
+// Returns how many of the count pixels from the given column onwards in a row
+// are contiguous in both buffers
+static size_t bmi_shared_run(const bmi_buffer* a, const bmi_buffer* b,
+                             uint32_t x, size_t count) {
+    const size_t run = BMI_KERNEL_RUN(a, x, count);
+    return BMI_KERNEL_RUN(b, x, run);
+}
+
+// Returns the number of parts a pass over the rows of a buffer is split into
+static uint32_t bmi_compare_parts(const bmi_buffer* buffer, size_t size) {
+    const uint32_t parts = bmi_parallel_parts((uint64_t)buffer->width * size
+                                              * buffer->height,
+                                              BMI_COMPARE_GRAIN);
+    if (parts > buffer->height) {
+        return buffer->height ? buffer->height : 1;
+    }
+    return parts;
+}
+
+// Returns the first index at which the bytes differ, given that they do
+static size_t bmi_first_difference(const uint8_t* a, const uint8_t* b,
+                                   size_t count) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= count; i += 16) {
+        const __m128i equal = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(a + i)),
+            _mm_loadu_si128((const __m128i*)(b + i)));
+        const unsigned mask = (unsigned)_mm_movemask_epi8(equal) ^ 0xFFFF;
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#endif
+    while (i < count && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+typedef struct {
+    const bmi_buffer* a;
+    const bmi_buffer* b;
+    size_t size;
+    uint32_t parts;
+    uint64_t first;
+} bmi_compare_job;
+
+static void bmi_compare_part(void* context, uint32_t index) {
+    bmi_compare_job* job = context;
+    const bmi_buffer* a = job->a;
+    const bmi_buffer* b = job->b;
+    const bmi_kernels* kernels = bmi_buffer_kernels(a);
+    const uint32_t first = (uint32_t)((uint64_t)a->height * index / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)a->height * (index + 1)
+                                     / job->parts);
+    const size_t limit = BMI_COMPARE_CHUNK / job->size;
+    
+    // Offsets are counted in row-major order, whatever the layouts
+    for (uint32_t y = first; y < last; y++) {
+        const uint64_t row = (uint64_t)y * a->width * job->size;
+        for (uint32_t x = 0; x < a->width;) {
+            // Stop early once a difference before this one is known
+            const uint64_t offset = row + (uint64_t)x * job->size;
+            if (__atomic_load_n(&job->first, __ATOMIC_RELAXED) <= offset) {
+                return;
+            }
+            const size_t rest = a->width - x < limit ? a->width - x : limit;
+            const size_t run = bmi_shared_run(a, b, x, rest);
+            const uint8_t* pa = BMI_KERNEL_ADDRESS(a, kernels, x, y);
+            const uint8_t* pb = BMI_KERNEL_ADDRESS(b, kernels, x, y);
+            if (memcmp(pa, pb, run * job->size) != 0) {
+                const uint64_t found = offset
+                    + bmi_first_difference(pa, pb, run * job->size);
+                uint64_t known = __atomic_load_n(&job->first,
+                                                 __ATOMIC_RELAXED);
+                while (found < known
+                       && !__atomic_compare_exchange_n(&job->first, &known,
+                                                       found, 1,
+                                                       __ATOMIC_RELAXED,
+                                                       __ATOMIC_RELAXED)) {
+                }
+                return;
+            }
+            x += (uint32_t)run;
+        }
+    }
+}
+
+int bmi_buffer_compare(const bmi_buffer* a, const bmi_buffer* b, int* equal,
+                       bmi_point* first) {
+    if (!bmi_buffers_match(a, b, "bmi_buffer_compare: Buffers differ in size "
+                           "or format")) {
+        return BMI_FAILURE;
+    }
+    
+    // Indices only compare directly under the same palette
+    if ((a->flags & BMI_FL_IS_PALETTE) && !bmi_palette_equal(a, b)) {
+        bmi_buffer* rgb_a;
+        bmi_buffer* rgb_b;
+        if (!bmi_expand_pair(a, b, &rgb_a, &rgb_b, "bmi_buffer_compare: "
+                             "Virtual memory exhausted")) {
+            return BMI_FAILURE;
+        }
+        const int status = bmi_buffer_compare(rgb_a, rgb_b, equal, first);
+        free(rgb_a);
+        free(rgb_b);
+        return status;
+    }
+    
+    bmi_compare_job job = {
+        .a = a,
+        .b = b,
+        .size = bmi_buffer_kernels(a)->size,
+        .first = UINT64_MAX
+    };
+    job.parts = bmi_compare_parts(a, job.size);
+    bmi_parallel_for(job.parts, bmi_compare_part, &job);
+    
+    *equal = job.first == UINT64_MAX;
+    if (!*equal && first != NULL) {
+        const uint64_t pixel = job.first / job.size;
+        *first = BMI_POINT((uint32_t)(pixel % a->width),
+                           (uint32_t)(pixel / a->width));
+    }
+    return BMI_SUCCESS;
+}
+
+// Writes the absolute difference of each byte, returning nonzero if any were
+// different
+static int bmi_abs_diff(uint8_t* dst, const uint8_t* a, const uint8_t* b,
+                        size_t count) {
+    size_t i = 0;
+    uint8_t any = 0;
+#ifdef __SSE2__
+    __m128i accumulated = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        const __m128i d = _mm_or_si128(_mm_subs_epu8(x, y),
+                                       _mm_subs_epu8(y, x));
+        _mm_storeu_si128((__m128i*)(dst + i), d);
+        accumulated = _mm_or_si128(accumulated, d);
+    }
+    any = _mm_movemask_epi8(_mm_cmpeq_epi8(accumulated,
+                                           _mm_setzero_si128())) != 0xFFFF;
+#endif
+    for (; i < count; i++) {
+        dst[i] = (uint8_t)(a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]);
+        any |= dst[i];
+    }
+    return any != 0;
+}
+
+typedef struct {
+    uint32_t min_x;
+    uint32_t min_y;
+    uint32_t max_x;
+    uint32_t max_y;
+    int any;
+} bmi_diff_bounds;
+
+typedef struct {
+    const bmi_buffer* a;
+    const bmi_buffer* b;
+    bmi_buffer* result;
+    size_t size;
+    uint32_t parts;
+    bmi_diff_bounds* bounds;
+} bmi_diff_job;
+
+static void bmi_diff_part(void* context, uint32_t index) {
+    const bmi_diff_job* job = context;
+    const bmi_buffer* a = job->a;
+    const bmi_buffer* b = job->b;
+    const bmi_kernels* kernels = bmi_buffer_kernels(a);
+    const uint32_t first = (uint32_t)((uint64_t)a->height * index / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)a->height * (index + 1)
+                                     / job->parts);
+    bmi_diff_bounds* bounds = &job->bounds[index];
+    
+    for (uint32_t y = first; y < last; y++) {
+        // The result shares the layout of the first buffer
+        uint32_t min_x = UINT32_MAX;
+        uint32_t max_x = 0;
+        for (uint32_t x = 0; x < a->width;) {
+            const size_t run = bmi_shared_run(a, b, x, a->width - x);
+            const size_t length = run * job->size;
+            uint8_t* dst = BMI_KERNEL_ADDRESS(job->result, kernels, x, y);
+            if (bmi_abs_diff(dst, BMI_KERNEL_ADDRESS(a, kernels, x, y),
+                             BMI_KERNEL_ADDRESS(b, kernels, x, y), length)) {
+                // Only runs that changed are scanned for their extent
+                size_t left = 0;
+                while (dst[left] == 0) {
+                    left++;
+                }
+                size_t right = length - 1;
+                while (dst[right] == 0) {
+                    right--;
+                }
+                if (min_x == UINT32_MAX) {
+                    min_x = x + (uint32_t)(left / job->size);
+                }
+                max_x = x + (uint32_t)(right / job->size);
+            }
+            x += (uint32_t)run;
+        }
+        if (min_x == UINT32_MAX) {
+            continue;
+        }
+        if (!bounds->any) {
+            *bounds = (bmi_diff_bounds){ min_x, y, max_x, y, 1 };
+        } else {
+            bounds->min_x = min_x < bounds->min_x ? min_x : bounds->min_x;
+            bounds->max_x = max_x > bounds->max_x ? max_x : bounds->max_x;
+            bounds->max_y = y;
+        }
+    }
+}
+
+bmi_buffer* bmi_buffer_diff(const bmi_buffer* a, const bmi_buffer* b,
+                            bmi_rect* changed) {
+    if (!bmi_buffers_match(a, b, "bmi_buffer_diff: Buffers differ in size or "
+                           "format")) {
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Differences of indices mean nothing, so palette buffers differ in RGB
+    if (a->flags & BMI_FL_IS_PALETTE) {
+        bmi_buffer* rgb_a;
+        bmi_buffer* rgb_b;
+        if (!bmi_expand_pair(a, b, &rgb_a, &rgb_b, "bmi_buffer_diff: Virtual "
+                             "memory exhausted")) {
+            return BMI_PTR_FAILURE;
+        }
+        bmi_buffer* result = bmi_buffer_diff(rgb_a, rgb_b, changed);
+        free(rgb_a);
+        free(rgb_b);
+        return result;
+    }
+    bmi_buffer* result = bmi_buffer_new(a->width, a->height,
+                                        a->flags & (BMI_FL_FORMAT_MASK
+                                                    | BMI_FL_IS_TILED));
+    if (result == NULL) {
+        bmi_set_error("bmi_buffer_diff: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    
+    bmi_diff_job job = {
+        .a = a,
+        .b = b,
+        .result = result,
+        .size = bmi_buffer_kernels(a)->size
+    };
+    job.parts = bmi_compare_parts(a, job.size);
+    job.bounds = calloc(job.parts, sizeof(bmi_diff_bounds));
+    if (job.bounds == NULL) {
+        free(result);
+        bmi_set_error("bmi_buffer_diff: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_parallel_for(job.parts, bmi_diff_part, &job);
+    
+    // Merge the bounds of each part, which are already in row order
+    bmi_diff_bounds total = { 0, 0, 0, 0, 0 };
+    for (uint32_t i = 0; i < job.parts; i++) {
+        const bmi_diff_bounds part = job.bounds[i];
+        if (!part.any) {
+            continue;
+        }
+        if (!total.any) {
+            total = part;
+        } else {
+            total.min_x = part.min_x < total.min_x ? part.min_x : total.min_x;
+            total.max_x = part.max_x > total.max_x ? part.max_x : total.max_x;
+            total.max_y = part.max_y;
+        }
+    }
+    free(job.bounds);
+    
+    if (changed != NULL) {
+        *changed = total.any
+            ? BMI_RECT(total.min_x, total.min_y,
+                       total.max_x - total.min_x + 1,
+                       total.max_y - total.min_y + 1)
+            : BMI_RECT(0, 0, 0, 0);
+    }
+    return result;
+}
+
+// Sums the squared difference of each byte
+static uint64_t bmi_squared_error(const uint8_t* a, const uint8_t* b,
+                                  size_t count) {
+    uint64_t total = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= count) {
+        // Each 32-bit lane gains at most 4 * 255 * 255 per step, so a chunk
+        // cannot overflow it
+        const size_t end = count - i < BMI_MSE_CHUNK ? count : i
+                                                               + BMI_MSE_CHUNK;
+        __m128i sums = zero;
+        for (; i + 16 <= end; i += 16) {
+            const __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+            const __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+            const __m128i d = _mm_or_si128(_mm_subs_epu8(x, y),
+                                           _mm_subs_epu8(y, x));
+            const __m128i low = _mm_unpacklo_epi8(d, zero);
+            const __m128i high = _mm_unpackhi_epi8(d, zero);
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(low, low));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(high, high));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, sums);
+        total += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+    for (; i < count; i++) {
+        const int32_t d = (int32_t)a[i] - (int32_t)b[i];
+        total += (uint64_t)(d * d);
+    }
+    return total;
+}
+
+typedef struct {
+    const bmi_buffer* a;
+    const bmi_buffer* b;
+    size_t size;
+    uint32_t parts;
+    uint64_t* sums;
+} bmi_mse_job;
+
+static void bmi_mse_part(void* context, uint32_t index) {
+    const bmi_mse_job* job = context;
+    const bmi_buffer* a = job->a;
+    const bmi_buffer* b = job->b;
+    const bmi_kernels* kernels = bmi_buffer_kernels(a);
+    const uint32_t first = (uint32_t)((uint64_t)a->height * index / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)a->height * (index + 1)
+                                     / job->parts);
+    uint64_t sum = 0;
+    for (uint32_t y = first; y < last; y++) {
+        for (uint32_t x = 0; x < a->width;) {
+            const size_t run = bmi_shared_run(a, b, x, a->width - x);
+            sum += bmi_squared_error(BMI_KERNEL_ADDRESS(a, kernels, x, y),
+                                     BMI_KERNEL_ADDRESS(b, kernels, x, y),
+                                     run * job->size);
+            x += (uint32_t)run;
+        }
+    }
+    job->sums[index] = sum;
+}
+
+int bmi_buffer_mse(const bmi_buffer* a, const bmi_buffer* b, double* mse) {
+    if (!bmi_buffers_match(a, b, "bmi_buffer_mse: Buffers differ in size or "
+                           "format")) {
+        return BMI_FAILURE;
+    }
+    if (a->flags & BMI_FL_IS_PALETTE) {
+        bmi_buffer* rgb_a;
+        bmi_buffer* rgb_b;
+        if (!bmi_expand_pair(a, b, &rgb_a, &rgb_b, "bmi_buffer_mse: Virtual "
+                             "memory exhausted")) {
+            return BMI_FAILURE;
+        }
+        const int status = bmi_buffer_mse(rgb_a, rgb_b, mse);
+        free(rgb_a);
+        free(rgb_b);
+        return status;
+    }
+    
+    bmi_mse_job job = {
+        .a = a,
+        .b = b,
+        .size = bmi_buffer_kernels(a)->size
+    };
+    const uint64_t total = (uint64_t)a->width * a->height * job.size;
+    if (total == 0) {
+        bmi_set_error("bmi_buffer_mse: Buffers are empty");
+        return BMI_FAILURE;
+    }
+    job.parts = bmi_compare_parts(a, job.size);
+    job.sums = malloc(job.parts * sizeof(uint64_t));
+    if (job.sums == NULL) {
+        bmi_set_error("bmi_buffer_mse: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    bmi_parallel_for(job.parts, bmi_mse_part, &job);
+    
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < job.parts; i++) {
+        sum += job.sums[i];
+    }
+    free(job.sums);
+    
+    *mse = (double)sum / (double)total;
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_psnr(const bmi_buffer* a, const bmi_buffer* b, double* psnr) {
+    double mse;
+    if (bmi_buffer_mse(a, b, &mse) != BMI_SUCCESS) {
+        return BMI_FAILURE;
+    }
+    *psnr = mse == 0.0 ? INFINITY : 10.0 * log10(255.0 * 255.0 / mse);
+    return BMI_SUCCESS;
+}
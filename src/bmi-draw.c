@@ -16,41 +16,108 @@
 
 #define _BMI_USE_INTERNAL
 
-// BMI_GET_INDEX
+// bmi_buffer
 #include "bmi-file.h"
 
 // bmi_set_error
 #include "bmi-error.h"
 
-// bmi_clip_rect, bmi_inset_rect, bmi_set_rect
+// bmi_clip_rect, bmi_clip_line, bmi_inset_rect, bmi_set_rect,
+// bmi_bin_points, bmi_index_points
 #include "bmi-geometry.h"
 
-// bmi_buffer_component_size
 #include "bmi-draw.h"
 
-// bmi_buffer_get_pixel
-#include "bmi-util.h"
+// bmi_buffer_kernels, bmi_kernel_span, bmi_kernel_fill, BMI_KERNEL_ADDRESS,
+// BMI_KERNEL_RUN, BMI_KERNEL_CHUNK
+#include "bmi-kernel.h"
 
-// memset
-#include <string.h>
+// BMI_SHARED_TOUCH, BMI_SHARED_PREPARE
+#include "bmi-shared.h"
 
-// abs
+// bmi_buffer_palette, bmi_palette_map, bmi_palette_equal, BMI_PALETTE_INDEX
+#include "bmi-palette.h"
+
+// bmi_mask_row, bmi_mask_next_run
+#include "bmi-mask.h"
+
+// abs, malloc, calloc, free
 #include <stdlib.h>
 
-#define BMI_GRAY_WRITE(buffer, i, p) \
-    (buffer)->contents[i] = (uint8_t)BMI_GRY_V(p)
-#define BMI_RGB_WRITE(buffer, i, p) \
-    (buffer)->contents[i] = (uint8_t)BMI_RGB_R(p); \
-    (buffer)->contents[(i) + 1] = (uint8_t)BMI_RGB_G(p); \
-    (buffer)->contents[(i) + 2] = (uint8_t)BMI_RGB_B(p)
+// sqrt, ceil, floor
+#include <math.h>
 
 void bmi_buffer_draw_point(bmi_buffer* buffer, bmi_point point,
                            bmi_pixel pixel) {
-    const size_t index = BMI_GET_INDEX(buffer, point.x, point.y);
-    if (buffer->flags & BMI_FL_IS_GRAYSCALE) {
-        BMI_GRAY_WRITE(buffer, index, pixel);
-    } else {
-        BMI_RGB_WRITE(buffer, index, pixel);
+    if (!BMI_SHARED_TOUCH(buffer, BMI_PIXEL_INDEX(buffer, point.x,
+                                                   point.y))) {
+        bmi_set_error("bmi_buffer_draw_point: Virtual memory exhausted");
+        return;
+    }
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    kernels->point(BMI_KERNEL_ADDRESS(buffer, kernels, point.x, point.y),
+                   BMI_PALETTE_INDEX(buffer, pixel));
+}
+
+// Points are indexed in chunks so that the index computation runs as its own
+// vectorizable loop ahead of the scattered stores
+#define BMI_POINT_CHUNK 256
+
+// Draws the points within the buffer, failing when the tiles of a shared
+// buffer could not be copied, in which case the rest are still drawn
+static int bmi_buffer_scatter(bmi_buffer* buffer, const bmi_point* points,
+                              const bmi_pixel* pixels, size_t count,
+                              bmi_pixel pixel) {
+    size_t total;
+    size_t* order = bmi_bin_points(points, count, buffer->width,
+                                   buffer->height, &total);
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    size_t indices[BMI_POINT_CHUNK];
+    int status = BMI_SUCCESS;
+    if (pixels == NULL) {
+        pixel = BMI_PALETTE_INDEX(buffer, pixel);
+    }
+    
+    for (size_t base = 0; base < total; base += BMI_POINT_CHUNK) {
+        const size_t length = total - base < BMI_POINT_CHUNK
+            ? total - base : BMI_POINT_CHUNK;
+        const size_t* chunk_order = order ? order + base : NULL;
+        bmi_index_points(order ? points : points + base, chunk_order, length,
+                         buffer->width, buffer->height, buffer->flags,
+                         indices);
+        
+        for (size_t i = 0; i < length; i++) {
+            if (indices[i] == BMI_INDEX_INVALID) {
+                continue;
+            }
+            if (!BMI_SHARED_TOUCH(buffer, indices[i])) {
+                status = BMI_FAILURE;
+                continue;
+            }
+            const bmi_pixel p = pixels == NULL ? pixel
+                : BMI_PALETTE_INDEX(buffer, pixels[chunk_order ? chunk_order[i]
+                                                   : base + i]);
+            kernels->point(buffer->contents + indices[i] * kernels->size, p);
+        }
+    }
+    
+    free(order);
+    return status;
+}
+
+void bmi_buffer_draw_points(bmi_buffer* buffer, const bmi_point* points,
+                            size_t count, bmi_pixel pixel) {
+    if (bmi_buffer_scatter(buffer, points, NULL, count, pixel)
+        != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_draw_points: Virtual memory exhausted");
+    }
+}
+
+void bmi_buffer_draw_colored_points(bmi_buffer* buffer, const bmi_point* points,
+                                    const bmi_pixel* pixels, size_t count) {
+    if (bmi_buffer_scatter(buffer, points, pixels, count, 0) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_draw_colored_points: Virtual memory "
+                      "exhausted");
     }
 }
 
@@ -59,23 +126,40 @@ void bmi_buffer_fill_rect(bmi_buffer* buffer, bmi_rect bounds,
     // Clip the rectangle to prevent out-of-bounds drawing
     bmi_clip_rect(&bounds, BMI_RECT(0, 0, buffer->width, buffer->height));
     
-    // Initialize the row to the specified pixels
-    if (buffer->flags & BMI_FL_IS_GRAYSCALE) {
-        // Grayscale offers an optimized path using memset because each pixel is
-        // just one byte
-        for (uint32_t i = 0; i < bounds.height; i++) {
-            void* row = buffer->contents + BMI_GET_INDEX(buffer, bounds.x,
-                                                         bounds.y + i);
-            memset(row, (uint8_t)pixel, bounds.width);
-        }
-    } else {
-        // RGB requires us to loop through the row, and this is probably not
-        // vectorized because writing an RGB pixel writes 24 bits
-        for (uint32_t i = 0; i < bounds.height; i++) {
-            const size_t index = BMI_GET_INDEX(buffer, bounds.x, bounds.y + i);
-            for (uint32_t j = 0; j < bounds.width; j++) {
-                BMI_RGB_WRITE(buffer, index + j * 3, pixel);
+    // Each row, or each run of contiguous rows, is a single span, which the
+    // kernel fills with memset for grayscale and with a few doubling copies
+    // for RGB
+    if (bmi_kernel_fill(buffer, bmi_buffer_kernels(buffer), bounds.x,
+                        bounds.y, bounds.width, bounds.height,
+                        BMI_PALETTE_INDEX(buffer, pixel)) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_fill_rect: Virtual memory exhausted");
+    }
+}
+
+void bmi_buffer_fill_rect_masked(bmi_buffer* buffer, bmi_rect bounds,
+                                 bmi_pixel pixel, const bmi_mask* mask) {
+    // Clip the rectangle to both the buffer and the mask, outside of which
+    // nothing is drawn
+    bmi_clip_rect(&bounds, BMI_RECT(0, 0, buffer->width, buffer->height));
+    bmi_clip_rect(&bounds, BMI_RECT(0, 0, mask->width, mask->height));
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    pixel = BMI_PALETTE_INDEX(buffer, pixel);
+    
+    // Fill each run of set bits as one span, skipping whole clear words
+    for (uint32_t y = bounds.y; y < bounds.y + bounds.height; y++) {
+        const uint64_t* row = bmi_mask_row(mask, y);
+        uint32_t x = bounds.x;
+        uint32_t start;
+        size_t length;
+        while ((length = bmi_mask_next_run(row, x, bounds.x + bounds.width,
+                                           &start)) != 0) {
+            if (bmi_kernel_span(buffer, kernels, start, y, length, pixel)
+                != BMI_SUCCESS) {
+                bmi_set_error("bmi_buffer_fill_rect_masked: Virtual memory "
+                              "exhausted");
+                return;
             }
+            x = start + (uint32_t)length;
         }
     }
 }
@@ -100,10 +184,60 @@ void bmi_buffer_stroke_rect(bmi_buffer* buffer, bmi_rect bounds,
     bmi_set_rect(&top, thickness, BMI_RECT_EDGE_TOP);
     bmi_set_rect(&bottom, thickness, BMI_RECT_EDGE_BOTTOM);
     
-    bmi_buffer_fill_rect(buffer, left, pixel);
-    bmi_buffer_fill_rect(buffer, right, pixel);
-    bmi_buffer_fill_rect(buffer, top, pixel);
-    bmi_buffer_fill_rect(buffer, bottom, pixel);
+    const bmi_rect edges[] = { left, right, top, bottom };
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    pixel = BMI_PALETTE_INDEX(buffer, pixel);
+    for (size_t i = 0; i < sizeof(edges) / sizeof(*edges); i++) {
+        bmi_rect edge = edges[i];
+        bmi_clip_rect(&edge, BMI_RECT(0, 0, buffer->width, buffer->height));
+        if (bmi_kernel_fill(buffer, kernels, edge.x, edge.y, edge.width,
+                            edge.height, pixel) != BMI_SUCCESS) {
+            bmi_set_error("bmi_buffer_stroke_rect: Virtual memory exhausted");
+            return;
+        }
+    }
+}
+
+void bmi_buffer_fill_ellipse(bmi_buffer* buffer, bmi_rect bounds,
+                             bmi_pixel pixel) {
+    if (bounds.width == 0 || bounds.height == 0) {
+        return;
+    }
+    pixel = BMI_PALETTE_INDEX(buffer, pixel);
+    
+    // A pixel is inside when its center is inside the ellipse inscribed in the
+    // bounds, so each row reduces to one span whose half-width is found once
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    const double width = bounds.width;
+    const double height = bounds.height;
+    for (uint32_t j = 0; j < bounds.height; j++) {
+        const uint32_t y = bounds.y + j;
+        if (y >= buffer->height) {
+            break;
+        }
+        const double t = (2.0 * j + 1.0 - height) / height;
+        const double extent = width * sqrt(1.0 - t * t);
+        const double first = ceil((width - 1.0 - extent) / 2.0);
+        const double last = floor((width - 1.0 + extent) / 2.0);
+        if (first > last) {
+            continue;
+        }
+        
+        // Clip the span rather than the bounds so the shape is unchanged
+        uint32_t x0 = bounds.x + (uint32_t)first;
+        uint32_t x1 = bounds.x + (uint32_t)last + 1;
+        if (x1 > buffer->width) {
+            x1 = buffer->width;
+        }
+        if (x0 >= x1) {
+            continue;
+        }
+        if (bmi_kernel_span(buffer, kernels, x0, y, x1 - x0, pixel)
+            != BMI_SUCCESS) {
+            bmi_set_error("bmi_buffer_fill_ellipse: Virtual memory exhausted");
+            return;
+        }
+    }
 }
 
 #define _SWAP(x, y, T) do { \
@@ -112,67 +246,542 @@ void bmi_buffer_stroke_rect(bmi_buffer* buffer, bmi_rect bounds,
     *(y) = temp; \
 } while (0)
 
-// Modified from: https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
+// Plots one pixel of a walk. Untiled buffers are addressed by the byte offset
+// the walk advances, and tiled ones by their coordinates, since a step in
+// either direction is not a fixed distance in a tiled buffer. Fails when the
+// tile of a shared buffer could not be copied.
+static inline int bmi_stroke_plot(bmi_buffer* buffer,
+                                   const bmi_kernels* kernels, int tiled,
+                                   uint32_t x, uint32_t y, ptrdiff_t offset,
+                                   bmi_pixel pixel) {
+    if (!tiled) {
+        kernels->point(buffer->contents + offset, pixel);
+        return BMI_SUCCESS;
+    }
+    if (!BMI_SHARED_TOUCH(buffer, BMI_PIXEL_INDEX(buffer, x, y))) {
+        return BMI_FAILURE;
+    }
+    kernels->point(BMI_KERNEL_ADDRESS(buffer, kernels, x, y), pixel);
+    return BMI_SUCCESS;
+}
+
+// Walks the pixels of a segment that is not horizontal from start, moving by
+// dx and dy, with Bresenham, modified from:
+// https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
+// The walk steps both the coordinates and a byte offset, and is called with a
+// constant tiled so that each layout gets a copy keeping only what it plots
+// with. Shared buffers are always tiled, so untiled ones have nothing to
+// touch. Stops at the first pixel that fails to plot.
+static inline int bmi_stroke_walk(bmi_buffer* buffer,
+                                   const bmi_kernels* kernels, int tiled,
+                                   bmi_point start, int64_t dx, int64_t dy,
+                                   int include_end, bmi_pixel pixel) {
+    const int64_t adx = dx < 0 ? -dx : dx;
+    const int64_t ady = dy < 0 ? -dy : dy;
+    const int32_t xi = dx < 0 ? -1 : 1;
+    const int32_t yi = dy < 0 ? -1 : 1;
+    const ptrdiff_t column = (ptrdiff_t)kernels->size;
+    const ptrdiff_t row = (ptrdiff_t)buffer->width * column;
+    const ptrdiff_t x_offset = dx < 0 ? -column : column;
+    const ptrdiff_t y_offset = dy < 0 ? -row : row;
+    uint32_t x = start.x;
+    uint32_t y = start.y;
+    ptrdiff_t offset = tiled ? 0 : (ptrdiff_t)BMI_PIXEL_INDEX(buffer, x, y)
+                                   * column;
+    
+    if (dx == 0) {
+        // Vertical path without any horizontal steps, which is a column
+        const int64_t length = ady + (include_end ? 1 : 0);
+        for (int64_t i = 0; i < length; i++) {
+            if (bmi_stroke_plot(buffer, kernels, tiled, x, y, offset, pixel)
+                != BMI_SUCCESS) {
+                return BMI_FAILURE;
+            }
+            y += yi;
+            offset += y_offset;
+        }
+    } else if (ady > adx) {
+        // Vertical path
+        const int64_t length = ady + (include_end ? 1 : 0);
+        int64_t rolling_error = 2 * adx - ady;
+        for (int64_t i = 0; i < length; i++) {
+            if (bmi_stroke_plot(buffer, kernels, tiled, x, y, offset, pixel)
+                != BMI_SUCCESS) {
+                return BMI_FAILURE;
+            }
+            if (rolling_error > 0) {
+                x += xi;
+                offset += x_offset;
+                rolling_error -= 2 * ady;
+            }
+            rolling_error += 2 * adx;
+            y += yi;
+            offset += y_offset;
+        }
+    } else {
+        // Horizontal path
+        const int64_t length = adx + (include_end ? 1 : 0);
+        int64_t rolling_error = 2 * ady - adx;
+        for (int64_t i = 0; i < length; i++) {
+            if (bmi_stroke_plot(buffer, kernels, tiled, x, y, offset, pixel)
+                != BMI_SUCCESS) {
+                return BMI_FAILURE;
+            }
+            if (rolling_error > 0) {
+                y += yi;
+                offset += y_offset;
+                rolling_error -= 2 * adx;
+            }
+            rolling_error += 2 * ady;
+            x += xi;
+            offset += x_offset;
+        }
+    }
+    return BMI_SUCCESS;
+}
+
+// Strokes a segment lying entirely within the buffer, leaving out the end
+// point unless include_end is set. Horizontal segments are filled as a span.
+// Fails when the tiles of a shared buffer could not be copied.
+static int bmi_buffer_stroke_segment(bmi_buffer* buffer,
+                                      const bmi_kernels* kernels,
+                                      bmi_point start, bmi_point end,
+                                      int include_end, bmi_pixel pixel) {
+    const int64_t dx = (int64_t)end.x - (int64_t)start.x;
+    const int64_t dy = (int64_t)end.y - (int64_t)start.y;
+    
+    if (dy == 0) {
+        // Horizontal path, which is a single span
+        const uint32_t x = dx < 0 ? end.x + (include_end ? 0 : 1) : start.x;
+        return bmi_kernel_span(buffer, kernels, x, start.y,
+                               (size_t)(dx < 0 ? -dx : dx)
+                               + (include_end ? 1 : 0), pixel);
+    }
+    if (buffer->flags & BMI_FL_IS_TILED) {
+        return bmi_stroke_walk(buffer, kernels, 1, start, dx, dy, include_end,
+                               pixel);
+    }
+    return bmi_stroke_walk(buffer, kernels, 0, start, dx, dy, include_end,
+                           pixel);
+}
+
 void bmi_buffer_stroke_line(bmi_buffer* buffer, bmi_point start, bmi_point end,
                             uint32_t thickness, bmi_pixel pixel) {
-    // Clip the points to prevent out-of-bounds drawing
-    bmi_clip_point(&start, BMI_RECT(0, 0, buffer->width, buffer->height));
-    bmi_clip_point(&end, BMI_RECT(0, 0, buffer->width, buffer->height));
-        
+    // Walk along increasing coordinates of the major axis, which leaves out
+    // whichever end point lies further along it
     if (abs((int32_t)end.y - (int32_t)start.y)
         > abs((int32_t)end.x - (int32_t)start.x)) {
-        // Vertical path
-        
         if (end.y < start.y) {
-            _SWAP(&start.x, &end.x, uint32_t);
-            _SWAP(&start.y, &end.y, uint32_t);
+            _SWAP(&start, &end, bmi_point);
         }
-        
-        int32_t dx = (int32_t)end.x - (int32_t)start.x;
-        const uint32_t dy = end.y - start.y;
-        int32_t xi = 1;
-        if (dx < 0) {
-            xi = -1;
-            dx = -dx;
-        }
-        int32_t rolling_error = (int32_t)(2 * dx) - (int32_t)dy;
-        uint32_t x = start.x;
-
-        for (uint32_t y = start.y; y < end.y; y++) {
-            bmi_buffer_draw_point(buffer, BMI_POINT(x, y), pixel);
-            if (rolling_error > 0) {
-                x += xi;
-                rolling_error -= 2 * dy;
+    } else if (end.x < start.x) {
+        _SWAP(&start, &end, bmi_point);
+    }
+    
+    // Clip the line to prevent out-of-bounds drawing. An end point moved onto
+    // the edge of the buffer is drawn, since the line continues past it.
+    const bmi_point original_end = end;
+    if (!bmi_clip_line(&start, &end,
+                       BMI_RECT(0, 0, buffer->width, buffer->height))) {
+        return;
+    }
+    const int clipped = end.x != original_end.x || end.y != original_end.y;
+    
+    if (bmi_buffer_stroke_segment(buffer, bmi_buffer_kernels(buffer), start,
+                                  end, clipped,
+                                  BMI_PALETTE_INDEX(buffer, pixel))
+        != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_stroke_line: Virtual memory exhausted");
+    }
+}
+
+// Cohen-Sutherland region codes of a point relative to the buffer
+#define BMI_OUTCODE_RIGHT (1 << 0)
+#define BMI_OUTCODE_BOTTOM (1 << 1)
+
+static unsigned bmi_outcode(bmi_point point, uint32_t width, uint32_t height) {
+    // Coordinates are unsigned, so a point can only leave past the right or
+    // bottom edges
+    return (point.x >= width ? BMI_OUTCODE_RIGHT : 0)
+        | (point.y >= height ? BMI_OUTCODE_BOTTOM : 0);
+}
+
+void bmi_buffer_stroke_polyline(bmi_buffer* buffer, const bmi_point* points,
+                                size_t count, bmi_pixel pixel) {
+    if (count == 0) {
+        return;
+    }
+    pixel = BMI_PALETTE_INDEX(buffer, pixel);
+    
+    // The kernels, bounds and region code of each shared vertex are computed
+    // once for the whole polyline
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    const bmi_rect canvas = BMI_RECT(0, 0, buffer->width, buffer->height);
+    unsigned start_code = bmi_outcode(points[0], buffer->width, buffer->height);
+    
+    // Every segment leaves out its end point, which is the start of the next
+    int status = BMI_SUCCESS;
+    for (size_t i = 1; status == BMI_SUCCESS && i < count; i++) {
+        const unsigned end_code = bmi_outcode(points[i], buffer->width,
+                                              buffer->height);
+        if ((start_code | end_code) == 0) {
+            // Trivially inside
+            status = bmi_buffer_stroke_segment(buffer, kernels, points[i - 1],
+                                               points[i], 0, pixel);
+        } else if ((start_code & end_code) == 0) {
+            // Possibly crossing the buffer, and drawn through to the edge when
+            // the end point was outside
+            bmi_point start = points[i - 1];
+            bmi_point end = points[i];
+            if (bmi_clip_line(&start, &end, canvas)) {
+                status = bmi_buffer_stroke_segment(buffer, kernels, start, end,
+                                                   end_code != 0, pixel);
             }
-            rolling_error += 2 * dx;
         }
-    } else {
-        // Horizontal path
-        
-        if (end.x < start.x) {
-            _SWAP(&start.x, &end.x, uint32_t);
-            _SWAP(&start.y, &end.y, uint32_t);
+        start_code = end_code;
+    }
+    
+    // Finish the last segment
+    const bmi_point last = points[count - 1];
+    if (status == BMI_SUCCESS && start_code == 0) {
+        if (BMI_SHARED_TOUCH(buffer, BMI_PIXEL_INDEX(buffer, last.x,
+                                                     last.y))) {
+            kernels->point(BMI_KERNEL_ADDRESS(buffer, kernels, last.x, last.y),
+                           pixel);
+        } else {
+            status = BMI_FAILURE;
+        }
+    }
+    if (status != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_stroke_polyline: Virtual memory exhausted");
+    }
+}
+
+// A span of a row already filled, whose neighbors in the row dy away are yet to
+// be scanned
+typedef struct {
+    uint32_t y;
+    uint32_t left;
+    uint32_t right;
+    int32_t dy;
+} bmi_flood_span;
+
+// Spans are pushed onto a stack of pooled blocks so that the fill never
+// recurses and its memory grows with the number of pending spans alone
+#define BMI_FLOOD_BLOCK 4096
+
+typedef struct bmi_flood_block {
+    struct bmi_flood_block* previous;
+    bmi_flood_span spans[BMI_FLOOD_BLOCK];
+} bmi_flood_block;
+
+typedef struct {
+    bmi_buffer* buffer;
+    const bmi_kernels* kernels;
+    bmi_pixel target;
+    uint32_t tolerance;
+    
+    // The colors of a palette buffer, through which its pixels compare
+    const bmi_pixel* colors;
+    
+    // Set only when filled pixels would still match, marking those filled
+    uint64_t* visited;
+    
+    bmi_flood_block* top;
+    bmi_flood_block* spare;
+    size_t count;
+} bmi_flood;
+
+#define BMI_CHANNEL_DISTANCE(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
+
+#define BMI_FLOOD_COLOR(flood, pixel) \
+    ((flood)->colors != NULL ? (flood)->colors[pixel] : (pixel))
+
+static int bmi_flood_matches(const bmi_flood* flood, bmi_pixel pixel) {
+    if (pixel == flood->target) {
+        return 1;
+    }
+    const bmi_pixel target = flood->target;
+    return BMI_CHANNEL_DISTANCE(BMI_RGB_R(pixel), BMI_RGB_R(target))
+           <= flood->tolerance
+        && BMI_CHANNEL_DISTANCE(BMI_RGB_G(pixel), BMI_RGB_G(target))
+           <= flood->tolerance
+        && BMI_CHANNEL_DISTANCE(BMI_RGB_B(pixel), BMI_RGB_B(target))
+           <= flood->tolerance;
+}
+
+static int bmi_flood_inside(const bmi_flood* flood, uint32_t x, uint32_t y) {
+    if (flood->visited != NULL) {
+        const size_t bit = (size_t)y * flood->buffer->width + x;
+        if (flood->visited[bit >> 6] >> (bit & 63) & 1) {
+            return 0;
+        }
+    }
+    return bmi_flood_matches(flood, BMI_FLOOD_COLOR(flood, flood->kernels->read(
+        BMI_KERNEL_ADDRESS(flood->buffer, flood->kernels, x, y))));
+}
+
+// Fills and marks a span, failing when the tiles of a shared buffer could not
+// be copied
+static int bmi_flood_fill_span(bmi_flood* flood, uint32_t y, uint32_t left,
+                               uint32_t right, bmi_pixel pixel) {
+    if (bmi_kernel_span(flood->buffer, flood->kernels, left, y,
+                        right - left + 1, pixel) != BMI_SUCCESS) {
+        return BMI_FAILURE;
+    }
+    if (flood->visited == NULL) {
+        return BMI_SUCCESS;
+    }
+    
+    // Mark the span a word at a time
+    const size_t first = (size_t)y * flood->buffer->width + left;
+    const size_t last = first + (right - left);
+    const uint64_t first_mask = ~(uint64_t)0 << (first & 63);
+    const uint64_t last_mask = ~(uint64_t)0 >> (63 - (last & 63));
+    if (first >> 6 == last >> 6) {
+        flood->visited[first >> 6] |= first_mask & last_mask;
+        return BMI_SUCCESS;
+    }
+    flood->visited[first >> 6] |= first_mask;
+    for (size_t i = (first >> 6) + 1; i < last >> 6; i++) {
+        flood->visited[i] = ~(uint64_t)0;
+    }
+    flood->visited[last >> 6] |= last_mask;
+    return BMI_SUCCESS;
+}
+
+static int bmi_flood_push(bmi_flood* flood, uint32_t y, uint32_t left,
+                          uint32_t right, int32_t dy) {
+    if (flood->top == NULL || flood->count == BMI_FLOOD_BLOCK) {
+        bmi_flood_block* block = flood->spare;
+        if (block != NULL) {
+            flood->spare = NULL;
+        } else if ((block = malloc(sizeof(bmi_flood_block))) == NULL) {
+            return 0;
+        }
+        block->previous = flood->top;
+        flood->top = block;
+        flood->count = 0;
+    }
+    flood->top->spans[flood->count++] = (bmi_flood_span){ y, left, right, dy };
+    return 1;
+}
+
+static int bmi_flood_pop(bmi_flood* flood, bmi_flood_span* span) {
+    if (flood->top != NULL && flood->count == 0) {
+        // Keep one emptied block, so a stack hovering around a block boundary
+        // does not allocate on every push
+        bmi_flood_block* block = flood->top;
+        flood->top = block->previous;
+        flood->count = BMI_FLOOD_BLOCK;
+        free(flood->spare);
+        flood->spare = block;
+    }
+    if (flood->top == NULL) {
+        return 0;
+    }
+    *span = flood->top->spans[--flood->count];
+    return 1;
+}
+
+int bmi_buffer_flood_fill(bmi_buffer* buffer, bmi_point seed, bmi_pixel pixel,
+                          bmi_connectivity connectivity, uint32_t tolerance) {
+    if (seed.x >= buffer->width || seed.y >= buffer->height) {
+        bmi_set_error("bmi_buffer_flood_fill: Seed is outside of the buffer");
+        return BMI_FAILURE;
+    }
+    if (connectivity != BMI_CONNECTIVITY_4
+        && connectivity != BMI_CONNECTIVITY_8) {
+        bmi_set_error("bmi_buffer_flood_fill: Connectivity must be 4 or 8");
+        return BMI_FAILURE;
+    }
+    
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    bmi_flood flood = {
+        .buffer = buffer,
+        .kernels = kernels,
+        .tolerance = tolerance,
+        .colors = (buffer->flags & BMI_FL_IS_PALETTE)
+            ? bmi_buffer_palette(buffer)->colors : NULL
+    };
+    flood.target = BMI_FLOOD_COLOR(&flood, kernels->read(
+        BMI_KERNEL_ADDRESS(buffer, kernels, seed.x, seed.y)));
+    
+    // Round trip the fill through the format so it compares like the pixels
+    // read back after filling
+    pixel = BMI_PALETTE_INDEX(buffer, pixel);
+    uint8_t sample[4];
+    kernels->point(sample, pixel);
+    const bmi_pixel fill = BMI_FLOOD_COLOR(&flood, kernels->read(sample));
+    if (fill == flood.target && tolerance == 0) {
+        return BMI_SUCCESS;
+    }
+    if (bmi_flood_matches(&flood, fill)) {
+        const size_t bits = (size_t)buffer->width * buffer->height;
+        flood.visited = calloc((bits + 63) / 64, sizeof(uint64_t));
+        if (flood.visited == NULL) {
+            bmi_set_error("bmi_buffer_flood_fill: Virtual memory exhausted");
+            return BMI_FAILURE;
+        }
+    }
+    
+    const uint32_t width = buffer->width;
+    const uint32_t height = buffer->height;
+    const uint32_t reach = connectivity == BMI_CONNECTIVITY_8 ? 1 : 0;
+    
+    // Fill the whole span around the seed, and scan both of its neighbors
+    uint32_t left = seed.x;
+    uint32_t right = seed.x;
+    while (left > 0 && bmi_flood_inside(&flood, left - 1, seed.y)) {
+        left--;
+    }
+    while (right + 1 < width && bmi_flood_inside(&flood, right + 1, seed.y)) {
+        right++;
+    }
+    int ok = bmi_flood_fill_span(&flood, seed.y, left, right, pixel)
+             == BMI_SUCCESS
+             && bmi_flood_push(&flood, seed.y, left, right, 1)
+             && bmi_flood_push(&flood, seed.y, left, right, -1);
+    
+    bmi_flood_span span;
+    while (ok && bmi_flood_pop(&flood, &span)) {
+        if ((span.dy < 0 && span.y == 0)
+            || (span.dy > 0 && span.y + 1 >= height)) {
+            continue;
         }
+        const uint32_t y = span.y + span.dy;
         
-        const uint32_t dx = end.x - start.x;
-        int32_t dy = (int32_t)end.y - (int32_t)start.y;
-        int32_t yi = 1;
-        if (dy < 0) {
-            yi = -1;
-            dy = -dy;
-        }
-        int32_t rolling_error = (int32_t)(2 * dy) - (int32_t)dx;
-        uint32_t y = start.y;
-
-        for (uint32_t x = start.x; x < end.x; x++) {
-            bmi_buffer_draw_point(buffer, BMI_POINT(x, y), pixel);
-            if (rolling_error > 0) {
-                y += yi;
-                rolling_error -= 2 * dx;
+        // Diagonal neighbors widen the scan by one pixel on each side
+        const uint32_t low = span.left >= reach ? span.left - reach : 0;
+        const uint32_t high = span.right + reach < width
+            ? span.right + reach : width - 1;
+        
+        for (uint32_t x = low; ok && x <= high;) {
+            if (!bmi_flood_inside(&flood, x, y)) {
+                x++;
+                continue;
+            }
+            
+            // Only a run starting at the edge of the scan can extend left
+            uint32_t start = x;
+            if (x == low) {
+                while (start > 0 && bmi_flood_inside(&flood, start - 1, y)) {
+                    start--;
+                }
+            }
+            uint32_t end = x;
+            while (end + 1 < width && bmi_flood_inside(&flood, end + 1, y)) {
+                end++;
+            }
+            // Keep going in the same direction, and turn back wherever the run
+            // overhangs the parent span, whose own row is only known to be
+            // done next to it
+            ok = bmi_flood_fill_span(&flood, y, start, end, pixel)
+                 == BMI_SUCCESS
+                 && bmi_flood_push(&flood, y, start, end, span.dy);
+            if (ok && start < span.left) {
+                ok = bmi_flood_push(&flood, y, start, span.left - 1, -span.dy);
+            }
+            if (ok && end > span.right) {
+                ok = bmi_flood_push(&flood, y, span.right + 1, end, -span.dy);
             }
-            rolling_error += 2 * dy;
+            if (end >= high) {
+                break;
+            }
+            x = end + 2;
         }
     }
+    
+    while (flood.top != NULL) {
+        bmi_flood_block* block = flood.top;
+        flood.top = block->previous;
+        free(block);
+    }
+    free(flood.spare);
+    free(flood.visited);
+    
+    if (!ok) {
+        bmi_set_error("bmi_buffer_flood_fill: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+// The state shared by the rows of one overdraw
+typedef struct {
+    bmi_buffer* buffer;
+    const bmi_buffer* layer;
+    bmi_rect region;
+    const bmi_kernels* dst_kernels;
+    const bmi_kernels* src_kernels;
+    const bmi_palette* src_palette;
+    bmi_palette* dst_palette;
+    int convert;
+} bmi_overdraw;
+
+// Prepares the buffer for writing to a region already clipped to it and no
+// larger than the layer, failing when a shared buffer cannot copy its tiles
+static int bmi_overdraw_init(bmi_overdraw* overdraw, bmi_buffer* buffer,
+                             bmi_rect region, const bmi_buffer* layer) {
+    if (!BMI_SHARED_PREPARE(buffer, region.x, region.y, region.width,
+                            region.height)) {
+        return BMI_FAILURE;
+    }
+    
+    overdraw->buffer = buffer;
+    overdraw->layer = layer;
+    overdraw->region = region;
+    overdraw->dst_kernels = bmi_buffer_kernels(buffer);
+    overdraw->src_kernels = bmi_buffer_kernels(layer);
+    
+    // Palette pixels convert through their colors, unless both buffers have
+    // the same palette
+    overdraw->src_palette = (layer->flags & BMI_FL_IS_PALETTE)
+        ? bmi_buffer_palette(layer) : NULL;
+    overdraw->dst_palette = (buffer->flags & BMI_FL_IS_PALETTE)
+        ? bmi_buffer_palette(buffer) : NULL;
+    overdraw->convert = overdraw->dst_kernels != overdraw->src_kernels
+        || (overdraw->dst_palette != NULL && !bmi_palette_equal(buffer, layer));
+    return BMI_SUCCESS;
+}
+
+// Draws the columns from x up to end of one row of the layer into the region,
+// in runs contiguous in both buffers
+static void bmi_overdraw_row(const bmi_overdraw* overdraw, uint32_t y,
+                             uint32_t x, uint32_t end) {
+    bmi_buffer* buffer = overdraw->buffer;
+    const bmi_buffer* layer = overdraw->layer;
+    const bmi_rect region = overdraw->region;
+    const bmi_kernels* dst_kernels = overdraw->dst_kernels;
+    const bmi_kernels* src_kernels = overdraw->src_kernels;
+    bmi_pixel pixels[BMI_KERNEL_CHUNK];
+    while (x < end) {
+        size_t length = BMI_KERNEL_RUN(layer, x, end - x);
+        length = BMI_KERNEL_RUN(buffer, region.x + x, length);
+        uint8_t* dst = BMI_KERNEL_ADDRESS(buffer, dst_kernels, region.x + x,
+                                          region.y + y);
+        const uint8_t* src = BMI_KERNEL_ADDRESS(layer, src_kernels, x, y);
+        if (!overdraw->convert) {
+            // Matching formats copy directly
+            dst_kernels->blit(dst, src, length);
+        } else {
+            // Differing formats convert through a chunk of pixels on the stack
+            if (length > BMI_KERNEL_CHUNK) {
+                length = BMI_KERNEL_CHUNK;
+            }
+            src_kernels->load(pixels, src, length);
+            if (overdraw->src_palette != NULL) {
+                for (size_t i = 0; i < length; i++) {
+                    pixels[i] = overdraw->src_palette->colors[pixels[i]];
+                }
+            }
+            if (overdraw->dst_palette != NULL) {
+                bmi_palette_map(overdraw->dst_palette, pixels, length);
+            }
+            dst_kernels->store(dst, pixels, length);
+        }
+        x += (uint32_t)length;
+    }
 }
 
 int bmi_buffer_overdraw_buffer(bmi_buffer* buffer, bmi_rect region,
@@ -191,14 +800,58 @@ int bmi_buffer_overdraw_buffer(bmi_buffer* buffer, bmi_rect region,
         return BMI_FAILURE;
     }
     
+    bmi_overdraw overdraw;
+    if (bmi_overdraw_init(&overdraw, buffer, region, layer) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_overdraw_buffer: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
     
     // Draw the buffer from the top left into the region
-    for (uint32_t y = 0; y < region.height; y++) {
-        for (uint32_t x = 0; x < region.width; x++) {
-            const bmi_point src = BMI_POINT(x, y);
-            const bmi_point dst = BMI_POINT(x + region.x, y + region.y);
-            bmi_buffer_draw_point(buffer, dst,
-                                  bmi_buffer_get_pixel(layer, src));
+    for (uint32_t y = 0; y < overdraw.region.height; y++) {
+        bmi_overdraw_row(&overdraw, y, 0, overdraw.region.width);
+    }
+    
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_overdraw_buffer_masked(bmi_buffer* buffer, bmi_rect region,
+                                      const bmi_buffer* layer,
+                                      const bmi_mask* mask) {
+    // Clip the rectangle to prevent out-of-bounds drawing
+    bmi_clip_rect(&region, BMI_RECT(0, 0, buffer->width, buffer->height));
+    
+    // Handle errors to ensure integrity
+    if (region.width > layer->width) {
+        bmi_set_error("bmi_buffer_overdraw_buffer_masked: Attempted to draw "
+                      "a region wider than the given buffer");
+        return BMI_FAILURE;
+    } else if (region.height > layer->height) {
+        bmi_set_error("bmi_buffer_overdraw_buffer_masked: Attempted to draw "
+                      "a region taller than the given buffer");
+        return BMI_FAILURE;
+    }
+    
+    bmi_overdraw overdraw;
+    if (bmi_overdraw_init(&overdraw, buffer, region, layer) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_overdraw_buffer_masked: Virtual memory "
+                      "exhausted");
+        return BMI_FAILURE;
+    }
+    
+    // Copy only the runs of set bits, skipping whole clear words of the mask
+    region = overdraw.region;
+    bmi_clip_rect(&region, BMI_RECT(0, 0, mask->width, mask->height));
+    for (uint32_t y = region.y; y < region.y + region.height; y++) {
+        const uint64_t* row = bmi_mask_row(mask, y);
+        uint32_t x = region.x;
+        uint32_t start;
+        size_t length;
+        while ((length = bmi_mask_next_run(row, x, region.x + region.width,
+                                           &start)) != 0) {
+            x = start + (uint32_t)length;
+            bmi_overdraw_row(&overdraw, y - overdraw.region.y,
+                             start - overdraw.region.x,
+                             x - overdraw.region.x);
         }
     }
     
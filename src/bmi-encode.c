@@ -0,0 +1,270 @@
+// src: bmi-encode.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+// fileno, ftello, fseeko, pwrite
+#define _POSIX_C_SOURCE 200809L
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-encode.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_to_file, bmi_buffer_to_ppm, bmi_buffer_to_bmp, bmi_bmp_header,
+// bmi_bmp_row, BMI_BMP_HEADER_MAX, BMI_BMP_STRIDE
+#include "bmi-util.h"
+
+// bmi_buffer_kernels, bmi_kernel_gather, BMI_KERNEL_ADDRESS
+#include "bmi-kernel.h"
+
+// bmi_buffer_hash
+#include "bmi-hash.h"
+
+// bmi_buffer_palette, bmi_palette_encode, bmi_palette_table_init,
+// bmi_palette_expand, BMI_PALETTE_BLOCK_MAX
+#include "bmi-palette.h"
+
+// bmi_parallel_for
+#include "bmi-parallel.h"
+
+// malloc, free
+#include <stdlib.h>
+
+// memcpy
+#include <string.h>
+
+// errno, EINTR
+#include <errno.h>
+
+// pwrite
+#include <unistd.h>
+
+// fcntl, F_GETFL, O_APPEND
+#include <fcntl.h>
+
+// Bands hold about this many bytes of the encoded file
+#define BMI_ENCODE_BAND (4 << 20)
+
+typedef struct {
+    const bmi_buffer* buffer;
+    const bmi_kernels* kernels;
+    bmi_encode_format format;
+    bmi_palette_table table;
+    int fd;
+    
+    // Where the first row starts in the file, and the size of each row
+    off_t offset;
+    size_t row_size;
+    uint32_t band_rows;
+    
+    // Whether the rows are already laid out in memory as they are in the file
+    int direct;
+    
+    // Set once any band fails, and also when the failure was a band that
+    // could not be allocated rather than written
+    uint32_t failed;
+    uint32_t exhausted;
+} bmi_encode_job;
+
+// Writes all of the data at the given offset, returning whether it did
+static int bmi_encode_write(int fd, const uint8_t* data, size_t size,
+                            off_t offset) {
+    while (size > 0) {
+        const ssize_t result = pwrite(fd, data, size, offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return 0;
+        }
+        data += result;
+        size -= (size_t)result;
+        offset += result;
+    }
+    return 1;
+}
+
+// Encodes the i-th row of the file
+static void bmi_encode_row(const bmi_encode_job* job, uint32_t i,
+                           uint8_t* row, uint8_t* indices) {
+    const bmi_buffer* buffer = job->buffer;
+    if (job->format == BMI_ENCODE_BMP) {
+        bmi_bmp_row(buffer, job->kernels, i, row);
+    } else if (job->format == BMI_ENCODE_PPM
+               && (buffer->flags & BMI_FL_IS_PALETTE)) {
+        bmi_kernel_gather(buffer, job->kernels, 0, i, indices, buffer->width);
+        bmi_palette_expand(&job->table, row, indices, buffer->width);
+    } else {
+        bmi_kernel_gather(buffer, job->kernels, 0, i, row, buffer->width);
+    }
+}
+
+static void bmi_encode_band(void* context, uint32_t index) {
+    bmi_encode_job* job = context;
+    if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+        return;
+    }
+    const bmi_buffer* buffer = job->buffer;
+    const uint32_t first = index * job->band_rows;
+    const uint32_t last = buffer->height - first > job->band_rows
+        ? first + job->band_rows : buffer->height;
+    const size_t size = (size_t)(last - first) * job->row_size;
+    const off_t offset = job->offset + (off_t)first * (off_t)job->row_size;
+    
+    // Rows already in file order go out without a copy
+    if (job->direct) {
+        if (!bmi_encode_write(job->fd, BMI_KERNEL_ADDRESS(buffer, job->kernels,
+                                                          0, first),
+                              size, offset)) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    
+    uint8_t* band = malloc(size);
+    uint8_t* indices = malloc(buffer->width);
+    if (band == NULL || indices == NULL) {
+        __atomic_store_n(&job->exhausted, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        free(band);
+        free(indices);
+        return;
+    }
+    for (uint32_t i = first; i < last; i++) {
+        bmi_encode_row(job, i, band + (size_t)(i - first) * job->row_size,
+                       indices);
+    }
+    if (!bmi_encode_write(job->fd, band, size, offset)) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+    free(band);
+    free(indices);
+}
+
+// Writes the file in order through the stream
+static int bmi_encode_serial(FILE* dest, const bmi_buffer* buffer,
+                             bmi_encode_format format) {
+    switch (format) {
+        case BMI_ENCODE_PPM:
+            return bmi_buffer_to_ppm(dest, buffer);
+        case BMI_ENCODE_BMP:
+            return bmi_buffer_to_bmp(dest, buffer);
+        default:
+            return bmi_buffer_to_file(dest, buffer);
+    }
+}
+
+int bmi_buffer_encode(FILE* dest, const bmi_buffer* buffer,
+                      bmi_encode_format format) {
+    // Everything buffered in the stream lands before the rows are placed
+    // after it. Appending descriptors ignore the offset given to pwrite, so
+    // their bands would land in whatever order they finish.
+    const off_t start = fflush(dest) == 0 ? ftello(dest) : -1;
+    const int flags = fcntl(fileno(dest), F_GETFL);
+    if (start < 0 || flags < 0 || (flags & O_APPEND)
+        || buffer->width == 0 || buffer->height == 0) {
+        return bmi_encode_serial(dest, buffer, format);
+    }
+    bmi_encode_job job = {
+        .buffer = buffer,
+        .kernels = bmi_buffer_kernels(buffer),
+        .format = format,
+        .fd = fileno(dest)
+    };
+    
+    // The header is written first, while the rows of each format are of one
+    // size, so every band's offset is known up front
+    uint8_t header[BMI_BMP_HEADER_MAX + BMI_PALETTE_BLOCK_MAX];
+    size_t header_size = 0;
+    job.row_size = (size_t)buffer->width * job.kernels->size;
+    if (format == BMI_ENCODE_BMP) {
+        header_size = bmi_bmp_header(buffer, header);
+        if (header_size == 0) {
+            bmi_set_error("bmi_buffer_encode: Image is too large for a BMP");
+            return BMI_FAILURE;
+        }
+        job.row_size = (size_t)BMI_BMP_STRIDE(buffer);
+    } else if (format == BMI_ENCODE_PPM) {
+        header_size = (size_t)snprintf((char*)header, sizeof(header),
+                                       "P%c\n%u %u\n255\n",
+                                       (buffer->flags & BMI_FL_IS_GRAYSCALE)
+                                       ? '5' : '6',
+                                       buffer->width, buffer->height);
+        if (buffer->flags & BMI_FL_IS_PALETTE) {
+            bmi_palette_table_init(bmi_buffer_palette(buffer), &job.table);
+            job.row_size = (size_t)buffer->width * 3;
+        }
+        job.direct = !(buffer->flags & (BMI_FL_IS_TILED | BMI_FL_IS_PALETTE));
+    } else {
+        bmi_buffer file_header;
+        memcpy(&file_header, buffer, sizeof(bmi_buffer));
+        file_header.flags &= ~(uint32_t)BMI_FL_MEMORY_MASK;
+        memcpy(header, &file_header, sizeof(bmi_buffer));
+        header_size = sizeof(bmi_buffer);
+        if (buffer->flags & BMI_FL_IS_PALETTE) {
+            header_size += bmi_palette_encode(bmi_buffer_palette(buffer),
+                                              header + header_size);
+        }
+        job.direct = !(buffer->flags & BMI_FL_IS_TILED);
+    }
+    if (!bmi_encode_write(job.fd, header, header_size, start)) {
+        bmi_set_error("bmi_buffer_encode: Failed to write file header");
+        return BMI_FAILURE;
+    }
+    job.offset = start + (off_t)header_size;
+    
+    // Bands are whole rows of about the same number of bytes
+    job.band_rows = job.row_size < BMI_ENCODE_BAND
+        ? (uint32_t)(BMI_ENCODE_BAND / job.row_size) : 1;
+    if (job.band_rows > buffer->height) {
+        job.band_rows = buffer->height;
+    }
+    bmi_parallel_for((buffer->height + job.band_rows - 1) / job.band_rows,
+                     bmi_encode_band, &job);
+    if (job.exhausted) {
+        bmi_set_error("bmi_buffer_encode: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    if (job.failed) {
+        bmi_set_error("bmi_buffer_encode: Failed to write image data");
+        return BMI_FAILURE;
+    }
+    off_t end = job.offset + (off_t)job.row_size * buffer->height;
+    
+    // The checksum covers the whole file in order, which the stored hash of
+    // the buffer already does
+    if (format == BMI_ENCODE_BMI && (buffer->flags & BMI_FL_HAS_CHECKSUM)) {
+        uint64_t checksum = bmi_buffer_hash(buffer);
+        uint8_t trailer[BMI_CHECKSUM_SIZE];
+        for (int i = 0; i < BMI_CHECKSUM_SIZE; i++) {
+            trailer[i] = (uint8_t)checksum;
+            checksum >>= 8;
+        }
+        if (!bmi_encode_write(job.fd, trailer, BMI_CHECKSUM_SIZE, end)) {
+            bmi_set_error("bmi_buffer_encode: Failed to write checksum");
+            return BMI_FAILURE;
+        }
+        end += BMI_CHECKSUM_SIZE;
+    }
+    
+    // Leave the stream where the file ends, as the serial writers do
+    if (fseeko(dest, end, SEEK_SET) != 0) {
+        bmi_set_error("bmi_buffer_encode: Failed to seek past the image");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
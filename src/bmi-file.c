@@ -16,7 +16,7 @@
 
 #define _BMI_USE_INTERNAL
 
-// bmi_buffer_component_size
+// bmi_buffer_component_size, BMI_PIXEL_COUNT_FROM_FL
 #include "bmi-file.h"
 
 const char* bmi_version_string(const uint8_t version) {
@@ -27,6 +27,8 @@ const char* bmi_version_string(const uint8_t version) {
     return result;
 }
 
-inline size_t bmi_buffer_content_size(const bmi_buffer* buffer) {
-    return buffer->width * buffer->height * bmi_buffer_component_size(buffer);
+size_t bmi_buffer_content_size(const bmi_buffer* buffer) {
+    return BMI_PIXEL_COUNT_FROM_FL(buffer->width, buffer->height,
+                                   buffer->flags)
+           * bmi_buffer_component_size(buffer);
 }
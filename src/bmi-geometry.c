@@ -18,9 +18,15 @@
 
 #include "bmi-geometry.h"
 
+// BMI_TILED_INDEX
+#include "bmi-file.h"
+
 // fprintf
 #include <stdio.h>
 
+// malloc, calloc, free
+#include <stdlib.h>
+
 void bmi_dump_point(FILE* dest, const bmi_point point) {
     fprintf(dest, "(x: %u, y: %u)\n", point.x, point.y);
 }
@@ -41,13 +47,70 @@ void bmi_clip_point(bmi_point* point, const bmi_rect bounds) {
 }
 
 void bmi_clip_rect(bmi_rect* rect, const bmi_rect bounds) {
-    const uint32_t max_x = _MIN(rect->x + rect->width, bounds.x + bounds.width);
-    const uint32_t max_y = _MIN(rect->y + rect->height,
-                                bounds.y + bounds.height);
+    // Edges are found in 64 bits so that they cannot wrap, and a rectangle
+    // entirely outside of the bounds becomes empty
+    const uint64_t max_x = _MIN((uint64_t)rect->x + rect->width,
+                                (uint64_t)bounds.x + bounds.width);
+    const uint64_t max_y = _MIN((uint64_t)rect->y + rect->height,
+                                (uint64_t)bounds.y + bounds.height);
     rect->x = _MAX(rect->x, bounds.x);
     rect->y = _MAX(rect->y, bounds.y);
-    rect->width = max_x - rect->x;
-    rect->height = max_y - rect->y;
+    rect->width = max_x > rect->x ? (uint32_t)(max_x - rect->x) : 0;
+    rect->height = max_y > rect->y ? (uint32_t)(max_y - rect->y) : 0;
+}
+
+// Liang-Barsky: the line is parameterized over [0, 1] and each edge of the
+// bounds narrows that interval from one side
+int bmi_clip_line(bmi_point* start, bmi_point* end, const bmi_rect bounds) {
+    if (bounds.width == 0 || bounds.height == 0) {
+        return 0;
+    }
+    
+    const double x0 = start->x;
+    const double y0 = start->y;
+    const double dx = (double)end->x - x0;
+    const double dy = (double)end->y - y0;
+    const double min_x = bounds.x;
+    const double min_y = bounds.y;
+    const double max_x = (double)bounds.x + bounds.width - 1.0;
+    const double max_y = (double)bounds.y + bounds.height - 1.0;
+    
+    const double p[4] = { -dx, dx, -dy, dy };
+    const double q[4] = { x0 - min_x, max_x - x0, y0 - min_y, max_y - y0 };
+    double t0 = 0.0;
+    double t1 = 1.0;
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0) {
+            // Parallel to this edge, so either entirely outside or unaffected
+            if (q[i] < 0.0) {
+                return 0;
+            }
+        } else {
+            const double t = q[i] / p[i];
+            if (p[i] < 0.0) {
+                if (t > t1) {
+                    return 0;
+                }
+                t0 = _MAX(t0, t);
+            } else {
+                if (t < t0) {
+                    return 0;
+                }
+                t1 = _MIN(t1, t);
+            }
+        }
+    }
+    
+    // Round to the nearest pixel, clamping away any floating point error
+    if (t1 < 1.0) {
+        end->x = (uint32_t)_MIN(_MAX(x0 + t1 * dx + 0.5, min_x), max_x);
+        end->y = (uint32_t)_MIN(_MAX(y0 + t1 * dy + 0.5, min_y), max_y);
+    }
+    if (t0 > 0.0) {
+        start->x = (uint32_t)_MIN(_MAX(x0 + t0 * dx + 0.5, min_x), max_x);
+        start->y = (uint32_t)_MIN(_MAX(y0 + t0 * dy + 0.5, min_y), max_y);
+    }
+    return 1;
 }
 
 void bmi_inset_rect(bmi_rect* rect, uint32_t delta, const bmi_rect_edge edge) {
@@ -89,3 +152,84 @@ void bmi_set_rect(bmi_rect* rect, uint32_t width, bmi_rect_edge edge) {
         }
     }
 }
+
+// Points are binned by bands of 1 << BMI_BIN_BAND_SHIFT rows, which keeps each
+// band within a handful of pages without needing a counter per row
+#define BMI_BIN_BAND_SHIFT 2
+
+// Below this many points the sort costs more than the locality it buys
+#define BMI_BIN_THRESHOLD 4096
+
+size_t* bmi_bin_points(const bmi_point* points, size_t count, uint32_t width,
+                       uint32_t height, size_t* valid) {
+    *valid = count;
+    if (count < BMI_BIN_THRESHOLD) {
+        return NULL;
+    }
+    
+    const size_t bins = ((size_t)height >> BMI_BIN_BAND_SHIFT) + 1;
+    size_t* starts = calloc(bins + 1, sizeof(size_t));
+    if (starts == NULL) {
+        return NULL;
+    }
+    
+    // Count the in-bounds points of each band, noting whether they already
+    // arrive in band order, as scanline-generated points often do
+    int sorted = 1;
+    size_t last_band = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (points[i].x < width && points[i].y < height) {
+            const size_t band = points[i].y >> BMI_BIN_BAND_SHIFT;
+            sorted &= band >= last_band;
+            last_band = band;
+            starts[band + 1]++;
+        }
+    }
+    if (sorted) {
+        free(starts);
+        return NULL;
+    }
+    
+    size_t* order = malloc(count * sizeof(size_t));
+    if (order == NULL) {
+        free(starts);
+        return NULL;
+    }
+    
+    // Distribute the point indices into their bands, preserving the original
+    // order within each band so later points still overwrite earlier ones
+    for (size_t i = 1; i <= bins; i++) {
+        starts[i] += starts[i - 1];
+    }
+    *valid = starts[bins];
+    for (size_t i = 0; i < count; i++) {
+        if (points[i].x < width && points[i].y < height) {
+            order[starts[points[i].y >> BMI_BIN_BAND_SHIFT]++] = i;
+        }
+    }
+    
+    free(starts);
+    return order;
+}
+
+void bmi_index_points(const bmi_point* points, const size_t* order,
+                      size_t count, uint32_t width, uint32_t height,
+                      uint32_t flags, size_t* indices) {
+    const int tiled = (flags & BMI_FL_IS_TILED) != 0;
+    if (order != NULL) {
+        // Binned points were bounds-checked while binning
+        for (size_t i = 0; i < count; i++) {
+            const bmi_point point = points[order[i]];
+            indices[i] = tiled ? BMI_TILED_INDEX(width, point.x, point.y)
+                : (size_t)point.y * width + point.x;
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            const bmi_point point = points[i];
+            indices[i] = (point.x < width && point.y < height)
+                ? (tiled ? BMI_TILED_INDEX(width, point.x, point.y)
+                   : (size_t)point.y * width + point.x)
+                : BMI_INDEX_INVALID;
+        }
+    }
+}
@@ -0,0 +1,469 @@
+// src: bmi-gradient.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-gradient.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_clip_rect
+#include "bmi-geometry.h"
+
+// bmi_buffer_kernels, bmi_kernel_table, bmi_kernel_span, BMI_KERNEL_ADDRESS,
+// BMI_KERNEL_RUN
+#include "bmi-kernel.h"
+
+// bmi_parallel_for, bmi_parallel_parts
+#include "bmi-parallel.h"
+
+// BMI_SHARED_PREPARE
+#include "bmi-shared.h"
+
+// bmi_buffer_palette, bmi_palette_index
+#include "bmi-palette.h"
+
+// sqrtf, fabs, floor
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Ramps are looked up in a table of this many colors, which is fine enough that
+// a ramp across the whole range of a channel moves a quarter of a level at most
+// between entries
+#define BMI_GRADIENT_STEPS 1024
+#define BMI_GRADIENT_LAST (BMI_GRADIENT_STEPS - 1)
+
+// Linear positions are stepped in fixed point for at most this many pixels
+// before being recomputed, which keeps the rounding error below a table entry
+#define BMI_GRADIENT_RUN 1024
+
+// Runs are written in blocks of this many pixels, a whole number of dither
+// periods, whose levels are gathered from the table and then stored together
+#define BMI_GRADIENT_BLOCK 16
+
+// Each thread fills parts of at least this many bytes
+#define BMI_GRADIENT_GRAIN (1u << 18)
+
+// The thresholds of a 4x4 ordered dither, in 256ths of a level
+static const uint8_t bmi_bayer[4][4] = {
+    { 8, 136, 40, 168 },
+    { 200, 72, 232, 104 },
+    { 56, 184, 24, 152 },
+    { 248, 120, 216, 88 }
+};
+
+typedef struct {
+    bmi_buffer* buffer;
+    const bmi_kernels* kernels;
+    bmi_rect bounds;
+    uint32_t parts;
+    int radial;
+    int dithered;
+    
+    // A linear ramp's position, in table entries, at the origin and how far it
+    // moves with each pixel in either direction
+    double origin;
+    double step_x;
+    double step_y;
+    
+    // A radial ramp's center and its table entries per pixel of distance
+    double center_x;
+    double center_y;
+    double radius;
+    double scale;
+    
+    // Levels are rounded up past these thresholds, which are all one half
+    // when not dithering
+    uint8_t thresholds[4][4];
+    
+    // Each color of the ramp in the buffer's format, in 256ths of a level
+    uint16_t table[BMI_GRADIENT_STEPS][3];
+} bmi_gradient_job;
+
+// Builds the table of the ramp through at least one stop, failing when their
+// offsets decrease or lie outside of 0 to 1
+static int bmi_gradient_table(bmi_gradient_job* job,
+                              const bmi_gradient_stop* stops, size_t count,
+                              bmi_dither dither) {
+    for (size_t i = 0; i < count; i++) {
+        if (!(stops[i].offset >= 0 && stops[i].offset <= 1)
+            || (i > 0 && stops[i].offset < stops[i - 1].offset)) {
+            return BMI_FAILURE;
+        }
+    }
+    
+    // Palette buffers take the index nearest to each mixed color, and there is
+    // nothing between neighboring indices to dither to
+    const int indexed = (job->buffer->flags & BMI_FL_IS_PALETTE) != 0;
+    const bmi_kernels* kernels = indexed ? &bmi_kernel_table[0] : job->kernels;
+    job->dithered = dither == BMI_DITHER_ORDERED && !indexed;
+    for (uint32_t y = 0; y < 4; y++) {
+        for (uint32_t x = 0; x < 4; x++) {
+            job->thresholds[y][x] = job->dithered ? bmi_bayer[y][x] : 128;
+        }
+    }
+    
+    // Stops are converted to the buffer's format once, and each entry mixes
+    // the pair it lies between
+    const size_t size = kernels->size;
+    size_t stop = 0;
+    for (uint32_t i = 0; i < BMI_GRADIENT_STEPS; i++) {
+        const double t = (double)i / BMI_GRADIENT_LAST;
+        while (stop + 1 < count && stops[stop + 1].offset <= t) {
+            stop++;
+        }
+        uint8_t from[4];
+        uint8_t to[4];
+        kernels->point(from, stops[stop].pixel);
+        double mix = 0;
+        if (stop + 1 < count && t > stops[stop].offset) {
+            kernels->point(to, stops[stop + 1].pixel);
+            mix = (t - stops[stop].offset)
+                  / (stops[stop + 1].offset - stops[stop].offset);
+        }
+        for (size_t c = 0; c < size; c++) {
+            const double level = mix == 0 ? from[c]
+                : from[c] + (to[c] - (double)from[c]) * mix;
+            job->table[i][c] = (uint16_t)(level * 256 + 0.5);
+        }
+        if (indexed) {
+            uint8_t mixed[4];
+            for (size_t c = 0; c < size; c++) {
+                mixed[c] = (uint8_t)((job->table[i][c] + 128) >> 8);
+            }
+            job->table[i][0] = (uint16_t)(bmi_palette_index(
+                bmi_buffer_palette(job->buffer), kernels->read(mixed)) << 8);
+        }
+    }
+    return BMI_SUCCESS;
+}
+
+// Returns the pixel of a table entry, for rows that are a single color
+static bmi_pixel bmi_gradient_pixel(const bmi_gradient_job* job,
+                                    size_t index) {
+    uint8_t sample[4];
+    for (size_t c = 0; c < job->kernels->size; c++) {
+        sample[c] = (uint8_t)((job->table[index][c] + 128) >> 8);
+    }
+    return job->kernels->read(sample);
+}
+
+// Fills the thresholds for each level of a block starting at column x, which
+// are the same for every block of a run
+static inline void bmi_gradient_phases(uint16_t* phases, size_t size,
+                                       const uint8_t* thresholds, uint32_t x) {
+    for (size_t i = 0; i < BMI_GRADIENT_BLOCK; i++) {
+        for (size_t c = 0; c < size; c++) {
+            phases[i * size + c] = thresholds[(x + i) & 3];
+        }
+    }
+}
+
+// Rounds count levels in 256ths of a level by their thresholds and stores
+// them, sixteen at a time where SSE2 is available. No sum overflows, since
+// levels are at most 255 * 256 and thresholds below 256.
+static inline void bmi_gradient_store(uint8_t* dst, const uint16_t* levels,
+                                      const uint16_t* phases, size_t count) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= count; i += 16) {
+        const __m128i low = _mm_srli_epi16(_mm_add_epi16(
+            _mm_loadu_si128((const __m128i*)(levels + i)),
+            _mm_loadu_si128((const __m128i*)(phases + i))), 8);
+        const __m128i high = _mm_srli_epi16(_mm_add_epi16(
+            _mm_loadu_si128((const __m128i*)(levels + i + 8)),
+            _mm_loadu_si128((const __m128i*)(phases + i + 8))), 8);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(low, high));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = (uint8_t)((levels[i] + phases[i]) >> 8);
+    }
+}
+
+// Stores the table entries at count indices as a block of pixels
+static inline void bmi_gradient_block(uint8_t* dst, size_t size,
+                                      const bmi_gradient_job* job,
+                                      const uint32_t* indices, size_t count,
+                                      const uint16_t* phases) {
+    uint16_t levels[BMI_GRADIENT_BLOCK * 3];
+    for (size_t i = 0; i < count; i++) {
+        const uint16_t* entry = job->table[indices[i]];
+        for (size_t c = 0; c < size; c++) {
+            levels[i * size + c] = entry[c];
+        }
+    }
+    bmi_gradient_store(dst, levels, phases, count * size);
+}
+
+// Writes count pixels of a linear ramp, whose position in table entries, with
+// a 16-bit fraction, starts at position and moves by step with each pixel
+static inline void bmi_linear_run(uint8_t* dst, size_t count, size_t size,
+                                  int64_t position, int64_t step,
+                                  const bmi_gradient_job* job,
+                                  const uint8_t* thresholds, uint32_t x) {
+    uint16_t phases[BMI_GRADIENT_BLOCK * 3];
+    bmi_gradient_phases(phases, size, thresholds, x);
+    for (size_t i = 0; i < count; i += BMI_GRADIENT_BLOCK) {
+        const size_t length = count - i < BMI_GRADIENT_BLOCK
+            ? count - i : BMI_GRADIENT_BLOCK;
+        uint32_t indices[BMI_GRADIENT_BLOCK];
+        for (size_t j = 0; j < length; j++) {
+            const int64_t index = position < 0 ? 0 : position >> 16;
+            indices[j] = index > BMI_GRADIENT_LAST ? BMI_GRADIENT_LAST
+                : (uint32_t)index;
+            position += step;
+        }
+        bmi_gradient_block(dst + i * size, size, job, indices, length,
+                           phases);
+    }
+}
+
+// Converts count squared distances to table indices, four at a time where
+// SSE2 is available
+static inline void bmi_radial_indices(uint32_t* indices, const float* squares,
+                                      size_t count, float scale) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 factor = _mm_set1_ps(scale);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 last = _mm_set1_ps(BMI_GRADIENT_LAST);
+    for (; i + 4 <= count; i += 4) {
+        const __m128 position = _mm_add_ps(_mm_mul_ps(
+            _mm_sqrt_ps(_mm_loadu_ps(squares + i)), factor), half);
+        _mm_storeu_si128((__m128i*)(indices + i),
+                         _mm_cvttps_epi32(_mm_min_ps(position, last)));
+    }
+#endif
+    for (; i < count; i++) {
+        const float position = sqrtf(squares[i]) * scale + 0.5f;
+        indices[i] = position < BMI_GRADIENT_LAST ? (uint32_t)position
+            : BMI_GRADIENT_LAST;
+    }
+}
+
+// Writes count pixels of a radial ramp, whose squared distance from the center
+// grows by an odd step with each pixel. The distances are whole numbers, which
+// a double holds exactly far beyond any radius a table entry can resolve and,
+// unlike an integer, without overflowing for centers far from the buffer.
+static inline void bmi_radial_run(uint8_t* dst, size_t count, size_t size,
+                                  double dx, double dy2,
+                                  const bmi_gradient_job* job,
+                                  const uint8_t* thresholds, uint32_t x) {
+    uint16_t phases[BMI_GRADIENT_BLOCK * 3];
+    bmi_gradient_phases(phases, size, thresholds, x);
+    const float scale = (float)job->scale;
+    double distance2 = dx * dx + dy2;
+    for (size_t i = 0; i < count; i += BMI_GRADIENT_BLOCK) {
+        const size_t length = count - i < BMI_GRADIENT_BLOCK
+            ? count - i : BMI_GRADIENT_BLOCK;
+        float squares[BMI_GRADIENT_BLOCK];
+        for (size_t j = 0; j < length; j++) {
+            squares[j] = (float)distance2;
+            distance2 += 2 * dx + 1;
+            dx += 1;
+        }
+        uint32_t indices[BMI_GRADIENT_BLOCK];
+        bmi_radial_indices(indices, squares, length, scale);
+        bmi_gradient_block(dst + i * size, size, job, indices, length,
+                           phases);
+    }
+}
+
+static void bmi_gradient_part(void* context, uint32_t index) {
+    const bmi_gradient_job* job = context;
+    bmi_buffer* buffer = job->buffer;
+    const bmi_kernels* kernels = job->kernels;
+    const size_t size = kernels->size;
+    const uint32_t first = (uint32_t)((uint64_t)job->bounds.height * index
+                                      / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)job->bounds.height
+                                     * (index + 1) / job->parts);
+    const uint32_t left = job->bounds.x;
+    const uint32_t right = job->bounds.x + job->bounds.width;
+    
+    for (uint32_t y = job->bounds.y + first; y < job->bounds.y + last; y++) {
+        const uint8_t* thresholds = job->thresholds[y & 3];
+        const double dy = y - job->center_y;
+        
+        // Rows that are a single color are filled as spans
+        if (job->radial && fabs(dy) >= job->radius) {
+            bmi_kernel_span(buffer, kernels, left, y, job->bounds.width,
+                            bmi_gradient_pixel(job, BMI_GRADIENT_LAST));
+            continue;
+        }
+        if (!job->radial && job->step_x == 0 && !job->dithered) {
+            const double position = job->origin + y * job->step_y;
+            bmi_kernel_span(buffer, kernels, left, y, job->bounds.width,
+                            bmi_gradient_pixel(job, position <= 0 ? 0
+                                : position >= BMI_GRADIENT_LAST
+                                ? BMI_GRADIENT_LAST : (size_t)position));
+            continue;
+        }
+        
+        for (uint32_t x = left; x < right;) {
+            size_t run = BMI_KERNEL_RUN(buffer, x, right - x);
+            if (run > BMI_GRADIENT_RUN) {
+                run = BMI_GRADIENT_RUN;
+            }
+            
+            // The runs are specialized for each pixel size
+            uint8_t* dst = BMI_KERNEL_ADDRESS(buffer, kernels, x, y);
+            if (job->radial) {
+                const double dx = x - job->center_x;
+                if (size == 1) {
+                    bmi_radial_run(dst, run, 1, dx, dy * dy, job, thresholds,
+                                   x);
+                } else {
+                    bmi_radial_run(dst, run, 3, dx, dy * dy, job, thresholds,
+                                   x);
+                }
+            } else {
+                const int64_t position = (int64_t)floor(
+                    (job->origin + x * job->step_x + y * job->step_y) * 65536);
+                const int64_t step = (int64_t)floor(job->step_x * 65536 + 0.5);
+                if (size == 1) {
+                    bmi_linear_run(dst, run, 1, position, step, job,
+                                   thresholds, x);
+                } else {
+                    bmi_linear_run(dst, run, 3, position, step, job,
+                                   thresholds, x);
+                }
+            }
+            x += (uint32_t)run;
+        }
+    }
+}
+
+// Fills the clipped bounds of the job in parallel bands of rows, failing when
+// the tiles of a shared buffer could not be copied
+static int bmi_gradient_fill(bmi_gradient_job* job) {
+    bmi_rect* bounds = &job->bounds;
+    bmi_clip_rect(bounds, BMI_RECT(0, 0, job->buffer->width,
+                                   job->buffer->height));
+    if (bounds->width == 0 || bounds->height == 0) {
+        return BMI_SUCCESS;
+    }
+    
+    // Every tile of a shared buffer is copied up front, as the threads write
+    // to them without checking
+    if (!BMI_SHARED_PREPARE(job->buffer, bounds->x, bounds->y, bounds->width,
+                            bounds->height)) {
+        return BMI_FAILURE;
+    }
+    job->parts = bmi_parallel_parts((uint64_t)bounds->width * bounds->height
+                                    * job->kernels->size, BMI_GRADIENT_GRAIN);
+    if (job->parts > bounds->height) {
+        job->parts = bounds->height;
+    }
+    bmi_parallel_for(job->parts, bmi_gradient_part, job);
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_fill_linear_gradient(bmi_buffer* buffer, bmi_rect bounds,
+                                    bmi_point start, bmi_point end,
+                                    const bmi_gradient_stop* stops,
+                                    size_t count, bmi_dither dither) {
+    bmi_gradient_job job = {
+        .buffer = buffer,
+        .kernels = bmi_buffer_kernels(buffer),
+        .bounds = bounds
+    };
+    if (count == 0) {
+        bmi_set_error("bmi_buffer_fill_linear_gradient: Gradients need at "
+                      "least one stop");
+        return BMI_FAILURE;
+    }
+    if (dither != BMI_DITHER_NONE && dither != BMI_DITHER_ORDERED) {
+        bmi_set_error("bmi_buffer_fill_linear_gradient: Dither must be none or "
+                      "ordered");
+        return BMI_FAILURE;
+    }
+    if (bmi_gradient_table(&job, stops, count, dither) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_fill_linear_gradient: Stop offsets must not "
+                      "decrease and must lie between 0 and 1");
+        return BMI_FAILURE;
+    }
+    if (start.x == end.x && start.y == end.y) {
+        bmi_set_error("bmi_buffer_fill_linear_gradient: Start and end points "
+                      "must differ");
+        return BMI_FAILURE;
+    }
+    
+    // The position is the projection onto the line from start to end, which
+    // is affine in the coordinates, and is offset by half an entry so that
+    // truncating it rounds to the nearest one
+    const double dx = (double)end.x - start.x;
+    const double dy = (double)end.y - start.y;
+    const double scale = BMI_GRADIENT_LAST / (dx * dx + dy * dy);
+    job.step_x = dx * scale;
+    job.step_y = dy * scale;
+    job.origin = 0.5 - start.x * job.step_x - start.y * job.step_y;
+    
+    if (bmi_gradient_fill(&job) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_fill_linear_gradient: Virtual memory "
+                      "exhausted");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_fill_radial_gradient(bmi_buffer* buffer, bmi_rect bounds,
+                                    bmi_point center, uint32_t radius,
+                                    const bmi_gradient_stop* stops,
+                                    size_t count, bmi_dither dither) {
+    bmi_gradient_job job = {
+        .buffer = buffer,
+        .kernels = bmi_buffer_kernels(buffer),
+        .bounds = bounds,
+        .radial = 1,
+        .center_x = center.x,
+        .center_y = center.y,
+        .radius = radius
+    };
+    if (count == 0) {
+        bmi_set_error("bmi_buffer_fill_radial_gradient: Gradients need at "
+                      "least one stop");
+        return BMI_FAILURE;
+    }
+    if (dither != BMI_DITHER_NONE && dither != BMI_DITHER_ORDERED) {
+        bmi_set_error("bmi_buffer_fill_radial_gradient: Dither must be none or "
+                      "ordered");
+        return BMI_FAILURE;
+    }
+    if (bmi_gradient_table(&job, stops, count, dither) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_fill_radial_gradient: Stop offsets must not "
+                      "decrease and must lie between 0 and 1");
+        return BMI_FAILURE;
+    }
+    if (radius == 0) {
+        bmi_set_error("bmi_buffer_fill_radial_gradient: Radius must not be "
+                      "zero");
+        return BMI_FAILURE;
+    }
+    job.scale = (double)BMI_GRADIENT_LAST / radius;
+    
+    if (bmi_gradient_fill(&job) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_fill_radial_gradient: Virtual memory "
+                      "exhausted");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
@@ -0,0 +1,178 @@
+// src: bmi-hash.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-hash.h"
+
+// bmi_buffer_kernels, bmi_kernel_segment
+#include "bmi-kernel.h"
+
+// bmi_buffer_palette, bmi_palette_encode, BMI_PALETTE_BLOCK_MAX
+#include "bmi-palette.h"
+
+// memcpy
+#include <string.h>
+
+// The hash is XXH64, so checksums can be checked by other tools
+#define BMI_PRIME64_1 0x9E3779B185EBCA87ULL
+#define BMI_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define BMI_PRIME64_3 0x165667B19E3779F9ULL
+#define BMI_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define BMI_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define BMI_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+// Input is read as little-endian regardless of the host
+static inline uint64_t bmi_read64(const uint8_t* p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16
+           | (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32
+           | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48
+           | (uint64_t)p[7] << 56;
+}
+
+static inline uint32_t bmi_read32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+           | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t bmi_hash_round(uint64_t lane, uint64_t input) {
+    lane += input * BMI_PRIME64_2;
+    lane = BMI_ROTL64(lane, 31);
+    return lane * BMI_PRIME64_1;
+}
+
+static inline uint64_t bmi_hash_merge(uint64_t hash, uint64_t lane) {
+    hash ^= bmi_hash_round(0, lane);
+    return hash * BMI_PRIME64_1 + BMI_PRIME64_4;
+}
+
+// Consumes whole 32-byte stripes, returning the number of bytes used
+static size_t bmi_hash_stripes(uint64_t lanes[4], const uint8_t* data,
+                               size_t size) {
+    uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+    size_t used = 0;
+    for (; used + 32 <= size; used += 32) {
+        v1 = bmi_hash_round(v1, bmi_read64(data + used));
+        v2 = bmi_hash_round(v2, bmi_read64(data + used + 8));
+        v3 = bmi_hash_round(v3, bmi_read64(data + used + 16));
+        v4 = bmi_hash_round(v4, bmi_read64(data + used + 24));
+    }
+    lanes[0] = v1;
+    lanes[1] = v2;
+    lanes[2] = v3;
+    lanes[3] = v4;
+    return used;
+}
+
+void bmi_hash_init(bmi_hash_state* state) {
+    state->lanes[0] = BMI_PRIME64_1 + BMI_PRIME64_2;
+    state->lanes[1] = BMI_PRIME64_2;
+    state->lanes[2] = 0;
+    state->lanes[3] = 0 - BMI_PRIME64_1;
+    state->total = 0;
+    state->pending_size = 0;
+}
+
+void bmi_hash_update(bmi_hash_state* state, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    state->total += size;
+    
+    // Top up a partial stripe left by the previous update first
+    if (state->pending_size != 0) {
+        size_t fill = 32 - state->pending_size;
+        if (fill > size) {
+            fill = size;
+        }
+        memcpy(state->pending + state->pending_size, bytes, fill);
+        state->pending_size += (uint32_t)fill;
+        bytes += fill;
+        size -= fill;
+        if (state->pending_size < 32) {
+            return;
+        }
+        bmi_hash_stripes(state->lanes, state->pending, 32);
+        state->pending_size = 0;
+    }
+    
+    const size_t used = bmi_hash_stripes(state->lanes, bytes, size);
+    memcpy(state->pending, bytes + used, size - used);
+    state->pending_size = (uint32_t)(size - used);
+}
+
+uint64_t bmi_hash_digest(const bmi_hash_state* state) {
+    uint64_t hash;
+    if (state->total >= 32) {
+        const uint64_t* v = state->lanes;
+        hash = BMI_ROTL64(v[0], 1) + BMI_ROTL64(v[1], 7)
+               + BMI_ROTL64(v[2], 12) + BMI_ROTL64(v[3], 18);
+        hash = bmi_hash_merge(hash, v[0]);
+        hash = bmi_hash_merge(hash, v[1]);
+        hash = bmi_hash_merge(hash, v[2]);
+        hash = bmi_hash_merge(hash, v[3]);
+    } else {
+        hash = state->lanes[2] + BMI_PRIME64_5;
+    }
+    hash += state->total;
+    
+    const uint8_t* p = state->pending;
+    const uint8_t* end = p + state->pending_size;
+    for (; p + 8 <= end; p += 8) {
+        hash ^= bmi_hash_round(0, bmi_read64(p));
+        hash = BMI_ROTL64(hash, 27) * BMI_PRIME64_1 + BMI_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)bmi_read32(p) * BMI_PRIME64_1;
+        hash = BMI_ROTL64(hash, 23) * BMI_PRIME64_2 + BMI_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= *p * BMI_PRIME64_5;
+        hash = BMI_ROTL64(hash, 11) * BMI_PRIME64_1;
+    }
+    
+    hash ^= hash >> 33;
+    hash *= BMI_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= BMI_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t bmi_buffer_hash(const bmi_buffer* buffer) {
+    // Pixels are hashed in row-major order, so the hash is independent of the
+    // layout
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    const uint64_t total = (uint64_t)buffer->width * buffer->height;
+    bmi_hash_state state;
+    bmi_hash_init(&state);
+    
+    // Palettes are hashed first, as they come first in files
+    if (buffer->flags & BMI_FL_IS_PALETTE) {
+        uint8_t block[BMI_PALETTE_BLOCK_MAX];
+        bmi_hash_update(&state, block,
+                        bmi_palette_encode(bmi_buffer_palette(buffer), block));
+    }
+    for (uint64_t position = 0; position < total;) {
+        const uint8_t* segment;
+        const size_t count = bmi_kernel_segment(buffer, kernels, position,
+                                                SIZE_MAX, &segment);
+        bmi_hash_update(&state, segment, count * kernels->size);
+        position += count;
+    }
+    return bmi_hash_digest(&state);
+}
@@ -0,0 +1,209 @@
+// src: bmi-kernel.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+// bmi_kernels, BMI_KERNEL_SLOT, BMI_KERNEL_ADDRESS, BMI_KERNEL_RUN
+#include "bmi-kernel.h"
+
+// BMI_SHARED_PREPARE
+#include "bmi-shared.h"
+
+// memset, memcpy
+#include <string.h>
+
+#define BMI_GRAY_WRITE(dst, p) \
+    (dst)[0] = (uint8_t)BMI_GRY_V(p)
+#define BMI_GRAY_READ(src) \
+    BMI_GRY((src)[0])
+
+#define BMI_RGB_WRITE(dst, p) \
+    (dst)[0] = (uint8_t)BMI_RGB_R(p); \
+    (dst)[1] = (uint8_t)BMI_RGB_G(p); \
+    (dst)[2] = (uint8_t)BMI_RGB_B(p)
+#define BMI_RGB_READ(src) \
+    BMI_RGB((bmi_pixel)(src)[0], (bmi_pixel)(src)[1], (bmi_pixel)(src)[2])
+
+// Generates the kernel set for a format given its pixel size and the statements
+// writing and reading one pixel. Since the size is a constant, every address
+// computation and the span fill below are specialized by the compiler.
+#define BMI_DEFINE_KERNELS(name, SIZE, WRITE, READ) \
+    static void bmi_##name##_point(uint8_t* dst, bmi_pixel pixel) { \
+        WRITE(dst, pixel); \
+    } \
+    static void bmi_##name##_span(uint8_t* dst, size_t count, \
+                                  bmi_pixel pixel) { \
+        if (count == 0) { \
+            return; \
+        } \
+        if ((SIZE) == 1) { \
+            memset(dst, (uint8_t)pixel, count); \
+            return; \
+        } \
+        /* Write one pixel and then keep doubling the written prefix, so */ \
+        /* multi-byte pixels still fill with a handful of large copies */ \
+        WRITE(dst, pixel); \
+        const size_t total = count * (SIZE); \
+        size_t filled = (SIZE); \
+        while (filled < total) { \
+            const size_t next = filled < total - filled \
+                ? filled : total - filled; \
+            memcpy(dst + filled, dst, next); \
+            filled += next; \
+        } \
+    } \
+    static void bmi_##name##_blit(uint8_t* dst, const uint8_t* src, \
+                                  size_t count) { \
+        memcpy(dst, src, count * (SIZE)); \
+    } \
+    static bmi_pixel bmi_##name##_read(const uint8_t* src) { \
+        return READ(src); \
+    } \
+    static void bmi_##name##_load(bmi_pixel* dst, const uint8_t* src, \
+                                  size_t count) { \
+        for (size_t i = 0; i < count; i++) { \
+            dst[i] = READ(src + i * (SIZE)); \
+        } \
+    } \
+    static void bmi_##name##_store(uint8_t* dst, const bmi_pixel* src, \
+                                   size_t count) { \
+        for (size_t i = 0; i < count; i++) { \
+            WRITE(dst + i * (SIZE), src[i]); \
+        } \
+    }
+
+#define BMI_KERNELS(name, SIZE) { \
+    .size = (SIZE), \
+    .point = bmi_##name##_point, \
+    .span = bmi_##name##_span, \
+    .blit = bmi_##name##_blit, \
+    .read = bmi_##name##_read, \
+    .load = bmi_##name##_load, \
+    .store = bmi_##name##_store \
+}
+
+BMI_DEFINE_KERNELS(rgb, 3, BMI_RGB_WRITE, BMI_RGB_READ)
+BMI_DEFINE_KERNELS(gray, 1, BMI_GRAY_WRITE, BMI_GRAY_READ)
+
+// Indices into a palette are stored just like gray levels
+BMI_DEFINE_KERNELS(index, 1, BMI_GRAY_WRITE, BMI_GRAY_READ)
+
+const bmi_kernels bmi_kernel_table[BMI_KERNEL_SLOTS] = {
+    [0] = BMI_KERNELS(rgb, 3),
+    [BMI_KERNEL_SLOT(BMI_FL_IS_GRAYSCALE)] = BMI_KERNELS(gray, 1),
+    [BMI_KERNEL_SLOT(BMI_FL_IS_PALETTE)] = BMI_KERNELS(index, 1)
+};
+
+int bmi_kernel_span(bmi_buffer* buffer, const bmi_kernels* kernels,
+                    uint32_t x, uint32_t y, size_t count, bmi_pixel pixel) {
+    if (!BMI_SHARED_PREPARE(buffer, x, y, (uint32_t)count, 1)) {
+        return BMI_FAILURE;
+    }
+    while (count > 0) {
+        const size_t run = BMI_KERNEL_RUN(buffer, x, count);
+        kernels->span(BMI_KERNEL_ADDRESS(buffer, kernels, x, y), run, pixel);
+        x += (uint32_t)run;
+        count -= run;
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_kernel_fill(bmi_buffer* buffer, const bmi_kernels* kernels,
+                    uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                    bmi_pixel pixel) {
+    if (!BMI_SHARED_PREPARE(buffer, x, y, width, height)) {
+        return BMI_FAILURE;
+    }
+    if (!(buffer->flags & BMI_FL_IS_TILED)) {
+        // Rows as wide as the buffer follow on from each other
+        if (x == 0 && width == buffer->width) {
+            kernels->span(BMI_KERNEL_ADDRESS(buffer, kernels, 0, y),
+                          (size_t)width * height, pixel);
+            return BMI_SUCCESS;
+        }
+        for (uint32_t row = y; row < y + height; row++) {
+            kernels->span(BMI_KERNEL_ADDRESS(buffer, kernels, x, row), width,
+                          pixel);
+        }
+        return BMI_SUCCESS;
+    }
+    
+    // Work through one band of tiles at a time, where the rows of a tile
+    // covered across its whole width follow on from each other
+    for (uint32_t top = y; top < y + height;) {
+        const uint64_t band_end = (uint64_t)(top | BMI_TILE_MASK) + 1;
+        const uint32_t bottom = band_end < (uint64_t)y + height
+            ? (uint32_t)band_end : y + height;
+        for (uint32_t left = x; left < x + width;) {
+            const size_t run = BMI_KERNEL_RUN(buffer, left, x + width - left);
+            if (run == BMI_TILE_SIZE) {
+                kernels->span(BMI_KERNEL_ADDRESS(buffer, kernels, left, top),
+                              run * (bottom - top), pixel);
+            } else {
+                for (uint32_t row = top; row < bottom; row++) {
+                    kernels->span(BMI_KERNEL_ADDRESS(buffer, kernels, left,
+                                                     row),
+                                  run, pixel);
+                }
+            }
+            left += (uint32_t)run;
+        }
+        top = bottom;
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_kernel_blit(bmi_buffer* buffer, const bmi_kernels* kernels,
+                    uint32_t x, uint32_t y, const uint8_t* src, size_t count) {
+    if (!BMI_SHARED_PREPARE(buffer, x, y, (uint32_t)count, 1)) {
+        return BMI_FAILURE;
+    }
+    while (count > 0) {
+        const size_t run = BMI_KERNEL_RUN(buffer, x, count);
+        kernels->blit(BMI_KERNEL_ADDRESS(buffer, kernels, x, y), src, run);
+        src += run * kernels->size;
+        x += (uint32_t)run;
+        count -= run;
+    }
+    return BMI_SUCCESS;
+}
+
+void bmi_kernel_gather(const bmi_buffer* buffer, const bmi_kernels* kernels,
+                       uint32_t x, uint32_t y, uint8_t* dst, size_t count) {
+    while (count > 0) {
+        const size_t run = BMI_KERNEL_RUN(buffer, x, count);
+        kernels->blit(dst, BMI_KERNEL_ADDRESS(buffer, kernels, x, y), run);
+        dst += run * kernels->size;
+        x += (uint32_t)run;
+        count -= run;
+    }
+}
+
+size_t bmi_kernel_segment(const bmi_buffer* buffer, const bmi_kernels* kernels,
+                          uint64_t position, size_t limit,
+                          const uint8_t** address) {
+    if (!(buffer->flags & BMI_FL_IS_TILED)) {
+        // Row-major contents are contiguous to the end
+        const uint64_t total = (uint64_t)buffer->width * buffer->height;
+        *address = buffer->contents + position * kernels->size;
+        return total - position < limit ? (size_t)(total - position) : limit;
+    }
+    const uint32_t x = (uint32_t)(position % buffer->width);
+    const uint32_t y = (uint32_t)(position / buffer->width);
+    const size_t rest = buffer->width - x < limit ? buffer->width - x : limit;
+    *address = BMI_KERNEL_ADDRESS(buffer, kernels, x, y);
+    return BMI_KERNEL_RUN(buffer, x, rest);
+}
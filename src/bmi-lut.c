@@ -0,0 +1,346 @@
+// src: bmi-lut.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-lut.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_content_size, BMI_COMPONENT_SIZE_FROM_FL
+#include "bmi-file.h"
+
+// bmi_clip_rect
+#include "bmi-geometry.h"
+
+// bmi_buffer_kernels, BMI_KERNEL_ADDRESS, BMI_KERNEL_RUN, BMI_KERNEL_CHUNK
+#include "bmi-kernel.h"
+
+// BMI_SHARED_PREPARE
+#include "bmi-shared.h"
+
+// bmi_buffer_palette, bmi_buffer_get_palette, bmi_buffer_set_palette,
+// bmi_palette_map, BMI_PALETTE_CAPACITY
+#include "bmi-palette.h"
+
+// bmi_parallel_for, bmi_parallel_parts
+#include "bmi-parallel.h"
+
+// memcmp
+#include <string.h>
+
+// pow, sqrt, isfinite
+#include <math.h>
+
+// Each thread transforms parts of at least this many pixels
+#define BMI_LUT_GRAIN (1u << 16)
+
+typedef struct {
+    bmi_buffer* buffer;
+    const bmi_lut* lut;
+    bmi_rect region;
+    size_t size;
+    uint32_t parts;
+    
+    // Whether every channel has the same table, so that the bytes of RGB
+    // pixels can be looked up without regard to their channel
+    int uniform;
+} bmi_lut_job;
+
+// Looks up count pixels of the given size in place, eight bytes or four
+// pixels at a time to keep the independent loads in flight
+static void bmi_lut_span(uint8_t* data, size_t count, size_t size,
+                         const bmi_lut* lut, int uniform) {
+    if (size == 1 || uniform) {
+        const uint8_t* table = lut->tables[0];
+        const size_t total = count * size;
+        size_t i = 0;
+        for (; i + 8 <= total; i += 8) {
+            data[i] = table[data[i]];
+            data[i + 1] = table[data[i + 1]];
+            data[i + 2] = table[data[i + 2]];
+            data[i + 3] = table[data[i + 3]];
+            data[i + 4] = table[data[i + 4]];
+            data[i + 5] = table[data[i + 5]];
+            data[i + 6] = table[data[i + 6]];
+            data[i + 7] = table[data[i + 7]];
+        }
+        for (; i < total; i++) {
+            data[i] = table[data[i]];
+        }
+        return;
+    }
+    const uint8_t* red = lut->tables[0];
+    const uint8_t* green = lut->tables[1];
+    const uint8_t* blue = lut->tables[2];
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint8_t* p = data + 3 * i;
+        p[0] = red[p[0]];
+        p[1] = green[p[1]];
+        p[2] = blue[p[2]];
+        p[3] = red[p[3]];
+        p[4] = green[p[4]];
+        p[5] = blue[p[5]];
+        p[6] = red[p[6]];
+        p[7] = green[p[7]];
+        p[8] = blue[p[8]];
+        p[9] = red[p[9]];
+        p[10] = green[p[10]];
+        p[11] = blue[p[11]];
+    }
+    for (; i < count; i++) {
+        uint8_t* p = data + 3 * i;
+        p[0] = red[p[0]];
+        p[1] = green[p[1]];
+        p[2] = blue[p[2]];
+    }
+}
+
+// Transforms a share of the whole contents, padding included, which lie in
+// one piece whatever the layout
+static void bmi_lut_whole_part(void* context, uint32_t index) {
+    const bmi_lut_job* job = context;
+    const size_t total = bmi_buffer_content_size(job->buffer) / job->size;
+    const size_t first = (size_t)((uint64_t)total * index / job->parts);
+    const size_t last = (size_t)((uint64_t)total * (index + 1) / job->parts);
+    bmi_lut_span(job->buffer->contents + first * job->size, last - first,
+                 job->size, job->lut, job->uniform);
+}
+
+// Transforms a band of rows of the region, in runs contiguous in memory
+static void bmi_lut_rect_part(void* context, uint32_t index) {
+    const bmi_lut_job* job = context;
+    bmi_buffer* buffer = job->buffer;
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    const bmi_rect region = job->region;
+    const uint32_t first = region.y + (uint32_t)((uint64_t)region.height
+                                                 * index / job->parts);
+    const uint32_t last = region.y + (uint32_t)((uint64_t)region.height
+                                                * (index + 1) / job->parts);
+    bmi_palette* palette = (buffer->flags & BMI_FL_IS_PALETTE)
+        ? bmi_buffer_palette(buffer) : NULL;
+    
+    // Palette pixels go through their colors and back to the nearest index
+    bmi_pixel pixels[BMI_KERNEL_CHUNK];
+    uint8_t rgb[3 * BMI_KERNEL_CHUNK];
+    for (uint32_t y = first; y < last; y++) {
+        for (uint32_t x = region.x; x < region.x + region.width;) {
+            size_t length = BMI_KERNEL_RUN(buffer, x,
+                                           region.x + region.width - x);
+            uint8_t* data = BMI_KERNEL_ADDRESS(buffer, kernels, x, y);
+            if (palette == NULL) {
+                bmi_lut_span(data, length, job->size, job->lut, job->uniform);
+            } else {
+                if (length > BMI_KERNEL_CHUNK) {
+                    length = BMI_KERNEL_CHUNK;
+                }
+                for (size_t i = 0; i < length; i++) {
+                    const bmi_pixel color = palette->colors[data[i]];
+                    rgb[3 * i] = (uint8_t)BMI_RGB_R(color);
+                    rgb[3 * i + 1] = (uint8_t)BMI_RGB_G(color);
+                    rgb[3 * i + 2] = (uint8_t)BMI_RGB_B(color);
+                }
+                bmi_lut_span(rgb, length, 3, job->lut, job->uniform);
+                for (size_t i = 0; i < length; i++) {
+                    pixels[i] = BMI_RGB((bmi_pixel)rgb[3 * i],
+                                        (bmi_pixel)rgb[3 * i + 1],
+                                        (bmi_pixel)rgb[3 * i + 2]);
+                }
+                bmi_palette_map(palette, pixels, length);
+                kernels->store(data, pixels, length);
+            }
+            x += (uint32_t)length;
+        }
+    }
+}
+
+static void bmi_lut_job_init(bmi_lut_job* job, bmi_buffer* buffer,
+                             const bmi_lut* lut) {
+    job->buffer = buffer;
+    job->lut = lut;
+    job->size = BMI_COMPONENT_SIZE_FROM_FL(buffer->flags);
+    job->uniform = !memcmp(lut->tables[0], lut->tables[1], 256)
+                   && !memcmp(lut->tables[0], lut->tables[2], 256);
+}
+
+int bmi_buffer_apply_lut(bmi_buffer* buffer, const bmi_lut* lut) {
+    // The colors of a palette are transformed exactly, which its pixels then
+    // take on
+    if (buffer->flags & BMI_FL_IS_PALETTE) {
+        bmi_pixel colors[BMI_PALETTE_CAPACITY];
+        const uint32_t count = bmi_buffer_get_palette(buffer, colors);
+        uint8_t rgb[3 * BMI_PALETTE_CAPACITY];
+        for (uint32_t i = 0; i < count; i++) {
+            rgb[3 * i] = (uint8_t)BMI_RGB_R(colors[i]);
+            rgb[3 * i + 1] = (uint8_t)BMI_RGB_G(colors[i]);
+            rgb[3 * i + 2] = (uint8_t)BMI_RGB_B(colors[i]);
+        }
+        bmi_lut_span(rgb, count, 3, lut, 0);
+        for (uint32_t i = 0; i < count; i++) {
+            colors[i] = BMI_RGB((bmi_pixel)rgb[3 * i],
+                                (bmi_pixel)rgb[3 * i + 1],
+                                (bmi_pixel)rgb[3 * i + 2]);
+        }
+        return bmi_buffer_set_palette(buffer, colors, count);
+    }
+    if (!BMI_SHARED_PREPARE(buffer, 0, 0, buffer->width, buffer->height)) {
+        bmi_set_error("bmi_buffer_apply_lut: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    bmi_lut_job job;
+    bmi_lut_job_init(&job, buffer, lut);
+    job.parts = bmi_parallel_parts(bmi_buffer_content_size(buffer) / job.size,
+                                   BMI_LUT_GRAIN);
+    bmi_parallel_for(job.parts, bmi_lut_whole_part, &job);
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_apply_lut_rect(bmi_buffer* buffer, bmi_rect region,
+                              const bmi_lut* lut) {
+    // Clip the rectangle to prevent out-of-bounds drawing
+    bmi_clip_rect(&region, BMI_RECT(0, 0, buffer->width, buffer->height));
+    if (region.width == 0 || region.height == 0) {
+        return BMI_SUCCESS;
+    }
+    if (!BMI_SHARED_PREPARE(buffer, region.x, region.y, region.width,
+                            region.height)) {
+        bmi_set_error("bmi_buffer_apply_lut_rect: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    bmi_lut_job job;
+    bmi_lut_job_init(&job, buffer, lut);
+    job.region = region;
+    job.parts = bmi_parallel_parts((uint64_t)region.width * region.height,
+                                   BMI_LUT_GRAIN);
+    if (job.parts > region.height) {
+        job.parts = region.height;
+    }
+    bmi_parallel_for(job.parts, bmi_lut_rect_part, &job);
+    return BMI_SUCCESS;
+}
+
+// Rounds a level to the nearest value, clamped to those a channel holds
+static uint8_t bmi_lut_round(double level) {
+    if (!(level > 0)) {
+        return 0;
+    }
+    return level >= 255 ? 255 : (uint8_t)(level + 0.5);
+}
+
+int bmi_lut_gamma(uint8_t* table, double gamma) {
+    if (!(gamma > 0) || !isfinite(gamma)) {
+        bmi_set_error("bmi_lut_gamma: Gamma must be positive and finite");
+        return BMI_FAILURE;
+    }
+    for (int i = 0; i < 256; i++) {
+        table[i] = bmi_lut_round(255 * pow(i / 255.0, 1 / gamma));
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_lut_levels(uint8_t* table, uint8_t in_low, uint8_t in_high,
+                   double gamma, uint8_t out_low, uint8_t out_high) {
+    if (in_low >= in_high) {
+        bmi_set_error("bmi_lut_levels: The input range must not be empty");
+        return BMI_FAILURE;
+    }
+    if (!(gamma > 0) || !isfinite(gamma)) {
+        bmi_set_error("bmi_lut_levels: Gamma must be positive and finite");
+        return BMI_FAILURE;
+    }
+    for (int i = 0; i < 256; i++) {
+        double level = (double)(i - in_low) / (in_high - in_low);
+        level = level < 0 ? 0 : level > 1 ? 1 : level;
+        level = pow(level, 1 / gamma);
+        table[i] = bmi_lut_round(out_low + level * (out_high - out_low));
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_lut_curve(uint8_t* table, const bmi_point* points, size_t count) {
+    if (count == 0) {
+        bmi_set_error("bmi_lut_curve: Curves need at least one point");
+        return BMI_FAILURE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (points[i].x > 255 || points[i].y > 255
+            || (i > 0 && points[i].x <= points[i - 1].x)) {
+            bmi_set_error("bmi_lut_curve: Points must lie within 0 to 255 "
+                          "and increase in x");
+            return BMI_FAILURE;
+        }
+    }
+    
+    // Monotone cubic interpolation: each point's tangent starts as the mean
+    // of the slopes beside it, and is then limited wherever it would make the
+    // curve overshoot (Fritsch and Carlson)
+    double slopes[256];
+    double tangents[256];
+    for (size_t i = 0; i + 1 < count; i++) {
+        slopes[i] = ((double)points[i + 1].y - points[i].y)
+                    / (points[i + 1].x - points[i].x);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || i + 1 == count) {
+            tangents[i] = count == 1 ? 0 : slopes[i == 0 ? 0 : i - 1];
+        } else if (slopes[i - 1] * slopes[i] <= 0) {
+            tangents[i] = 0;
+        } else {
+            tangents[i] = (slopes[i - 1] + slopes[i]) / 2;
+        }
+    }
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (slopes[i] == 0) {
+            tangents[i] = tangents[i + 1] = 0;
+            continue;
+        }
+        const double a = tangents[i] / slopes[i];
+        const double b = tangents[i + 1] / slopes[i];
+        const double length = a * a + b * b;
+        if (length > 9) {
+            const double scale = 3 / sqrt(length);
+            tangents[i] = scale * a * slopes[i];
+            tangents[i + 1] = scale * b * slopes[i];
+        }
+    }
+    
+    size_t segment = 0;
+    for (uint32_t x = 0; x < 256; x++) {
+        if (x <= points[0].x) {
+            table[x] = (uint8_t)points[0].y;
+            continue;
+        }
+        if (x >= points[count - 1].x) {
+            table[x] = (uint8_t)points[count - 1].y;
+            continue;
+        }
+        while (x > points[segment + 1].x) {
+            segment++;
+        }
+        const double width = points[segment + 1].x - points[segment].x;
+        const double t = (x - points[segment].x) / width;
+        const double t2 = t * t;
+        const double t3 = t2 * t;
+        table[x] = bmi_lut_round(
+            (2 * t3 - 3 * t2 + 1) * points[segment].y
+            + (t3 - 2 * t2 + t) * width * tangents[segment]
+            + (-2 * t3 + 3 * t2) * points[segment + 1].y
+            + (t3 - t2) * width * tangents[segment + 1]);
+    }
+    return BMI_SUCCESS;
+}
@@ -0,0 +1,321 @@
+// src: bmi-mask.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-mask.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_new
+#include "bmi-util.h"
+
+// bmi_buffer_kernels, bmi_kernel_span, bmi_kernel_fill, BMI_KERNEL_ADDRESS,
+// BMI_KERNEL_RUN, BMI_KERNEL_CHUNK
+#include "bmi-kernel.h"
+
+// bmi_buffer_palette
+#include "bmi-palette.h"
+
+// bmi_parallel_for, bmi_parallel_parts
+#include "bmi-parallel.h"
+
+// calloc, free
+#include <stdlib.h>
+
+// memset
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Each thread reads parts of at least this many pixels into a mask
+#define BMI_MASK_GRAIN (1u << 16)
+
+// The bits of a row's last word that lie within the width, or all of them
+// when the width fills the word
+#define BMI_MASK_TAIL(width) \
+    (((width) & 63) ? ((uint64_t)1 << ((width) & 63)) - 1 : ~(uint64_t)0)
+
+// The number of words in a whole mask
+#define BMI_MASK_WORDS(mask) \
+    (BMI_MASK_STRIDE((mask)->width) * (mask)->height)
+
+bmi_mask* bmi_mask_new(uint32_t width, uint32_t height) {
+    const size_t stride = BMI_MASK_STRIDE(width);
+    if (height != 0 && stride > (SIZE_MAX - sizeof(bmi_mask))
+                                / sizeof(uint64_t) / height) {
+        bmi_set_error("bmi_mask_new: Mask is too large");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_mask* mask = calloc(1, sizeof(bmi_mask)
+                            + stride * height * sizeof(uint64_t));
+    if (mask == NULL) {
+        bmi_set_error("bmi_mask_new: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    mask->width = width;
+    mask->height = height;
+    return mask;
+}
+
+void bmi_mask_free(bmi_mask* mask) {
+    free(mask);
+}
+
+typedef struct {
+    const bmi_buffer* buffer;
+    bmi_mask* mask;
+    uint32_t parts;
+    uint8_t threshold;
+} bmi_mask_job;
+
+static void bmi_mask_part(void* context, uint32_t index) {
+    const bmi_mask_job* job = context;
+    const bmi_buffer* buffer = job->buffer;
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    const bmi_pixel* colors = (buffer->flags & BMI_FL_IS_PALETTE)
+        ? bmi_buffer_palette(buffer)->colors : NULL;
+    const int gray = (buffer->flags & BMI_FL_IS_GRAYSCALE) != 0;
+    const uint32_t first = (uint32_t)((uint64_t)buffer->height * index
+                                      / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)buffer->height * (index + 1)
+                                     / job->parts);
+    
+    // Rows start on whole words, so parts never write to the same word
+    bmi_pixel pixels[BMI_KERNEL_CHUNK];
+    for (uint32_t y = first; y < last; y++) {
+        uint64_t* row = bmi_mask_row(job->mask, y);
+        for (uint32_t x = 0; x < buffer->width;) {
+            size_t length = BMI_KERNEL_RUN(buffer, x, buffer->width - x);
+            if (length > BMI_KERNEL_CHUNK) {
+                length = BMI_KERNEL_CHUNK;
+            }
+            kernels->load(pixels, BMI_KERNEL_ADDRESS(buffer, kernels, x, y),
+                          length);
+            for (size_t i = 0; i < length; i++) {
+                const bmi_pixel color = colors ? colors[pixels[i]] : pixels[i];
+                const uint32_t level = gray ? BMI_RGB_R(color)
+                    : (77 * BMI_RGB_R(color) + 150 * BMI_RGB_G(color)
+                       + 29 * BMI_RGB_B(color) + 128) >> 8;
+                const size_t bit = x + i;
+                row[bit >> 6] |= (uint64_t)(level >= job->threshold)
+                                 << (bit & 63);
+            }
+            x += (uint32_t)length;
+        }
+    }
+}
+
+bmi_mask* bmi_mask_from_buffer(const bmi_buffer* buffer, uint8_t threshold) {
+    bmi_mask* mask = bmi_mask_new(buffer->width, buffer->height);
+    if (mask == NULL) {
+        bmi_set_error("bmi_mask_from_buffer: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_mask_job job = {
+        .buffer = buffer,
+        .mask = mask,
+        .threshold = threshold
+    };
+    job.parts = bmi_parallel_parts((uint64_t)buffer->width * buffer->height,
+                                   BMI_MASK_GRAIN);
+    if (job.parts > buffer->height) {
+        job.parts = buffer->height ? buffer->height : 1;
+    }
+    bmi_parallel_for(job.parts, bmi_mask_part, &job);
+    return mask;
+}
+
+bmi_buffer* bmi_mask_to_buffer(const bmi_mask* mask) {
+    bmi_buffer* buffer = bmi_buffer_new(mask->width, mask->height,
+                                        BMI_FL_IS_GRAYSCALE);
+    if (buffer == NULL) {
+        bmi_set_error("bmi_mask_to_buffer: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    bmi_kernel_fill(buffer, kernels, 0, 0, mask->width, mask->height,
+                    BMI_RGB_BLACK());
+    for (uint32_t y = 0; y < mask->height; y++) {
+        const uint64_t* row = bmi_mask_row(mask, y);
+        uint32_t x = 0;
+        uint32_t start;
+        size_t length;
+        while ((length = bmi_mask_next_run(row, x, mask->width, &start))
+               != 0) {
+            bmi_kernel_span(buffer, kernels, start, y, length,
+                            BMI_RGB_WHITE());
+            x = start + (uint32_t)length;
+        }
+    }
+    return buffer;
+}
+
+int bmi_mask_get(const bmi_mask* mask, bmi_point point) {
+    if (point.x >= mask->width || point.y >= mask->height) {
+        return 0;
+    }
+    return (int)(bmi_mask_row(mask, point.y)[point.x >> 6] >> (point.x & 63)
+                 & 1);
+}
+
+void bmi_mask_set_rect(bmi_mask* mask, bmi_rect bounds, int value) {
+    bmi_clip_rect(&bounds, BMI_RECT(0, 0, mask->width, mask->height));
+    if (bounds.width == 0 || bounds.height == 0) {
+        return;
+    }
+    
+    // Only the words at either end of a row are partly covered
+    const size_t first = bounds.x >> 6;
+    const size_t last = (bounds.x + bounds.width - 1) >> 6;
+    uint64_t head = ~(uint64_t)0 << (bounds.x & 63);
+    const uint64_t tail = ~(uint64_t)0
+                          >> (63 - ((bounds.x + bounds.width - 1) & 63));
+    if (first == last) {
+        head &= tail;
+    }
+    for (uint32_t y = bounds.y; y < bounds.y + bounds.height; y++) {
+        uint64_t* row = bmi_mask_row(mask, y);
+        if (value) {
+            row[first] |= head;
+        } else {
+            row[first] &= ~head;
+        }
+        if (first == last) {
+            continue;
+        }
+        if (last > first + 1) {
+            memset(row + first + 1, value ? 0xFF : 0,
+                   (last - first - 1) * sizeof(uint64_t));
+        }
+        if (value) {
+            row[last] |= tail;
+        } else {
+            row[last] &= ~tail;
+        }
+    }
+}
+
+// Defines a boolean operation combining a mask into another, two words at a
+// time where SSE2 is available. Both masks have their padding clear, so the
+// result does too.
+#ifdef __SSE2__
+#define BMI_MASK_VECTOR(sse_op, dst, src, i, count) \
+    for (; i + 2 <= count; i += 2) { \
+        _mm_storeu_si128((__m128i*)(dst + i), \
+                         sse_op(_mm_loadu_si128((const __m128i*)(dst + i)), \
+                                _mm_loadu_si128((const __m128i*)(src + i)))); \
+    }
+#else
+#define BMI_MASK_VECTOR(sse_op, dst, src, i, count)
+#endif
+
+#define BMI_DEFINE_MASK_OP(name, sse_op, op) \
+    int bmi_mask_##name(bmi_mask* dst, const bmi_mask* src) { \
+        if (dst->width != src->width || dst->height != src->height) { \
+            bmi_set_error("bmi_mask_" #name ": Masks differ in size"); \
+            return BMI_FAILURE; \
+        } \
+        uint64_t* a = dst->words; \
+        const uint64_t* b = src->words; \
+        const size_t count = BMI_MASK_WORDS(dst); \
+        size_t i = 0; \
+        BMI_MASK_VECTOR(sse_op, a, b, i, count) \
+        for (; i < count; i++) { \
+            a[i] = a[i] op b[i]; \
+        } \
+        return BMI_SUCCESS; \
+    }
+
+BMI_DEFINE_MASK_OP(and, _mm_and_si128, &)
+BMI_DEFINE_MASK_OP(or, _mm_or_si128, |)
+BMI_DEFINE_MASK_OP(xor, _mm_xor_si128, ^)
+
+void bmi_mask_not(bmi_mask* mask) {
+    const size_t stride = BMI_MASK_STRIDE(mask->width);
+    const uint64_t tail = BMI_MASK_TAIL(mask->width);
+    if (stride == 0) {
+        return;
+    }
+    
+    // Flip whole rows, then clear the padding flipped on at the end of each
+    for (uint32_t y = 0; y < mask->height; y++) {
+        uint64_t* row = bmi_mask_row(mask, y);
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128i ones = _mm_set1_epi32(-1);
+        for (; i + 2 <= stride; i += 2) {
+            _mm_storeu_si128((__m128i*)(row + i),
+                             _mm_xor_si128(_mm_loadu_si128(
+                                 (const __m128i*)(row + i)), ones));
+        }
+#endif
+        for (; i < stride; i++) {
+            row[i] = ~row[i];
+        }
+        row[stride - 1] &= tail;
+    }
+}
+
+uint64_t bmi_mask_count(const bmi_mask* mask) {
+    // Four counters keep the population counts independent of each other
+    const size_t count = BMI_MASK_WORDS(mask);
+    const uint64_t* words = mask->words;
+    uint64_t sums[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        sums[0] += (uint64_t)__builtin_popcountll(words[i]);
+        sums[1] += (uint64_t)__builtin_popcountll(words[i + 1]);
+        sums[2] += (uint64_t)__builtin_popcountll(words[i + 2]);
+        sums[3] += (uint64_t)__builtin_popcountll(words[i + 3]);
+    }
+    for (; i < count; i++) {
+        sums[0] += (uint64_t)__builtin_popcountll(words[i]);
+    }
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+size_t bmi_mask_next_run(const uint64_t* row, uint32_t x, uint32_t end,
+                         uint32_t* start) {
+    // Find the first set bit, skipping clear words
+    while (x < end) {
+        const uint64_t word = row[x >> 6] >> (x & 63);
+        if (word != 0) {
+            x += (uint32_t)__builtin_ctzll(word);
+            break;
+        }
+        x = (x | 63) + 1;
+    }
+    if (x >= end) {
+        return 0;
+    }
+    *start = x;
+    
+    // Then the first clear bit after it, skipping set words. Shifting brings
+    // in zeros, which read as set and carry the run on to the next word.
+    while (x < end) {
+        const uint64_t word = ~row[x >> 6] >> (x & 63);
+        if (word != 0) {
+            x += (uint32_t)__builtin_ctzll(word);
+            break;
+        }
+        x = (x | 63) + 1;
+    }
+    return (x < end ? x : end) - *start;
+}
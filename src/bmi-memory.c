@@ -0,0 +1,177 @@
+// src: bmi-memory.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+
+// MAP_ANONYMOUS, MADV_HUGEPAGE
+#define _DEFAULT_SOURCE
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-memory.h"
+
+// BMI_COMPONENT_SIZE_FROM_FL, BMI_TILE_COUNT, BMI_FL_IS_MAPPED
+#include "bmi-file.h"
+
+// bmi_parallel_for, bmi_parallel_parts
+#include "bmi-parallel.h"
+
+// bmi_shared_free
+#include "bmi-shared.h"
+
+// bmi_palette, BMI_PALETTE_OFFSET
+#include "bmi-palette.h"
+
+// free
+#include <stdlib.h>
+
+// mmap, munmap, madvise
+#include <sys/mman.h>
+
+// sysconf
+#include <unistd.h>
+
+// Mappings are rounded to whole huge pages of this size
+#define BMI_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+#define BMI_ROUND_UP(n, to) (((n) + (to) - 1) / (to) * (to))
+
+// Each thread prefaults parts of at least this many bytes
+#define BMI_PREFAULT_GRAIN ((uint64_t)16 << 20)
+
+size_t bmi_buffer_storage_size(uint32_t width, uint32_t height,
+                               uint32_t flags) {
+    uint64_t columns = width;
+    uint64_t rows = height;
+    if (flags & BMI_FL_IS_TILED) {
+        columns = (uint64_t)BMI_TILE_COUNT(width) << BMI_TILE_SHIFT;
+        rows = (uint64_t)BMI_TILE_COUNT(height) << BMI_TILE_SHIFT;
+    }
+    
+    // Both factors fit in 32 bits, so only the final size can overflow, and
+    // palettes follow the pixels
+    const uint64_t component = BMI_COMPONENT_SIZE_FROM_FL(flags);
+    const size_t extra = (flags & BMI_FL_IS_PALETTE)
+        ? sizeof(bmi_palette) + 7 : 0;
+    if (rows != 0 && columns > (SIZE_MAX - sizeof(bmi_buffer) - extra)
+                               / component / rows) {
+        return 0;
+    }
+    if (flags & BMI_FL_IS_PALETTE) {
+        return BMI_PALETTE_OFFSET(width, height, flags) + sizeof(bmi_palette);
+    }
+    return sizeof(bmi_buffer) + (size_t)(columns * rows * component);
+}
+
+void* bmi_map_pages(size_t size) {
+    if (size > SIZE_MAX - 2 * BMI_HUGE_PAGE_SIZE) {
+        return NULL;
+    }
+    const size_t length = BMI_ROUND_UP(size, BMI_HUGE_PAGE_SIZE);
+    
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    // Explicit huge pages only exist when they have been reserved
+    void* pages = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+                       | (21 << MAP_HUGE_SHIFT), -1, 0);
+    if (pages != MAP_FAILED) {
+        return pages;
+    }
+#endif
+    
+    // Otherwise map enough to trim down to a range aligned to a huge page, so
+    // that transparent huge pages can back all of it
+    uint8_t* raw = mmap(NULL, length + BMI_HUGE_PAGE_SIZE,
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    const size_t head = (BMI_HUGE_PAGE_SIZE
+                         - (uintptr_t)raw % BMI_HUGE_PAGE_SIZE)
+                        % BMI_HUGE_PAGE_SIZE;
+    if (head != 0) {
+        munmap(raw, head);
+    }
+    munmap(raw + head + length, BMI_HUGE_PAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+    madvise(raw + head, length, MADV_HUGEPAGE);
+#endif
+    return raw + head;
+}
+
+void bmi_unmap_pages(void* pages, size_t size) {
+    munmap(pages, BMI_ROUND_UP(size, BMI_HUGE_PAGE_SIZE));
+}
+
+void bmi_buffer_free(bmi_buffer* buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    if (buffer->flags & BMI_FL_IS_SHARED) {
+        bmi_shared_free(buffer);
+    } else if (buffer->flags & BMI_FL_IS_MAPPED) {
+        bmi_unmap_pages(buffer, bmi_buffer_storage_size(buffer->width,
+                                                        buffer->height,
+                                                        buffer->flags));
+    } else {
+        free(buffer);
+    }
+}
+
+typedef struct {
+    uint8_t* start;
+    uint8_t* base;
+    size_t pages;
+    size_t page;
+    uint32_t parts;
+} bmi_prefault_job;
+
+static void bmi_prefault_part(void* context, uint32_t index) {
+    const bmi_prefault_job* job = context;
+    const size_t first = (size_t)((uint64_t)job->pages * index / job->parts);
+    const size_t last = (size_t)((uint64_t)job->pages * (index + 1)
+                                 / job->parts);
+    
+    // Rewriting a byte with itself faults the page in for writing without
+    // changing what it holds, and the first page is only touched from where
+    // the buffer begins
+    for (size_t i = first; i < last; i++) {
+        uint8_t* address = job->base + i * job->page;
+        volatile uint8_t* byte = address < job->start ? job->start : address;
+        *byte = *byte;
+    }
+}
+
+void bmi_buffer_prefault(bmi_buffer* buffer) {
+    // The tiles of a shared buffer may be mapped read-only, and are left to be
+    // faulted in by whichever handle uses them
+    if (buffer->flags & BMI_FL_IS_SHARED) {
+        return;
+    }
+    const long page = sysconf(_SC_PAGESIZE);
+    const size_t size = bmi_buffer_storage_size(buffer->width, buffer->height,
+                                                buffer->flags);
+    bmi_prefault_job job = {
+        .start = (uint8_t*)buffer,
+        .page = page > 0 ? (size_t)page : 4096
+    };
+    job.base = job.start - (uintptr_t)job.start % job.page;
+    job.pages = (size_t)(job.start + size - job.base + job.page - 1)
+                / job.page;
+    job.parts = bmi_parallel_parts((uint64_t)job.pages * job.page,
+                                   BMI_PREFAULT_GRAIN);
+    bmi_parallel_for(job.parts, bmi_prefault_part, &job);
+}
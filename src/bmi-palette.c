@@ -0,0 +1,654 @@
+// src: bmi-palette.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-palette.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_new
+#include "bmi-util.h"
+
+// bmi_buffer_free
+#include "bmi-memory.h"
+
+// bmi_buffer_kernels, BMI_KERNEL_ADDRESS, BMI_KERNEL_RUN, BMI_KERNEL_CHUNK
+#include "bmi-kernel.h"
+
+// bmi_parallel_for, bmi_parallel_parts
+#include "bmi-parallel.h"
+
+// calloc, malloc, free, qsort
+#include <stdlib.h>
+
+// memcpy, memset, memcmp
+#include <string.h>
+
+// Keys of colors in caches and sets, which are never zero so that zero marks
+// an empty slot
+#define BMI_COLOR_KEY(color) (((color) & 0xFFFFFF) | (uint32_t)1 << 24)
+#define BMI_COLOR_HASH(color, shift) \
+    ((uint32_t)((color) & 0xFFFFFF) * 0x9E3779B1u >> (32 - (shift)))
+
+// Distinct colors are collected into open addressed sets of this many slots,
+// which stay at most a quarter full
+#define BMI_COLOR_SET_SHIFT 10
+#define BMI_COLOR_SET_SIZE (1 << BMI_COLOR_SET_SHIFT)
+
+// Median cut counts colors in bins of this many bits per channel
+#define BMI_BIN_BITS 5
+#define BMI_BIN_LEVELS (1 << BMI_BIN_BITS)
+#define BMI_BIN_COUNT (1 << (3 * BMI_BIN_BITS))
+#define BMI_BIN_OF(r, g, b) \
+    ((uint32_t)(r) << (2 * BMI_BIN_BITS) | (uint32_t)(g) << BMI_BIN_BITS \
+     | (uint32_t)(b))
+#define BMI_BIN(color) \
+    BMI_BIN_OF(BMI_RGB_R(color) >> (8 - BMI_BIN_BITS), \
+               BMI_RGB_G(color) >> (8 - BMI_BIN_BITS), \
+               BMI_RGB_B(color) >> (8 - BMI_BIN_BITS))
+
+// The level at the center of a bin
+#define BMI_BIN_CENTER(v) ((v) << (8 - BMI_BIN_BITS) | 1 << (7 - BMI_BIN_BITS))
+
+// Each thread quantizes parts of at least this many pixels
+#define BMI_QUANTIZE_GRAIN (1u << 16)
+
+void bmi_palette_init(bmi_palette* palette) {
+    uint32_t i = 0;
+    for (uint32_t r = 0; r < 6; r++) {
+        for (uint32_t g = 0; g < 6; g++) {
+            for (uint32_t b = 0; b < 6; b++) {
+                palette->colors[i++] = BMI_RGB(r * 51, g * 51, b * 51);
+            }
+        }
+    }
+    
+    // The cube already holds black and white, so the grays lie between them
+    for (uint32_t v = 1; i < BMI_PALETTE_CAPACITY; v++) {
+        const uint32_t level = v * 255 / (BMI_PALETTE_CAPACITY - 216 + 1);
+        palette->colors[i++] = BMI_RGB(level, level, level);
+    }
+    palette->count = BMI_PALETTE_CAPACITY;
+    memset(palette->cache, 0, sizeof(palette->cache));
+}
+
+static uint32_t bmi_palette_nearest(const bmi_palette* palette,
+                                    bmi_pixel color) {
+    const int32_t r = (int32_t)BMI_RGB_R(color);
+    const int32_t g = (int32_t)BMI_RGB_G(color);
+    const int32_t b = (int32_t)BMI_RGB_B(color);
+    uint32_t best = 0;
+    uint32_t best_distance = UINT32_MAX;
+    for (uint32_t i = 0; i < palette->count; i++) {
+        const bmi_pixel entry = palette->colors[i];
+        const int32_t dr = (int32_t)BMI_RGB_R(entry) - r;
+        const int32_t dg = (int32_t)BMI_RGB_G(entry) - g;
+        const int32_t db = (int32_t)BMI_RGB_B(entry) - b;
+        const uint32_t distance = (uint32_t)(dr * dr + dg * dg + db * db);
+        if (distance < best_distance) {
+            best = i;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+bmi_pixel bmi_palette_index(bmi_palette* palette, bmi_pixel color) {
+    // Each slot packs the key of a color above its index
+    const uint64_t key = BMI_COLOR_KEY(color);
+    uint64_t* slot = &palette->cache[BMI_COLOR_HASH(color,
+                                                    BMI_PALETTE_CACHE_SHIFT)];
+    const uint64_t entry = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (entry >> 8 == key) {
+        return (bmi_pixel)(entry & 0xFF);
+    }
+    const uint32_t index = bmi_palette_nearest(palette, color);
+    __atomic_store_n(slot, key << 8 | index, __ATOMIC_RELAXED);
+    return index;
+}
+
+void bmi_palette_map(bmi_palette* palette, bmi_pixel* pixels, size_t count) {
+    // Neighboring pixels are often the same color, which skips the cache
+    bmi_pixel last = BMI_PIXEL_INVALID;
+    bmi_pixel index = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (pixels[i] != last) {
+            last = pixels[i];
+            index = bmi_palette_index(palette, last);
+        }
+        pixels[i] = index;
+    }
+}
+
+void bmi_palette_copy(bmi_buffer* dst, const bmi_buffer* src) {
+    if (!(dst->flags & src->flags & BMI_FL_IS_PALETTE)) {
+        return;
+    }
+    bmi_palette* to = bmi_buffer_palette(dst);
+    const bmi_palette* from = bmi_buffer_palette(src);
+    to->count = from->count;
+    memcpy(to->colors, from->colors, sizeof(to->colors));
+    memset(to->cache, 0, sizeof(to->cache));
+}
+
+int bmi_palette_equal(const bmi_buffer* a, const bmi_buffer* b) {
+    const bmi_palette* pa = bmi_buffer_palette(a);
+    const bmi_palette* pb = bmi_buffer_palette(b);
+    return pa->count == pb->count
+        && memcmp(pa->colors, pb->colors, pa->count * sizeof(bmi_pixel)) == 0;
+}
+
+size_t bmi_palette_encode(const bmi_palette* palette, uint8_t* block) {
+    for (int i = 0; i < 4; i++) {
+        block[i] = (uint8_t)(palette->count >> (8 * i));
+    }
+    uint8_t* rgb = block + 4;
+    for (uint32_t i = 0; i < palette->count; i++, rgb += 3) {
+        rgb[0] = (uint8_t)BMI_RGB_R(palette->colors[i]);
+        rgb[1] = (uint8_t)BMI_RGB_G(palette->colors[i]);
+        rgb[2] = (uint8_t)BMI_RGB_B(palette->colors[i]);
+    }
+    return BMI_PALETTE_BLOCK_SIZE(palette->count);
+}
+
+uint32_t bmi_palette_block_count(const uint8_t* block) {
+    const uint32_t count = (uint32_t)block[0] | (uint32_t)block[1] << 8
+        | (uint32_t)block[2] << 16 | (uint32_t)block[3] << 24;
+    return count >= 1 && count <= BMI_PALETTE_CAPACITY ? count : 0;
+}
+
+void bmi_palette_decode(bmi_palette* palette, const uint8_t* block) {
+    // Indices past the count still read the default colors
+    bmi_palette_init(palette);
+    palette->count = bmi_palette_block_count(block);
+    const uint8_t* rgb = block + 4;
+    for (uint32_t i = 0; i < palette->count; i++, rgb += 3) {
+        palette->colors[i] = BMI_RGB((bmi_pixel)rgb[0], (bmi_pixel)rgb[1],
+                                     (bmi_pixel)rgb[2]);
+    }
+}
+
+void bmi_palette_table_init(const bmi_palette* palette,
+                            bmi_palette_table* table) {
+    for (uint32_t i = 0; i < BMI_PALETTE_CAPACITY; i++) {
+        const bmi_pixel color = palette->colors[i];
+        table->rgb[i][0] = (uint8_t)BMI_RGB_R(color);
+        table->rgb[i][1] = (uint8_t)BMI_RGB_G(color);
+        table->rgb[i][2] = (uint8_t)BMI_RGB_B(color);
+        table->rgb[i][3] = 0;
+    }
+}
+
+void bmi_palette_expand(const bmi_palette_table* table, uint8_t* dst,
+                        const uint8_t* src, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    
+    // Every color is copied as four bytes, the last of which the next pixel
+    // overwrites, so the loop is a plain load and store per pixel
+    for (size_t i = 0; i + 1 < count; i++) {
+        memcpy(dst + 3 * i, table->rgb[src[i]], 4);
+    }
+    memcpy(dst + 3 * (count - 1), table->rgb[src[count - 1]], 3);
+}
+
+int bmi_buffer_set_palette(bmi_buffer* buffer, const bmi_pixel* colors,
+                           uint32_t count) {
+    if (!(buffer->flags & BMI_FL_IS_PALETTE)) {
+        bmi_set_error("bmi_buffer_set_palette: Buffer does not have a "
+                      "palette");
+        return BMI_FAILURE;
+    }
+    if (count == 0 || count > BMI_PALETTE_CAPACITY) {
+        bmi_set_error("bmi_buffer_set_palette: Palettes hold between 1 and "
+                      "256 colors");
+        return BMI_FAILURE;
+    }
+    bmi_palette* palette = bmi_buffer_palette(buffer);
+    palette->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        palette->colors[i] = colors[i] & 0xFFFFFF;
+    }
+    memset(palette->cache, 0, sizeof(palette->cache));
+    return BMI_SUCCESS;
+}
+
+uint32_t bmi_buffer_get_palette(const bmi_buffer* buffer, bmi_pixel* colors) {
+    if (!(buffer->flags & BMI_FL_IS_PALETTE)) {
+        return 0;
+    }
+    const bmi_palette* palette = bmi_buffer_palette(buffer);
+    memcpy(colors, palette->colors, palette->count * sizeof(bmi_pixel));
+    return palette->count;
+}
+
+// A set of distinct colors, each given an index once the set is complete
+typedef struct {
+    uint32_t count;
+    uint32_t keys[BMI_COLOR_SET_SIZE];
+    uint8_t indices[BMI_COLOR_SET_SIZE];
+} bmi_color_set;
+
+// Returns the slot holding a color, or the empty slot where it belongs
+static uint32_t bmi_color_set_slot(const bmi_color_set* set, bmi_pixel color) {
+    const uint32_t key = BMI_COLOR_KEY(color);
+    uint32_t slot = BMI_COLOR_HASH(color, BMI_COLOR_SET_SHIFT);
+    while (set->keys[slot] != 0 && set->keys[slot] != key) {
+        slot = (slot + 1) & (BMI_COLOR_SET_SIZE - 1);
+    }
+    return slot;
+}
+
+// Adds a color, returning whether the set still holds at most limit colors
+static int bmi_color_set_add(bmi_color_set* set, bmi_pixel color,
+                             uint32_t limit) {
+    const uint32_t slot = bmi_color_set_slot(set, color);
+    if (set->keys[slot] != 0) {
+        return 1;
+    }
+    if (set->count == limit) {
+        return 0;
+    }
+    set->keys[slot] = BMI_COLOR_KEY(color);
+    set->count++;
+    return 1;
+}
+
+static int bmi_compare_keys(const void* a, const void* b) {
+    const uint32_t x = *(const uint32_t*)a;
+    const uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// A box of color bins, in bins along each channel, that median cut splits
+typedef struct {
+    uint32_t low[3];
+    uint32_t high[3];
+    uint64_t population;
+} bmi_color_box;
+
+// Shrinks a box to the bins in it that hold colors, and counts them
+static void bmi_box_shrink(bmi_color_box* box, const uint64_t* bins) {
+    uint32_t low[3] = { BMI_BIN_LEVELS, BMI_BIN_LEVELS, BMI_BIN_LEVELS };
+    uint32_t high[3] = { 0, 0, 0 };
+    uint64_t population = 0;
+    for (uint32_t r = box->low[0]; r <= box->high[0]; r++) {
+        for (uint32_t g = box->low[1]; g <= box->high[1]; g++) {
+            for (uint32_t b = box->low[2]; b <= box->high[2]; b++) {
+                const uint64_t count = bins[BMI_BIN_OF(r, g, b)];
+                if (count == 0) {
+                    continue;
+                }
+                const uint32_t v[3] = { r, g, b };
+                for (int c = 0; c < 3; c++) {
+                    low[c] = v[c] < low[c] ? v[c] : low[c];
+                    high[c] = v[c] > high[c] ? v[c] : high[c];
+                }
+                population += count;
+            }
+        }
+    }
+    memcpy(box->low, low, sizeof(low));
+    memcpy(box->high, high, sizeof(high));
+    box->population = population;
+}
+
+// Splits a box holding more than one bin at the median of its longest side
+static void bmi_box_split(bmi_color_box* box, bmi_color_box* other,
+                          const uint64_t* bins) {
+    int axis = 0;
+    for (int c = 1; c < 3; c++) {
+        if (box->high[c] - box->low[c] > box->high[axis] - box->low[axis]) {
+            axis = c;
+        }
+    }
+    uint64_t slices[BMI_BIN_LEVELS] = { 0 };
+    for (uint32_t r = box->low[0]; r <= box->high[0]; r++) {
+        for (uint32_t g = box->low[1]; g <= box->high[1]; g++) {
+            for (uint32_t b = box->low[2]; b <= box->high[2]; b++) {
+                const uint32_t v[3] = { r, g, b };
+                slices[v[axis]] += bins[BMI_BIN_OF(r, g, b)];
+            }
+        }
+    }
+    
+    // Both halves keep at least one slice, and so at least one color, since
+    // the box was shrunk to its colors
+    uint32_t cut = box->low[axis];
+    uint64_t below = slices[cut];
+    while (cut + 1 < box->high[axis] && below * 2 < box->population) {
+        below += slices[++cut];
+    }
+    *other = *box;
+    box->high[axis] = cut;
+    other->low[axis] = cut + 1;
+    bmi_box_shrink(box, bins);
+    bmi_box_shrink(other, bins);
+}
+
+// Builds a palette of at most count colors from the histogram of bins
+static void bmi_median_cut(bmi_palette* palette, const uint64_t* bins,
+                           uint32_t count) {
+    bmi_color_box boxes[BMI_PALETTE_CAPACITY];
+    uint32_t total = 1;
+    boxes[0] = (bmi_color_box){
+        { 0, 0, 0 },
+        { BMI_BIN_LEVELS - 1, BMI_BIN_LEVELS - 1, BMI_BIN_LEVELS - 1 },
+        0
+    };
+    bmi_box_shrink(&boxes[0], bins);
+    
+    // Split whichever box weighs most by its population and longest side
+    while (total < count) {
+        uint32_t best = 0;
+        uint64_t best_weight = 0;
+        for (uint32_t i = 0; i < total; i++) {
+            uint32_t side = 0;
+            for (int c = 0; c < 3; c++) {
+                const uint32_t length = boxes[i].high[c] - boxes[i].low[c];
+                side = length > side ? length : side;
+            }
+            const uint64_t weight = boxes[i].population * side;
+            if (weight > best_weight) {
+                best = i;
+                best_weight = weight;
+            }
+        }
+        if (best_weight == 0) {
+            break;
+        }
+        bmi_box_split(&boxes[best], &boxes[total++], bins);
+    }
+    
+    // Each color is the mean of its box
+    for (uint32_t i = 0; i < total; i++) {
+        const bmi_color_box* box = &boxes[i];
+        uint64_t sums[3] = { 0, 0, 0 };
+        for (uint32_t r = box->low[0]; r <= box->high[0]; r++) {
+            for (uint32_t g = box->low[1]; g <= box->high[1]; g++) {
+                for (uint32_t b = box->low[2]; b <= box->high[2]; b++) {
+                    const uint64_t n = bins[BMI_BIN_OF(r, g, b)];
+                    sums[0] += n * BMI_BIN_CENTER(r);
+                    sums[1] += n * BMI_BIN_CENTER(g);
+                    sums[2] += n * BMI_BIN_CENTER(b);
+                }
+            }
+        }
+        const uint64_t n = box->population ? box->population : 1;
+        palette->colors[i] = BMI_RGB((bmi_pixel)((sums[0] + n / 2) / n),
+                                     (bmi_pixel)((sums[1] + n / 2) / n),
+                                     (bmi_pixel)((sums[2] + n / 2) / n));
+    }
+    palette->count = total;
+}
+
+typedef struct {
+    const bmi_buffer* src;
+    bmi_buffer* dst;
+    uint32_t parts;
+    uint32_t limit;
+    
+    // Set once some part has seen more colors than fit in the palette
+    int overflow;
+    bmi_color_set* sets;
+    uint64_t* bins;
+    
+    // Maps colors to indices, through the set of every color when they all
+    // fit and otherwise through their bins
+    const bmi_color_set* exact;
+    const uint8_t* bin_indices;
+} bmi_quantize_job;
+
+// Loads the colors of at most count pixels contiguous in the source from the
+// given point, returning how many were loaded. Gray levels and palette indices
+// are expanded to the colors they stand for.
+static size_t bmi_quantize_load(const bmi_buffer* src,
+                                const bmi_kernels* kernels, uint32_t x,
+                                uint32_t y, size_t count, bmi_pixel* pixels) {
+    size_t length = BMI_KERNEL_RUN(src, x, count);
+    if (length > BMI_KERNEL_CHUNK) {
+        length = BMI_KERNEL_CHUNK;
+    }
+    kernels->load(pixels, BMI_KERNEL_ADDRESS(src, kernels, x, y), length);
+    if (src->flags & BMI_FL_IS_PALETTE) {
+        const bmi_palette* palette = bmi_buffer_palette(src);
+        for (size_t i = 0; i < length; i++) {
+            pixels[i] = palette->colors[pixels[i]];
+        }
+    } else if (src->flags & BMI_FL_IS_GRAYSCALE) {
+        for (size_t i = 0; i < length; i++) {
+            pixels[i] = BMI_RGB(pixels[i], pixels[i], pixels[i]);
+        }
+    }
+    return length;
+}
+
+#define BMI_QUANTIZE_ROWS(job, index, first, last) \
+    const uint32_t first = (uint32_t)((uint64_t)(job)->src->height * (index) \
+                                      / (job)->parts); \
+    const uint32_t last = (uint32_t)((uint64_t)(job)->src->height \
+                                     * ((index) + 1) / (job)->parts)
+
+static void bmi_collect_part(void* context, uint32_t index) {
+    bmi_quantize_job* job = context;
+    const bmi_buffer* src = job->src;
+    const bmi_kernels* kernels = bmi_buffer_kernels(src);
+    bmi_color_set* set = &job->sets[index];
+    BMI_QUANTIZE_ROWS(job, index, first, last);
+    bmi_pixel pixels[BMI_KERNEL_CHUNK];
+    bmi_pixel previous = BMI_PIXEL_INVALID;
+    for (uint32_t y = first; y < last; y++) {
+        // Stop as soon as any part knows that the colors do not fit
+        if (__atomic_load_n(&job->overflow, __ATOMIC_RELAXED)) {
+            return;
+        }
+        for (uint32_t x = 0; x < src->width;) {
+            const size_t length = bmi_quantize_load(src, kernels, x, y,
+                                                    src->width - x, pixels);
+            for (size_t i = 0; i < length; i++) {
+                if (pixels[i] == previous) {
+                    continue;
+                }
+                previous = pixels[i];
+                if (!bmi_color_set_add(set, previous, job->limit)) {
+                    __atomic_store_n(&job->overflow, 1, __ATOMIC_RELAXED);
+                    return;
+                }
+            }
+            x += (uint32_t)length;
+        }
+    }
+}
+
+static void bmi_count_part(void* context, uint32_t index) {
+    bmi_quantize_job* job = context;
+    const bmi_buffer* src = job->src;
+    const bmi_kernels* kernels = bmi_buffer_kernels(src);
+    uint64_t* bins = job->bins + (size_t)index * BMI_BIN_COUNT;
+    BMI_QUANTIZE_ROWS(job, index, first, last);
+    bmi_pixel pixels[BMI_KERNEL_CHUNK];
+    for (uint32_t y = first; y < last; y++) {
+        for (uint32_t x = 0; x < src->width;) {
+            const size_t length = bmi_quantize_load(src, kernels, x, y,
+                                                    src->width - x, pixels);
+            for (size_t i = 0; i < length; i++) {
+                bins[BMI_BIN(pixels[i])]++;
+            }
+            x += (uint32_t)length;
+        }
+    }
+}
+
+static void bmi_map_part(void* context, uint32_t index) {
+    bmi_quantize_job* job = context;
+    const bmi_buffer* src = job->src;
+    bmi_buffer* dst = job->dst;
+    const bmi_kernels* src_kernels = bmi_buffer_kernels(src);
+    const bmi_kernels* dst_kernels = bmi_buffer_kernels(dst);
+    BMI_QUANTIZE_ROWS(job, index, first, last);
+    bmi_pixel pixels[BMI_KERNEL_CHUNK];
+    for (uint32_t y = first; y < last; y++) {
+        for (uint32_t x = 0; x < src->width;) {
+            const size_t run = BMI_KERNEL_RUN(dst, x, src->width - x);
+            const size_t length = bmi_quantize_load(src, src_kernels, x, y,
+                                                    run, pixels);
+            bmi_pixel previous = BMI_PIXEL_INVALID;
+            bmi_pixel mapped = 0;
+            for (size_t i = 0; i < length; i++) {
+                if (pixels[i] != previous) {
+                    previous = pixels[i];
+                    mapped = job->exact != NULL
+                        ? job->exact->indices[bmi_color_set_slot(job->exact,
+                                                                 previous)]
+                        : job->bin_indices[BMI_BIN(previous)];
+                }
+                pixels[i] = mapped;
+            }
+            dst_kernels->store(BMI_KERNEL_ADDRESS(dst, dst_kernels, x, y),
+                               pixels, length);
+            x += (uint32_t)length;
+        }
+    }
+}
+
+// Gives every color of the merged set an index in ascending order of color,
+// so the palette does not depend on how the work was split
+static void bmi_quantize_exact(bmi_palette* palette, bmi_color_set* set) {
+    uint32_t keys[BMI_PALETTE_CAPACITY];
+    uint32_t count = 0;
+    for (uint32_t slot = 0; slot < BMI_COLOR_SET_SIZE; slot++) {
+        if (set->keys[slot] != 0) {
+            keys[count++] = set->keys[slot];
+        }
+    }
+    qsort(keys, count, sizeof(uint32_t), bmi_compare_keys);
+    for (uint32_t i = 0; i < count; i++) {
+        palette->colors[i] = keys[i] & 0xFFFFFF;
+        set->indices[bmi_color_set_slot(set, keys[i])] = (uint8_t)i;
+    }
+    
+    // Empty buffers still need a color
+    palette->count = count ? count : 1;
+    if (count == 0) {
+        palette->colors[0] = BMI_RGB_BLACK();
+    }
+}
+
+bmi_buffer* bmi_palette_quantize(const bmi_buffer* buffer, uint32_t flags,
+                                 uint32_t count) {
+    bmi_buffer* result = bmi_buffer_new(buffer->width, buffer->height,
+                                        flags | BMI_FL_IS_PALETTE);
+    if (result == NULL) {
+        return NULL;
+    }
+    bmi_palette* palette = bmi_buffer_palette(result);
+    uint32_t parts = bmi_parallel_parts((uint64_t)buffer->width
+                                        * buffer->height, BMI_QUANTIZE_GRAIN);
+    if (parts > buffer->height) {
+        parts = buffer->height ? buffer->height : 1;
+    }
+    bmi_quantize_job job = {
+        .src = buffer,
+        .dst = result,
+        .parts = parts,
+        .limit = count
+    };
+    
+    // Collect the distinct colors of each part, stopping once there are too
+    // many, and then merge them
+    job.sets = calloc(parts, sizeof(bmi_color_set));
+    bmi_color_set* merged = calloc(1, sizeof(bmi_color_set));
+    if (job.sets == NULL || merged == NULL) {
+        free(job.sets);
+        free(merged);
+        bmi_buffer_free(result);
+        return NULL;
+    }
+    bmi_parallel_for(parts, bmi_collect_part, &job);
+    int exact = !job.overflow;
+    for (uint32_t i = 0; exact && i < parts; i++) {
+        for (uint32_t slot = 0; exact && slot < BMI_COLOR_SET_SIZE; slot++) {
+            const uint32_t key = job.sets[i].keys[slot];
+            exact = key == 0 || bmi_color_set_add(merged, key, count);
+        }
+    }
+    free(job.sets);
+    job.sets = NULL;
+    
+    uint8_t* bin_indices = NULL;
+    if (exact) {
+        bmi_quantize_exact(palette, merged);
+        job.exact = merged;
+    } else {
+        // Otherwise count the colors in bins, cut them down to the palette,
+        // and map each bin to its nearest color
+        job.bins = calloc((size_t)parts * BMI_BIN_COUNT, sizeof(uint64_t));
+        bin_indices = malloc(BMI_BIN_COUNT);
+        if (job.bins == NULL || bin_indices == NULL) {
+            free(job.bins);
+            free(bin_indices);
+            free(merged);
+            bmi_buffer_free(result);
+            return NULL;
+        }
+        bmi_parallel_for(parts, bmi_count_part, &job);
+        for (uint32_t i = 1; i < parts; i++) {
+            const uint64_t* part = job.bins + (size_t)i * BMI_BIN_COUNT;
+            for (uint32_t bin = 0; bin < BMI_BIN_COUNT; bin++) {
+                job.bins[bin] += part[bin];
+            }
+        }
+        bmi_median_cut(palette, job.bins, count);
+        for (uint32_t bin = 0; bin < BMI_BIN_COUNT; bin++) {
+            if (job.bins[bin] != 0) {
+                const uint32_t r = bin >> (2 * BMI_BIN_BITS);
+                const uint32_t g = bin >> BMI_BIN_BITS & (BMI_BIN_LEVELS - 1);
+                const uint32_t b = bin & (BMI_BIN_LEVELS - 1);
+                bin_indices[bin] = (uint8_t)bmi_palette_nearest(
+                    palette, BMI_RGB(BMI_BIN_CENTER(r), BMI_BIN_CENTER(g),
+                                     BMI_BIN_CENTER(b)));
+            }
+        }
+        free(job.bins);
+        job.bins = NULL;
+        job.bin_indices = bin_indices;
+    }
+    memset(palette->cache, 0, sizeof(palette->cache));
+    
+    bmi_parallel_for(parts, bmi_map_part, &job);
+    free(merged);
+    free(bin_indices);
+    return result;
+}
+
+bmi_buffer* bmi_buffer_quantize(const bmi_buffer* buffer, uint32_t count) {
+    if (count == 0 || count > BMI_PALETTE_CAPACITY) {
+        bmi_set_error("bmi_buffer_quantize: Palettes hold between 1 and 256 "
+                      "colors");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_buffer* result = bmi_palette_quantize(
+        buffer, buffer->flags & (BMI_FL_HAS_CHECKSUM | BMI_FL_IS_TILED
+                                 | BMI_FL_IS_MAPPED), count);
+    if (result == NULL) {
+        bmi_set_error("bmi_buffer_quantize: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    return result;
+}
@@ -0,0 +1,107 @@
+// src: bmi-parallel.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+// sysconf
+#define _POSIX_C_SOURCE 200809L
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-parallel.h"
+
+// pthread_create, pthread_join
+#include <pthread.h>
+
+// sysconf
+#include <unistd.h>
+
+// Upper bound on the threads started for one operation
+#define BMI_MAX_THREADS 256
+
+// Parts handed to each thread by bmi_parallel_parts, which lets faster threads
+// pick up the slack of slower ones
+#define BMI_PARTS_PER_THREAD 4
+
+static uint32_t bmi_threads;
+
+void bmi_set_thread_count(uint32_t count) {
+    __atomic_store_n(&bmi_threads, count, __ATOMIC_RELAXED);
+}
+
+uint32_t bmi_thread_count(void) {
+    uint32_t count = __atomic_load_n(&bmi_threads, __ATOMIC_RELAXED);
+    if (count == 0) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        count = online > 0 ? (uint32_t)online : 1;
+    }
+    return count < BMI_MAX_THREADS ? count : BMI_MAX_THREADS;
+}
+
+typedef struct {
+    bmi_parallel_task task;
+    void* context;
+    uint32_t count;
+    uint32_t next;
+} bmi_parallel_job;
+
+static void* bmi_parallel_worker(void* argument) {
+    bmi_parallel_job* job = argument;
+    for (;;) {
+        const uint32_t index = __atomic_fetch_add(&job->next, 1,
+                                                  __ATOMIC_RELAXED);
+        if (index >= job->count) {
+            return NULL;
+        }
+        job->task(job->context, index);
+    }
+}
+
+void bmi_parallel_for(uint32_t count, bmi_parallel_task task, void* context) {
+    bmi_parallel_job job = {
+        .task = task,
+        .context = context,
+        .count = count,
+        .next = 0
+    };
+    
+    uint32_t threads = bmi_thread_count();
+    if (threads > count) {
+        threads = count;
+    }
+    
+    // The calling thread is one of the workers. Should a thread fail to
+    // start, the ones that did simply take on more of the indices.
+    pthread_t workers[BMI_MAX_THREADS];
+    uint32_t started = 0;
+    while (started + 1 < threads) {
+        if (pthread_create(&workers[started], NULL, bmi_parallel_worker,
+                           &job) != 0) {
+            break;
+        }
+        started++;
+    }
+    bmi_parallel_worker(&job);
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+uint32_t bmi_parallel_parts(uint64_t size, uint64_t grain) {
+    const uint64_t most = grain ? (size + grain - 1) / grain : size;
+    const uint64_t wanted = (uint64_t)bmi_thread_count()
+                            * BMI_PARTS_PER_THREAD;
+    const uint64_t parts = most < wanted ? most : wanted;
+    return parts > 0 ? (uint32_t)parts : 1;
+}
@@ -0,0 +1,333 @@
+// src: bmi-pipeline.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-pipeline.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_new, bmi_buffer_to_file, bmi_buffer_to_ppm
+#include "bmi-util.h"
+
+// bmi_buffer_free
+#include "bmi-memory.h"
+
+// pthread_create, pthread_join, pthread_mutex_*, pthread_cond_*
+#include <pthread.h>
+
+// calloc, free
+#include <stdlib.h>
+
+typedef enum {
+    BMI_SLOT_FREE,
+    BMI_SLOT_DRAWING,
+    BMI_SLOT_QUEUED,
+    BMI_SLOT_WRITING,
+    BMI_SLOT_WRITTEN
+} bmi_slot_state;
+
+typedef struct {
+    bmi_buffer* buffer;
+    FILE* dest;
+    uint64_t frame;
+    bmi_slot_state state;
+    int status;
+} bmi_pipeline_slot;
+
+// A first-in first-out ring of slot indices, which never holds more entries
+// than there are slots
+typedef struct {
+    uint32_t* indices;
+    uint32_t head;
+    uint32_t count;
+} bmi_slot_queue;
+
+struct bmi_pipeline {
+    pthread_mutex_t lock;
+    
+    // Signaled when a slot returns to the pool
+    pthread_cond_t freed;
+    
+    // Signaled when a frame is queued or the threads should stop
+    pthread_cond_t queued;
+    
+    // Signaled when every submitted frame has been reported
+    pthread_cond_t idle;
+    
+    bmi_pipeline_slot* slots;
+    uint32_t depth;
+    
+    // Frames waiting for a thread, and every frame not yet reported, in the
+    // order they were submitted
+    bmi_slot_queue pending;
+    bmi_slot_queue order;
+    
+    bmi_pipeline_format format;
+    bmi_pipeline_callback callback;
+    void* context;
+    
+    pthread_t* threads;
+    uint32_t started;
+    uint64_t next_frame;
+    uint32_t failed;
+    int reporting;
+    int stopping;
+};
+
+static void bmi_slot_push(bmi_slot_queue* queue, uint32_t depth,
+                          uint32_t index) {
+    queue->indices[(queue->head + queue->count) % depth] = index;
+    queue->count++;
+}
+
+static uint32_t bmi_slot_pop(bmi_slot_queue* queue, uint32_t depth) {
+    const uint32_t index = queue->indices[queue->head];
+    queue->head = (queue->head + 1) % depth;
+    queue->count--;
+    return index;
+}
+
+// Reports every written frame at the front of the submission order. Only one
+// thread reports at a time, so callbacks never overlap and stay in order even
+// when frames finish out of order. Called with the lock held.
+static void bmi_pipeline_report(bmi_pipeline* pipeline) {
+    if (pipeline->reporting) {
+        return;
+    }
+    pipeline->reporting = 1;
+    while (pipeline->order.count > 0) {
+        const uint32_t index = pipeline->order.indices[pipeline->order.head];
+        bmi_pipeline_slot* slot = &pipeline->slots[index];
+        if (slot->state != BMI_SLOT_WRITTEN) {
+            break;
+        }
+        bmi_slot_pop(&pipeline->order, pipeline->depth);
+        if (slot->status != BMI_SUCCESS) {
+            pipeline->failed++;
+        }
+        if (pipeline->callback != NULL) {
+            pthread_mutex_unlock(&pipeline->lock);
+            pipeline->callback(pipeline->context, slot->frame, slot->dest,
+                               slot->status);
+            pthread_mutex_lock(&pipeline->lock);
+        }
+        slot->dest = NULL;
+        slot->state = BMI_SLOT_FREE;
+        pthread_cond_signal(&pipeline->freed);
+    }
+    pipeline->reporting = 0;
+    if (pipeline->order.count == 0) {
+        pthread_cond_broadcast(&pipeline->idle);
+    }
+}
+
+static void* bmi_pipeline_worker(void* argument) {
+    bmi_pipeline* pipeline = argument;
+    pthread_mutex_lock(&pipeline->lock);
+    for (;;) {
+        while (pipeline->pending.count == 0 && !pipeline->stopping) {
+            pthread_cond_wait(&pipeline->queued, &pipeline->lock);
+        }
+        if (pipeline->pending.count == 0) {
+            break;
+        }
+        const uint32_t index = bmi_slot_pop(&pipeline->pending,
+                                            pipeline->depth);
+        bmi_pipeline_slot* slot = &pipeline->slots[index];
+        slot->state = BMI_SLOT_WRITING;
+        
+        // Encoding and writing happen outside the lock, while the caller
+        // draws the next frames into the other buffers
+        pthread_mutex_unlock(&pipeline->lock);
+        int status;
+        if (pipeline->format == BMI_PIPELINE_PPM) {
+            status = bmi_buffer_to_ppm(slot->dest, slot->buffer);
+        } else {
+            status = bmi_buffer_to_file(slot->dest, slot->buffer);
+        }
+        if (status == BMI_SUCCESS && fflush(slot->dest) != 0) {
+            status = BMI_FAILURE;
+        }
+        pthread_mutex_lock(&pipeline->lock);
+        
+        slot->status = status;
+        slot->state = BMI_SLOT_WRITTEN;
+        bmi_pipeline_report(pipeline);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+// Stops the threads, which finish the frames still queued first, and frees
+// everything the pipeline holds
+static void bmi_pipeline_destroy(bmi_pipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stopping = 1;
+    pthread_cond_broadcast(&pipeline->queued);
+    pthread_mutex_unlock(&pipeline->lock);
+    for (uint32_t i = 0; i < pipeline->started; i++) {
+        pthread_join(pipeline->threads[i], NULL);
+    }
+    
+    if (pipeline->slots != NULL) {
+        for (uint32_t i = 0; i < pipeline->depth; i++) {
+            if (pipeline->slots[i].buffer != NULL) {
+                bmi_buffer_free(pipeline->slots[i].buffer);
+            }
+        }
+    }
+    pthread_cond_destroy(&pipeline->idle);
+    pthread_cond_destroy(&pipeline->queued);
+    pthread_cond_destroy(&pipeline->freed);
+    pthread_mutex_destroy(&pipeline->lock);
+    free(pipeline->threads);
+    free(pipeline->order.indices);
+    free(pipeline->pending.indices);
+    free(pipeline->slots);
+    free(pipeline);
+}
+
+bmi_pipeline* bmi_pipeline_new(uint32_t width, uint32_t height, uint32_t flags,
+                               uint32_t depth, uint32_t threads,
+                               bmi_pipeline_format format,
+                               bmi_pipeline_callback callback, void* context) {
+    if (depth == 0 || threads == 0) {
+        bmi_set_error("bmi_pipeline_new: Depth and thread count must be "
+                      "positive");
+        return BMI_PTR_FAILURE;
+    }
+    if (format != BMI_PIPELINE_BMI && format != BMI_PIPELINE_PPM) {
+        bmi_set_error("bmi_pipeline_new: Format must be BMI or PPM");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // More threads than buffers would never have a frame to write
+    if (threads > depth) {
+        threads = depth;
+    }
+    
+    bmi_pipeline* pipeline = calloc(1, sizeof(*pipeline));
+    if (pipeline == NULL) {
+        bmi_set_error("bmi_pipeline_new: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->freed, NULL);
+    pthread_cond_init(&pipeline->queued, NULL);
+    pthread_cond_init(&pipeline->idle, NULL);
+    pipeline->depth = depth;
+    pipeline->format = format;
+    pipeline->callback = callback;
+    pipeline->context = context;
+    
+    pipeline->slots = calloc(depth, sizeof(*pipeline->slots));
+    pipeline->pending.indices = calloc(depth, sizeof(uint32_t));
+    pipeline->order.indices = calloc(depth, sizeof(uint32_t));
+    pipeline->threads = calloc(threads, sizeof(pthread_t));
+    if (pipeline->slots == NULL || pipeline->pending.indices == NULL
+        || pipeline->order.indices == NULL || pipeline->threads == NULL) {
+        bmi_pipeline_destroy(pipeline);
+        bmi_set_error("bmi_pipeline_new: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    for (uint32_t i = 0; i < depth; i++) {
+        pipeline->slots[i].buffer = bmi_buffer_new(width, height, flags);
+        if (pipeline->slots[i].buffer == NULL) {
+            // bmi_buffer_new has already described the error
+            bmi_pipeline_destroy(pipeline);
+            return BMI_PTR_FAILURE;
+        }
+    }
+    
+    // Unlike bmi_parallel_for, there is no calling thread to fall back on, so
+    // at least one thread has to start
+    while (pipeline->started < threads) {
+        if (pthread_create(&pipeline->threads[pipeline->started], NULL,
+                           bmi_pipeline_worker, pipeline) != 0) {
+            break;
+        }
+        pipeline->started++;
+    }
+    if (pipeline->started == 0) {
+        bmi_pipeline_destroy(pipeline);
+        bmi_set_error("bmi_pipeline_new: Could not start a thread");
+        return BMI_PTR_FAILURE;
+    }
+    
+    return pipeline;
+}
+
+bmi_buffer* bmi_pipeline_acquire(bmi_pipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    for (;;) {
+        for (uint32_t i = 0; i < pipeline->depth; i++) {
+            bmi_pipeline_slot* slot = &pipeline->slots[i];
+            if (slot->state == BMI_SLOT_FREE) {
+                slot->state = BMI_SLOT_DRAWING;
+                pthread_mutex_unlock(&pipeline->lock);
+                return slot->buffer;
+            }
+        }
+        
+        // Every buffer is in flight, so drawing waits on the writers
+        pthread_cond_wait(&pipeline->freed, &pipeline->lock);
+    }
+}
+
+int bmi_pipeline_submit(bmi_pipeline* pipeline, bmi_buffer* buffer,
+                        FILE* dest) {
+    pthread_mutex_lock(&pipeline->lock);
+    for (uint32_t i = 0; i < pipeline->depth; i++) {
+        bmi_pipeline_slot* slot = &pipeline->slots[i];
+        if (slot->buffer == buffer && slot->state == BMI_SLOT_DRAWING) {
+            slot->dest = dest;
+            slot->frame = pipeline->next_frame++;
+            slot->state = BMI_SLOT_QUEUED;
+            bmi_slot_push(&pipeline->pending, pipeline->depth, i);
+            bmi_slot_push(&pipeline->order, pipeline->depth, i);
+            pthread_cond_signal(&pipeline->queued);
+            pthread_mutex_unlock(&pipeline->lock);
+            return BMI_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    bmi_set_error("bmi_pipeline_submit: Buffer was not acquired from the "
+                  "pipeline");
+    return BMI_FAILURE;
+}
+
+int bmi_pipeline_flush(bmi_pipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->order.count > 0 || pipeline->reporting) {
+        pthread_cond_wait(&pipeline->idle, &pipeline->lock);
+    }
+    const uint32_t failed = pipeline->failed;
+    pipeline->failed = 0;
+    pthread_mutex_unlock(&pipeline->lock);
+    
+    if (failed > 0) {
+        bmi_set_error("bmi_pipeline_flush: A frame could not be written");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+void bmi_pipeline_free(bmi_pipeline* pipeline) {
+    bmi_pipeline_flush(pipeline);
+    bmi_pipeline_destroy(pipeline);
+}
@@ -0,0 +1,259 @@
+// src: bmi-pyramid.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-pyramid.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_storage_size
+#include "bmi-memory.h"
+
+// bmi_buffer_kernels, bmi_kernel_blit, BMI_KERNEL_ADDRESS, BMI_KERNEL_RUN
+#include "bmi-kernel.h"
+
+// bmi_buffer_palette
+#include "bmi-palette.h"
+
+// bmi_parallel_for
+#include "bmi-parallel.h"
+
+// malloc, free
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Each band covers this many levels, so its rows of the first level it reads
+// are a multiple of two to this power and every level below shares none of
+// its rows with other bands
+#define BMI_PYRAMID_DEPTH 6
+
+// Levels start on a cache line within the allocation
+#define BMI_PYRAMID_ALIGN 64
+
+#define BMI_PYRAMID_ROUND(size) \
+    (((size) + BMI_PYRAMID_ALIGN - 1) & ~(size_t)(BMI_PYRAMID_ALIGN - 1))
+
+// Averages each 2x2 block of two rows into a row of width pixels. The rows
+// hold twice as many pixels, the last repeated where a level's width is odd.
+static void bmi_pyramid_filter(bmi_pixel* dst, const bmi_pixel* top,
+                               const bmi_pixel* bottom, uint32_t width) {
+    uint32_t x = 0;
+#ifdef __SSE2__
+    // Two output pixels at a time, widening every channel to 16 bits, adding
+    // the rows, and then adding the neighbouring pixels in the upper half
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 2 <= width; x += 2) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(top + 2 * x));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(bottom + 2 * x));
+        __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                    _mm_unpacklo_epi8(b, zero));
+        __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                     _mm_unpackhi_epi8(b, zero));
+        low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+        high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+        __m128i sum = _mm_unpacklo_epi64(low, high);
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for (; x < width; x++) {
+        const bmi_pixel p[4] = {
+            top[2 * x], top[2 * x + 1], bottom[2 * x], bottom[2 * x + 1]
+        };
+        bmi_pixel result = 0;
+        for (uint32_t shift = 0; shift < 24; shift += 8) {
+            const uint32_t sum = (p[0] >> shift & 0xFF) + (p[1] >> shift & 0xFF)
+                                 + (p[2] >> shift & 0xFF)
+                                 + (p[3] >> shift & 0xFF);
+            result |= (sum + 2) >> 2 << shift;
+        }
+        dst[x] = result;
+    }
+}
+
+typedef struct {
+    // The level read from, which is the source for the first bands
+    const bmi_buffer* base;
+    
+    // The levels written, of which there are depth
+    bmi_buffer** levels;
+    uint32_t depth;
+    uint32_t failed;
+} bmi_pyramid_job;
+
+typedef struct {
+    // Two rows for each level, the one of even rows kept until its odd row
+    // arrives, each with room to repeat the last pixel
+    bmi_pixel* rows[BMI_PYRAMID_DEPTH + 1][2];
+    
+    // Room for a row of the largest level written in its own format
+    uint8_t* line;
+} bmi_pyramid_band;
+
+// Takes row y of level k of a band, filtering it and the row before it into
+// the next level once both have arrived, and so on down the cascade
+static void bmi_pyramid_push(const bmi_pyramid_job* job,
+                             const bmi_pyramid_band* band, uint32_t k,
+                             uint32_t y) {
+    const bmi_buffer* input = k == 0 ? job->base : job->levels[k - 1];
+    if (k == job->depth || (!(y & 1) && y + 1 < input->height)) {
+        return;
+    }
+    
+    // The last row of a level of odd height pairs with itself
+    bmi_buffer* output = job->levels[k];
+    const bmi_kernels* kernels = bmi_buffer_kernels(output);
+    bmi_pixel* row = band->rows[k + 1][(y >> 1) & 1];
+    bmi_pyramid_filter(row, band->rows[k][0], band->rows[k][y & 1],
+                       output->width);
+    row[output->width] = row[output->width - 1];
+    if (output->flags & BMI_FL_IS_TILED) {
+        kernels->store(band->line, row, output->width);
+        bmi_kernel_blit(output, kernels, 0, y >> 1, band->line,
+                        output->width);
+    } else {
+        kernels->store(BMI_KERNEL_ADDRESS(output, kernels, 0, y >> 1), row,
+                       output->width);
+    }
+    bmi_pyramid_push(job, band, k + 1, y >> 1);
+}
+
+static void bmi_pyramid_part(void* context, uint32_t index) {
+    bmi_pyramid_job* job = context;
+    const bmi_buffer* base = job->base;
+    const bmi_kernels* kernels = bmi_buffer_kernels(base);
+    const bmi_pixel* colors = (base->flags & BMI_FL_IS_PALETTE)
+        ? bmi_buffer_palette(base)->colors : NULL;
+    const uint32_t first = index << BMI_PYRAMID_DEPTH;
+    const uint32_t last = base->height - first > 1u << BMI_PYRAMID_DEPTH
+        ? first + (1u << BMI_PYRAMID_DEPTH) : base->height;
+    
+    // Each band streams its rows of the base through every level in turn, so
+    // that the rows of each level are filtered while still in cache
+    bmi_pyramid_band band = { .line = NULL };
+    size_t total = 0;
+    for (uint32_t k = 0; k <= job->depth; k++) {
+        const bmi_buffer* level = k == 0 ? base : job->levels[k - 1];
+        total += 2 * ((size_t)level->width + 1);
+    }
+    bmi_pixel* rows = malloc(total * sizeof(bmi_pixel));
+    band.line = malloc((size_t)job->levels[0]->width * 3);
+    if (rows == NULL || band.line == NULL) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        free(rows);
+        free(band.line);
+        return;
+    }
+    bmi_pixel* next = rows;
+    for (uint32_t k = 0; k <= job->depth; k++) {
+        const bmi_buffer* level = k == 0 ? base : job->levels[k - 1];
+        band.rows[k][0] = next;
+        band.rows[k][1] = next + level->width + 1;
+        next += 2 * ((size_t)level->width + 1);
+    }
+    
+    for (uint32_t y = first; y < last; y++) {
+        bmi_pixel* row = band.rows[0][y & 1];
+        for (uint32_t x = 0; x < base->width;) {
+            const size_t length = BMI_KERNEL_RUN(base, x, base->width - x);
+            kernels->load(row + x, BMI_KERNEL_ADDRESS(base, kernels, x, y),
+                          length);
+            x += (uint32_t)length;
+        }
+        if (colors != NULL) {
+            for (uint32_t x = 0; x < base->width; x++) {
+                row[x] = colors[row[x]];
+            }
+        }
+        row[base->width] = row[base->width - 1];
+        bmi_pyramid_push(job, &band, 0, y);
+    }
+    
+    free(rows);
+    free(band.line);
+}
+
+bmi_pyramid* bmi_buffer_build_pyramid(const bmi_buffer* buffer) {
+    if (buffer->width == 0 || buffer->height == 0) {
+        bmi_set_error("bmi_buffer_build_pyramid: Sizes must not be zero");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Size every level up front so that they share one allocation
+    const uint32_t flags = buffer->flags
+        & (BMI_FL_IS_GRAYSCALE | BMI_FL_HAS_CHECKSUM | BMI_FL_IS_TILED);
+    uint32_t count = 0;
+    size_t size = 0;
+    for (uint32_t w = buffer->width, h = buffer->height; w > 1 || h > 1;) {
+        w = (w + 1) >> 1;
+        h = (h + 1) >> 1;
+        size += BMI_PYRAMID_ROUND(bmi_buffer_storage_size(w, h, flags));
+        count++;
+    }
+    const size_t head = BMI_PYRAMID_ROUND(sizeof(bmi_pyramid)
+                                          + count * sizeof(bmi_buffer*));
+    bmi_pyramid* pyramid = malloc(head + size);
+    if (pyramid == NULL) {
+        bmi_set_error("bmi_buffer_build_pyramid: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    pyramid->count = count;
+    uint8_t* next = (uint8_t*)pyramid + head;
+    for (uint32_t k = 0, w = buffer->width, h = buffer->height; k < count;
+         k++) {
+        w = (w + 1) >> 1;
+        h = (h + 1) >> 1;
+        bmi_buffer* level = (bmi_buffer*)next;
+        level->header[0] = BMI_HEADER_0;
+        level->header[1] = BMI_HEADER_1;
+        level->header[2] = BMI_HEADER_2;
+        level->version[0] = BMI_VERSION_CURRENT;
+        level->width = w;
+        level->height = h;
+        level->flags = flags;
+        pyramid->levels[k] = level;
+        next += BMI_PYRAMID_ROUND(bmi_buffer_storage_size(w, h, flags));
+    }
+    
+    // The source is read once, by the first bands, and each later group of
+    // levels is built from the last level of the group before it
+    bmi_pyramid_job job = { .base = buffer };
+    for (uint32_t done = 0; done < count; done += job.depth) {
+        job.levels = pyramid->levels + done;
+        job.depth = count - done < BMI_PYRAMID_DEPTH
+            ? count - done : BMI_PYRAMID_DEPTH;
+        bmi_parallel_for((job.base->height + (1u << BMI_PYRAMID_DEPTH) - 1)
+                         >> BMI_PYRAMID_DEPTH, bmi_pyramid_part, &job);
+        if (job.failed) {
+            free(pyramid);
+            bmi_set_error("bmi_buffer_build_pyramid: Virtual memory "
+                          "exhausted");
+            return BMI_PTR_FAILURE;
+        }
+        job.base = job.levels[job.depth - 1];
+    }
+    return pyramid;
+}
+
+void bmi_pyramid_free(bmi_pyramid* pyramid) {
+    free(pyramid);
+}
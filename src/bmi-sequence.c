@@ -0,0 +1,904 @@
+// src: bmi-sequence.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-sequence.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// BMI_RECT
+#include "bmi-geometry.h"
+
+// bmi_buffer_new
+#include "bmi-util.h"
+
+// bmi_buffer_overdraw_buffer
+#include "bmi-draw.h"
+
+// bmi_buffer_storage_size, bmi_buffer_free
+#include "bmi-memory.h"
+
+// bmi_buffer_kernels, BMI_FORMAT_FROM_FL, BMI_KERNEL_ADDRESS,
+// bmi_kernel_gather, bmi_kernel_segment
+#include "bmi-kernel.h"
+
+// bmi_hash_init, bmi_hash_update, bmi_hash_digest
+#include "bmi-hash.h"
+
+// fseek, ftell, rewind, fread, fwrite, fflush
+#include <stdio.h>
+
+// malloc, realloc, free
+#include <stdlib.h>
+
+// memcmp, memcpy
+#include <string.h>
+
+#define BMI_FRAME_KEY 0
+#define BMI_FRAME_DELTA 1
+
+// Each frame record starts with its kind, the number of row ranges it holds,
+// the number of its keyframe and the size of what follows, all little-endian,
+// and ends with a checksum of what follows when the sequence has checksums
+#define BMI_FRAME_HEADER_SIZE 24
+
+// Each row range is its first row and number of rows
+#define BMI_RANGE_SIZE 8
+
+// Indexed files end with the magic, the offset of the index and the number of
+// frames in it, after the index itself
+#define BMI_SEQUENCE_MAGIC "BMIINDEX"
+#define BMI_SEQUENCE_TRAILER_SIZE 24
+
+// Deltas are only stored when at most this fraction of a keyframe's size
+#define BMI_DELTA_RATIO 2
+
+// Pixels are streamed in chunks of this many bytes
+#define BMI_SEQUENCE_CHUNK (1 << 20)
+
+// Index entries are written through a buffer of this many
+#define BMI_INDEX_CHUNK 512
+
+static void bmi_put_le(uint8_t* dst, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        dst[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+static uint64_t bmi_get_le(const uint8_t* src, int size) {
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--) {
+        value = value << 8 | src[i];
+    }
+    return value;
+}
+
+typedef struct {
+    uint32_t kind;
+    uint32_t ranges;
+    uint64_t key;
+    uint64_t size;
+} bmi_frame_header;
+
+static void bmi_frame_header_pack(uint8_t* dst, const bmi_frame_header* head) {
+    bmi_put_le(dst, head->kind, 4);
+    bmi_put_le(dst + 4, head->ranges, 4);
+    bmi_put_le(dst + 8, head->key, 8);
+    bmi_put_le(dst + 16, head->size, 8);
+}
+
+static void bmi_frame_header_unpack(bmi_frame_header* head,
+                                    const uint8_t* src) {
+    head->kind = (uint32_t)bmi_get_le(src, 4);
+    head->ranges = (uint32_t)bmi_get_le(src + 4, 4);
+    head->key = bmi_get_le(src + 8, 8);
+    head->size = bmi_get_le(src + 16, 8);
+}
+
+// Returns the size of a frame record holding a payload of the given size
+static uint64_t bmi_frame_record_size(uint32_t flags, uint64_t size) {
+    return BMI_FRAME_HEADER_SIZE + size
+        + ((flags & BMI_FL_HAS_CHECKSUM) ? BMI_CHECKSUM_SIZE : 0);
+}
+
+// Returns the size of one row of a frame in a file
+static size_t bmi_frame_row_size(uint32_t width, uint32_t flags) {
+    return (size_t)width * BMI_COMPONENT_SIZE_FROM_FL(flags);
+}
+
+struct bmi_sequence_writer {
+    FILE* dest;
+    
+    // The attributes from the sequence's header
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;
+    uint32_t interval;
+    
+    // The last keyframe, in row-major order, which deltas are taken against
+    bmi_buffer* key;
+    uint64_t key_frame;
+    
+    // Where each frame written so far starts, and where the next one goes
+    uint64_t* offsets;
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t position;
+    
+    // One row staged out of a tiled frame, and the first row and number of
+    // rows of each changed range
+    uint8_t* row;
+    uint32_t* ranges;
+};
+
+static bmi_sequence_writer* bmi_sequence_writer_alloc(FILE* dest,
+                                                      uint32_t width,
+                                                      uint32_t height,
+                                                      uint32_t flags,
+                                                      uint32_t interval) {
+    bmi_sequence_writer* writer = calloc(1, sizeof(*writer));
+    if (writer == NULL) {
+        return NULL;
+    }
+    writer->dest = dest;
+    writer->width = width;
+    writer->height = height;
+    writer->flags = flags;
+    writer->interval = interval;
+    
+    // A frame never has more changed ranges than every other row
+    writer->row = malloc(bmi_frame_row_size(width, flags) + 1);
+    writer->ranges = malloc(((size_t)height / 2 + 1) * 2 * sizeof(uint32_t));
+    if (writer->row == NULL || writer->ranges == NULL) {
+        free(writer->row);
+        free(writer->ranges);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+static void bmi_sequence_writer_release(bmi_sequence_writer* writer) {
+    if (writer->key != NULL) {
+        bmi_buffer_free(writer->key);
+    }
+    free(writer->offsets);
+    free(writer->row);
+    free(writer->ranges);
+    free(writer);
+}
+
+bmi_sequence_writer* bmi_sequence_writer_new(FILE* dest, uint32_t width,
+                                             uint32_t height, uint32_t flags,
+                                             uint32_t interval) {
+    bmi_buffer header = {
+        .header = { BMI_HEADER_0, BMI_HEADER_1, BMI_HEADER_2 },
+        .version = { BMI_VERSION_CURRENT },
+        .width = width,
+        .height = height,
+        .flags = (flags & ~(uint32_t)BMI_FL_MEMORY_MASK) | BMI_FL_IS_SEQUENCE
+    };
+    
+    // Frames are stored without palettes, so their indices would lose meaning
+    if (flags & BMI_FL_IS_PALETTE) {
+        bmi_set_error("bmi_sequence_writer_new: Sequences cannot hold palette "
+                      "buffers");
+        return BMI_PTR_FAILURE;
+    }
+    if (bmi_buffer_storage_size(width, height, header.flags) == 0) {
+        bmi_set_error("bmi_sequence_writer_new: Image is too large");
+        return BMI_PTR_FAILURE;
+    }
+    
+    bmi_sequence_writer* writer = bmi_sequence_writer_alloc(dest, width,
+                                                            height,
+                                                            header.flags,
+                                                            interval);
+    if (writer == NULL) {
+        bmi_set_error("bmi_sequence_writer_new: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    if (fwrite(&header, sizeof(bmi_buffer), 1, dest) != 1) {
+        bmi_sequence_writer_release(writer);
+        bmi_set_error("bmi_sequence_writer_new: Failed to write");
+        return BMI_PTR_FAILURE;
+    }
+    writer->position = sizeof(bmi_buffer);
+    return writer;
+}
+
+// Writes bytes of a frame's payload, hashing them on the way when the
+// sequence has checksums
+static int bmi_sequence_emit(bmi_sequence_writer* writer,
+                             bmi_hash_state* state, const void* data,
+                             size_t size) {
+    if (size == 0) {
+        return BMI_SUCCESS;
+    }
+    if (writer->flags & BMI_FL_HAS_CHECKSUM) {
+        bmi_hash_update(state, data, size);
+    }
+    if (fwrite(data, size, 1, writer->dest) != 1) {
+        return BMI_FAILURE;
+    }
+    writer->position += size;
+    return BMI_SUCCESS;
+}
+
+// Returns the pixels of one row of the frame, staging it when the frame is
+// tiled
+static const uint8_t* bmi_frame_row(const bmi_buffer* frame,
+                                    const bmi_kernels* kernels, uint32_t y,
+                                    uint8_t* scratch) {
+    if (!(frame->flags & BMI_FL_IS_TILED)) {
+        return BMI_KERNEL_ADDRESS(frame, kernels, 0, y);
+    }
+    bmi_kernel_gather(frame, kernels, 0, y, scratch, frame->width);
+    return scratch;
+}
+
+// Finds the ranges of rows in which the frame differs from the keyframe,
+// returning the number of ranges and storing the number of rows in them
+static uint32_t bmi_sequence_diff(bmi_sequence_writer* writer,
+                                  const bmi_buffer* frame,
+                                  const bmi_kernels* kernels,
+                                  uint64_t* changed) {
+    const size_t row_size = bmi_frame_row_size(writer->width, writer->flags);
+    uint32_t count = 0;
+    *changed = 0;
+    for (uint32_t y = 0; y < frame->height; y++) {
+        const uint8_t* row = bmi_frame_row(frame, kernels, y, writer->row);
+        if (memcmp(row, writer->key->contents + y * row_size, row_size) == 0) {
+            continue;
+        }
+        if (count > 0 && writer->ranges[2 * count - 2]
+                         + writer->ranges[2 * count - 1] == y) {
+            writer->ranges[2 * count - 1]++;
+        } else {
+            writer->ranges[2 * count] = y;
+            writer->ranges[2 * count + 1] = 1;
+            count++;
+        }
+        (*changed)++;
+    }
+    return count;
+}
+
+static int bmi_sequence_write_payload(bmi_sequence_writer* writer,
+                                      const bmi_buffer* frame,
+                                      const bmi_kernels* kernels,
+                                      const bmi_frame_header* head,
+                                      bmi_hash_state* state) {
+    if (head->kind == BMI_FRAME_KEY) {
+        // Keyframes are stored in row-major order whatever the layout
+        const uint64_t total = (uint64_t)frame->width * frame->height;
+        for (uint64_t position = 0; position < total;) {
+            const uint8_t* segment;
+            const size_t count = bmi_kernel_segment(frame, kernels, position,
+                                                    BMI_SEQUENCE_CHUNK
+                                                    / kernels->size,
+                                                    &segment);
+            if (bmi_sequence_emit(writer, state, segment,
+                                  count * kernels->size) != BMI_SUCCESS) {
+                return BMI_FAILURE;
+            }
+            position += count;
+        }
+        return BMI_SUCCESS;
+    }
+    
+    uint8_t range[BMI_RANGE_SIZE];
+    for (uint32_t i = 0; i < head->ranges; i++) {
+        bmi_put_le(range, writer->ranges[2 * i], 4);
+        bmi_put_le(range + 4, writer->ranges[2 * i + 1], 4);
+        if (bmi_sequence_emit(writer, state, range, BMI_RANGE_SIZE)
+            != BMI_SUCCESS) {
+            return BMI_FAILURE;
+        }
+    }
+    const size_t row_size = bmi_frame_row_size(writer->width, writer->flags);
+    for (uint32_t i = 0; i < head->ranges; i++) {
+        const uint32_t first = writer->ranges[2 * i];
+        const uint32_t rows = writer->ranges[2 * i + 1];
+        for (uint32_t y = first; y < first + rows; y++) {
+            const uint8_t* row = bmi_frame_row(frame, kernels, y,
+                                               writer->row);
+            if (bmi_sequence_emit(writer, state, row, row_size)
+                != BMI_SUCCESS) {
+                return BMI_FAILURE;
+            }
+        }
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_sequence_write_frame(bmi_sequence_writer* writer,
+                             const bmi_buffer* frame) {
+    if (frame->width != writer->width
+        || frame->height != writer->height
+        || BMI_FORMAT_FROM_FL(frame->flags)
+        != BMI_FORMAT_FROM_FL(writer->flags)) {
+        bmi_set_error("bmi_sequence_write_frame: Frame does not match the "
+                      "sequence");
+        return BMI_FAILURE;
+    }
+    if (writer->count == writer->capacity) {
+        const uint64_t capacity = writer->capacity ? writer->capacity * 2 : 64;
+        uint64_t* offsets = realloc(writer->offsets,
+                                    capacity * sizeof(uint64_t));
+        if (offsets == NULL) {
+            bmi_set_error("bmi_sequence_write_frame: Virtual memory "
+                          "exhausted");
+            return BMI_FAILURE;
+        }
+        writer->offsets = offsets;
+        writer->capacity = capacity;
+    }
+    if (writer->key == NULL) {
+        writer->key = bmi_buffer_new(frame->width, frame->height,
+                                     BMI_FORMAT_FROM_FL(frame->flags));
+        if (writer->key == NULL) {
+            bmi_set_error("bmi_sequence_write_frame: Virtual memory "
+                          "exhausted");
+            return BMI_FAILURE;
+        }
+        writer->key_frame = UINT64_MAX;
+    }
+    
+    const bmi_kernels* kernels = bmi_buffer_kernels(frame);
+    const size_t row_size = bmi_frame_row_size(writer->width, writer->flags);
+    const uint64_t frame_size = (uint64_t)row_size * frame->height;
+    const uint64_t number = writer->count;
+    bmi_frame_header head = {
+        .kind = BMI_FRAME_KEY,
+        .ranges = 0,
+        .key = number,
+        .size = frame_size
+    };
+    
+    // Frames are stored whole at the start, every interval frames, and
+    // whenever too much of the frame changed for a delta to pay off
+    if (writer->key_frame != UINT64_MAX
+        && (writer->interval == 0
+            || number - writer->key_frame < writer->interval)) {
+        uint64_t changed;
+        const uint32_t ranges = bmi_sequence_diff(writer, frame, kernels,
+                                                  &changed);
+        const uint64_t size = (uint64_t)ranges * BMI_RANGE_SIZE
+            + changed * row_size;
+        if (size * BMI_DELTA_RATIO <= frame_size) {
+            head.kind = BMI_FRAME_DELTA;
+            head.ranges = ranges;
+            head.key = writer->key_frame;
+            head.size = size;
+        }
+    }
+    
+    const uint64_t start = writer->position;
+    uint8_t packed[BMI_FRAME_HEADER_SIZE];
+    bmi_frame_header_pack(packed, &head);
+    bmi_hash_state state;
+    bmi_hash_init(&state);
+    int status = fwrite(packed, BMI_FRAME_HEADER_SIZE, 1, writer->dest) == 1
+        ? BMI_SUCCESS : BMI_FAILURE;
+    writer->position += BMI_FRAME_HEADER_SIZE;
+    if (status == BMI_SUCCESS) {
+        status = bmi_sequence_write_payload(writer, frame, kernels, &head,
+                                            &state);
+    }
+    if (status == BMI_SUCCESS
+        && (writer->flags & BMI_FL_HAS_CHECKSUM)) {
+        uint8_t trailer[BMI_CHECKSUM_SIZE];
+        bmi_put_le(trailer, bmi_hash_digest(&state), BMI_CHECKSUM_SIZE);
+        status = fwrite(trailer, BMI_CHECKSUM_SIZE, 1, writer->dest) == 1
+            ? BMI_SUCCESS : BMI_FAILURE;
+        writer->position += BMI_CHECKSUM_SIZE;
+    }
+    if (status != BMI_SUCCESS) {
+        // Leave the partial record to be overwritten by the next frame
+        writer->position = start;
+        fseek(writer->dest, (long)start, SEEK_SET);
+        bmi_set_error("bmi_sequence_write_frame: Failed to write");
+        return BMI_FAILURE;
+    }
+    
+    if (head.kind == BMI_FRAME_KEY) {
+        bmi_buffer_overdraw_buffer(writer->key, BMI_RECT(0, 0, frame->width,
+                                                         frame->height),
+                                   frame);
+        writer->key_frame = number;
+    }
+    writer->offsets[writer->count++] = start;
+    return BMI_SUCCESS;
+}
+
+int bmi_sequence_writer_free(bmi_sequence_writer* writer) {
+    // The index goes right after the last frame
+    int status = fseek(writer->dest, (long)writer->position, SEEK_SET) == 0
+        ? BMI_SUCCESS : BMI_FAILURE;
+    uint8_t entries[BMI_INDEX_CHUNK * 8];
+    for (uint64_t i = 0; status == BMI_SUCCESS && i < writer->count;
+         i += BMI_INDEX_CHUNK) {
+        const uint64_t chunk = writer->count - i < BMI_INDEX_CHUNK
+            ? writer->count - i : BMI_INDEX_CHUNK;
+        for (uint64_t j = 0; j < chunk; j++) {
+            bmi_put_le(entries + j * 8, writer->offsets[i + j], 8);
+        }
+        if (fwrite(entries, (size_t)chunk * 8, 1, writer->dest) != 1) {
+            status = BMI_FAILURE;
+        }
+    }
+    if (status == BMI_SUCCESS) {
+        uint8_t trailer[BMI_SEQUENCE_TRAILER_SIZE];
+        memcpy(trailer, BMI_SEQUENCE_MAGIC, 8);
+        bmi_put_le(trailer + 8, writer->position, 8);
+        bmi_put_le(trailer + 16, writer->count, 8);
+        if (fwrite(trailer, BMI_SEQUENCE_TRAILER_SIZE, 1, writer->dest) != 1
+            || fflush(writer->dest) != 0) {
+            status = BMI_FAILURE;
+        }
+    }
+    bmi_sequence_writer_release(writer);
+    
+    if (status != BMI_SUCCESS) {
+        bmi_set_error("bmi_sequence_writer_free: Failed to write the index");
+    }
+    return status;
+}
+
+struct bmi_sequence_reader {
+    FILE* source;
+    
+    // The attributes from the sequence's header
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;
+    
+    // Where each frame starts, and where the frames end
+    uint64_t* offsets;
+    uint64_t count;
+    uint64_t end;
+    
+    // The last keyframe read, which deltas are applied to
+    bmi_buffer* key;
+    uint64_t key_frame;
+};
+
+// Reads the index at the end of the file, returning whether there is a valid
+// one
+static int bmi_sequence_read_index(bmi_sequence_reader* reader,
+                                   uint64_t length) {
+    if (length < sizeof(bmi_buffer) + BMI_SEQUENCE_TRAILER_SIZE) {
+        return 0;
+    }
+    uint8_t trailer[BMI_SEQUENCE_TRAILER_SIZE];
+    if (fseek(reader->source, (long)(length - BMI_SEQUENCE_TRAILER_SIZE),
+              SEEK_SET) != 0
+        || fread(trailer, BMI_SEQUENCE_TRAILER_SIZE, 1, reader->source) != 1
+        || memcmp(trailer, BMI_SEQUENCE_MAGIC, 8) != 0) {
+        return 0;
+    }
+    const uint64_t start = bmi_get_le(trailer + 8, 8);
+    const uint64_t count = bmi_get_le(trailer + 16, 8);
+    const uint64_t end = length - BMI_SEQUENCE_TRAILER_SIZE;
+    if (start < sizeof(bmi_buffer) || start > end
+        || count != (end - start) / 8 || (end - start) % 8 != 0) {
+        return 0;
+    }
+    
+    uint64_t* offsets = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (offsets == NULL || fseek(reader->source, (long)start, SEEK_SET) != 0) {
+        free(offsets);
+        return 0;
+    }
+    uint8_t entries[BMI_INDEX_CHUNK * 8];
+    for (uint64_t i = 0; i < count; i += BMI_INDEX_CHUNK) {
+        const uint64_t chunk = count - i < BMI_INDEX_CHUNK
+            ? count - i : BMI_INDEX_CHUNK;
+        if (fread(entries, (size_t)chunk * 8, 1, reader->source) != 1) {
+            free(offsets);
+            return 0;
+        }
+        for (uint64_t j = 0; j < chunk; j++) {
+            offsets[i + j] = bmi_get_le(entries + j * 8, 8);
+            if (offsets[i + j] < sizeof(bmi_buffer)
+                || offsets[i + j] >= start) {
+                free(offsets);
+                return 0;
+            }
+        }
+    }
+    reader->offsets = offsets;
+    reader->count = count;
+    reader->end = start;
+    return 1;
+}
+
+// Walks the frame records from the start of the file, for sequences whose
+// writer never finished, stopping at the first incomplete or invalid record
+static int bmi_sequence_scan(bmi_sequence_reader* reader, uint64_t length) {
+    const uint64_t frame_size = (uint64_t)bmi_frame_row_size(reader->width,
+                                                             reader->flags)
+        * reader->height;
+    uint64_t capacity = 0;
+    uint64_t position = sizeof(bmi_buffer);
+    while (length - position >= BMI_FRAME_HEADER_SIZE) {
+        uint8_t packed[BMI_FRAME_HEADER_SIZE];
+        if (fseek(reader->source, (long)position, SEEK_SET) != 0
+            || fread(packed, BMI_FRAME_HEADER_SIZE, 1, reader->source) != 1) {
+            break;
+        }
+        bmi_frame_header head;
+        bmi_frame_header_unpack(&head, packed);
+        const int valid = head.kind == BMI_FRAME_KEY
+            ? head.ranges == 0 && head.key == reader->count
+              && head.size == frame_size
+            : head.kind == BMI_FRAME_DELTA && head.key < reader->count
+              && head.size <= frame_size;
+        if (!valid || length - position - BMI_FRAME_HEADER_SIZE
+                      < bmi_frame_record_size(reader->flags, head.size)
+                        - BMI_FRAME_HEADER_SIZE) {
+            break;
+        }
+        
+        if (reader->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            uint64_t* offsets = realloc(reader->offsets,
+                                        capacity * sizeof(uint64_t));
+            if (offsets == NULL) {
+                return BMI_FAILURE;
+            }
+            reader->offsets = offsets;
+        }
+        reader->offsets[reader->count++] = position;
+        position += bmi_frame_record_size(reader->flags, head.size);
+    }
+    reader->end = position;
+    return BMI_SUCCESS;
+}
+
+bmi_sequence_reader* bmi_sequence_reader_from_file(FILE* source) {
+    fseek(source, 0, SEEK_END);
+    const long end = ftell(source);
+    rewind(source);
+    const uint64_t length = end > 0 ? (uint64_t)end : 0;
+    
+    bmi_buffer header;
+    if (length < sizeof(bmi_buffer)
+        || fread(&header, sizeof(bmi_buffer), 1, source) != 1) {
+        bmi_set_error("bmi_sequence_reader_from_file: File is too small to be "
+                      "valid");
+        return BMI_PTR_FAILURE;
+    }
+    if (!BMI_FILE_IS_VALID(header)) {
+        bmi_set_error("bmi_sequence_reader_from_file: File has invalid "
+                      "header");
+        return BMI_PTR_FAILURE;
+    }
+    if (BMI_VERSION_IS_OUTDATED(*header.version)) {
+        bmi_set_error("bmi_sequence_reader_from_file: File has outdated "
+                      "version");
+        return BMI_PTR_FAILURE;
+    }
+    if (BMI_VERSION_IS_LATER(*header.version)) {
+        bmi_set_error("bmi_sequence_reader_from_file: File has version from "
+                      "future");
+        return BMI_PTR_FAILURE;
+    }
+    if (!(header.flags & BMI_FL_IS_SEQUENCE)) {
+        bmi_set_error("bmi_sequence_reader_from_file: File is not a "
+                      "sequence");
+        return BMI_PTR_FAILURE;
+    }
+    if (header.flags & BMI_FL_IS_PALETTE) {
+        bmi_set_error("bmi_sequence_reader_from_file: File has invalid "
+                      "header");
+        return BMI_PTR_FAILURE;
+    }
+    header.flags &= ~(uint32_t)BMI_FL_MEMORY_MASK;
+    if (bmi_buffer_storage_size(header.width, header.height,
+                                header.flags) == 0) {
+        bmi_set_error("bmi_sequence_reader_from_file: Image is too large");
+        return BMI_PTR_FAILURE;
+    }
+    
+    bmi_sequence_reader* reader = calloc(1, sizeof(*reader));
+    if (reader == NULL) {
+        bmi_set_error("bmi_sequence_reader_from_file: Virtual memory "
+                      "exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    reader->source = source;
+    reader->width = header.width;
+    reader->height = header.height;
+    reader->flags = header.flags;
+    reader->key_frame = UINT64_MAX;
+    
+    if (!bmi_sequence_read_index(reader, length)
+        && bmi_sequence_scan(reader, length) != BMI_SUCCESS) {
+        bmi_sequence_reader_free(reader);
+        bmi_set_error("bmi_sequence_reader_from_file: Virtual memory "
+                      "exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    return reader;
+}
+
+uint64_t bmi_sequence_frame_count(const bmi_sequence_reader* reader) {
+    return reader->count;
+}
+
+// Reads bytes of a frame's payload, hashing them on the way when the sequence
+// has checksums
+static int bmi_sequence_fetch(bmi_sequence_reader* reader,
+                              bmi_hash_state* state, uint8_t* data,
+                              uint64_t size) {
+    for (uint64_t offset = 0; offset < size; offset += BMI_SEQUENCE_CHUNK) {
+        const size_t chunk = size - offset < BMI_SEQUENCE_CHUNK
+            ? (size_t)(size - offset) : BMI_SEQUENCE_CHUNK;
+        if (fread(data + offset, 1, chunk, reader->source) != chunk) {
+            return BMI_FAILURE;
+        }
+        if (reader->flags & BMI_FL_HAS_CHECKSUM) {
+            bmi_hash_update(state, data + offset, chunk);
+        }
+    }
+    return BMI_SUCCESS;
+}
+
+// Returns whether the checksum following a frame's payload matches it
+static int bmi_sequence_verify(bmi_sequence_reader* reader,
+                               bmi_hash_state* state) {
+    if (!(reader->flags & BMI_FL_HAS_CHECKSUM)) {
+        return 1;
+    }
+    uint8_t trailer[BMI_CHECKSUM_SIZE];
+    return fread(trailer, BMI_CHECKSUM_SIZE, 1, reader->source) == 1
+        && bmi_get_le(trailer, BMI_CHECKSUM_SIZE) == bmi_hash_digest(state);
+}
+
+// Reads the header of the given frame, leaving the file at its payload
+static int bmi_sequence_seek(bmi_sequence_reader* reader, uint64_t frame,
+                             bmi_frame_header* head) {
+    uint8_t packed[BMI_FRAME_HEADER_SIZE];
+    if (fseek(reader->source, (long)reader->offsets[frame], SEEK_SET) != 0
+        || fread(packed, BMI_FRAME_HEADER_SIZE, 1, reader->source) != 1) {
+        bmi_set_error("bmi_sequence_read_frame: An error occured while "
+                      "reading the frame");
+        return BMI_FAILURE;
+    }
+    bmi_frame_header_unpack(head, packed);
+    return BMI_SUCCESS;
+}
+
+// Returns the flags of the frames read from the sequence
+static uint32_t bmi_sequence_frame_flags(const bmi_sequence_reader* reader) {
+    return reader->flags & ~(uint32_t)BMI_FL_IS_SEQUENCE;
+}
+
+// Makes the given keyframe the one deltas are applied to
+static int bmi_sequence_load_key(bmi_sequence_reader* reader, uint64_t frame) {
+    if (reader->key_frame == frame) {
+        return BMI_SUCCESS;
+    }
+    if (reader->key == NULL) {
+        reader->key = bmi_buffer_new(reader->width,
+                                     reader->height,
+                                     bmi_sequence_frame_flags(reader));
+        if (reader->key == NULL) {
+            bmi_set_error("bmi_sequence_read_frame: Virtual memory "
+                          "exhausted");
+            return BMI_FAILURE;
+        }
+    }
+    bmi_frame_header head;
+    if (bmi_sequence_seek(reader, frame, &head) != BMI_SUCCESS) {
+        return BMI_FAILURE;
+    }
+    if (head.kind != BMI_FRAME_KEY
+        || head.size != bmi_buffer_content_size(reader->key)) {
+        bmi_set_error("bmi_sequence_read_frame: Frame is corrupt");
+        return BMI_FAILURE;
+    }
+    
+    // The cached keyframe is invalid until it has been read in whole
+    reader->key_frame = UINT64_MAX;
+    bmi_hash_state state;
+    bmi_hash_init(&state);
+    if (bmi_sequence_fetch(reader, &state, reader->key->contents, head.size)
+        != BMI_SUCCESS) {
+        bmi_set_error("bmi_sequence_read_frame: An error occured while "
+                      "reading the frame");
+        return BMI_FAILURE;
+    }
+    if (!bmi_sequence_verify(reader, &state)) {
+        bmi_set_error("bmi_sequence_read_frame: Frame contents do not match "
+                      "checksum");
+        return BMI_FAILURE;
+    }
+    reader->key_frame = frame;
+    return BMI_SUCCESS;
+}
+
+// Reads the changed rows of a delta frame over the keyframe already copied
+// into the buffer
+static int bmi_sequence_apply_delta(bmi_sequence_reader* reader,
+                                    const bmi_frame_header* head,
+                                    bmi_buffer* buffer) {
+    const size_t row_size = bmi_frame_row_size(reader->width, reader->flags);
+    uint8_t* table = malloc((size_t)head->ranges * BMI_RANGE_SIZE + 1);
+    if (table == NULL) {
+        bmi_set_error("bmi_sequence_read_frame: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    bmi_hash_state state;
+    bmi_hash_init(&state);
+    if (bmi_sequence_fetch(reader, &state, table,
+                           (uint64_t)head->ranges * BMI_RANGE_SIZE)
+        != BMI_SUCCESS) {
+        free(table);
+        bmi_set_error("bmi_sequence_read_frame: An error occured while "
+                      "reading the frame");
+        return BMI_FAILURE;
+    }
+    
+    // Every range has to lie within the frame and together they have to
+    // account for the whole payload
+    uint64_t size = (uint64_t)head->ranges * BMI_RANGE_SIZE;
+    for (uint32_t i = 0; i < head->ranges; i++) {
+        const uint64_t first = bmi_get_le(table + i * BMI_RANGE_SIZE, 4);
+        const uint64_t rows = bmi_get_le(table + i * BMI_RANGE_SIZE + 4, 4);
+        if (first + rows > buffer->height) {
+            size = UINT64_MAX;
+            break;
+        }
+        size += rows * row_size;
+    }
+    if (size != head->size) {
+        free(table);
+        bmi_set_error("bmi_sequence_read_frame: Frame is corrupt");
+        return BMI_FAILURE;
+    }
+    
+    // Frames are read in row-major order, so each range is contiguous
+    for (uint32_t i = 0; i < head->ranges; i++) {
+        const uint32_t first = (uint32_t)bmi_get_le(table + i * BMI_RANGE_SIZE,
+                                                    4);
+        const uint32_t rows = (uint32_t)bmi_get_le(table + i * BMI_RANGE_SIZE
+                                                   + 4, 4);
+        if (bmi_sequence_fetch(reader, &state,
+                               buffer->contents + (size_t)first * row_size,
+                               (uint64_t)rows * row_size) != BMI_SUCCESS) {
+            free(table);
+            bmi_set_error("bmi_sequence_read_frame: An error occured while "
+                          "reading the frame");
+            return BMI_FAILURE;
+        }
+    }
+    free(table);
+    
+    if (!bmi_sequence_verify(reader, &state)) {
+        bmi_set_error("bmi_sequence_read_frame: Frame contents do not match "
+                      "checksum");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+bmi_buffer* bmi_sequence_read_frame(bmi_sequence_reader* reader,
+                                    uint64_t frame) {
+    if (frame >= reader->count) {
+        bmi_set_error("bmi_sequence_read_frame: Frame is out of range");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_frame_header head;
+    if (bmi_sequence_seek(reader, frame, &head) != BMI_SUCCESS) {
+        return BMI_PTR_FAILURE;
+    }
+    const uint64_t key = head.kind == BMI_FRAME_DELTA ? head.key : frame;
+    if (key >= frame && head.kind == BMI_FRAME_DELTA) {
+        bmi_set_error("bmi_sequence_read_frame: Frame is corrupt");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Consecutive deltas of one keyframe only read the keyframe once
+    if (bmi_sequence_load_key(reader, key) != BMI_SUCCESS) {
+        return BMI_PTR_FAILURE;
+    }
+    bmi_buffer* buffer = bmi_buffer_new(reader->width,
+                                        reader->height,
+                                        bmi_sequence_frame_flags(reader));
+    if (buffer == NULL) {
+        bmi_set_error("bmi_sequence_read_frame: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    memcpy(buffer->contents, reader->key->contents,
+           bmi_buffer_content_size(buffer));
+    if (head.kind == BMI_FRAME_DELTA) {
+        if (bmi_sequence_seek(reader, frame, &head) != BMI_SUCCESS
+            || bmi_sequence_apply_delta(reader, &head, buffer)
+               != BMI_SUCCESS) {
+            bmi_buffer_free(buffer);
+            return BMI_PTR_FAILURE;
+        }
+    }
+    return buffer;
+}
+
+void bmi_sequence_reader_free(bmi_sequence_reader* reader) {
+    if (reader->key != NULL) {
+        bmi_buffer_free(reader->key);
+    }
+    free(reader->offsets);
+    free(reader);
+}
+
+bmi_sequence_writer* bmi_sequence_writer_from_file(FILE* file,
+                                                   uint32_t interval) {
+    // Appending starts from what a reader finds in the file
+    bmi_sequence_reader* reader = bmi_sequence_reader_from_file(file);
+    if (reader == NULL) {
+        return BMI_PTR_FAILURE;
+    }
+    bmi_sequence_writer* writer = bmi_sequence_writer_alloc(file,
+                                                            reader->width,
+                                                            reader->height,
+                                                            reader->flags,
+                                                            interval);
+    if (writer == NULL) {
+        bmi_sequence_reader_free(reader);
+        bmi_set_error("bmi_sequence_writer_from_file: Virtual memory "
+                      "exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Deltas continue against the last keyframe
+    if (reader->count > 0) {
+        bmi_frame_header head;
+        uint64_t key = reader->count - 1;
+        if (bmi_sequence_seek(reader, key, &head) == BMI_SUCCESS
+            && head.kind == BMI_FRAME_DELTA) {
+            key = head.key;
+        }
+        if (bmi_sequence_load_key(reader, key) == BMI_SUCCESS) {
+            writer->key = reader->key;
+            writer->key_frame = key;
+            reader->key = NULL;
+        }
+    }
+    
+    // New frames overwrite the old index, which is written again on free
+    writer->offsets = reader->offsets;
+    writer->count = reader->count;
+    writer->capacity = reader->count;
+    writer->position = reader->end;
+    reader->offsets = NULL;
+    bmi_sequence_reader_free(reader);
+    if (writer->count > 0 && writer->key == NULL) {
+        bmi_sequence_writer_release(writer);
+        return BMI_PTR_FAILURE;
+    }
+    
+    if (fseek(file, (long)writer->position, SEEK_SET) != 0) {
+        bmi_sequence_writer_release(writer);
+        bmi_set_error("bmi_sequence_writer_from_file: Failed to seek");
+        return BMI_PTR_FAILURE;
+    }
+    return writer;
+}
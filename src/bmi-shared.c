@@ -0,0 +1,473 @@
+// src: bmi-shared.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+// memfd_create, MAP_ANONYMOUS, mkstemp
+#define _GNU_SOURCE
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-shared.h"
+
+// bmi_set_error, BMI_PTR_FAILURE
+#include "bmi-error.h"
+
+// BMI_COMPONENT_SIZE_FROM_FL, BMI_TILE_COUNT, BMI_FL_IS_SHARED
+#include "bmi-file.h"
+
+// bmi_clip_rect
+#include "bmi-geometry.h"
+
+// bmi_buffer_storage_size
+#include "bmi-memory.h"
+
+// pthread_mutex_init, pthread_mutex_lock, pthread_mutex_unlock,
+// pthread_mutex_destroy
+#include <pthread.h>
+
+// malloc, calloc, realloc, free, mkstemp
+#include <stdlib.h>
+
+// memcpy, memset
+#include <string.h>
+
+// mmap, munmap, mprotect, memfd_create
+#include <sys/mman.h>
+
+// ftruncate, pwrite, close, unlink, sysconf
+#include <unistd.h>
+
+// Reference counts are allocated in chunks of this many slots, which never
+// move once published, so that they can be found without taking the lock
+#define BMI_COUNT_CHUNK_SHIFT 16
+#define BMI_COUNT_CHUNK ((uint64_t)1 << BMI_COUNT_CHUNK_SHIFT)
+#define BMI_COUNT_CHUNKS 4096
+
+// The pixels of every handle onto the same buffer live in blocks of one memory
+// file, each shared by as many handles as its reference count says
+typedef struct {
+    int fd;
+    size_t block_size;
+    
+    // The number of handles still using the file
+    uint32_t handles;
+    
+    // Guards the allocation of slots, but not their reference counts
+    pthread_mutex_t lock;
+    uint64_t slots;
+    uint64_t capacity;
+    uint64_t* free;
+    uint64_t free_count;
+    uint64_t free_capacity;
+    uint32_t* counts[BMI_COUNT_CHUNKS];
+} bmi_shared_pool;
+
+typedef struct {
+    bmi_shared_pool* pool;
+    uint8_t* base;
+    size_t mapping_size;
+    
+    // Each block is this many tiles, so that it covers whole pages
+    uint64_t unit;
+    uint64_t blocks;
+    
+    // The slot each block is mapped from, and whether only this handle uses
+    // the block and has it mapped writable
+    uint64_t* slots;
+    uint64_t* owned;
+} bmi_shared_handle;
+
+// The header of a shared buffer ends a page of its own, so that its contents
+// begin on the next page, and is preceded by a pointer to its handle
+#define BMI_SHARED_HANDLE(buffer) \
+    (((bmi_shared_handle**)(buffer))[-1])
+
+#define BMI_OWNED(handle, block) \
+    ((handle)->owned[(block) >> 6] >> ((block) & 63) & 1)
+
+static size_t bmi_page_size(void) {
+    const long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (size_t)page : 4096;
+}
+
+static uint32_t* bmi_slot_count(bmi_shared_pool* pool, uint64_t slot) {
+    uint32_t* chunk = __atomic_load_n(
+        &pool->counts[slot >> BMI_COUNT_CHUNK_SHIFT], __ATOMIC_ACQUIRE);
+    return chunk + (slot & (BMI_COUNT_CHUNK - 1));
+}
+
+static int bmi_pool_grow(bmi_shared_pool* pool, uint64_t capacity) {
+    if (capacity > BMI_COUNT_CHUNK * BMI_COUNT_CHUNKS
+        || capacity > (uint64_t)INT64_MAX / pool->block_size) {
+        return BMI_FAILURE;
+    }
+    for (uint64_t chunk = pool->capacity >> BMI_COUNT_CHUNK_SHIFT;
+         chunk < (capacity + BMI_COUNT_CHUNK - 1) >> BMI_COUNT_CHUNK_SHIFT;
+         chunk++) {
+        if (pool->counts[chunk] == NULL) {
+            uint32_t* counts = calloc(BMI_COUNT_CHUNK, sizeof(uint32_t));
+            if (counts == NULL) {
+                return BMI_FAILURE;
+            }
+            __atomic_store_n(&pool->counts[chunk], counts, __ATOMIC_RELEASE);
+        }
+    }
+    if (ftruncate(pool->fd, (off_t)(capacity * pool->block_size)) != 0) {
+        return BMI_FAILURE;
+    }
+    pool->capacity = capacity;
+    return BMI_SUCCESS;
+}
+
+// Takes a free slot, with a single reference held by the caller
+static int bmi_slot_alloc(bmi_shared_pool* pool, uint64_t* slot) {
+    int result = BMI_SUCCESS;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_count > 0) {
+        *slot = pool->free[--pool->free_count];
+    } else if (pool->slots < pool->capacity
+               || bmi_pool_grow(pool, 2 * pool->capacity) == BMI_SUCCESS) {
+        *slot = pool->slots++;
+    } else {
+        result = BMI_FAILURE;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (result == BMI_SUCCESS) {
+        __atomic_store_n(bmi_slot_count(pool, *slot), 1, __ATOMIC_RELAXED);
+    }
+    return result;
+}
+
+// Drops a reference to a slot, which is reused once no handle maps it
+static void bmi_slot_release(bmi_shared_pool* pool, uint64_t slot) {
+    if (__atomic_sub_fetch(bmi_slot_count(pool, slot), 1, __ATOMIC_ACQ_REL)
+        != 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_count == pool->free_capacity) {
+        const uint64_t capacity = pool->free_capacity
+            ? 2 * pool->free_capacity : 64;
+        uint64_t* grown = realloc(pool->free, capacity * sizeof(uint64_t));
+        if (grown != NULL) {
+            pool->free = grown;
+            pool->free_capacity = capacity;
+        }
+    }
+    // A slot that cannot be remembered is only lost until the file is closed
+    if (pool->free_count < pool->free_capacity) {
+        pool->free[pool->free_count++] = slot;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void bmi_pool_free(bmi_shared_pool* pool) {
+    close(pool->fd);
+    for (size_t i = 0; i < BMI_COUNT_CHUNKS && pool->counts[i] != NULL; i++) {
+        free(pool->counts[i]);
+    }
+    free(pool->free);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+static int bmi_memory_file(void) {
+#ifdef MFD_CLOEXEC
+    return memfd_create("bmi", MFD_CLOEXEC);
+#else
+    // Otherwise fall back to an unlinked temporary file
+    char path[] = "/tmp/bmi-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+#endif
+}
+
+// Maps a new handle onto the given slots, taking ownership of the array when it
+// succeeds. The blocks are mapped writable only for a handle that owns all of
+// them.
+static bmi_buffer* bmi_shared_map(bmi_shared_pool* pool,
+                                  const bmi_buffer* header, uint64_t unit,
+                                  uint64_t blocks, uint64_t* slots,
+                                  int owned) {
+    const size_t page = bmi_page_size();
+    bmi_shared_handle* handle = malloc(sizeof(bmi_shared_handle));
+    uint64_t* bits = calloc((size_t)((blocks + 63) / 64) + 1,
+                            sizeof(uint64_t));
+    if (handle == NULL || bits == NULL
+        || blocks > (SIZE_MAX - page) / pool->block_size) {
+        free(handle);
+        free(bits);
+        return NULL;
+    }
+    handle->mapping_size = page + (size_t)blocks * pool->block_size;
+    handle->base = mmap(NULL, handle->mapping_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (handle->base == MAP_FAILED) {
+        free(handle);
+        free(bits);
+        return NULL;
+    }
+    
+    // Map each run of consecutive slots at once, so that a new buffer takes
+    // a single mapping
+    const int protection = owned ? PROT_READ | PROT_WRITE : PROT_READ;
+    uint8_t* contents = handle->base + page;
+    for (uint64_t block = 0; block < blocks;) {
+        uint64_t run = 1;
+        while (block + run < blocks
+               && slots[block + run] == slots[block] + run) {
+            run++;
+        }
+        if (mmap(contents + block * pool->block_size,
+                 (size_t)run * pool->block_size, protection,
+                 MAP_SHARED | MAP_FIXED, pool->fd,
+                 (off_t)(slots[block] * pool->block_size)) == MAP_FAILED) {
+            munmap(handle->base, handle->mapping_size);
+            free(handle);
+            free(bits);
+            return NULL;
+        }
+        block += run;
+    }
+    if (owned) {
+        memset(bits, 0xff, (size_t)((blocks + 63) / 64) * sizeof(uint64_t));
+    }
+    
+    handle->pool = pool;
+    handle->unit = unit;
+    handle->blocks = blocks;
+    handle->slots = slots;
+    handle->owned = bits;
+    bmi_buffer* buffer = (bmi_buffer*)(contents - sizeof(bmi_buffer));
+    memcpy(buffer, header, sizeof(bmi_buffer));
+    BMI_SHARED_HANDLE(buffer) = handle;
+    return buffer;
+}
+
+bmi_buffer* bmi_shared_new(uint32_t width, uint32_t height, uint32_t flags) {
+    if (bmi_buffer_storage_size(width, height, flags) == 0) {
+        return NULL;
+    }
+    
+    // Blocks are the fewest whole tiles that also make whole pages, which is
+    // a single tile unless pages are larger than tiles
+    const size_t page = bmi_page_size();
+    const size_t tile = (size_t)BMI_COMPONENT_SIZE_FROM_FL(flags)
+                        << (2 * BMI_TILE_SHIFT);
+    size_t a = page;
+    size_t b = tile;
+    while (b != 0) {
+        const size_t r = a % b;
+        a = b;
+        b = r;
+    }
+    const uint64_t unit = page / a;
+    const uint64_t tiles = (uint64_t)BMI_TILE_COUNT(width)
+                           * BMI_TILE_COUNT(height);
+    const uint64_t blocks = (tiles + unit - 1) / unit;
+    
+    bmi_shared_pool* pool = calloc(1, sizeof(bmi_shared_pool));
+    uint64_t* slots = malloc((size_t)(blocks ? blocks : 1) * sizeof(uint64_t));
+    if (pool == NULL || slots == NULL) {
+        free(pool);
+        free(slots);
+        return NULL;
+    }
+    pool->block_size = (size_t)unit * tile;
+    pool->handles = 1;
+    pool->fd = bmi_memory_file();
+    if (pool->fd < 0) {
+        free(pool);
+        free(slots);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    if (bmi_pool_grow(pool, blocks ? blocks : 1) != BMI_SUCCESS) {
+        bmi_pool_free(pool);
+        free(slots);
+        return NULL;
+    }
+    for (uint64_t block = 0; block < blocks; block++) {
+        slots[block] = block;
+        *bmi_slot_count(pool, block) = 1;
+    }
+    pool->slots = blocks;
+    
+    const bmi_buffer header = {
+        .width = width,
+        .height = height,
+        .flags = flags
+    };
+    bmi_buffer* buffer = bmi_shared_map(pool, &header, unit, blocks, slots, 1);
+    if (buffer == NULL) {
+        bmi_pool_free(pool);
+        free(slots);
+    }
+    return buffer;
+}
+
+void bmi_shared_free(bmi_buffer* buffer) {
+    bmi_shared_handle* handle = BMI_SHARED_HANDLE(buffer);
+    bmi_shared_pool* pool = handle->pool;
+    for (uint64_t block = 0; block < handle->blocks; block++) {
+        bmi_slot_release(pool, handle->slots[block]);
+    }
+    munmap(handle->base, handle->mapping_size);
+    free(handle->slots);
+    free(handle->owned);
+    free(handle);
+    if (__atomic_sub_fetch(&pool->handles, 1, __ATOMIC_ACQ_REL) == 0) {
+        bmi_pool_free(pool);
+    }
+}
+
+// Makes a block writable by this handle alone, copying it into a slot of its
+// own unless every other handle has already let go of it
+static int bmi_shared_own(bmi_buffer* buffer, bmi_shared_handle* handle,
+                          uint64_t block) {
+    bmi_shared_pool* pool = handle->pool;
+    uint8_t* address = buffer->contents + block * pool->block_size;
+    const uint64_t slot = handle->slots[block];
+    
+    if (__atomic_load_n(bmi_slot_count(pool, slot), __ATOMIC_ACQUIRE) == 1) {
+        if (mprotect(address, pool->block_size,
+                     PROT_READ | PROT_WRITE) != 0) {
+            return BMI_FAILURE;
+        }
+    } else {
+        // The copy is written to the file straight from this handle's view of
+        // the block, and then mapped over it
+        uint64_t copy;
+        if (bmi_slot_alloc(pool, &copy) != BMI_SUCCESS) {
+            return BMI_FAILURE;
+        }
+        const off_t offset = (off_t)(copy * pool->block_size);
+        size_t written = 0;
+        while (written < pool->block_size) {
+            const ssize_t result = pwrite(pool->fd, address + written,
+                                          pool->block_size - written,
+                                          offset + (off_t)written);
+            if (result <= 0) {
+                break;
+            }
+            written += (size_t)result;
+        }
+        if (written < pool->block_size
+            || mmap(address, pool->block_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_FIXED, pool->fd, offset) == MAP_FAILED) {
+            bmi_slot_release(pool, copy);
+            return BMI_FAILURE;
+        }
+        handle->slots[block] = copy;
+        bmi_slot_release(pool, slot);
+    }
+    
+    handle->owned[block >> 6] |= (uint64_t)1 << (block & 63);
+    return BMI_SUCCESS;
+}
+
+int bmi_shared_touch(bmi_buffer* buffer, size_t index) {
+    bmi_shared_handle* handle = BMI_SHARED_HANDLE(buffer);
+    const uint64_t block = (index >> (2 * BMI_TILE_SHIFT)) / handle->unit;
+    if (BMI_OWNED(handle, block)) {
+        return BMI_SUCCESS;
+    }
+    return bmi_shared_own(buffer, handle, block);
+}
+
+int bmi_shared_prepare(bmi_buffer* buffer, uint32_t x, uint32_t y,
+                       uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0) {
+        return BMI_SUCCESS;
+    }
+    bmi_shared_handle* handle = BMI_SHARED_HANDLE(buffer);
+    const size_t columns = BMI_TILE_COUNT(buffer->width);
+    const size_t left = x >> BMI_TILE_SHIFT;
+    const size_t right = ((size_t)x + width - 1) >> BMI_TILE_SHIFT;
+    const size_t top = y >> BMI_TILE_SHIFT;
+    const size_t bottom = ((size_t)y + height - 1) >> BMI_TILE_SHIFT;
+    for (size_t row = top; row <= bottom; row++) {
+        for (size_t column = left; column <= right; column++) {
+            const uint64_t block = (row * columns + column) / handle->unit;
+            if (!BMI_OWNED(handle, block)
+                && bmi_shared_own(buffer, handle, block) != BMI_SUCCESS) {
+                return BMI_FAILURE;
+            }
+        }
+    }
+    return BMI_SUCCESS;
+}
+
+bmi_buffer* bmi_buffer_snapshot(bmi_buffer* buffer) {
+    if (!(buffer->flags & BMI_FL_IS_SHARED)) {
+        bmi_set_error("bmi_buffer_snapshot: Buffer is not shared");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_shared_handle* handle = BMI_SHARED_HANDLE(buffer);
+    bmi_shared_pool* pool = handle->pool;
+    const size_t slots_size = (size_t)(handle->blocks ? handle->blocks : 1)
+                              * sizeof(uint64_t);
+    uint64_t* slots = malloc(slots_size);
+    if (slots == NULL) {
+        bmi_set_error("bmi_buffer_snapshot: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    memcpy(slots, handle->slots, (size_t)handle->blocks * sizeof(uint64_t));
+    
+    // Every block gains a reference before it becomes visible through the
+    // snapshot
+    for (uint64_t block = 0; block < handle->blocks; block++) {
+        __atomic_add_fetch(bmi_slot_count(pool, slots[block]), 1,
+                           __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&pool->handles, 1, __ATOMIC_RELAXED);
+    bmi_buffer* snapshot = bmi_shared_map(pool, buffer, handle->unit,
+                                          handle->blocks, slots, 0);
+    if (snapshot == NULL) {
+        for (uint64_t block = 0; block < handle->blocks; block++) {
+            bmi_slot_release(pool, slots[block]);
+        }
+        __atomic_sub_fetch(&pool->handles, 1, __ATOMIC_RELAXED);
+        free(slots);
+        bmi_set_error("bmi_buffer_snapshot: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // The original no longer owns any block, so its next write to each copies
+    // it first
+    if (handle->blocks > 0) {
+        mprotect(buffer->contents, (size_t)handle->blocks * pool->block_size,
+                 PROT_READ);
+        memset(handle->owned, 0,
+               (size_t)((handle->blocks + 63) / 64) * sizeof(uint64_t));
+    }
+    return snapshot;
+}
+
+int bmi_buffer_unshare(bmi_buffer* buffer, bmi_rect region) {
+    if (!(buffer->flags & BMI_FL_IS_SHARED)) {
+        return BMI_SUCCESS;
+    }
+    bmi_clip_rect(&region, BMI_RECT(0, 0, buffer->width, buffer->height));
+    if (bmi_shared_prepare(buffer, region.x, region.y, region.width,
+                           region.height) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_unshare: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
@@ -0,0 +1,278 @@
+// src: bmi-stats.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-stats.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_kernels, BMI_KERNEL_ADDRESS, BMI_KERNEL_RUN
+#include "bmi-kernel.h"
+
+// bmi_parallel_for, bmi_parallel_parts
+#include "bmi-parallel.h"
+
+// bmi_buffer_palette
+#include "bmi-palette.h"
+
+// calloc, free
+#include <stdlib.h>
+
+// memset, memcpy
+#include <string.h>
+
+// Incrementing the same counter in back-to-back iterations stalls each store
+// on the load before it, so neighboring values are counted into separate
+// sub-histograms that are summed at the end
+#define BMI_SUBHISTOGRAMS 4
+
+// The 32-bit sub-histograms are flushed before any counter could overflow
+#define BMI_FLUSH_PIXELS (1u << 30)
+
+// Rows are split into parts of at least this many pixels
+#define BMI_HISTOGRAM_GRAIN (1u << 16)
+
+typedef uint32_t bmi_subhistograms[BMI_SUBHISTOGRAMS][BMI_MAX_CHANNELS][256];
+
+static void bmi_count_gray(bmi_subhistograms sub, const uint8_t* src,
+                           size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        sub[0][0][src[i]]++;
+        sub[1][0][src[i + 1]]++;
+        sub[2][0][src[i + 2]]++;
+        sub[3][0][src[i + 3]]++;
+    }
+    for (; i < count; i++) {
+        sub[0][0][src[i]]++;
+    }
+}
+
+static void bmi_count_rgb(bmi_subhistograms sub, const uint8_t* src,
+                          size_t count) {
+    // The channels interleave already, so alternating pixels is enough
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const uint8_t* p = src + i * 3;
+        sub[0][0][p[0]]++;
+        sub[0][1][p[1]]++;
+        sub[0][2][p[2]]++;
+        sub[1][0][p[3]]++;
+        sub[1][1][p[4]]++;
+        sub[1][2][p[5]]++;
+    }
+    for (; i < count; i++) {
+        const uint8_t* p = src + i * 3;
+        sub[0][0][p[0]]++;
+        sub[0][1][p[1]]++;
+        sub[0][2][p[2]]++;
+    }
+}
+
+static void bmi_flush_subhistograms(bmi_subhistograms sub,
+                                    bmi_histogram* histogram) {
+    for (uint32_t s = 0; s < BMI_SUBHISTOGRAMS; s++) {
+        for (uint32_t c = 0; c < BMI_MAX_CHANNELS; c++) {
+            for (uint32_t v = 0; v < 256; v++) {
+                histogram->counts[c][v] += sub[s][c][v];
+            }
+        }
+    }
+    memset(sub, 0, sizeof(bmi_subhistograms));
+}
+
+typedef struct {
+    const bmi_buffer* buffer;
+    bmi_rect region;
+    uint32_t parts;
+    bmi_histogram* partials;
+} bmi_histogram_job;
+
+static void bmi_histogram_part(void* context, uint32_t index) {
+    const bmi_histogram_job* job = context;
+    const bmi_buffer* buffer = job->buffer;
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    const bmi_rect region = job->region;
+    const uint32_t first = region.y + (uint32_t)((uint64_t)region.height
+                                                 * index / job->parts);
+    const uint32_t last = region.y + (uint32_t)((uint64_t)region.height
+                                                * (index + 1) / job->parts);
+    
+    bmi_subhistograms sub;
+    memset(sub, 0, sizeof(sub));
+    uint64_t pending = 0;
+    for (uint32_t y = first; y < last; y++) {
+        for (uint32_t x = region.x; x < region.x + region.width;) {
+            const uint32_t rest = region.x + region.width - x;
+            const uint32_t length = (uint32_t)BMI_KERNEL_RUN(
+                buffer, x, rest < BMI_FLUSH_PIXELS ? rest : BMI_FLUSH_PIXELS);
+            if (pending + length > BMI_FLUSH_PIXELS) {
+                bmi_flush_subhistograms(sub, &job->partials[index]);
+                pending = 0;
+            }
+            const uint8_t* run = BMI_KERNEL_ADDRESS(buffer, kernels, x, y);
+            if (kernels->size == 1) {
+                bmi_count_gray(sub, run, length);
+            } else {
+                bmi_count_rgb(sub, run, length);
+            }
+            pending += length;
+            x += length;
+        }
+    }
+    bmi_flush_subhistograms(sub, &job->partials[index]);
+}
+
+// Counts the clipped region into the histogram, failing only when there is
+// not enough memory for the partial histograms
+static int bmi_histogram_region(const bmi_buffer* buffer, bmi_rect region,
+                                bmi_histogram* histogram) {
+    bmi_clip_rect(&region, BMI_RECT(0, 0, buffer->width, buffer->height));
+    memset(histogram, 0, sizeof(bmi_histogram));
+    const int indexed = (buffer->flags & BMI_FL_IS_PALETTE) != 0;
+    histogram->channels = indexed ? 3
+        : (uint32_t)bmi_buffer_kernels(buffer)->size;
+    if (region.width == 0 || region.height == 0) {
+        return BMI_SUCCESS;
+    }
+    
+    // Each part of the rows counts into its own histogram, which are then
+    // reduced on the calling thread
+    const uint64_t grain = (BMI_HISTOGRAM_GRAIN + region.width - 1)
+                           / region.width;
+    bmi_histogram_job job = {
+        .buffer = buffer,
+        .region = region,
+        .parts = bmi_parallel_parts(region.height, grain),
+        .partials = NULL
+    };
+    job.partials = calloc(job.parts, sizeof(bmi_histogram));
+    if (job.partials == NULL) {
+        return BMI_FAILURE;
+    }
+    bmi_parallel_for(job.parts, bmi_histogram_part, &job);
+    
+    for (uint32_t i = 0; i < job.parts; i++) {
+        for (uint32_t c = 0; c < BMI_MAX_CHANNELS; c++) {
+            for (uint32_t v = 0; v < 256; v++) {
+                histogram->counts[c][v] += job.partials[i].counts[c][v];
+            }
+        }
+    }
+    free(job.partials);
+    
+    // Palette buffers count their indices, which are then spread over the
+    // channels of their colors
+    if (indexed) {
+        const bmi_palette* palette = bmi_buffer_palette(buffer);
+        uint64_t indices[256];
+        memcpy(indices, histogram->counts[0], sizeof(indices));
+        memset(histogram->counts[0], 0, sizeof(indices));
+        for (uint32_t v = 0; v < 256; v++) {
+            const bmi_pixel color = palette->colors[v];
+            histogram->counts[0][BMI_RGB_R(color)] += indices[v];
+            histogram->counts[1][BMI_RGB_G(color)] += indices[v];
+            histogram->counts[2][BMI_RGB_B(color)] += indices[v];
+        }
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_histogram_rect(const bmi_buffer* buffer, bmi_rect region,
+                              bmi_histogram* histogram) {
+    if (bmi_histogram_region(buffer, region, histogram) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_histogram_rect: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_histogram(const bmi_buffer* buffer, bmi_histogram* histogram) {
+    if (bmi_histogram_region(buffer,
+                             BMI_RECT(0, 0, buffer->width, buffer->height),
+                             histogram) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_histogram: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+// Every channel is 8 bits, so the statistics follow exactly from the
+// histogram rather than needing another pass over the pixels
+int bmi_histogram_stats(const bmi_histogram* histogram, bmi_stats* stats) {
+    memset(stats, 0, sizeof(bmi_stats));
+    stats->channels = histogram->channels;
+    for (uint32_t v = 0; v < 256; v++) {
+        stats->pixels += histogram->counts[0][v];
+    }
+    if (stats->pixels == 0) {
+        bmi_set_error("bmi_histogram_stats: Histogram is empty");
+        return BMI_FAILURE;
+    }
+    
+    for (uint32_t c = 0; c < histogram->channels; c++) {
+        const uint64_t* counts = histogram->counts[c];
+        uint64_t sum = 0;
+        stats->min[c] = 255;
+        for (uint32_t v = 0; v < 256; v++) {
+            if (counts[v] != 0) {
+                stats->min[c] = v < stats->min[c] ? v : stats->min[c];
+                stats->max[c] = v;
+            }
+            sum += counts[v] * v;
+        }
+        stats->mean[c] = (double)sum / (double)stats->pixels;
+        
+        double squares = 0.0;
+        for (uint32_t v = 0; v < 256; v++) {
+            const double delta = (double)v - stats->mean[c];
+            squares += (double)counts[v] * delta * delta;
+        }
+        stats->variance[c] = squares / (double)stats->pixels;
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_stats_rect(const bmi_buffer* buffer, bmi_rect region,
+                          bmi_stats* stats) {
+    bmi_histogram histogram;
+    if (bmi_histogram_region(buffer, region, &histogram) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_stats_rect: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    if (bmi_histogram_stats(&histogram, stats) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_stats_rect: Region is empty");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_stats(const bmi_buffer* buffer, bmi_stats* stats) {
+    bmi_histogram histogram;
+    if (bmi_histogram_region(buffer,
+                             BMI_RECT(0, 0, buffer->width, buffer->height),
+                             &histogram) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_stats: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    if (bmi_histogram_stats(&histogram, stats) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_stats: Region is empty");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
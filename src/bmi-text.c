@@ -0,0 +1,630 @@
+// src: bmi-text.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-text.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_kernels, bmi_kernel_blit, BMI_FORMAT_FROM_FL
+#include "bmi-kernel.h"
+
+// BMI_PALETTE_INDEX
+#include "bmi-palette.h"
+
+// malloc, realloc, calloc, free, strtol
+#include <stdlib.h>
+
+// strncmp, strchr, memset
+#include <string.h>
+
+#define BMI_FONT_GLYPHS 256
+
+// The number of format and color combinations kept rendered per font
+#define BMI_FONT_ATLASES 8
+
+// A horizontal run of lit pixels within a glyph cell
+typedef struct {
+    uint16_t row;
+    uint16_t x;
+    uint16_t length;
+} bmi_glyph_run;
+
+typedef struct {
+    int present;
+    uint32_t advance;
+    // Offset, in pixels, of the cell within the coverage map and every atlas
+    size_t offset;
+    size_t first_run;
+    size_t run_count;
+} bmi_glyph;
+
+// Every glyph cell rendered in one format with one pair of colors. A
+// transparent background is recorded as BMI_PIXEL_INVALID, and the unlit
+// pixels of such an atlas are never read.
+typedef struct {
+    uint8_t* cells;
+    uint32_t format;
+    bmi_pixel pixel;
+    bmi_pixel background;
+} bmi_glyph_atlas;
+
+struct bmi_font {
+    uint32_t line_height;
+    uint32_t default_glyph;
+    bmi_glyph glyphs[BMI_FONT_GLYPHS];
+    
+    // One byte per pixel of every glyph cell, nonzero where lit
+    uint8_t* coverage;
+    size_t coverage_size;
+    size_t coverage_capacity;
+    
+    bmi_glyph_run* runs;
+    size_t run_count;
+    
+    bmi_glyph_atlas atlases[BMI_FONT_ATLASES];
+    uint32_t next_atlas;
+};
+
+#define BMI_BUILTIN_ADVANCE 6
+#define BMI_BUILTIN_LINE_HEIGHT 10
+#define BMI_BUILTIN_ROWS 9
+#define BMI_BUILTIN_FIRST ' '
+#define BMI_BUILTIN_LAST '~'
+
+// Printable ASCII, five pixels wide with the leftmost pixel in bit 4. Rows 0
+// through 6 sit on the baseline and rows 7 and 8 hold descenders.
+static const uint8_t bmi_builtin_glyphs[][BMI_BUILTIN_ROWS] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ' '
+    { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00 }, // '!'
+    { 0x0a, 0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '"'
+    { 0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a, 0x00, 0x00 }, // '#'
+    { 0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04, 0x00, 0x00 }, // '$'
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03, 0x00, 0x00 }, // '%'
+    { 0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d, 0x00, 0x00 }, // '&'
+    { 0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '\''
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02, 0x00, 0x00 }, // '('
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08, 0x00, 0x00 }, // ')'
+    { 0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00, 0x00, 0x00 }, // '*'
+    { 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00, 0x00, 0x00 }, // '+'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x04, 0x08 }, // ','
+    { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '-'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x00, 0x00 }, // '.'
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00, 0x00, 0x00 }, // '/'
+    { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e, 0x00, 0x00 }, // '0'
+    { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e, 0x00, 0x00 }, // '1'
+    { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f, 0x00, 0x00 }, // '2'
+    { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e, 0x00, 0x00 }, // '3'
+    { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02, 0x00, 0x00 }, // '4'
+    { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e, 0x00, 0x00 }, // '5'
+    { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e, 0x00, 0x00 }, // '6'
+    { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08, 0x00, 0x00 }, // '7'
+    { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e, 0x00, 0x00 }, // '8'
+    { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c, 0x00, 0x00 }, // '9'
+    { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00, 0x00, 0x00 }, // ':'
+    { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x04, 0x08, 0x00 }, // ';'
+    { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02, 0x00, 0x00 }, // '<'
+    { 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00, 0x00, 0x00 }, // '='
+    { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08, 0x00, 0x00 }, // '>'
+    { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04, 0x00, 0x00 }, // '?'
+    { 0x0e, 0x11, 0x01, 0x0d, 0x15, 0x15, 0x0e, 0x00, 0x00 }, // '@'
+    { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11, 0x00, 0x00 }, // 'A'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e, 0x00, 0x00 }, // 'B'
+    { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e, 0x00, 0x00 }, // 'C'
+    { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c, 0x00, 0x00 }, // 'D'
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f, 0x00, 0x00 }, // 'E'
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10, 0x00, 0x00 }, // 'F'
+    { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f, 0x00, 0x00 }, // 'G'
+    { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11, 0x00, 0x00 }, // 'H'
+    { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e, 0x00, 0x00 }, // 'I'
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c, 0x00, 0x00 }, // 'J'
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11, 0x00, 0x00 }, // 'K'
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f, 0x00, 0x00 }, // 'L'
+    { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11, 0x00, 0x00 }, // 'M'
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x00, 0x00 }, // 'N'
+    { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e, 0x00, 0x00 }, // 'O'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10, 0x00, 0x00 }, // 'P'
+    { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d, 0x00, 0x00 }, // 'Q'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11, 0x00, 0x00 }, // 'R'
+    { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e, 0x00, 0x00 }, // 'S'
+    { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x00 }, // 'T'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e, 0x00, 0x00 }, // 'U'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04, 0x00, 0x00 }, // 'V'
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a, 0x00, 0x00 }, // 'W'
+    { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11, 0x00, 0x00 }, // 'X'
+    { 0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x00, 0x00 }, // 'Y'
+    { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f, 0x00, 0x00 }, // 'Z'
+    { 0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e, 0x00, 0x00 }, // '['
+    { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00, 0x00, 0x00 }, // '\\'
+    { 0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e, 0x00, 0x00 }, // ']'
+    { 0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '^'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f, 0x00 }, // '_'
+    { 0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '`'
+    { 0x00, 0x00, 0x0e, 0x01, 0x0f, 0x11, 0x0f, 0x00, 0x00 }, // 'a'
+    { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1e, 0x00, 0x00 }, // 'b'
+    { 0x00, 0x00, 0x0e, 0x10, 0x10, 0x11, 0x0e, 0x00, 0x00 }, // 'c'
+    { 0x01, 0x01, 0x0d, 0x13, 0x11, 0x11, 0x0f, 0x00, 0x00 }, // 'd'
+    { 0x00, 0x00, 0x0e, 0x11, 0x1f, 0x10, 0x0e, 0x00, 0x00 }, // 'e'
+    { 0x06, 0x09, 0x08, 0x1c, 0x08, 0x08, 0x08, 0x00, 0x00 }, // 'f'
+    { 0x00, 0x00, 0x0f, 0x11, 0x11, 0x0f, 0x01, 0x11, 0x0e }, // 'g'
+    { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00, 0x00 }, // 'h'
+    { 0x04, 0x00, 0x0c, 0x04, 0x04, 0x04, 0x0e, 0x00, 0x00 }, // 'i'
+    { 0x02, 0x00, 0x06, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c }, // 'j'
+    { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12, 0x00, 0x00 }, // 'k'
+    { 0x0c, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e, 0x00, 0x00 }, // 'l'
+    { 0x00, 0x00, 0x1a, 0x15, 0x15, 0x11, 0x11, 0x00, 0x00 }, // 'm'
+    { 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00, 0x00 }, // 'n'
+    { 0x00, 0x00, 0x0e, 0x11, 0x11, 0x11, 0x0e, 0x00, 0x00 }, // 'o'
+    { 0x00, 0x00, 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 }, // 'p'
+    { 0x00, 0x00, 0x0f, 0x11, 0x11, 0x0f, 0x01, 0x01, 0x01 }, // 'q'
+    { 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10, 0x00, 0x00 }, // 'r'
+    { 0x00, 0x00, 0x0e, 0x10, 0x0e, 0x01, 0x1e, 0x00, 0x00 }, // 's'
+    { 0x08, 0x08, 0x1c, 0x08, 0x08, 0x09, 0x06, 0x00, 0x00 }, // 't'
+    { 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0d, 0x00, 0x00 }, // 'u'
+    { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0a, 0x04, 0x00, 0x00 }, // 'v'
+    { 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0a, 0x00, 0x00 }, // 'w'
+    { 0x00, 0x00, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x00, 0x00 }, // 'x'
+    { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0f, 0x01, 0x11, 0x0e }, // 'y'
+    { 0x00, 0x00, 0x1f, 0x02, 0x04, 0x08, 0x1f, 0x00, 0x00 }, // 'z'
+    { 0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02, 0x00, 0x00 }, // '{'
+    { 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x00 }, // '|'
+    { 0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08, 0x00, 0x00 }, // '}'
+    { 0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00, 0x00, 0x00 }, // '~'
+};
+
+static bmi_font* bmi_font_alloc(uint32_t line_height) {
+    bmi_font* font = calloc(1, sizeof(bmi_font));
+    if (font == NULL) {
+        return NULL;
+    }
+    font->line_height = line_height;
+    return font;
+}
+
+// Appends a blank cell for the glyph, returning its coverage or NULL if
+// allocation failed
+static uint8_t* bmi_font_add_glyph(bmi_font* font, uint32_t code,
+                                   uint32_t advance) {
+    const size_t size = (size_t)advance * font->line_height;
+    if (font->coverage_size + size > font->coverage_capacity) {
+        size_t capacity = font->coverage_capacity ? font->coverage_capacity
+                                                  : 4096;
+        while (capacity < font->coverage_size + size) {
+            capacity *= 2;
+        }
+        uint8_t* coverage = realloc(font->coverage, capacity);
+        if (coverage == NULL) {
+            return NULL;
+        }
+        font->coverage = coverage;
+        font->coverage_capacity = capacity;
+    }
+    
+    // A glyph defined twice keeps its later definition
+    bmi_glyph* glyph = &font->glyphs[code];
+    glyph->present = 1;
+    glyph->advance = advance;
+    glyph->offset = font->coverage_size;
+    font->coverage_size += size;
+    
+    uint8_t* cell = font->coverage + glyph->offset;
+    memset(cell, 0, size);
+    return cell;
+}
+
+// Splits every glyph into runs of lit pixels once the coverage is complete
+static int bmi_font_finish(bmi_font* font, uint32_t default_glyph) {
+    size_t capacity = 0;
+    for (uint32_t code = 0; code < BMI_FONT_GLYPHS; code++) {
+        bmi_glyph* glyph = &font->glyphs[code];
+        if (!glyph->present) {
+            continue;
+        }
+        glyph->first_run = font->run_count;
+        const uint8_t* cell = font->coverage + glyph->offset;
+        for (uint32_t row = 0; row < font->line_height; row++) {
+            const uint8_t* line = cell + (size_t)row * glyph->advance;
+            uint32_t x = 0;
+            while (x < glyph->advance) {
+                if (!line[x]) {
+                    x++;
+                    continue;
+                }
+                const uint32_t start = x;
+                while (x < glyph->advance && line[x]) {
+                    x++;
+                }
+                if (font->run_count == capacity) {
+                    capacity = capacity ? capacity * 2 : 1024;
+                    bmi_glyph_run* runs = realloc(font->runs, capacity
+                                                  * sizeof(bmi_glyph_run));
+                    if (runs == NULL) {
+                        return BMI_FAILURE;
+                    }
+                    font->runs = runs;
+                }
+                font->runs[font->run_count++] = (bmi_glyph_run){
+                    .row = (uint16_t)row,
+                    .x = (uint16_t)start,
+                    .length = (uint16_t)(x - start)
+                };
+            }
+        }
+        glyph->run_count = font->run_count - glyph->first_run;
+    }
+    
+    // Fall back on the first glyph available for missing characters
+    font->default_glyph = default_glyph;
+    for (uint32_t code = 0; !font->glyphs[font->default_glyph].present;
+         code++) {
+        if (code == BMI_FONT_GLYPHS) {
+            return BMI_FAILURE;
+        }
+        font->default_glyph = code;
+    }
+    return BMI_SUCCESS;
+}
+
+bmi_font* bmi_font_new(void) {
+    bmi_font* font = bmi_font_alloc(BMI_BUILTIN_LINE_HEIGHT);
+    if (font == NULL) {
+        bmi_set_error("bmi_font_new: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    for (uint32_t code = BMI_BUILTIN_FIRST; code <= BMI_BUILTIN_LAST; code++) {
+        uint8_t* cell = bmi_font_add_glyph(font, code, BMI_BUILTIN_ADVANCE);
+        if (cell == NULL) {
+            bmi_font_free(font);
+            bmi_set_error("bmi_font_new: Virtual memory exhausted");
+            return BMI_PTR_FAILURE;
+        }
+        const uint8_t* rows = bmi_builtin_glyphs[code - BMI_BUILTIN_FIRST];
+        for (uint32_t row = 0; row < BMI_BUILTIN_ROWS; row++) {
+            for (uint32_t x = 0; x < 5; x++) {
+                cell[row * BMI_BUILTIN_ADVANCE + x] = (rows[row] >> (4 - x))
+                                                      & 1;
+            }
+        }
+    }
+    if (bmi_font_finish(font, '?') != BMI_SUCCESS) {
+        bmi_font_free(font);
+        bmi_set_error("bmi_font_new: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    return font;
+}
+
+#define BMI_BDF_LINE 1024
+
+// Returns whether the line starts with the given keyword followed by a space
+// or its end
+static int bmi_bdf_keyword(const char* line, const char* keyword) {
+    const size_t length = strlen(keyword);
+    return strncmp(line, keyword, length) == 0
+        && (line[length] == ' ' || line[length] == '\n'
+            || line[length] == '\r' || line[length] == '\0');
+}
+
+static int bmi_bdf_hex(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bmi_font* bmi_font_from_bdf(FILE* source) {
+    char line[BMI_BDF_LINE];
+    long box_width = 0, box_height = 0, box_y = 0;
+    long ascent = -1, descent = -1, default_char = '?';
+    bmi_font* font = NULL;
+    
+    // Glyph state between STARTCHAR and ENDCHAR
+    long code = -1, advance = 0;
+    long width = 0, height = 0, offset_x = 0, offset_y = 0;
+    uint8_t* cell = NULL;
+    long bitmap_row = -1;
+    
+    while (fgets(line, sizeof(line), source) != NULL) {
+        char* cursor = line;
+        if (bitmap_row >= 0) {
+            if (bmi_bdf_keyword(line, "ENDCHAR")) {
+                bitmap_row = -1;
+                code = -1;
+                continue;
+            }
+            // Place each set bit, most significant first, into the cell
+            // relative to the baseline and clipped to the cell
+            if (cell != NULL) {
+                const long y = ascent - (offset_y + height) + bitmap_row;
+                for (long x = 0; x < width; x++) {
+                    const int digit = bmi_bdf_hex(line[x / 4]);
+                    if (digit < 0) {
+                        break;
+                    }
+                    const long cx = offset_x + x;
+                    if ((digit >> (3 - x % 4) & 1) && y >= 0
+                        && y < (long)font->line_height && cx >= 0
+                        && cx < advance) {
+                        cell[y * advance + cx] = 1;
+                    }
+                }
+            }
+            bitmap_row++;
+            continue;
+        }
+        
+        if (bmi_bdf_keyword(line, "FONTBOUNDINGBOX")) {
+            box_width = strtol(cursor + 15, &cursor, 10);
+            box_height = strtol(cursor, &cursor, 10);
+            strtol(cursor, &cursor, 10);
+            box_y = strtol(cursor, &cursor, 10);
+        } else if (bmi_bdf_keyword(line, "FONT_ASCENT")) {
+            ascent = strtol(cursor + 11, NULL, 10);
+        } else if (bmi_bdf_keyword(line, "FONT_DESCENT")) {
+            descent = strtol(cursor + 12, NULL, 10);
+        } else if (bmi_bdf_keyword(line, "DEFAULT_CHAR")) {
+            default_char = strtol(cursor + 12, NULL, 10);
+        } else if (bmi_bdf_keyword(line, "ENCODING")) {
+            code = strtol(cursor + 8, NULL, 10);
+            advance = box_width;
+        } else if (bmi_bdf_keyword(line, "DWIDTH")) {
+            advance = strtol(cursor + 6, NULL, 10);
+        } else if (bmi_bdf_keyword(line, "BBX")) {
+            width = strtol(cursor + 3, &cursor, 10);
+            height = strtol(cursor, &cursor, 10);
+            offset_x = strtol(cursor, &cursor, 10);
+            offset_y = strtol(cursor, &cursor, 10);
+        } else if (bmi_bdf_keyword(line, "BITMAP")) {
+            // The line metrics are settled by the first glyph
+            if (font == NULL) {
+                if (ascent < 0 || descent < 0) {
+                    ascent = box_height + box_y;
+                    descent = -box_y;
+                }
+                if (ascent + descent <= 0 || ascent + descent > UINT16_MAX) {
+                    bmi_set_error("bmi_font_from_bdf: Font has invalid line "
+                                  "height");
+                    return BMI_PTR_FAILURE;
+                }
+                font = bmi_font_alloc((uint32_t)(ascent + descent));
+                if (font == NULL) {
+                    bmi_set_error("bmi_font_from_bdf: Virtual memory "
+                                  "exhausted");
+                    return BMI_PTR_FAILURE;
+                }
+            }
+            
+            // Only the first 256 encodings are addressable from text
+            cell = NULL;
+            if (code >= 0 && code < BMI_FONT_GLYPHS && advance > 0
+                && advance <= UINT16_MAX) {
+                cell = bmi_font_add_glyph(font, (uint32_t)code,
+                                          (uint32_t)advance);
+                if (cell == NULL) {
+                    bmi_font_free(font);
+                    bmi_set_error("bmi_font_from_bdf: Virtual memory "
+                                  "exhausted");
+                    return BMI_PTR_FAILURE;
+                }
+            }
+            bitmap_row = 0;
+        }
+    }
+    
+    if (ferror(source)) {
+        bmi_font_free(font);
+        bmi_set_error("bmi_font_from_bdf: An error occured while reading the "
+                      "file");
+        return BMI_PTR_FAILURE;
+    }
+    if (font == NULL) {
+        bmi_set_error("bmi_font_from_bdf: File has no glyphs");
+        return BMI_PTR_FAILURE;
+    }
+    if (default_char < 0 || default_char >= BMI_FONT_GLYPHS) {
+        default_char = '?';
+    }
+    if (bmi_font_finish(font, (uint32_t)default_char) != BMI_SUCCESS) {
+        bmi_font_free(font);
+        bmi_set_error("bmi_font_from_bdf: File has no usable glyphs");
+        return BMI_PTR_FAILURE;
+    }
+    return font;
+}
+
+void bmi_font_free(bmi_font* font) {
+    if (font == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < BMI_FONT_ATLASES; i++) {
+        free(font->atlases[i].cells);
+    }
+    free(font->runs);
+    free(font->coverage);
+    free(font);
+}
+
+uint32_t bmi_font_line_height(const bmi_font* font) {
+    return font->line_height;
+}
+
+static const bmi_glyph* bmi_font_glyph(const bmi_font* font, unsigned char c) {
+    return font->glyphs[c].present ? &font->glyphs[c]
+                                   : &font->glyphs[font->default_glyph];
+}
+
+bmi_rect bmi_font_measure(const bmi_font* font, const char* text) {
+    uint32_t width = 0;
+    uint32_t lines = 1;
+    uint32_t x = 0;
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        if (*c == '\n') {
+            lines++;
+            x = 0;
+            continue;
+        }
+        x += bmi_font_glyph(font, *c)->advance;
+        if (x > width) {
+            width = x;
+        }
+    }
+    return BMI_RECT(0, 0, width, lines * font->line_height);
+}
+
+// Returns the atlas rendered in the format and colors, rendering it if it is
+// not already cached
+static const bmi_glyph_atlas* bmi_font_atlas(bmi_font* font,
+                                             const bmi_buffer* buffer,
+                                             bmi_pixel pixel,
+                                             bmi_pixel background) {
+    const uint32_t format = BMI_FORMAT_FROM_FL(buffer->flags);
+    for (uint32_t i = 0; i < BMI_FONT_ATLASES; i++) {
+        const bmi_glyph_atlas* atlas = &font->atlases[i];
+        if (atlas->cells != NULL && atlas->format == format
+            && atlas->pixel == pixel && atlas->background == background) {
+            return atlas;
+        }
+    }
+    
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    uint8_t* cells = malloc(font->coverage_size * kernels->size);
+    if (cells == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < font->coverage_size; i++) {
+        kernels->point(cells + i * kernels->size,
+                       font->coverage[i] ? pixel : background);
+    }
+    
+    // Replace the cached atlases in turn
+    bmi_glyph_atlas* atlas = &font->atlases[font->next_atlas];
+    font->next_atlas = (font->next_atlas + 1) % BMI_FONT_ATLASES;
+    free(atlas->cells);
+    atlas->cells = cells;
+    atlas->format = format;
+    atlas->pixel = pixel;
+    atlas->background = background;
+    return atlas;
+}
+
+static int bmi_buffer_render_text(bmi_buffer* buffer, bmi_font* font,
+                                  bmi_point origin, const char* text,
+                                  bmi_pixel pixel, bmi_pixel background) {
+    // Atlases of palette buffers hold indices, and so are cached by them
+    pixel = BMI_PALETTE_INDEX(buffer, pixel);
+    if (background != BMI_PIXEL_INVALID) {
+        background = BMI_PALETTE_INDEX(buffer, background);
+    }
+    const bmi_glyph_atlas* atlas = bmi_font_atlas(font, buffer, pixel,
+                                                  background);
+    if (atlas == NULL) {
+        return BMI_FAILURE;
+    }
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    const int opaque = background != BMI_PIXEL_INVALID;
+    
+    // Positions are kept wide so that text running off the buffer never wraps
+    uint64_t x = origin.x;
+    uint64_t y = origin.y;
+    for (const char* c = text; *c; c++) {
+        if (*c == '\n') {
+            x = origin.x;
+            y += font->line_height;
+            continue;
+        }
+        if (y >= buffer->height) {
+            break;
+        }
+        if (x >= buffer->width) {
+            // Nothing more of this line is visible
+            c = strchr(c, '\n');
+            if (c == NULL) {
+                break;
+            }
+            c--;
+            continue;
+        }
+        
+        const bmi_glyph* glyph = bmi_font_glyph(font, (unsigned char)*c);
+        const uint8_t* cell = atlas->cells + glyph->offset * kernels->size;
+        const uint64_t right = x + glyph->advance < buffer->width
+            ? x + glyph->advance : buffer->width;
+        
+        if (opaque) {
+            // Whole rows of the cell are copied at once
+            for (uint32_t row = 0; row < font->line_height
+                 && y + row < buffer->height; row++) {
+                if (bmi_kernel_blit(buffer, kernels, (uint32_t)x,
+                                    (uint32_t)(y + row),
+                                    cell + (size_t)row * glyph->advance
+                                    * kernels->size,
+                                    right - x) != BMI_SUCCESS) {
+                    return BMI_FAILURE;
+                }
+            }
+        } else {
+            // Only the lit runs are copied, leaving the rest untouched
+            const bmi_glyph_run* runs = font->runs + glyph->first_run;
+            for (size_t i = 0; i < glyph->run_count; i++) {
+                const bmi_glyph_run run = runs[i];
+                if (y + run.row >= buffer->height) {
+                    break;
+                }
+                if (x + run.x >= right) {
+                    continue;
+                }
+                const uint64_t length = x + run.x + run.length <= right
+                    ? run.length : right - x - run.x;
+                if (bmi_kernel_blit(buffer, kernels, (uint32_t)(x + run.x),
+                                    (uint32_t)(y + run.row),
+                                    cell + ((size_t)run.row * glyph->advance
+                                            + run.x) * kernels->size,
+                                    length) != BMI_SUCCESS) {
+                    return BMI_FAILURE;
+                }
+            }
+        }
+        x += glyph->advance;
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_draw_text(bmi_buffer* buffer, bmi_font* font, bmi_point origin,
+                         const char* text, bmi_pixel pixel) {
+    if (bmi_buffer_render_text(buffer, font, origin, text, pixel,
+                               BMI_PIXEL_INVALID) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_draw_text: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+int bmi_buffer_draw_text_box(bmi_buffer* buffer, bmi_font* font,
+                             bmi_point origin, const char* text,
+                             bmi_pixel pixel, bmi_pixel background) {
+    if (bmi_buffer_render_text(buffer, font, origin, text, pixel,
+                               background) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_draw_text_box: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
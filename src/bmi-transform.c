@@ -0,0 +1,808 @@
+// src: bmi-transform.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+#define _BMI_USE_INTERNAL
+
+#include "bmi-transform.h"
+
+// bmi_set_error
+#include "bmi-error.h"
+
+// bmi_buffer_new, bmi_buffer_convert
+#include "bmi-util.h"
+
+// bmi_buffer_overdraw_buffer
+#include "bmi-draw.h"
+
+// bmi_clip_rect
+#include "bmi-geometry.h"
+
+// bmi_buffer_kernels, BMI_KERNEL_ADDRESS, BMI_KERNEL_RUN, bmi_kernel_gather,
+// bmi_kernel_blit, BMI_KERNEL_CHUNK
+#include "bmi-kernel.h"
+
+// bmi_buffer_free
+#include "bmi-memory.h"
+
+// bmi_parallel_for, bmi_parallel_parts
+#include "bmi-parallel.h"
+
+// BMI_SHARED_PREPARE
+#include "bmi-shared.h"
+
+// bmi_palette_copy
+#include "bmi-palette.h"
+
+// ptrdiff_t
+#include <stddef.h>
+
+// malloc, calloc, free
+#include <stdlib.h>
+
+// memcpy, memset
+#include <string.h>
+
+// ceil, floor, fabs
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Work is split into parts of at least this many bytes
+#define BMI_TRANSFORM_GRAIN (1u << 18)
+
+// The largest block of pixels a transpose ever has to stage
+#define BMI_BLOCK_BYTES (BMI_TILE_SIZE * BMI_TILE_SIZE * 3)
+
+// Rows are swapped through a buffer of this many bytes
+#define BMI_SWAP_CHUNK 4096
+
+static uint32_t bmi_transform_parts(uint64_t bytes, uint32_t units) {
+    const uint32_t parts = bmi_parallel_parts(bytes, BMI_TRANSFORM_GRAIN);
+    if (parts > units) {
+        return units ? units : 1;
+    }
+    return parts;
+}
+
+#ifdef __SSE2__
+// Reverses the order of the sixteen bytes in a register
+static __m128i bmi_reverse_bytes(__m128i v) {
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+// Transposes an 8 by 8 block of gray pixels entirely in registers
+static void bmi_transpose_8x8(uint8_t* dst, ptrdiff_t dst_stride,
+                              const uint8_t* src, ptrdiff_t src_stride) {
+    __m128i r[8];
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm_loadl_epi64((const __m128i*)(src + i * src_stride));
+    }
+    
+    // Interleave bytes, then pairs, then quads of neighboring rows until each
+    // half of a register holds one column
+    const __m128i a0 = _mm_unpacklo_epi8(r[0], r[1]);
+    const __m128i a1 = _mm_unpacklo_epi8(r[2], r[3]);
+    const __m128i a2 = _mm_unpacklo_epi8(r[4], r[5]);
+    const __m128i a3 = _mm_unpacklo_epi8(r[6], r[7]);
+    const __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    const __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    const __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    const __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+    const __m128i c[4] = {
+        _mm_unpacklo_epi32(b0, b2),
+        _mm_unpackhi_epi32(b0, b2),
+        _mm_unpacklo_epi32(b1, b3),
+        _mm_unpackhi_epi32(b1, b3)
+    };
+    
+    for (int i = 0; i < 4; i++) {
+        _mm_storel_epi64((__m128i*)(dst + (2 * i) * dst_stride), c[i]);
+        _mm_storel_epi64((__m128i*)(dst + (2 * i + 1) * dst_stride),
+                         _mm_srli_si128(c[i], 8));
+    }
+}
+#endif
+
+// Transposes a block of rows by cols pixels into a block of cols by rows
+// pixels, where the strides between rows may be negative
+static void bmi_transpose_block(uint8_t* dst, ptrdiff_t dst_stride,
+                                const uint8_t* src, ptrdiff_t src_stride,
+                                uint32_t rows, uint32_t cols, size_t size) {
+    uint32_t r = 0;
+    if (size == 1) {
+#ifdef __SSE2__
+        for (; r + 8 <= rows; r += 8) {
+            uint32_t c = 0;
+            for (; c + 8 <= cols; c += 8) {
+                bmi_transpose_8x8(dst + (ptrdiff_t)c * dst_stride + r,
+                                  dst_stride,
+                                  src + (ptrdiff_t)r * src_stride + c,
+                                  src_stride);
+            }
+            for (; c < cols; c++) {
+                for (uint32_t k = r; k < r + 8; k++) {
+                    dst[(ptrdiff_t)c * dst_stride + k]
+                        = src[(ptrdiff_t)k * src_stride + c];
+                }
+            }
+        }
+#endif
+        for (; r < rows; r++) {
+            const uint8_t* from = src + (ptrdiff_t)r * src_stride;
+            for (uint32_t c = 0; c < cols; c++) {
+                dst[(ptrdiff_t)c * dst_stride + r] = from[c];
+            }
+        }
+        return;
+    }
+    
+    // Copies of a constant size compile to plain moves
+    for (; r < rows; r++) {
+        const uint8_t* from = src + (ptrdiff_t)r * src_stride;
+        uint8_t* to = dst + r * size;
+        if (size == 3) {
+            for (uint32_t c = 0; c < cols; c++) {
+                memcpy(to + (ptrdiff_t)c * dst_stride, from + c * 3, 3);
+            }
+        } else {
+            for (uint32_t c = 0; c < cols; c++) {
+                memcpy(to + (ptrdiff_t)c * dst_stride, from + c * size, size);
+            }
+        }
+    }
+}
+
+typedef struct {
+    const bmi_buffer* src;
+    bmi_buffer* dst;
+    const bmi_kernels* kernels;
+    
+    // Either 0 for a plain transpose, 90 or 270
+    uint32_t rotation;
+    uint32_t parts;
+} bmi_transpose_job;
+
+// Transposes each destination tile-sized block in one part of the bands of
+// blocks, reading its source block in place whenever it sits within one tile
+static void bmi_transpose_part(void* context, uint32_t index) {
+    bmi_transpose_job* job = context;
+    const bmi_buffer* src = job->src;
+    bmi_buffer* dst = job->dst;
+    const size_t size = job->kernels->size;
+    const uint32_t bands = (uint32_t)BMI_TILE_COUNT(dst->height);
+    const uint32_t first = (uint32_t)((uint64_t)bands * index / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)bands * (index + 1)
+                                     / job->parts);
+    uint8_t block[BMI_BLOCK_BYTES];
+    
+    const ptrdiff_t src_pitch = (ptrdiff_t)((src->flags & BMI_FL_IS_TILED)
+                                            ? BMI_TILE_SIZE : src->width)
+        * (ptrdiff_t)size;
+    const ptrdiff_t dst_pitch = (ptrdiff_t)((dst->flags & BMI_FL_IS_TILED)
+                                            ? BMI_TILE_SIZE : dst->width)
+        * (ptrdiff_t)size;
+    
+    for (uint32_t band = first; band < last; band++) {
+        const uint32_t dy = band << BMI_TILE_SHIFT;
+        const uint32_t bh = dst->height - dy < BMI_TILE_SIZE
+            ? dst->height - dy : BMI_TILE_SIZE;
+        for (uint32_t dx = 0; dx < dst->width; dx += BMI_TILE_SIZE) {
+            const uint32_t bw = dst->width - dx < BMI_TILE_SIZE
+                ? dst->width - dx : BMI_TILE_SIZE;
+            
+            // The source block is bw rows of bh pixels
+            uint32_t sx = dy;
+            uint32_t sy = dx;
+            if (job->rotation == BMI_ROTATE_90) {
+                sy = src->height - dx - bw;
+            } else if (job->rotation == BMI_ROTATE_270) {
+                sx = src->width - dy - bh;
+            }
+            
+            const uint8_t* from;
+            ptrdiff_t from_stride;
+            if (!(src->flags & BMI_FL_IS_TILED)
+                || ((sx & BMI_TILE_MASK) + bh <= BMI_TILE_SIZE
+                    && sy >> BMI_TILE_SHIFT
+                    == (sy + bw - 1) >> BMI_TILE_SHIFT)) {
+                from = BMI_KERNEL_ADDRESS(src, job->kernels, sx, sy);
+                from_stride = src_pitch;
+            } else {
+                // The block straddles tiles, so it is staged row by row
+                for (uint32_t r = 0; r < bw; r++) {
+                    bmi_kernel_gather(src, job->kernels, sx, sy + r,
+                                      block + r * BMI_TILE_SIZE * size, bh);
+                }
+                from = block;
+                from_stride = BMI_TILE_SIZE * (ptrdiff_t)size;
+            }
+            
+            // Destination blocks always sit within one tile
+            uint8_t* to = BMI_KERNEL_ADDRESS(dst, job->kernels, dx, dy);
+            ptrdiff_t to_stride = dst_pitch;
+            
+            // Rotations are transposes with the source or destination rows
+            // taken in reverse
+            if (job->rotation == BMI_ROTATE_90) {
+                from += (ptrdiff_t)(bw - 1) * from_stride;
+                from_stride = -from_stride;
+            } else if (job->rotation == BMI_ROTATE_270) {
+                to += (ptrdiff_t)(bh - 1) * to_stride;
+                to_stride = -to_stride;
+            }
+            
+            bmi_transpose_block(to, to_stride, from, from_stride, bw, bh,
+                                size);
+        }
+    }
+}
+
+static bmi_buffer* bmi_buffer_transposed(const bmi_buffer* buffer,
+                                         uint32_t rotation) {
+    bmi_buffer* result = bmi_buffer_new(buffer->height, buffer->width,
+                                        buffer->flags);
+    if (result == NULL) {
+        return BMI_PTR_FAILURE;
+    }
+    bmi_palette_copy(result, buffer);
+    
+    bmi_transpose_job job = {
+        .src = buffer,
+        .dst = result,
+        .kernels = bmi_buffer_kernels(buffer),
+        .rotation = rotation
+    };
+    job.parts = bmi_transform_parts(bmi_buffer_content_size(buffer),
+                                    (uint32_t)BMI_TILE_COUNT(result->height));
+    bmi_parallel_for(job.parts, bmi_transpose_part, &job);
+    
+    return result;
+}
+
+// Copies count pixels into dst, walking backwards from src
+static void bmi_reverse_copy(uint8_t* dst, const uint8_t* src, size_t count,
+                             size_t size) {
+    size_t i = 0;
+    if (size == 1) {
+#ifdef __SSE2__
+        for (; i + 16 <= count; i += 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(src - i - 15));
+            _mm_storeu_si128((__m128i*)(dst + i), bmi_reverse_bytes(v));
+        }
+#endif
+        for (; i < count; i++) {
+            dst[i] = *(src - i);
+        }
+        return;
+    }
+    if (size == 3) {
+        for (; i < count; i++) {
+            memcpy(dst + i * 3, src - i * 3, 3);
+        }
+        return;
+    }
+    for (; i < count; i++) {
+        memcpy(dst + i * size, src - i * size, size);
+    }
+}
+
+// Swaps count pixels from a with count pixels walking backwards from b
+static void bmi_reverse_swap(uint8_t* a, uint8_t* b, size_t count,
+                             size_t size) {
+    size_t i = 0;
+    if (size == 1) {
+#ifdef __SSE2__
+        for (; i + 16 <= count; i += 16) {
+            const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            const __m128i vb = _mm_loadu_si128((const __m128i*)(b - i - 15));
+            _mm_storeu_si128((__m128i*)(a + i), bmi_reverse_bytes(vb));
+            _mm_storeu_si128((__m128i*)(b - i - 15), bmi_reverse_bytes(va));
+        }
+#endif
+        for (; i < count; i++) {
+            const uint8_t t = a[i];
+            a[i] = *(b - i);
+            *(b - i) = t;
+        }
+        return;
+    }
+    uint8_t t[4];
+    if (size == 3) {
+        for (; i < count; i++) {
+            memcpy(t, a + i * 3, 3);
+            memcpy(a + i * 3, b - i * 3, 3);
+            memcpy(b - i * 3, t, 3);
+        }
+        return;
+    }
+    for (; i < count; i++) {
+        memcpy(t, a + i * size, size);
+        memcpy(a + i * size, b - i * size, size);
+        memcpy(b - i * size, t, size);
+    }
+}
+
+// Returns how many pixels from the given column backwards in a row are
+// contiguous
+static size_t bmi_backward_run(const bmi_buffer* buffer, uint32_t x,
+                               size_t count) {
+    const size_t run = (buffer->flags & BMI_FL_IS_TILED)
+        ? (size_t)(x & BMI_TILE_MASK) + 1 : (size_t)x + 1;
+    return run < count ? run : count;
+}
+
+typedef struct {
+    const bmi_buffer* src;
+    bmi_buffer* dst;
+    const bmi_kernels* kernels;
+    uint32_t rows;
+    uint32_t parts;
+} bmi_mirror_job;
+
+// Writes each destination row as the source row across from it, reversed
+static void bmi_rotate_half_part(void* context, uint32_t index) {
+    bmi_mirror_job* job = context;
+    const bmi_buffer* src = job->src;
+    bmi_buffer* dst = job->dst;
+    const bmi_kernels* kernels = job->kernels;
+    const uint32_t first = (uint32_t)((uint64_t)job->rows * index / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)job->rows * (index + 1)
+                                     / job->parts);
+    
+    for (uint32_t y = first; y < last; y++) {
+        const uint32_t sy = src->height - 1 - y;
+        for (uint32_t x = 0; x < dst->width;) {
+            const uint32_t mirror = src->width - 1 - x;
+            const size_t run = bmi_backward_run(src, mirror,
+                BMI_KERNEL_RUN(dst, x, dst->width - x));
+            bmi_reverse_copy(BMI_KERNEL_ADDRESS(dst, kernels, x, y),
+                             BMI_KERNEL_ADDRESS(src, kernels, mirror, sy),
+                             run, kernels->size);
+            x += (uint32_t)run;
+        }
+    }
+}
+
+// Reverses each row in place by swapping pixels from both ends inwards
+static void bmi_flip_horizontal_part(void* context, uint32_t index) {
+    bmi_mirror_job* job = context;
+    bmi_buffer* buffer = job->dst;
+    const bmi_kernels* kernels = job->kernels;
+    const uint32_t first = (uint32_t)((uint64_t)job->rows * index / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)job->rows * (index + 1)
+                                     / job->parts);
+    
+    for (uint32_t y = first; y < last; y++) {
+        uint32_t left = 0;
+        uint32_t right = buffer->width - 1;
+        while (left < right) {
+            const size_t pairs = (size_t)(right - left + 1) / 2;
+            const size_t run = bmi_backward_run(buffer, right,
+                BMI_KERNEL_RUN(buffer, left, pairs));
+            bmi_reverse_swap(BMI_KERNEL_ADDRESS(buffer, kernels, left, y),
+                             BMI_KERNEL_ADDRESS(buffer, kernels, right, y),
+                             run, kernels->size);
+            left += (uint32_t)run;
+            right -= (uint32_t)run;
+        }
+    }
+}
+
+// Swaps each row in the top half with the row across from it
+static void bmi_flip_vertical_part(void* context, uint32_t index) {
+    bmi_mirror_job* job = context;
+    bmi_buffer* buffer = job->dst;
+    const bmi_kernels* kernels = job->kernels;
+    const uint32_t first = (uint32_t)((uint64_t)job->rows * index / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)job->rows * (index + 1)
+                                     / job->parts);
+    uint8_t swap[BMI_SWAP_CHUNK];
+    
+    for (uint32_t y = first; y < last; y++) {
+        const uint32_t across = buffer->height - 1 - y;
+        for (uint32_t x = 0; x < buffer->width;) {
+            // Both rows break into runs at the same columns
+            const size_t run = BMI_KERNEL_RUN(buffer, x, buffer->width - x);
+            uint8_t* a = BMI_KERNEL_ADDRESS(buffer, kernels, x, y);
+            uint8_t* b = BMI_KERNEL_ADDRESS(buffer, kernels, x, across);
+            for (size_t done = 0; done < run * kernels->size;) {
+                const size_t rest = run * kernels->size - done;
+                const size_t chunk = rest < BMI_SWAP_CHUNK
+                    ? rest : BMI_SWAP_CHUNK;
+                memcpy(swap, a + done, chunk);
+                memcpy(a + done, b + done, chunk);
+                memcpy(b + done, swap, chunk);
+                done += chunk;
+            }
+            x += (uint32_t)run;
+        }
+    }
+}
+
+bmi_buffer* bmi_buffer_transpose(const bmi_buffer* buffer) {
+    return bmi_buffer_transposed(buffer, 0);
+}
+
+bmi_buffer* bmi_buffer_rotate(const bmi_buffer* buffer, bmi_rotation rotation) {
+    if (rotation == BMI_ROTATE_90 || rotation == BMI_ROTATE_270) {
+        return bmi_buffer_transposed(buffer, rotation);
+    }
+    if (rotation != BMI_ROTATE_180) {
+        bmi_set_error("bmi_buffer_rotate: Rotation must be 90, 180 or 270 "
+                      "degrees");
+        return BMI_PTR_FAILURE;
+    }
+    
+    bmi_buffer* result = bmi_buffer_new(buffer->width, buffer->height,
+                                        buffer->flags);
+    if (result == NULL) {
+        return BMI_PTR_FAILURE;
+    }
+    bmi_palette_copy(result, buffer);
+    if (buffer->width == 0) {
+        return result;
+    }
+    
+    bmi_mirror_job job = {
+        .src = buffer,
+        .dst = result,
+        .kernels = bmi_buffer_kernels(buffer),
+        .rows = buffer->height
+    };
+    job.parts = bmi_transform_parts(bmi_buffer_content_size(buffer), job.rows);
+    bmi_parallel_for(job.parts, bmi_rotate_half_part, &job);
+    
+    return result;
+}
+
+int bmi_buffer_flip(bmi_buffer* buffer, bmi_flip_axis axis) {
+    bmi_mirror_job job = {
+        .src = buffer,
+        .dst = buffer,
+        .kernels = bmi_buffer_kernels(buffer)
+    };
+    bmi_parallel_task task;
+    switch (axis) {
+        case BMI_FLIP_HORIZONTAL: {
+            job.rows = buffer->width ? buffer->height : 0;
+            task = bmi_flip_horizontal_part;
+            break;
+        }
+        case BMI_FLIP_VERTICAL: {
+            job.rows = buffer->height / 2;
+            task = bmi_flip_vertical_part;
+            break;
+        }
+        default: {
+            bmi_set_error("bmi_buffer_flip: Axis must be horizontal or "
+                          "vertical");
+            return BMI_FAILURE;
+        }
+    }
+    if (job.rows == 0) {
+        return BMI_SUCCESS;
+    }
+    
+    // Every tile of a shared buffer is copied up front, as the threads write
+    // to them without checking
+    if (!BMI_SHARED_PREPARE(buffer, 0, 0, buffer->width, buffer->height)) {
+        bmi_set_error("bmi_buffer_flip: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    job.parts = bmi_transform_parts(bmi_buffer_content_size(buffer), job.rows);
+    bmi_parallel_for(job.parts, task, &job);
+    
+    return BMI_SUCCESS;
+}
+
+typedef struct {
+    const bmi_buffer* src;
+    bmi_buffer* dst;
+    const bmi_kernels* kernels;
+    bmi_rect region;
+    uint32_t parts;
+} bmi_crop_job;
+
+static void bmi_crop_part(void* context, uint32_t index) {
+    const bmi_crop_job* job = context;
+    const uint32_t height = job->dst->height;
+    const uint32_t first = (uint32_t)((uint64_t)height * index / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)height * (index + 1)
+                                     / job->parts);
+    const uint32_t width = job->dst->width;
+    uint8_t chunk[BMI_KERNEL_CHUNK * 3];
+    for (uint32_t y = first; y < last; y++) {
+        // Row-major rows are gathered straight into place
+        if (!(job->dst->flags & BMI_FL_IS_TILED)) {
+            bmi_kernel_gather(job->src, job->kernels, job->region.x,
+                              job->region.y + y,
+                              BMI_KERNEL_ADDRESS(job->dst, job->kernels, 0, y),
+                              width);
+            continue;
+        }
+        for (uint32_t x = 0; x < width;) {
+            const size_t count = width - x < BMI_KERNEL_CHUNK
+                ? width - x : BMI_KERNEL_CHUNK;
+            bmi_kernel_gather(job->src, job->kernels, job->region.x + x,
+                              job->region.y + y, chunk, count);
+            bmi_kernel_blit(job->dst, job->kernels, x, y, chunk, count);
+            x += (uint32_t)count;
+        }
+    }
+}
+
+bmi_buffer* bmi_buffer_crop(const bmi_buffer* buffer, bmi_rect region) {
+    bmi_clip_rect(&region, BMI_RECT(0, 0, buffer->width, buffer->height));
+    if (region.width == 0 || region.height == 0) {
+        bmi_set_error("bmi_buffer_crop: Region lies outside of the buffer");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_buffer* result = bmi_buffer_new(region.width, region.height,
+                                        buffer->flags);
+    if (result == NULL) {
+        bmi_set_error("bmi_buffer_crop: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_palette_copy(result, buffer);
+    
+    bmi_crop_job job = {
+        .src = buffer,
+        .dst = result,
+        .kernels = bmi_buffer_kernels(buffer),
+        .region = region
+    };
+    job.parts = bmi_transform_parts(bmi_buffer_content_size(result),
+                                    region.height);
+    bmi_parallel_for(job.parts, bmi_crop_part, &job);
+    
+    return result;
+}
+
+// Resampling weights are fixed point with this many fractional bits, and
+// rows are kept with BMI_LEVEL_BITS between the two passes
+#define BMI_WEIGHT_BITS 14
+#define BMI_LEVEL_BITS 8
+
+// The source pixels contributing to each pixel along one axis of a resized
+// image, which are taps consecutive pixels from first onwards
+typedef struct {
+    uint32_t* first;
+    int32_t* weights;
+    uint32_t taps;
+} bmi_resample_axis;
+
+// Computes the weights of a triangle filter, widened when shrinking so that
+// every source pixel contributes
+static int bmi_resample_weights(bmi_resample_axis* axis, uint32_t from,
+                                uint32_t to) {
+    const double scale = (double)from / to;
+    const double support = scale > 1 ? scale : 1;
+    axis->taps = (uint32_t)ceil(2 * support) + 1;
+    if (axis->taps > from) {
+        axis->taps = from;
+    }
+    axis->first = malloc(to * sizeof(uint32_t));
+    axis->weights = calloc((size_t)to * axis->taps, sizeof(int32_t));
+    if (axis->first == NULL || axis->weights == NULL) {
+        free(axis->first);
+        free(axis->weights);
+        return BMI_FAILURE;
+    }
+    
+    for (uint32_t i = 0; i < to; i++) {
+        const double center = (i + 0.5) * scale - 0.5;
+        int64_t first = (int64_t)floor(center - support) + 1;
+        if (first < 0) {
+            first = 0;
+        }
+        if (first + axis->taps > from) {
+            first = from - axis->taps;
+        }
+        axis->first[i] = (uint32_t)first;
+        
+        // Normalize the weights to exactly one, giving the rounding error to
+        // the largest of them
+        int32_t* weights = axis->weights + (size_t)i * axis->taps;
+        double total = 0;
+        for (uint32_t t = 0; t < axis->taps; t++) {
+            const double distance = fabs((double)(first + t) - center);
+            if (distance < support) {
+                total += 1 - distance / support;
+            }
+        }
+        int32_t sum = 0;
+        uint32_t largest = 0;
+        for (uint32_t t = 0; t < axis->taps; t++) {
+            const double distance = fabs((double)(first + t) - center);
+            const double weight = distance < support
+                ? (1 - distance / support) / total : 0;
+            weights[t] = (int32_t)floor(weight * (1 << BMI_WEIGHT_BITS) + 0.5);
+            sum += weights[t];
+            if (weights[t] > weights[largest]) {
+                largest = t;
+            }
+        }
+        weights[largest] += (1 << BMI_WEIGHT_BITS) - sum;
+    }
+    return BMI_SUCCESS;
+}
+
+typedef struct {
+    const bmi_buffer* src;
+    bmi_buffer* dst;
+    const bmi_kernels* kernels;
+    bmi_resample_axis columns;
+    bmi_resample_axis rows;
+    uint32_t parts;
+    uint32_t failed;
+} bmi_resize_job;
+
+static void bmi_resize_part(void* context, uint32_t index) {
+    bmi_resize_job* job = context;
+    const bmi_buffer* src = job->src;
+    bmi_buffer* dst = job->dst;
+    const size_t size = job->kernels->size;
+    const uint32_t first = (uint32_t)((uint64_t)dst->height * index
+                                      / job->parts);
+    const uint32_t last = (uint32_t)((uint64_t)dst->height * (index + 1)
+                                     / job->parts);
+    
+    // Each part gathers source rows, sums them down the columns, and filters
+    // the sums along the row into the output
+    const size_t src_row = (size_t)src->width * size;
+    const size_t dst_row = (size_t)dst->width * size;
+    uint8_t* line = malloc(src_row);
+    uint32_t* sums = malloc(src_row * sizeof(uint32_t));
+    uint8_t* out = malloc(dst_row);
+    if (line == NULL || sums == NULL || out == NULL) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        free(line);
+        free(sums);
+        free(out);
+        return;
+    }
+    
+    for (uint32_t y = first; y < last; y++) {
+        memset(sums, 0, src_row * sizeof(uint32_t));
+        const int32_t* weights = job->rows.weights
+                                 + (size_t)y * job->rows.taps;
+        for (uint32_t t = 0; t < job->rows.taps; t++) {
+            if (weights[t] == 0) {
+                continue;
+            }
+            const uint32_t sy = job->rows.first[y] + t;
+            const uint8_t* pixels = line;
+            if (src->flags & BMI_FL_IS_TILED) {
+                bmi_kernel_gather(src, job->kernels, 0, sy, line, src->width);
+            } else {
+                pixels = BMI_KERNEL_ADDRESS(src, job->kernels, 0, sy);
+            }
+            const uint32_t weight = (uint32_t)weights[t];
+            for (size_t i = 0; i < src_row; i++) {
+                sums[i] += weight * pixels[i];
+            }
+        }
+        for (size_t i = 0; i < src_row; i++) {
+            sums[i] = (sums[i] + (1 << (BMI_WEIGHT_BITS - BMI_LEVEL_BITS - 1)))
+                      >> (BMI_WEIGHT_BITS - BMI_LEVEL_BITS);
+        }
+        
+        uint8_t* row = dst->flags & BMI_FL_IS_TILED
+            ? out : BMI_KERNEL_ADDRESS(dst, job->kernels, 0, y);
+        for (uint32_t x = 0; x < dst->width; x++) {
+            const int32_t* taps = job->columns.weights
+                                  + (size_t)x * job->columns.taps;
+            const uint32_t* column = sums
+                                     + (size_t)job->columns.first[x] * size;
+            for (size_t c = 0; c < size; c++) {
+                uint32_t total = 0;
+                for (uint32_t t = 0; t < job->columns.taps; t++) {
+                    total += (uint32_t)taps[t] * column[t * size + c];
+                }
+                row[x * size + c] = (uint8_t)((total + (1u << (BMI_WEIGHT_BITS
+                    + BMI_LEVEL_BITS - 1))) >> (BMI_WEIGHT_BITS
+                                                + BMI_LEVEL_BITS));
+            }
+        }
+        if (row == out) {
+            bmi_kernel_blit(dst, job->kernels, 0, y, out, dst->width);
+        }
+    }
+    
+    free(line);
+    free(sums);
+    free(out);
+}
+
+// Indices cannot be filtered, so palette buffers are resized in RGB and then
+// mapped back to the same palette
+static bmi_buffer* bmi_resize_palette(const bmi_buffer* buffer, uint32_t width,
+                                      uint32_t height) {
+    const uint32_t flags = buffer->flags & ~(uint32_t)BMI_FL_IS_PALETTE;
+    bmi_buffer* rgb = bmi_buffer_convert(buffer, flags);
+    if (rgb == NULL) {
+        bmi_set_error("bmi_buffer_resize: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_buffer* resized = bmi_buffer_resize(rgb, width, height);
+    bmi_buffer_free(rgb);
+    if (resized == NULL) {
+        return BMI_PTR_FAILURE;
+    }
+    bmi_buffer* result = bmi_buffer_new(width, height, buffer->flags);
+    if (result == NULL) {
+        bmi_buffer_free(resized);
+        bmi_set_error("bmi_buffer_resize: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_palette_copy(result, buffer);
+    bmi_buffer_overdraw_buffer(result, BMI_RECT(0, 0, width, height), resized);
+    bmi_buffer_free(resized);
+    return result;
+}
+
+bmi_buffer* bmi_buffer_resize(const bmi_buffer* buffer, uint32_t width,
+                              uint32_t height) {
+    if (width == 0 || height == 0 || buffer->width == 0
+        || buffer->height == 0) {
+        bmi_set_error("bmi_buffer_resize: Sizes must not be zero");
+        return BMI_PTR_FAILURE;
+    }
+    if (buffer->flags & BMI_FL_IS_PALETTE) {
+        return bmi_resize_palette(buffer, width, height);
+    }
+    bmi_resize_job job = {
+        .src = buffer,
+        .kernels = bmi_buffer_kernels(buffer)
+    };
+    if (bmi_resample_weights(&job.columns, buffer->width, width)
+        != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_resize: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    if (bmi_resample_weights(&job.rows, buffer->height, height)
+        != BMI_SUCCESS) {
+        free(job.columns.first);
+        free(job.columns.weights);
+        bmi_set_error("bmi_buffer_resize: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    job.dst = bmi_buffer_new(width, height, buffer->flags);
+    if (job.dst != NULL) {
+        job.parts = bmi_transform_parts((uint64_t)buffer->width * height
+                                        * job.kernels->size
+                                        * job.rows.taps, height);
+        bmi_parallel_for(job.parts, bmi_resize_part, &job);
+        if (job.failed) {
+            bmi_buffer_free(job.dst);
+            job.dst = NULL;
+        }
+    }
+    free(job.columns.first);
+    free(job.columns.weights);
+    free(job.rows.first);
+    free(job.rows.weights);
+    if (job.dst == NULL) {
+        bmi_set_error("bmi_buffer_resize: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    return job.dst;
+}
@@ -16,8 +16,11 @@
 
 #define _BMI_USE_INTERNAL
 
-// bmi_buffer_content_size, BMI_COMPONENT_SIZE_FROM_FL, BMI_VERSION_IS_CURRENT,
-// BMI_FILE_IS_VALID, BMI_VERSION_IS_OUTDATED, BMI_VERSION_IS_LATER
+#include "bmi-util.h"
+
+// bmi_buffer_content_size, BMI_FL_MEMORY_MASK, BMI_VERSION_IS_CURRENT,
+// BMI_FILE_IS_VALID, BMI_VERSION_IS_OUTDATED, BMI_VERSION_IS_LATER,
+// BMI_PIXEL_COUNT_FROM_FL, BMI_COMPONENT_SIZE_FROM_FL
 #include "bmi-file.h"
 
 // bmi_set_error
@@ -27,35 +30,130 @@
 
 #include "bmi-color.h"
 
+// bmi_buffer_overdraw_buffer
+#include "bmi-draw.h"
+
+// bmi_buffer_kernels, bmi_kernel_segment, bmi_kernel_gather,
+// BMI_KERNEL_ADDRESS
+#include "bmi-kernel.h"
+
+// bmi_hash_init, bmi_hash_update, bmi_hash_digest
+#include "bmi-hash.h"
+
+// bmi_buffer_storage_size, bmi_map_pages
+#include "bmi-memory.h"
+
+// bmi_shared_new
+#include "bmi-shared.h"
+
+// bmi_buffer_palette, bmi_palette_init, bmi_palette_copy,
+// bmi_palette_quantize, bmi_palette_encode, bmi_palette_decode,
+// bmi_palette_expand, BMI_PALETTE_COLOR
+#include "bmi-palette.h"
+
 // fseek, ftell, rewind, fread, fwrite, fprintf
 #include <stdio.h>
 
-// malloc
+// malloc, free
 #include <stdlib.h>
 
+// memcpy
+#include <string.h>
+
 // srrno, strerror
 #include <errno.h>
 
 bmi_pixel bmi_buffer_get_pixel(const bmi_buffer* buffer, bmi_point point) {
-    if (point.x >= buffer->width && point.y >= buffer->height) {
+    if (point.x >= buffer->width || point.y >= buffer->height) {
         bmi_set_error("Attempt to access point out of buffer region");
         return BMI_PIXEL_INVALID;
     }
-    if (buffer->flags & BMI_FL_IS_GRAYSCALE) {
-        return BMI_GRY(buffer->contents[BMI_GET_INDEX(buffer, point.x,
-                                                      point.y)]);
-    } else {
-        const size_t index = BMI_GET_INDEX(buffer, point.x, point.y);
-        const bmi_pixel red = buffer->contents[index];
-        const bmi_pixel green = buffer->contents[index + 1];
-        const bmi_pixel blue = buffer->contents[index + 2];
-        return BMI_RGB(red, green, blue);
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    return BMI_PALETTE_COLOR(buffer, kernels->read(
+        BMI_KERNEL_ADDRESS(buffer, kernels, point.x, point.y)));
+}
+
+// Points are indexed in chunks so that the index computation runs as its own
+// vectorizable loop ahead of the gathered loads
+#define BMI_POINT_CHUNK 256
+
+int bmi_buffer_get_pixels(const bmi_buffer* buffer, const bmi_point* points,
+                          bmi_pixel* pixels, size_t count) {
+    size_t total;
+    size_t* order = bmi_bin_points(points, count, buffer->width,
+                                   buffer->height, &total);
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    size_t indices[BMI_POINT_CHUNK];
+    
+    // Binning drops out-of-bounds points, so their results are filled in ahead
+    // of time
+    if (order != NULL && total != count) {
+        for (size_t i = 0; i < count; i++) {
+            if (points[i].x >= buffer->width || points[i].y >= buffer->height) {
+                pixels[i] = BMI_PIXEL_INVALID;
+            }
+        }
+    }
+    
+    size_t invalid = order ? count - total : 0;
+    for (size_t base = 0; base < total; base += BMI_POINT_CHUNK) {
+        const size_t length = total - base < BMI_POINT_CHUNK
+            ? total - base : BMI_POINT_CHUNK;
+        const size_t* chunk_order = order ? order + base : NULL;
+        bmi_pixel* chunk_pixels = order ? pixels : pixels + base;
+        bmi_index_points(order ? points : points + base, chunk_order, length,
+                         buffer->width, buffer->height, buffer->flags,
+                         indices);
+        
+        for (size_t i = 0; i < length; i++) {
+            const size_t slot = chunk_order ? chunk_order[i] : i;
+            if (indices[i] == BMI_INDEX_INVALID) {
+                chunk_pixels[slot] = BMI_PIXEL_INVALID;
+                invalid++;
+            } else {
+                chunk_pixels[slot] = BMI_PALETTE_COLOR(buffer, kernels->read(
+                    buffer->contents + indices[i] * kernels->size));
+            }
+        }
     }
+    
+    free(order);
+    
+    if (invalid != 0) {
+        bmi_set_error("bmi_buffer_get_pixels: Attempt to access point out of "
+                      "buffer region");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
 }
 
 bmi_buffer* bmi_buffer_new(uint32_t width, uint32_t height, uint32_t flags) {
-    bmi_buffer* buffer = malloc(sizeof(bmi_buffer) + width * height
-                                * BMI_COMPONENT_SIZE_FROM_FL(flags));
+    // Palettes live past the pixels, where shared buffers have no room for
+    // them
+    if ((flags & BMI_FL_IS_PALETTE)
+        && (flags & (BMI_FL_IS_GRAYSCALE | BMI_FL_IS_SHARED))) {
+        bmi_set_error("bmi_buffer_new: Palette buffers cannot be grayscale or "
+                      "shared");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Shared buffers are copied a tile at a time, from memory of their own
+    if (flags & BMI_FL_IS_SHARED) {
+        flags = (flags | BMI_FL_IS_TILED) & ~(uint32_t)BMI_FL_IS_MAPPED;
+    }
+    const size_t size = bmi_buffer_storage_size(width, height, flags);
+    if (size == 0) {
+        bmi_set_error("bmi_buffer_new: Image is too large");
+        return BMI_PTR_FAILURE;
+    }
+    bmi_buffer* buffer;
+    if (flags & BMI_FL_IS_SHARED) {
+        buffer = bmi_shared_new(width, height, flags);
+    } else if (flags & BMI_FL_IS_MAPPED) {
+        buffer = bmi_map_pages(size);
+    } else {
+        buffer = malloc(size);
+    }
     if (buffer == NULL) {
         bmi_set_error("bmi_buffer_new: Virtual memory exhausted");
         return BMI_PTR_FAILURE;
@@ -67,9 +165,42 @@ bmi_buffer* bmi_buffer_new(uint32_t width, uint32_t height, uint32_t flags) {
     buffer->width = width;
     buffer->height = height;
     buffer->flags = flags;
+    if (flags & BMI_FL_IS_PALETTE) {
+        bmi_palette_init(bmi_buffer_palette(buffer));
+    }
     return buffer;
 }
 
+bmi_buffer* bmi_buffer_convert(const bmi_buffer* buffer, uint32_t flags) {
+    // Colors for a new palette are chosen from the image itself
+    if ((flags & BMI_FL_IS_PALETTE)
+        && !(buffer->flags & BMI_FL_IS_PALETTE)) {
+        bmi_buffer* result = bmi_palette_quantize(buffer, flags,
+                                                  BMI_PALETTE_CAPACITY);
+        if (result == NULL) {
+            bmi_set_error("bmi_buffer_convert: Virtual memory exhausted");
+            return BMI_PTR_FAILURE;
+        }
+        return result;
+    }
+    
+    bmi_buffer* result = bmi_buffer_new(buffer->width, buffer->height, flags);
+    if (result == NULL) {
+        bmi_set_error("bmi_buffer_convert: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Overdrawing handles every difference in format and layout, and copies
+    // indices outright once both palettes match
+    bmi_palette_copy(result, buffer);
+    bmi_buffer_overdraw_buffer(result, BMI_RECT(0, 0, buffer->width,
+                                                buffer->height), buffer);
+    return result;
+}
+
+// Contents are streamed through the checksum in chunks of this many bytes
+#define BMI_FILE_CHUNK (1 << 20)
+
 bmi_buffer* bmi_buffer_from_file(FILE* source) {
     fseek(source, 0, SEEK_END);
     const size_t length = ftell(source);
@@ -102,27 +233,189 @@ bmi_buffer* bmi_buffer_from_file(FILE* source) {
         return BMI_PTR_FAILURE;
     }
     
-    bmi_buffer* buffer = malloc(length);
+    if (header.flags & BMI_FL_IS_SEQUENCE) {
+        bmi_set_error("bmi_buffer_from_file: File is a sequence of frames");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Files are always row-major and read into ordinary memory
+    header.flags &= ~(uint32_t)BMI_FL_MEMORY_MASK;
+    
+    const size_t size = bmi_buffer_storage_size(header.width, header.height,
+                                                header.flags);
+    if (size == 0) {
+        bmi_set_error("bmi_buffer_from_file: Image is too large");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Palettes come between the header and the contents
+    uint8_t block[BMI_PALETTE_BLOCK_MAX];
+    size_t block_size = 0;
+    if (header.flags & BMI_FL_IS_PALETTE) {
+        if ((header.flags & BMI_FL_IS_GRAYSCALE)
+            || length - sizeof(bmi_buffer) < BMI_PALETTE_BLOCK_SIZE(0)
+            || fread(block, BMI_PALETTE_BLOCK_SIZE(0), 1, source) != 1
+            || bmi_palette_block_count(block) == 0) {
+            bmi_set_error("bmi_buffer_from_file: File has invalid palette");
+            return BMI_PTR_FAILURE;
+        }
+        block_size = BMI_PALETTE_BLOCK_SIZE(bmi_palette_block_count(block));
+        if (length - sizeof(bmi_buffer) < block_size
+            || fread(block + BMI_PALETTE_BLOCK_SIZE(0),
+                     block_size - BMI_PALETTE_BLOCK_SIZE(0), 1, source) != 1) {
+            bmi_set_error("bmi_buffer_from_file: File is truncated");
+            return BMI_PTR_FAILURE;
+        }
+    }
+    
+    const int has_checksum = (header.flags & BMI_FL_HAS_CHECKSUM) != 0;
+    const size_t content_size = BMI_PIXEL_COUNT_FROM_FL(header.width,
+                                                        header.height,
+                                                        header.flags)
+        * BMI_COMPONENT_SIZE_FROM_FL(header.flags);
+    if (length - sizeof(bmi_buffer) - block_size < content_size
+        + (has_checksum ? BMI_CHECKSUM_SIZE : 0)) {
+        bmi_set_error("bmi_buffer_from_file: File is truncated");
+        return BMI_PTR_FAILURE;
+    }
+    
+    bmi_buffer* buffer = malloc(size);
     if (buffer == NULL) {
         bmi_set_error("bmi_buffer_from_file: Exhausted virtual memory");
         return BMI_PTR_FAILURE;
     }
-    rewind(source);
-    if (fread(buffer, sizeof(char), length, source) != length) {
-        bmi_set_error("bmi_buffer_from_file: An error occured while reading "
-                      "the file contents");
-        return BMI_PTR_FAILURE;
+    memcpy(buffer, &header, sizeof(bmi_buffer));
+    
+    bmi_hash_state state;
+    bmi_hash_init(&state);
+    if (block_size != 0) {
+        bmi_palette_decode(bmi_buffer_palette(buffer), block);
+        if (has_checksum) {
+            bmi_hash_update(&state, block, block_size);
+        }
+    }
+    for (size_t offset = 0; offset < content_size; offset += BMI_FILE_CHUNK) {
+        const size_t chunk = content_size - offset < BMI_FILE_CHUNK
+            ? content_size - offset : BMI_FILE_CHUNK;
+        if (fread(buffer->contents + offset, 1, chunk, source) != chunk) {
+            free(buffer);
+            bmi_set_error("bmi_buffer_from_file: An error occured while "
+                          "reading the file contents");
+            return BMI_PTR_FAILURE;
+        }
+        if (has_checksum) {
+            bmi_hash_update(&state, buffer->contents + offset, chunk);
+        }
+    }
+    
+    if (has_checksum) {
+        uint8_t trailer[BMI_CHECKSUM_SIZE];
+        if (fread(trailer, BMI_CHECKSUM_SIZE, 1, source) != 1) {
+            free(buffer);
+            bmi_set_error("bmi_buffer_from_file: An error occured while "
+                          "reading the file checksum");
+            return BMI_PTR_FAILURE;
+        }
+        uint64_t checksum = 0;
+        for (int i = BMI_CHECKSUM_SIZE - 1; i >= 0; i--) {
+            checksum = checksum << 8 | trailer[i];
+        }
+        if (checksum != bmi_hash_digest(&state)) {
+            free(buffer);
+            bmi_set_error("bmi_buffer_from_file: File contents do not match "
+                          "checksum");
+            return BMI_PTR_FAILURE;
+        }
     }
     
     return buffer;
 }
 
 int bmi_buffer_to_file(FILE* dest, const bmi_buffer* buffer) {
-    if (fwrite(buffer, sizeof(buffer) + bmi_buffer_content_size(buffer), 1,
-               dest) != 1) {
+    bmi_buffer header;
+    memcpy(&header, buffer, sizeof(bmi_buffer));
+    header.flags &= ~(uint32_t)BMI_FL_MEMORY_MASK;
+    if (fwrite(&header, sizeof(bmi_buffer), 1, dest) != 1) {
         bmi_set_error("bmi_buffer_to_file: Failed to write");
         return BMI_FAILURE;
     }
+    
+    // Contents are written in row-major order whatever the layout, and each
+    // segment is hashed right before it is written, while still in cache
+    const int has_checksum = (buffer->flags & BMI_FL_HAS_CHECKSUM) != 0;
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    const uint64_t total = (uint64_t)buffer->width * buffer->height;
+    bmi_hash_state state;
+    bmi_hash_init(&state);
+    if (buffer->flags & BMI_FL_IS_PALETTE) {
+        uint8_t block[BMI_PALETTE_BLOCK_MAX];
+        const size_t block_size = bmi_palette_encode(
+            bmi_buffer_palette(buffer), block);
+        if (has_checksum) {
+            bmi_hash_update(&state, block, block_size);
+        }
+        if (fwrite(block, block_size, 1, dest) != 1) {
+            bmi_set_error("bmi_buffer_to_file: Failed to write palette");
+            return BMI_FAILURE;
+        }
+    }
+    for (uint64_t position = 0; position < total;) {
+        const uint8_t* segment;
+        const size_t count = bmi_kernel_segment(buffer, kernels, position,
+                                                BMI_FILE_CHUNK / kernels->size,
+                                                &segment);
+        if (has_checksum) {
+            bmi_hash_update(&state, segment, count * kernels->size);
+        }
+        if (fwrite(segment, count * kernels->size, 1, dest) != 1) {
+            bmi_set_error("bmi_buffer_to_file: Failed to write");
+            return BMI_FAILURE;
+        }
+        position += count;
+    }
+    if (!has_checksum) {
+        return BMI_SUCCESS;
+    }
+    
+    uint64_t checksum = bmi_hash_digest(&state);
+    uint8_t trailer[BMI_CHECKSUM_SIZE];
+    for (int i = 0; i < BMI_CHECKSUM_SIZE; i++) {
+        trailer[i] = (uint8_t)checksum;
+        checksum >>= 8;
+    }
+    if (fwrite(trailer, BMI_CHECKSUM_SIZE, 1, dest) != 1) {
+        bmi_set_error("bmi_buffer_to_file: Failed to write checksum");
+        return BMI_FAILURE;
+    }
+    return BMI_SUCCESS;
+}
+
+// Writes the pixels of a palette buffer as RGB, a row at a time
+static int bmi_ppm_expand(FILE* dest, const bmi_buffer* buffer,
+                          const bmi_kernels* kernels) {
+    bmi_palette_table table;
+    bmi_palette_table_init(bmi_buffer_palette(buffer), &table);
+    const size_t width = buffer->width;
+    uint8_t* indices = malloc(width ? width : 1);
+    uint8_t* row = malloc(width ? 3 * width : 1);
+    if (indices == NULL || row == NULL) {
+        free(indices);
+        free(row);
+        bmi_set_error("bmi_buffer_to_ppm: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    for (uint32_t y = 0; y < buffer->height && width != 0; y++) {
+        bmi_kernel_gather(buffer, kernels, 0, y, indices, width);
+        bmi_palette_expand(&table, row, indices, width);
+        if (fwrite(row, 3 * width, 1, dest) != 1) {
+            free(indices);
+            free(row);
+            bmi_set_error("bmi_buffer_to_ppm: Failed to write image data");
+            return BMI_FAILURE;
+        }
+    }
+    free(indices);
+    free(row);
     return BMI_SUCCESS;
 }
 
@@ -145,17 +438,307 @@ int bmi_buffer_to_ppm(FILE* dest, const bmi_buffer* buffer) {
                       "information");
         return BMI_FAILURE;
     }
-    if (fwrite(buffer->contents, bmi_buffer_content_size(buffer), 1,
-               dest) != 1) {
-        bmi_set_error("bmi_buffer_to_ppm: Failed to write image data");
-        return BMI_FAILURE;
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    if (buffer->flags & BMI_FL_IS_PALETTE) {
+        return bmi_ppm_expand(dest, buffer, kernels);
+    }
+    const uint64_t total = (uint64_t)buffer->width * buffer->height;
+    for (uint64_t position = 0; position < total;) {
+        const uint8_t* segment;
+        const size_t count = bmi_kernel_segment(buffer, kernels, position,
+                                                SIZE_MAX, &segment);
+        if (fwrite(segment, count * kernels->size, 1, dest) != 1) {
+            bmi_set_error("bmi_buffer_to_ppm: Failed to write image data");
+            return BMI_FAILURE;
+        }
+        position += count;
+    }
+    return BMI_SUCCESS;
+}
 
+// Reads the next number of a PPM header, skipping the whitespace and comments
+// before it and consuming the single whitespace character after it
+static int bmi_ppm_field(FILE* source, uint32_t* value) {
+    int c = getc(source);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = getc(source);
+            }
+        }
+        c = getc(source);
+    }
+    if (c < '0' || c > '9') {
+        return BMI_FAILURE;
+    }
+    uint64_t result = 0;
+    while (c >= '0' && c <= '9') {
+        result = result * 10 + (uint64_t)(c - '0');
+        if (result > UINT32_MAX) {
+            return BMI_FAILURE;
+        }
+        c = getc(source);
+    }
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+        return BMI_FAILURE;
     }
+    *value = (uint32_t)result;
     return BMI_SUCCESS;
 }
 
-int bmi_buffer_to_bmp(FILE* dest, const bmi_buffer* buffer) {
-    bmi_set_error("bmi_buffer_to_bmp: Function not implemented");
-    return BMI_BUG;
+bmi_buffer* bmi_buffer_from_ppm(FILE* source) {
+    char magic[2];
+    if (fread(magic, 2, 1, source) != 1 || magic[0] != 'P'
+        || (magic[1] != '5' && magic[1] != '6')) {
+        bmi_set_error("bmi_buffer_from_ppm: File is not a binary PPM or PGM");
+        return BMI_PTR_FAILURE;
+    }
+    uint32_t width;
+    uint32_t height;
+    uint32_t maximum;
+    if (bmi_ppm_field(source, &width) != BMI_SUCCESS
+        || bmi_ppm_field(source, &height) != BMI_SUCCESS
+        || bmi_ppm_field(source, &maximum) != BMI_SUCCESS) {
+        bmi_set_error("bmi_buffer_from_ppm: File has invalid header");
+        return BMI_PTR_FAILURE;
+    }
+    if (maximum != 255) {
+        bmi_set_error("bmi_buffer_from_ppm: Only 8-bit channels are "
+                      "supported");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // The raster is already in the layout of a row-major buffer
+    bmi_buffer* buffer = bmi_buffer_new(width, height, magic[1] == '5'
+                                        ? BMI_FL_IS_GRAYSCALE : 0);
+    if (buffer == NULL) {
+        bmi_set_error("bmi_buffer_from_ppm: Image is too large");
+        return BMI_PTR_FAILURE;
+    }
+    const size_t content_size = bmi_buffer_content_size(buffer);
+    for (size_t offset = 0; offset < content_size; offset += BMI_FILE_CHUNK) {
+        const size_t chunk = content_size - offset < BMI_FILE_CHUNK
+            ? content_size - offset : BMI_FILE_CHUNK;
+        if (fread(buffer->contents + offset, 1, chunk, source) != chunk) {
+            free(buffer);
+            bmi_set_error("bmi_buffer_from_ppm: File is truncated");
+            return BMI_PTR_FAILURE;
+        }
+    }
+    return buffer;
+}
+
+static uint32_t bmi_read_le32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8
+        | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void bmi_write_le32(uint8_t* bytes, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+bmi_buffer* bmi_buffer_from_bmp(FILE* source) {
+    uint8_t header[BMI_BMP_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, source) != 1
+        || header[0] != 'B' || header[1] != 'M') {
+        bmi_set_error("bmi_buffer_from_bmp: File is not a BMP");
+        return BMI_PTR_FAILURE;
+    }
+    const uint32_t offset = bmi_read_le32(header + 10);
+    const uint32_t info_size = bmi_read_le32(header + 14);
+    const int32_t width = (int32_t)bmi_read_le32(header + 18);
+    const int32_t height = (int32_t)bmi_read_le32(header + 22);
+    const uint32_t depth = header[28] | (uint32_t)header[29] << 8;
+    const uint32_t compression = bmi_read_le32(header + 30);
+    uint32_t colors = bmi_read_le32(header + 46);
+    if (info_size < BMI_BMP_INFO_HEADER_SIZE || width < 0
+        || height == INT32_MIN) {
+        bmi_set_error("bmi_buffer_from_bmp: File has invalid header");
+        return BMI_PTR_FAILURE;
+    }
+    if (compression != 0 || (depth != 8 && depth != 24 && depth != 32)) {
+        bmi_set_error("bmi_buffer_from_bmp: Only uncompressed 8, 24 and 32-bit "
+                      "images are supported");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Palettes of only grays are read into grayscale buffers, and others into
+    // palette buffers
+    uint8_t palette[BMI_BMP_PALETTE_SIZE] = { 0 };
+    int gray = 0;
+    if (depth == 8) {
+        if (colors == 0 || colors > 256) {
+            colors = 256;
+        }
+        if (fseek(source, BMI_BMP_FILE_HEADER_SIZE + (long)info_size,
+                  SEEK_SET) != 0
+            || fread(palette, 4, colors, source) != colors) {
+            bmi_set_error("bmi_buffer_from_bmp: File has invalid palette");
+            return BMI_PTR_FAILURE;
+        }
+        gray = 1;
+        for (uint32_t i = 0; i < colors; i++) {
+            if (palette[4 * i] != palette[4 * i + 1]
+                || palette[4 * i] != palette[4 * i + 2]) {
+                gray = 0;
+            }
+        }
+    }
+    
+    const uint32_t rows = (uint32_t)(height < 0 ? -height : height);
+    const uint32_t flags = gray ? BMI_FL_IS_GRAYSCALE
+        : depth == 8 ? BMI_FL_IS_PALETTE : 0;
+    bmi_buffer* buffer = bmi_buffer_new((uint32_t)width, rows, flags);
+    if (buffer == NULL) {
+        bmi_set_error("bmi_buffer_from_bmp: Image is too large");
+        return BMI_PTR_FAILURE;
+    }
+    if (flags & BMI_FL_IS_PALETTE) {
+        bmi_palette* colormap = bmi_buffer_palette(buffer);
+        colormap->count = colors;
+        for (uint32_t i = 0; i < colors; i++) {
+            const uint8_t* color = palette + 4 * i;
+            colormap->colors[i] = BMI_RGB((bmi_pixel)color[2],
+                                          (bmi_pixel)color[1],
+                                          (bmi_pixel)color[0]);
+        }
+    }
+    const size_t stride = ((size_t)width * depth + 31) / 32 * 4;
+    uint8_t* row = malloc(stride ? stride : 1);
+    if (row == NULL) {
+        free(buffer);
+        bmi_set_error("bmi_buffer_from_bmp: Virtual memory exhausted");
+        return BMI_PTR_FAILURE;
+    }
+    if (fseek(source, (long)offset, SEEK_SET) != 0) {
+        free(row);
+        free(buffer);
+        bmi_set_error("bmi_buffer_from_bmp: File is truncated");
+        return BMI_PTR_FAILURE;
+    }
+    
+    // Rows are stored bottom-up unless the height is negative, with their
+    // pixels in BGR order
+    const size_t size = depth == 8 ? 1 : 3;
+    for (uint32_t i = 0; i < rows; i++) {
+        if (fread(row, 1, stride, source) != stride) {
+            free(row);
+            free(buffer);
+            bmi_set_error("bmi_buffer_from_bmp: File is truncated");
+            return BMI_PTR_FAILURE;
+        }
+        const uint32_t y = height < 0 ? i : rows - 1 - i;
+        uint8_t* dst = buffer->contents + (size_t)y * width * size;
+        if (gray) {
+            for (int32_t x = 0; x < width; x++) {
+                dst[x] = palette[4 * row[x]];
+            }
+        } else if (depth == 8) {
+            memcpy(dst, row, (size_t)width);
+        } else {
+            const size_t step = depth / 8;
+            const uint8_t* src = row;
+            for (int32_t x = 0; x < width; x++, dst += 3, src += step) {
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+            }
+        }
+    }
+    free(row);
+    return buffer;
+}
+
+size_t bmi_bmp_header(const bmi_buffer* buffer, uint8_t* header) {
+    // Grayscale buffers are written with a palette of every gray, and palette
+    // buffers with their own
+    const int gray = (buffer->flags & BMI_FL_IS_GRAYSCALE) != 0;
+    const int indexed = gray || (buffer->flags & BMI_FL_IS_PALETTE);
+    const uint64_t stride = BMI_BMP_STRIDE(buffer);
+    const uint64_t offset = BMI_BMP_HEADER_SIZE
+                            + (indexed ? BMI_BMP_PALETTE_SIZE : 0);
+    const uint64_t file_size = offset + stride * buffer->height;
+    if (buffer->width > INT32_MAX || buffer->height > INT32_MAX
+        || file_size > UINT32_MAX) {
+        return 0;
+    }
+    
+    memset(header, 0, (size_t)offset);
+    header[0] = 'B';
+    header[1] = 'M';
+    bmi_write_le32(header + 2, (uint32_t)file_size);
+    bmi_write_le32(header + 10, (uint32_t)offset);
+    bmi_write_le32(header + 14, BMI_BMP_INFO_HEADER_SIZE);
+    bmi_write_le32(header + 18, buffer->width);
+    bmi_write_le32(header + 22, buffer->height);
+    header[26] = 1;
+    header[28] = indexed ? 8 : 24;
+    bmi_write_le32(header + 34, (uint32_t)(stride * buffer->height));
+    if (gray) {
+        bmi_write_le32(header + 46, 256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint8_t* color = header + BMI_BMP_HEADER_SIZE + 4 * i;
+            color[0] = color[1] = color[2] = (uint8_t)i;
+        }
+    } else if (indexed) {
+        // Every entry is written, so that indices past the count still have
+        // their colors
+        const bmi_palette* palette = bmi_buffer_palette(buffer);
+        bmi_write_le32(header + 46, 256);
+        for (uint32_t i = 0; i < 256; i++) {
+            uint8_t* color = header + BMI_BMP_HEADER_SIZE + 4 * i;
+            color[0] = (uint8_t)BMI_RGB_B(palette->colors[i]);
+            color[1] = (uint8_t)BMI_RGB_G(palette->colors[i]);
+            color[2] = (uint8_t)BMI_RGB_R(palette->colors[i]);
+        }
+    }
+    return (size_t)offset;
 }
 
+void bmi_bmp_row(const bmi_buffer* buffer, const bmi_kernels* kernels,
+                 uint32_t i, uint8_t* row) {
+    const uint32_t y = buffer->height - 1 - i;
+    const size_t size = (size_t)buffer->width * kernels->size;
+    bmi_kernel_gather(buffer, kernels, 0, y, row, buffer->width);
+    if (kernels->size == 3) {
+        for (uint8_t* pixel = row; pixel < row + size; pixel += 3) {
+            const uint8_t red = pixel[0];
+            pixel[0] = pixel[2];
+            pixel[2] = red;
+        }
+    }
+    memset(row + size, 0, (size_t)BMI_BMP_STRIDE(buffer) - size);
+}
+
+int bmi_buffer_to_bmp(FILE* dest, const bmi_buffer* buffer) {
+    const bmi_kernels* kernels = bmi_buffer_kernels(buffer);
+    uint8_t header[BMI_BMP_HEADER_MAX];
+    const size_t offset = bmi_bmp_header(buffer, header);
+    if (offset == 0) {
+        bmi_set_error("bmi_buffer_to_bmp: Image is too large for a BMP");
+        return BMI_FAILURE;
+    }
+    if (fwrite(header, offset, 1, dest) != 1) {
+        bmi_set_error("bmi_buffer_to_bmp: Failed to write file header");
+        return BMI_FAILURE;
+    }
+    
+    const uint64_t stride = BMI_BMP_STRIDE(buffer);
+    uint8_t* row = calloc(1, stride ? (size_t)stride : 1);
+    if (row == NULL) {
+        bmi_set_error("bmi_buffer_to_bmp: Virtual memory exhausted");
+        return BMI_FAILURE;
+    }
+    for (uint32_t i = 0; i < buffer->height; i++) {
+        bmi_bmp_row(buffer, kernels, i, row);
+        if (fwrite(row, (size_t)stride, 1, dest) != 1) {
+            free(row);
+            bmi_set_error("bmi_buffer_to_bmp: Failed to write image data");
+            return BMI_FAILURE;
+        }
+    }
+    free(row);
+    return BMI_SUCCESS;
+}
@@ -18,8 +18,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+
+// Tests compare the inline fast path against the library
+#define BMI_INLINE_FASTPATH
 #include "include/bmi.h"
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 int test_overdraw() {
     bmi_buffer* buffer = bmi_buffer_new(256, 256, 0);
     if (buffer == NULL) {
@@ -235,3 +243,1712 @@ int test_create_smile_ppm() {
     
     return 0;
 }
+
+int test_draw_points() {
+    bmi_buffer* buffer = bmi_buffer_new(256, 256, 0);
+    if (buffer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 256, 256), BMI_RGB_BLACK());
+    
+    // Scatter enough points in random order that they are binned by row, with
+    // some of them falling outside of the buffer
+    const size_t count = 20000;
+    bmi_point* points = malloc(count * sizeof(bmi_point));
+    bmi_pixel* pixels = malloc(count * sizeof(bmi_pixel));
+    if (points == NULL || pixels == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    srand(42);
+    for (size_t i = 0; i < count; i++) {
+        points[i] = BMI_POINT((uint32_t)(rand() % 300),
+                              (uint32_t)(rand() % 300));
+        pixels[i] = BMI_RGB(points[i].x & 0xFF, points[i].y & 0xFF, 128);
+    }
+    bmi_buffer_draw_points(buffer, points, 64, BMI_RGB_WHITE());
+    bmi_buffer_draw_colored_points(buffer, points, pixels, count);
+    
+    bmi_pixel* read = malloc(count * sizeof(bmi_pixel));
+    if (read == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    if (bmi_buffer_get_pixels(buffer, points, read, count) != BMI_FAILURE) {
+        fprintf(stderr, "Out-of-bounds points were not reported\n");
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const int inside = points[i].x < 256 && points[i].y < 256;
+        if (read[i] != (inside ? pixels[i] : BMI_PIXEL_INVALID)) {
+            bmi_dump_point(stderr, points[i]);
+            return 1;
+        }
+    }
+    
+    FILE* file = fopen("test.ppm", "w");
+    if (file == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    if (bmi_buffer_to_ppm(file, buffer) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (fclose(file) != 0) {
+        perror("fclose");
+        return 1;
+    }
+    
+    free(read);
+    free(pixels);
+    free(points);
+    free(buffer);
+    
+    return 0;
+}
+
+int test_stroke_polyline() {
+    bmi_buffer* buffer = bmi_buffer_new(256, 256, 0);
+    if (buffer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 256, 256), BMI_RGB_BLACK());
+    
+    // Axis-aligned frame
+    const bmi_point frame[] = {
+        BMI_POINT(8, 8), BMI_POINT(247, 8), BMI_POINT(247, 247),
+        BMI_POINT(8, 247), BMI_POINT(8, 8)
+    };
+    bmi_buffer_stroke_polyline(buffer, frame, 5, BMI_RGB_BLUE());
+    
+    // Sine wave whose peaks leave the bottom of the buffer
+    bmi_point wave[512];
+    for (int i = 0; i < 512; i++) {
+        const float radians = ((float)i * 4.0f * M_PI) / 512.0f;
+        wave[i] = BMI_POINT((uint32_t)(i * 300 / 512),
+                            (uint32_t)(sinf(radians) * 160.0f + 160.0f));
+    }
+    bmi_buffer_stroke_polyline(buffer, wave, 512, BMI_RGB_WHITE());
+    
+    // The frame is drawn on each edge away from the wave, and nothing beside
+    // it is
+    const bmi_point on_frame[] = {
+        BMI_POINT(60, 8), BMI_POINT(247, 150), BMI_POINT(100, 247),
+        BMI_POINT(8, 100), BMI_POINT(8, 8), BMI_POINT(247, 247)
+    };
+    const bmi_point off_frame[] = {
+        BMI_POINT(60, 9), BMI_POINT(246, 150), BMI_POINT(100, 246),
+        BMI_POINT(9, 100), BMI_POINT(7, 7), BMI_POINT(248, 248)
+    };
+    for (size_t i = 0; i < sizeof(on_frame) / sizeof(*on_frame); i++) {
+        if (bmi_buffer_get_pixel(buffer, on_frame[i]) != BMI_RGB_BLUE()
+            || bmi_buffer_get_pixel(buffer, off_frame[i])
+               != BMI_RGB_BLACK()) {
+            fprintf(stderr, "Frame was stroked wrongly\n");
+            return 1;
+        }
+    }
+    
+    // Every vertex within the buffer is drawn
+    for (int i = 0; i < 512; i++) {
+        if (wave[i].x < 256 && wave[i].y < 256
+            && bmi_buffer_get_pixel(buffer, wave[i]) != BMI_RGB_WHITE()) {
+            fprintf(stderr, "Wave vertex was not drawn\n");
+            return 1;
+        }
+    }
+    
+    // Segments leaving the buffer are drawn up to its edges, where the first
+    // peak crosses the bottom and the last trough the right, and not past
+    // them, so the middle of the peak is clear at both the bottom and the top
+    int bottom = 0;
+    int right = 0;
+    for (uint32_t i = 0; i < 256; i++) {
+        bottom |= i < 75 && bmi_buffer_get_pixel(buffer, BMI_POINT(i, 255))
+                            == BMI_RGB_WHITE();
+        right |= bmi_buffer_get_pixel(buffer, BMI_POINT(255, i))
+                 == BMI_RGB_WHITE();
+    }
+    if (!bottom || !right) {
+        fprintf(stderr, "Wave was not drawn up to the clip edges\n");
+        return 1;
+    }
+    for (uint32_t x = 30; x < 45; x++) {
+        if (bmi_buffer_get_pixel(buffer, BMI_POINT(x, 255)) != BMI_RGB_BLACK()
+            || bmi_buffer_get_pixel(buffer, BMI_POINT(x, 0))
+               != BMI_RGB_BLACK()) {
+            fprintf(stderr, "Wave was drawn past the clip edge\n");
+            return 1;
+        }
+    }
+    
+    FILE* file = fopen("test.ppm", "w");
+    if (file == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    if (bmi_buffer_to_ppm(file, buffer) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (fclose(file) != 0) {
+        perror("fclose");
+        return 1;
+    }
+    
+    bmi_buffer_free(buffer);
+    
+    return 0;
+}
+
+int test_draw_text() {
+    bmi_buffer* buffer = bmi_buffer_new(256, 256, 0);
+    if (buffer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_font* font = bmi_font_new();
+    if (font == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 256, 256), BMI_RGB_BLACK());
+    
+    // Axis ticks, which reuse one atlas
+    char label[16];
+    for (int i = 0; i < 10; i++) {
+        sprintf(label, "%d", i * 25);
+        if (bmi_buffer_draw_text(buffer, font, BMI_POINT(4, 8 + i * 24), label,
+                                 BMI_RGB_WHITE()) != BMI_SUCCESS) {
+            fprintf(stderr, "%s\n", bmi_last_error());
+            return 1;
+        }
+    }
+    
+    // A label with a background, running off the right edge
+    if (bmi_buffer_draw_text_box(buffer, font, BMI_POINT(64, 120),
+                                 "2021-06-01 12:00:00 UTC, frame 0001",
+                                 BMI_RGB_YELLOW(), BMI_RGB_BLUE())
+        != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    
+    // The box is clipped at the right edge without wrapping onto the left
+    const uint32_t box_height = bmi_font_line_height(font);
+    for (uint32_t y = 120; y < 120 + box_height; y++) {
+        for (uint32_t x = 64; x < 256; x++) {
+            const bmi_pixel pixel = bmi_buffer_get_pixel(buffer,
+                                                         BMI_POINT(x, y));
+            if (pixel != BMI_RGB_YELLOW() && pixel != BMI_RGB_BLUE()) {
+                fprintf(stderr, "Text box was not filled at (%u, %u)\n", x,
+                        y);
+                return 1;
+            }
+        }
+        for (uint32_t x = 30; x < 64; x++) {
+            if (bmi_buffer_get_pixel(buffer, BMI_POINT(x, y))
+                != BMI_RGB_BLACK()) {
+                fprintf(stderr, "Text box wrapped to (%u, %u)\n", x, y);
+                return 1;
+            }
+        }
+    }
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(255, 120 + box_height - 1))
+        != BMI_RGB_BLUE()) {
+        fprintf(stderr, "Text box background was not drawn to the edge\n");
+        return 1;
+    }
+    
+    // A BDF font with an 'L' set one column into its cell, and a glyph out
+    // of the addressable range which is skipped
+    FILE* source = tmpfile();
+    if (source == NULL) {
+        perror("tmpfile");
+        return 1;
+    }
+    fputs("STARTFONT 2.1\n"
+          "FONTBOUNDINGBOX 4 5 0 -1\n"
+          "FONT_ASCENT 4\n"
+          "FONT_DESCENT 1\n"
+          "CHARS 2\n"
+          "STARTCHAR L\n"
+          "ENCODING 76\n"
+          "DWIDTH 5 0\n"
+          "BBX 3 4 1 0\n"
+          "BITMAP\n"
+          "80\n80\n80\nE0\n"
+          "ENDCHAR\n"
+          "STARTCHAR Lstroke\n"
+          "ENCODING 321\n"
+          "DWIDTH 5 0\n"
+          "BBX 4 4 0 0\n"
+          "BITMAP\n"
+          "F0\nF0\nF0\nF0\n"
+          "ENDCHAR\n"
+          "ENDFONT\n", source);
+    rewind(source);
+    bmi_font* bdf = bmi_font_from_bdf(source);
+    fclose(source);
+    if (bdf == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    const bmi_rect size = bmi_font_measure(bdf, "LL");
+    if (bmi_font_line_height(bdf) != 5 || size.width != 10
+        || size.height != 5) {
+        fprintf(stderr, "BDF font has wrong metrics\n");
+        return 1;
+    }
+    if (bmi_buffer_draw_text(buffer, bdf, BMI_POINT(200, 200), "LL",
+                             BMI_RGB_WHITE()) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    for (uint32_t y = 0; y < 5; y++) {
+        for (uint32_t x = 0; x < 10; x++) {
+            const uint32_t cx = x % 5;
+            const int lit = (cx == 1 && y < 4) || (y == 3 && cx >= 1
+                                                   && cx <= 3);
+            const bmi_pixel pixel = bmi_buffer_get_pixel(buffer,
+                BMI_POINT(200 + x, 200 + y));
+            if (pixel != (lit ? BMI_RGB_WHITE() : BMI_RGB_BLACK())) {
+                fprintf(stderr, "Glyph pixel (%u, %u) is wrong\n", x, y);
+                return 1;
+            }
+        }
+    }
+    
+    FILE* file = fopen("test.ppm", "w");
+    if (file == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    if (bmi_buffer_to_ppm(file, buffer) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (fclose(file) != 0) {
+        perror("fclose");
+        return 1;
+    }
+    
+    bmi_font_free(bdf);
+    bmi_font_free(font);
+    bmi_buffer_free(buffer);
+    
+    return 0;
+}
+
+int test_histogram() {
+    bmi_buffer* buffer = bmi_buffer_new(256, 256, BMI_FL_IS_GRAYSCALE);
+    if (buffer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    
+    // A quarter of the buffer is white and the rest is black
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 256, 256), BMI_GRY_BLACK());
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 128, 128), BMI_GRY_WHITE());
+    
+    bmi_histogram histogram;
+    if (bmi_buffer_histogram(buffer, &histogram) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (histogram.counts[0][255] != 128 * 128
+        || histogram.counts[0][0] != 3 * 128 * 128) {
+        fprintf(stderr, "Histogram has wrong counts\n");
+        return 1;
+    }
+    
+    bmi_stats stats;
+    if (bmi_buffer_stats_rect(buffer, BMI_RECT(64, 64, 128, 128), &stats)
+        != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (stats.min[0] != 0 || stats.max[0] != 255 || stats.mean[0] != 63.75
+        || stats.pixels != 128 * 128) {
+        fprintf(stderr, "Statistics are wrong\n");
+        return 1;
+    }
+    
+    // Failures are reported by the function that was called
+    if (bmi_buffer_stats_rect(buffer, BMI_RECT(300, 0, 10, 10), &stats)
+        != BMI_FAILURE
+        || strcmp(bmi_last_error(), "bmi_buffer_stats_rect: Region is empty")
+           != 0) {
+        fprintf(stderr, "Empty region was reported wrongly\n");
+        return 1;
+    }
+    
+    free(buffer);
+    
+    return 0;
+}
+
+int test_compare() {
+    bmi_buffer* a = bmi_buffer_new(300, 200, 0);
+    bmi_buffer* b = bmi_buffer_new(300, 200, 0);
+    if (a == NULL || b == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    
+    bmi_buffer_fill_rect(a, BMI_RECT(0, 0, 300, 200), BMI_RGB(10, 20, 30));
+    bmi_buffer_fill_rect(b, BMI_RECT(0, 0, 300, 200), BMI_RGB(10, 20, 30));
+    
+    int equal;
+    double psnr;
+    if (bmi_buffer_compare(a, b, &equal, NULL) != BMI_SUCCESS
+        || bmi_buffer_psnr(a, b, &psnr) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (!equal || psnr != INFINITY) {
+        fprintf(stderr, "Identical buffers compare unequal\n");
+        return 1;
+    }
+    
+    // Change a small block and make sure it is located exactly
+    bmi_buffer_fill_rect(b, BMI_RECT(120, 50, 40, 30), BMI_RGB(13, 24, 30));
+    bmi_point first;
+    if (bmi_buffer_compare(a, b, &equal, &first) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (equal || first.x != 120 || first.y != 50) {
+        fprintf(stderr, "First difference is wrong\n");
+        return 1;
+    }
+    
+    bmi_rect changed;
+    bmi_buffer* diff = bmi_buffer_diff(a, b, &changed);
+    if (diff == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (changed.x != 120 || changed.y != 50
+        || changed.width != 40 || changed.height != 30) {
+        fprintf(stderr, "Changed region is wrong\n");
+        return 1;
+    }
+    
+    // Each changed pixel contributes 3 * 3 + 4 * 4 over three channels
+    double mse;
+    if (bmi_buffer_mse(a, b, &mse) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (mse != 25.0 * 40 * 30 / (300.0 * 200 * 3)) {
+        fprintf(stderr, "Mean squared error is wrong\n");
+        return 1;
+    }
+    
+    FILE* file = fopen("test.ppm", "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open test.ppm\n");
+        return 1;
+    }
+    bmi_buffer_to_ppm(file, diff);
+    fclose(file);
+    
+    free(diff);
+    free(b);
+    free(a);
+    
+    return 0;
+}
+
+int test_checksum() {
+    bmi_buffer* buffer = bmi_buffer_new(64, 48, BMI_FL_HAS_CHECKSUM);
+    if (buffer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 64, 48), BMI_RGB(0, 0, 0));
+    bmi_buffer_fill_ellipse(buffer, BMI_RECT(8, 8, 48, 32),
+                            BMI_RGB(255, 128, 0));
+    
+    FILE* file = fopen("test.bmi", "w+b");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open test.bmi\n");
+        return 1;
+    }
+    if (bmi_buffer_to_file(file, buffer) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    
+    // An intact file loads with the same hash
+    bmi_buffer* loaded = bmi_buffer_from_file(file);
+    if (loaded == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (bmi_buffer_hash(loaded) != bmi_buffer_hash(buffer)) {
+        fprintf(stderr, "Loaded buffer has a different hash\n");
+        return 1;
+    }
+    free(loaded);
+    
+    // Flipping a single bit of a pixel is caught
+    fseek(file, sizeof(bmi_buffer) + 1000, SEEK_SET);
+    fputc(buffer->contents[1000] ^ 1, file);
+    if ((loaded = bmi_buffer_from_file(file)) != NULL) {
+        fprintf(stderr, "Corrupted file was loaded\n");
+        return 1;
+    }
+    fclose(file);
+    
+    // As is a file cut short
+    file = fopen("test.bmi", "w+b");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open test.bmi\n");
+        return 1;
+    }
+    fwrite(buffer, sizeof(bmi_buffer) + bmi_buffer_content_size(buffer), 1,
+           file);
+    if ((loaded = bmi_buffer_from_file(file)) != NULL) {
+        fprintf(stderr, "Truncated file was loaded\n");
+        return 1;
+    }
+    fclose(file);
+    
+    free(buffer);
+    
+    return 0;
+}
+
+int test_tiled() {
+    bmi_buffer* tiled = bmi_buffer_new(200, 150, BMI_FL_IS_TILED);
+    if (tiled == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    
+    // Draw across tile boundaries in every direction
+    bmi_buffer_fill_rect(tiled, BMI_RECT(0, 0, 200, 150), BMI_RGB(0, 0, 0));
+    bmi_buffer_fill_rect(tiled, BMI_RECT(30, 40, 100, 70),
+                         BMI_RGB(0, 80, 160));
+    bmi_buffer_fill_ellipse(tiled, BMI_RECT(50, 20, 120, 110),
+                            BMI_RGB(255, 200, 0));
+    bmi_buffer_stroke_rect(tiled, BMI_RECT(5, 5, 190, 140), 3,
+                           BMI_RGB(255, 255, 255));
+    bmi_buffer_stroke_line(tiled, BMI_POINT(0, 149), BMI_POINT(199, 0), 1,
+                           BMI_RGB(255, 0, 0));
+    bmi_buffer_stroke_line(tiled, BMI_POINT(100, 0), BMI_POINT(100, 149), 1,
+                           BMI_RGB(0, 255, 0));
+    
+    // The same pixels must come out of a row-major copy
+    bmi_buffer* linear = bmi_buffer_convert(tiled, 0);
+    if (linear == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    const bmi_point probes[] = {
+        BMI_POINT(0, 0), BMI_POINT(63, 64), BMI_POINT(64, 63),
+        BMI_POINT(100, 75), BMI_POINT(128, 128), BMI_POINT(199, 149)
+    };
+    for (size_t i = 0; i < sizeof(probes) / sizeof(*probes); i++) {
+        if (bmi_buffer_get_pixel(tiled, probes[i])
+            != bmi_buffer_get_pixel(linear, probes[i])) {
+            fprintf(stderr, "Tiled and row-major pixels differ\n");
+            return 1;
+        }
+    }
+    if (bmi_buffer_hash(tiled) != bmi_buffer_hash(linear)) {
+        fprintf(stderr, "Tiled and row-major hashes differ\n");
+        return 1;
+    }
+    
+    // Lines walk by coordinates when tiled and by offsets otherwise, which
+    // must reach the same pixels in every direction
+    const bmi_point ends[] = {
+        BMI_POINT(199, 20), BMI_POINT(10, 0), BMI_POINT(0, 130),
+        BMI_POINT(180, 149), BMI_POINT(90, 149), BMI_POINT(110, 0)
+    };
+    for (size_t i = 0; i < sizeof(ends) / sizeof(*ends); i++) {
+        const bmi_point center = BMI_POINT(100, 75);
+        bmi_buffer_stroke_line(tiled, center, ends[i], 1,
+                               BMI_RGB(0, 0, 255));
+        bmi_buffer_stroke_line(linear, center, ends[i], 1,
+                               BMI_RGB(0, 0, 255));
+    }
+    if (bmi_buffer_hash(tiled) != bmi_buffer_hash(linear)) {
+        fprintf(stderr, "Tiled and row-major lines differ\n");
+        return 1;
+    }
+    
+    FILE* file = fopen("test.ppm", "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open test.ppm\n");
+        return 1;
+    }
+    bmi_buffer_to_ppm(file, tiled);
+    fclose(file);
+    
+    free(linear);
+    free(tiled);
+    
+    return 0;
+}
+
+int test_large_image() {
+    // More pixels than a 32-bit offset can reach
+    const uint32_t side = 66000;
+    bmi_buffer* buffer = bmi_buffer_new(side, side,
+                                        BMI_FL_IS_GRAYSCALE | BMI_FL_IS_MAPPED);
+    if (buffer == NULL) {
+        fprintf(stderr, "Skipping large image test: %s\n", bmi_last_error());
+        return 0;
+    }
+    if (bmi_buffer_content_size(buffer) != (size_t)side * side) {
+        fprintf(stderr, "Content size overflowed\n");
+        return 1;
+    }
+    
+    // Only the pages drawn to are ever touched
+    bmi_buffer_fill_rect(buffer, BMI_RECT(side - 100, side - 100, 100, 100),
+                         BMI_GRY(200));
+    bmi_buffer_draw_point(buffer, BMI_POINT(side - 1, side - 1), BMI_GRY(7));
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(side - 1, side - 1))
+        != BMI_GRY(7)
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(side - 50, side - 50))
+        != BMI_GRY(200)
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(0, side / 2))
+        != BMI_GRY(0)) {
+        fprintf(stderr, "Pixels past 4 GiB are wrong\n");
+        return 1;
+    }
+    
+    // Sizes that do not fit in memory fail cleanly
+    if (bmi_buffer_new(UINT32_MAX, UINT32_MAX, BMI_FL_IS_TILED) != NULL) {
+        fprintf(stderr, "Impossible buffer was allocated\n");
+        return 1;
+    }
+    
+    bmi_buffer_free(buffer);
+    
+    return 0;
+}
+
+int test_flood_fill() {
+    bmi_buffer* buffer = bmi_buffer_new(64, 64, BMI_FL_IS_TILED);
+    if (buffer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 64, 64), BMI_RGB_WHITE());
+    
+    // A closed box holds the fill with either connectivity, as its corners
+    // are solid
+    bmi_buffer_fill_rect(buffer, BMI_RECT(10, 10, 20, 1), BMI_RGB_BLACK());
+    bmi_buffer_fill_rect(buffer, BMI_RECT(10, 29, 20, 1), BMI_RGB_BLACK());
+    bmi_buffer_fill_rect(buffer, BMI_RECT(10, 10, 1, 20), BMI_RGB_BLACK());
+    bmi_buffer_fill_rect(buffer, BMI_RECT(29, 10, 1, 20), BMI_RGB_BLACK());
+    if (bmi_buffer_flood_fill(buffer, BMI_POINT(15, 15), BMI_RGB_RED(),
+                              BMI_CONNECTIVITY_4, 0) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(28, 28)) != BMI_RGB_RED()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(10, 10)) != BMI_RGB_BLACK()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(40, 40)) != BMI_RGB_WHITE()) {
+        fprintf(stderr, "Fill escaped or missed the box\n");
+        return 1;
+    }
+    if (bmi_buffer_flood_fill(buffer, BMI_POINT(15, 15), BMI_RGB_GREEN(),
+                              BMI_CONNECTIVITY_8, 0) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(28, 28)) != BMI_RGB_GREEN()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(9, 9)) != BMI_RGB_WHITE()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(30, 30)) != BMI_RGB_WHITE()) {
+        fprintf(stderr, "8-connected fill escaped the box\n");
+        return 1;
+    }
+    
+    // A diagonal wall stops 4-connected fills but not 8-connected ones
+    for (uint32_t i = 0; i < 64; i++) {
+        bmi_buffer_draw_point(buffer, BMI_POINT(i, 63 - i), BMI_RGB_BLACK());
+    }
+    bmi_buffer_flood_fill(buffer, BMI_POINT(63, 63), BMI_RGB_BLUE(),
+                          BMI_CONNECTIVITY_4, 0);
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(40, 5)) != BMI_RGB_WHITE()) {
+        fprintf(stderr, "4-connected fill crossed a diagonal\n");
+        return 1;
+    }
+    bmi_buffer_flood_fill(buffer, BMI_POINT(63, 63), BMI_RGB_WHITE(),
+                          BMI_CONNECTIVITY_4, 0);
+    bmi_buffer_flood_fill(buffer, BMI_POINT(63, 63), BMI_RGB_GREEN(),
+                          BMI_CONNECTIVITY_8, 0);
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(40, 5)) != BMI_RGB_GREEN()) {
+        fprintf(stderr, "8-connected fill did not cross a diagonal\n");
+        return 1;
+    }
+    
+    // Tolerance reaches nearby colors
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 64, 8), BMI_RGB(100, 100, 100));
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 4, 64, 4), BMI_RGB(104, 98, 100));
+    bmi_buffer_flood_fill(buffer, BMI_POINT(0, 0), BMI_RGB_RED(),
+                          BMI_CONNECTIVITY_4, 4);
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(63, 7)) != BMI_RGB_RED()) {
+        fprintf(stderr, "Tolerance was not applied\n");
+        return 1;
+    }
+    
+    if (bmi_buffer_flood_fill(buffer, BMI_POINT(64, 0), BMI_RGB_RED(),
+                              BMI_CONNECTIVITY_4, 0) != BMI_FAILURE) {
+        fprintf(stderr, "Seed outside of the buffer was accepted\n");
+        return 1;
+    }
+    
+    bmi_buffer_free(buffer);
+    
+    return 0;
+}
+
+int test_transform() {
+    const uint32_t flags[] = { 0, BMI_FL_IS_GRAYSCALE | BMI_FL_IS_TILED };
+    for (int i = 0; i < 2; i++) {
+        // Sizes off the tile grid exercise the partial blocks
+        const uint32_t width = 131;
+        const uint32_t height = 70;
+        bmi_buffer* buffer = bmi_buffer_new(width, height, flags[i]);
+        if (buffer == NULL) {
+            fprintf(stderr, "%s\n", bmi_last_error());
+            return 1;
+        }
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                bmi_buffer_draw_point(buffer, BMI_POINT(x, y),
+                                      BMI_RGB(x, y, x ^ y));
+            }
+        }
+        
+        bmi_buffer* transposed = bmi_buffer_transpose(buffer);
+        bmi_buffer* right = bmi_buffer_rotate(buffer, BMI_ROTATE_90);
+        bmi_buffer* half = bmi_buffer_rotate(buffer, BMI_ROTATE_180);
+        bmi_buffer* left = bmi_buffer_rotate(buffer, BMI_ROTATE_270);
+        bmi_buffer* mirrored = bmi_buffer_convert(buffer, flags[i]);
+        bmi_buffer* flipped = bmi_buffer_convert(buffer, flags[i]);
+        if (transposed == NULL || right == NULL || half == NULL
+            || left == NULL || mirrored == NULL || flipped == NULL
+            || bmi_buffer_flip(mirrored, BMI_FLIP_HORIZONTAL) != BMI_SUCCESS
+            || bmi_buffer_flip(flipped, BMI_FLIP_VERTICAL) != BMI_SUCCESS) {
+            fprintf(stderr, "%s\n", bmi_last_error());
+            return 1;
+        }
+        if (right->width != height || right->height != width) {
+            fprintf(stderr, "Rotated buffer has the wrong size\n");
+            return 1;
+        }
+        
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                const bmi_pixel pixel = bmi_buffer_get_pixel(buffer,
+                                                             BMI_POINT(x, y));
+                const uint32_t rx = width - 1 - x;
+                const uint32_t ry = height - 1 - y;
+                if (bmi_buffer_get_pixel(transposed, BMI_POINT(y, x)) != pixel
+                    || bmi_buffer_get_pixel(right, BMI_POINT(ry, x)) != pixel
+                    || bmi_buffer_get_pixel(half, BMI_POINT(rx, ry)) != pixel
+                    || bmi_buffer_get_pixel(left, BMI_POINT(y, rx)) != pixel
+                    || bmi_buffer_get_pixel(mirrored, BMI_POINT(rx, y))
+                    != pixel
+                    || bmi_buffer_get_pixel(flipped, BMI_POINT(x, ry))
+                    != pixel) {
+                    fprintf(stderr, "Transform moved (%u, %u) wrongly\n", x,
+                            y);
+                    return 1;
+                }
+            }
+        }
+        
+        bmi_buffer_free(buffer);
+        bmi_buffer_free(transposed);
+        bmi_buffer_free(right);
+        bmi_buffer_free(half);
+        bmi_buffer_free(left);
+        bmi_buffer_free(mirrored);
+        bmi_buffer_free(flipped);
+    }
+    
+    return 0;
+}
+
+typedef struct {
+    uint64_t next;
+    int bad;
+} test_pipeline_state;
+
+static void test_pipeline_written(void* context, uint64_t frame, FILE* dest,
+                                  int status) {
+    test_pipeline_state* state = context;
+    if (frame != state->next++ || status != BMI_SUCCESS) {
+        state->bad = 1;
+    }
+    
+    // Each frame reads back as what was drawn into it
+    rewind(dest);
+    bmi_buffer* buffer = bmi_buffer_from_file(dest);
+    if (buffer == NULL || bmi_buffer_get_pixel(buffer, BMI_POINT(frame, 0))
+                          != BMI_RGB_RED()) {
+        state->bad = 1;
+    }
+    if (buffer != NULL) {
+        bmi_buffer_free(buffer);
+    }
+    fclose(dest);
+}
+
+int test_pipeline() {
+    test_pipeline_state state = { 0, 0 };
+    bmi_pipeline* pipeline = bmi_pipeline_new(64, 48, 0, 2, 2,
+                                              BMI_PIPELINE_BMI,
+                                              test_pipeline_written, &state);
+    if (pipeline == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    
+    // Drawing only ever waits once both buffers are being written
+    for (uint32_t frame = 0; frame < 16; frame++) {
+        bmi_buffer* buffer = bmi_pipeline_acquire(pipeline);
+        bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 64, 48), BMI_RGB_BLACK());
+        bmi_buffer_draw_point(buffer, BMI_POINT(frame, 0), BMI_RGB_RED());
+        FILE* dest = tmpfile();
+        if (dest == NULL
+            || bmi_pipeline_submit(pipeline, buffer, dest) != BMI_SUCCESS) {
+            fprintf(stderr, "Could not submit frame %u\n", frame);
+            return 1;
+        }
+    }
+    if (bmi_pipeline_flush(pipeline) != BMI_SUCCESS || state.next != 16
+        || state.bad) {
+        fprintf(stderr, "Frames were not written in order\n");
+        return 1;
+    }
+    
+    // Only buffers from the pool can be submitted
+    bmi_buffer* stranger = bmi_buffer_new(64, 48, 0);
+    if (bmi_pipeline_submit(pipeline, stranger, stdout) != BMI_FAILURE) {
+        fprintf(stderr, "Foreign buffer was submitted\n");
+        return 1;
+    }
+    bmi_buffer_free(stranger);
+    
+    bmi_pipeline_free(pipeline);
+    
+    return 0;
+}
+
+int test_sequence() {
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        fprintf(stderr, "Could not open a temporary file\n");
+        return 1;
+    }
+    
+    // A dot moving across a still background only changes a few rows
+    bmi_buffer* frame = bmi_buffer_new(96, 64, BMI_FL_HAS_CHECKSUM);
+    bmi_buffer_fill_rect(frame, BMI_RECT(0, 0, 96, 64), BMI_RGB_BLUE());
+    bmi_sequence_writer* writer = bmi_sequence_writer_new(file, 96, 64,
+                                                          BMI_FL_HAS_CHECKSUM,
+                                                          8);
+    if (writer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    for (uint32_t i = 0; i < 20; i++) {
+        bmi_buffer_draw_point(frame, BMI_POINT(i * 4, i * 3), BMI_RGB_RED());
+        if (bmi_sequence_write_frame(writer, frame) != BMI_SUCCESS) {
+            fprintf(stderr, "%s\n", bmi_last_error());
+            return 1;
+        }
+    }
+    if (bmi_sequence_writer_free(writer) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if ((size_t)ftell(file) >= 20 * bmi_buffer_content_size(frame) / 2) {
+        fprintf(stderr, "Delta frames were not used\n");
+        return 1;
+    }
+    
+    // More frames can be added to the end later
+    writer = bmi_sequence_writer_from_file(file, 8);
+    if (writer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_buffer_fill_rect(frame, BMI_RECT(0, 0, 96, 64), BMI_RGB_GREEN());
+    bmi_sequence_write_frame(writer, frame);
+    bmi_sequence_writer_free(writer);
+    
+    bmi_sequence_reader* reader = bmi_sequence_reader_from_file(file);
+    if (reader == NULL || bmi_sequence_frame_count(reader) != 21) {
+        fprintf(stderr, "Sequence has the wrong number of frames\n");
+        return 1;
+    }
+    
+    // Frames can be read in any order
+    const uint32_t order[] = { 13, 0, 20, 19, 7 };
+    for (int i = 0; i < 5; i++) {
+        const uint32_t n = order[i];
+        bmi_buffer* read = bmi_sequence_read_frame(reader, n);
+        if (read == NULL) {
+            fprintf(stderr, "%s\n", bmi_last_error());
+            return 1;
+        }
+        const bmi_pixel expected = n == 20 ? BMI_RGB_GREEN() : BMI_RGB_RED();
+        const bmi_pixel later = n == 20 ? BMI_RGB_GREEN() : BMI_RGB_BLUE();
+        if (bmi_buffer_get_pixel(read, BMI_POINT(n * 4, n * 3)) != expected
+            || (n < 19 && bmi_buffer_get_pixel(read, BMI_POINT(n * 4 + 4,
+                                                               n * 3 + 3))
+                          != later)) {
+            fprintf(stderr, "Frame %u was read wrongly\n", n);
+            return 1;
+        }
+        bmi_buffer_free(read);
+    }
+    if (bmi_sequence_read_frame(reader, 21) != NULL) {
+        fprintf(stderr, "Frame past the end was read\n");
+        return 1;
+    }
+    
+    bmi_sequence_reader_free(reader);
+    bmi_buffer_free(frame);
+    fclose(file);
+    
+    return 0;
+}
+
+int test_shared() {
+    bmi_buffer* buffer = bmi_buffer_new(200, 130, BMI_FL_IS_SHARED);
+    if (buffer == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 200, 130), BMI_RGB_RED());
+    
+    // Snapshots keep the contents they were taken with, whichever handle is
+    // drawn on afterwards
+    bmi_buffer* snapshot = bmi_buffer_snapshot(buffer);
+    if (snapshot == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_buffer_draw_point(buffer, BMI_POINT(5, 5), BMI_RGB_BLUE());
+    bmi_buffer_fill_rect(buffer, BMI_RECT(150, 100, 10, 10), BMI_RGB_GREEN());
+    bmi_buffer_stroke_line(snapshot, BMI_POINT(0, 129), BMI_POINT(199, 0), 1,
+                           BMI_RGB_WHITE());
+    if (bmi_buffer_get_pixel(snapshot, BMI_POINT(5, 5)) != BMI_RGB_RED()
+        || bmi_buffer_get_pixel(snapshot, BMI_POINT(155, 105))
+        != BMI_RGB_RED()
+        || bmi_buffer_get_pixel(snapshot, BMI_POINT(0, 129))
+        != BMI_RGB_WHITE()) {
+        fprintf(stderr, "Snapshot changed with the original\n");
+        return 1;
+    }
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(5, 5)) != BMI_RGB_BLUE()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(155, 105))
+        != BMI_RGB_GREEN()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(0, 129)) != BMI_RGB_RED()) {
+        fprintf(stderr, "Original changed with the snapshot\n");
+        return 1;
+    }
+    
+    // Handles outlive each other in any order
+    bmi_buffer* second = bmi_buffer_snapshot(snapshot);
+    bmi_buffer_free(snapshot);
+    bmi_buffer_flip(second, BMI_FLIP_VERTICAL);
+    if (bmi_buffer_get_pixel(second, BMI_POINT(0, 0)) != BMI_RGB_WHITE()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(0, 0)) != BMI_RGB_RED()) {
+        fprintf(stderr, "Second snapshot was drawn wrongly\n");
+        return 1;
+    }
+    bmi_buffer_free(buffer);
+    bmi_buffer_free(second);
+    
+    // Only shared buffers can be snapshotted
+    bmi_buffer* plain = bmi_buffer_new(8, 8, 0);
+    if (bmi_buffer_snapshot(plain) != NULL
+        || bmi_buffer_unshare(plain, BMI_RECT(0, 0, 8, 8)) != BMI_SUCCESS) {
+        fprintf(stderr, "Unshared buffer was snapshotted\n");
+        return 1;
+    }
+    bmi_buffer_free(plain);
+    
+    return 0;
+}
+
+int test_gradient() {
+    bmi_buffer* buffer = bmi_buffer_new(256, 64, BMI_FL_IS_TILED);
+    const bmi_gradient_stop stops[] = {
+        { 0, BMI_RGB_BLACK() },
+        { 0.5, BMI_RGB_RED() },
+        { 1, BMI_RGB_WHITE() }
+    };
+    
+    // A horizontal ramp passes through each stop at its offset
+    if (bmi_buffer_fill_linear_gradient(buffer, BMI_RECT(0, 0, 256, 64),
+                                        BMI_POINT(0, 0), BMI_POINT(254, 0),
+                                        stops, 3, BMI_DITHER_NONE)
+        != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(0, 10)) != BMI_RGB_BLACK()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(127, 63)) != BMI_RGB_RED()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(255, 30))
+        != BMI_RGB_WHITE()
+        || abs((int)BMI_RGB_R(bmi_buffer_get_pixel(buffer, BMI_POINT(64, 0)))
+               - 128) > 1) {
+        fprintf(stderr, "Linear gradient was filled wrongly\n");
+        return 1;
+    }
+    
+    // Radial ramps are symmetric about their center and only fill the bounds
+    bmi_buffer_fill_radial_gradient(buffer, BMI_RECT(64, 0, 128, 64),
+                                    BMI_POINT(128, 32), 30, stops, 3,
+                                    BMI_DITHER_ORDERED);
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(128, 32)) != BMI_RGB_BLACK()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(116, 32))
+        != bmi_buffer_get_pixel(buffer, BMI_POINT(128, 20))
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(100, 0)) != BMI_RGB_WHITE()
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(0, 0)) != BMI_RGB_BLACK()) {
+        fprintf(stderr, "Radial gradient was filled wrongly\n");
+        return 1;
+    }
+    
+    // Both formats follow the ramp closely, across whole blocks of a run and
+    // the pixels left over after them
+    const bmi_gradient_stop ramp[] = {
+        { 0, BMI_RGB_BLACK() },
+        { 1, BMI_RGB_WHITE() }
+    };
+    bmi_buffer* gray = bmi_buffer_new(203, 61, BMI_FL_IS_GRAYSCALE);
+    bmi_buffer* rgb = bmi_buffer_new(203, 61, 0);
+    if (gray == NULL || rgb == NULL
+        || bmi_buffer_fill_radial_gradient(gray, BMI_RECT(0, 0, 203, 61),
+                                           BMI_POINT(90, 30), 100, ramp, 2,
+                                           BMI_DITHER_NONE) != BMI_SUCCESS
+        || bmi_buffer_fill_linear_gradient(rgb, BMI_RECT(0, 0, 203, 61),
+                                           BMI_POINT(0, 0), BMI_POINT(202, 0),
+                                           ramp, 2, BMI_DITHER_NONE)
+           != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    for (uint32_t y = 0; y < 61; y++) {
+        for (uint32_t x = 0; x < 203; x++) {
+            const double distance = sqrt((x - 90.0) * (x - 90.0)
+                                         + (y - 30.0) * (y - 30.0));
+            const double radial = 255 * (distance < 100 ? distance / 100 : 1);
+            const double linear = 255 * x / 202.0;
+            const bmi_point point = BMI_POINT(x, y);
+            const bmi_pixel color = bmi_buffer_get_pixel(rgb, point);
+            if (fabs(bmi_buffer_get_pixel(gray, point) - radial) > 1
+                || fabs(BMI_RGB_R(color) - linear) > 1
+                || BMI_RGB_G(color) != BMI_RGB_R(color)
+                || BMI_RGB_B(color) != BMI_RGB_R(color)) {
+                fprintf(stderr, "Gradient strays from its ramp\n");
+                return 1;
+            }
+        }
+    }
+    bmi_buffer_free(gray);
+    bmi_buffer_free(rgb);
+    
+    // Stops must be in order
+    const bmi_gradient_stop unordered[] = {
+        { 0.5, BMI_RGB_RED() },
+        { 0.2, BMI_RGB_BLUE() }
+    };
+    if (bmi_buffer_fill_linear_gradient(buffer, BMI_RECT(0, 0, 256, 64),
+                                        BMI_POINT(0, 0), BMI_POINT(10, 10),
+                                        unordered, 2, BMI_DITHER_NONE)
+        != BMI_FAILURE
+        || strcmp(bmi_last_error(), "bmi_buffer_fill_linear_gradient: Stop "
+                  "offsets must not decrease and must lie between 0 and 1")
+           != 0) {
+        fprintf(stderr, "Unordered stops were accepted\n");
+        return 1;
+    }
+    
+    bmi_buffer_free(buffer);
+    
+    return 0;
+}
+
+// Writes a buffer in one of the interchange formats and reads it back
+static bmi_buffer* test_round_trip(const bmi_buffer* buffer, int bmp) {
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        return NULL;
+    }
+    const int saved = bmp ? bmi_buffer_to_bmp(file, buffer)
+                          : bmi_buffer_to_ppm(file, buffer);
+    bmi_buffer* loaded = NULL;
+    if (saved == BMI_SUCCESS) {
+        rewind(file);
+        loaded = bmp ? bmi_buffer_from_bmp(file) : bmi_buffer_from_ppm(file);
+    }
+    fclose(file);
+    return loaded;
+}
+
+int test_image_formats() {
+    const uint32_t flags[] = { 0, BMI_FL_IS_GRAYSCALE };
+    for (int i = 0; i < 4; i++) {
+        bmi_buffer* buffer = bmi_buffer_new(70, 30, flags[i & 1]);
+        for (uint32_t y = 0; y < 30; y++) {
+            for (uint32_t x = 0; x < 70; x++) {
+                bmi_buffer_draw_point(buffer, BMI_POINT(x, y),
+                                      BMI_RGB(x * 3, y * 8, x ^ y));
+            }
+        }
+        
+        // Odd widths exercise the row padding of BMP
+        bmi_buffer* loaded = test_round_trip(buffer, i >> 1);
+        if (loaded == NULL) {
+            fprintf(stderr, "%s\n", bmi_last_error());
+            return 1;
+        }
+        if (loaded->width != 70 || loaded->height != 30
+            || loaded->flags != buffer->flags) {
+            fprintf(stderr, "Image changed size across a round trip\n");
+            return 1;
+        }
+        for (uint32_t y = 0; y < 30; y++) {
+            for (uint32_t x = 0; x < 70; x++) {
+                if (bmi_buffer_get_pixel(loaded, BMI_POINT(x, y))
+                    != bmi_buffer_get_pixel(buffer, BMI_POINT(x, y))) {
+                    fprintf(stderr, "Image changed across a round trip\n");
+                    return 1;
+                }
+            }
+        }
+        bmi_buffer_free(loaded);
+        bmi_buffer_free(buffer);
+    }
+    return 0;
+}
+
+int test_crop_resize() {
+    bmi_buffer* buffer = bmi_buffer_new(100, 60, BMI_FL_IS_TILED);
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 100, 60), BMI_RGB_BLUE());
+    bmi_buffer_fill_rect(buffer, BMI_RECT(20, 10, 30, 20), BMI_RGB_RED());
+    
+    // Regions are clipped to the buffer
+    bmi_buffer* crop = bmi_buffer_crop(buffer, BMI_RECT(20, 10, 200, 200));
+    if (crop == NULL || crop->width != 80 || crop->height != 50
+        || bmi_buffer_get_pixel(crop, BMI_POINT(0, 0)) != BMI_RGB_RED()
+        || bmi_buffer_get_pixel(crop, BMI_POINT(29, 19)) != BMI_RGB_RED()
+        || bmi_buffer_get_pixel(crop, BMI_POINT(30, 19)) != BMI_RGB_BLUE()) {
+        fprintf(stderr, "Buffer was cropped wrongly\n");
+        return 1;
+    }
+    bmi_buffer_free(crop);
+    if (bmi_buffer_crop(buffer, BMI_RECT(100, 0, 10, 10)) != NULL) {
+        fprintf(stderr, "Region outside of the buffer was cropped\n");
+        return 1;
+    }
+    
+    // Flat areas stay flat when scaled either way
+    for (int i = 0; i < 2; i++) {
+        bmi_buffer* resized = bmi_buffer_resize(buffer, i ? 300 : 50,
+                                                i ? 180 : 30);
+        const bmi_point inside = i ? BMI_POINT(102, 60) : BMI_POINT(17, 10);
+        if (resized == NULL
+            || bmi_buffer_get_pixel(resized, BMI_POINT(0, 0))
+            != BMI_RGB_BLUE()
+            || bmi_buffer_get_pixel(resized, inside) != BMI_RGB_RED()) {
+            fprintf(stderr, "Buffer was resized wrongly\n");
+            return 1;
+        }
+        bmi_buffer_free(resized);
+    }
+    
+    bmi_buffer_free(buffer);
+    
+    return 0;
+}
+
+int test_palette() {
+    // New palette buffers draw with their nearest default colors
+    bmi_buffer* buffer = bmi_buffer_new(40, 20, BMI_FL_IS_PALETTE
+                                        | BMI_FL_IS_TILED
+                                        | BMI_FL_HAS_CHECKSUM);
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 40, 20), BMI_RGB(250, 5, 0));
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(39, 19)) != BMI_RGB_RED()) {
+        fprintf(stderr, "Color was not matched to the palette\n");
+        return 1;
+    }
+    const bmi_pixel colors[] = {
+        BMI_RGB_BLACK(), BMI_RGB(10, 200, 30), BMI_RGB(90, 0, 140)
+    };
+    if (bmi_buffer_set_palette(buffer, colors, 0) != BMI_FAILURE
+        || bmi_buffer_set_palette(buffer, colors, 3) != BMI_SUCCESS) {
+        fprintf(stderr, "Palette was replaced wrongly\n");
+        return 1;
+    }
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 40, 20), BMI_RGB(0, 0, 0));
+    bmi_buffer_fill_ellipse(buffer, BMI_RECT(5, 5, 20, 10),
+                            BMI_RGB(20, 190, 40));
+    bmi_buffer_draw_point(buffer, BMI_POINT(30, 3), BMI_RGB(100, 0, 150));
+    if (bmi_buffer_get_pixel(buffer, BMI_POINT(15, 10)) != colors[1]
+        || bmi_buffer_get_pixel(buffer, BMI_POINT(30, 3)) != colors[2]) {
+        fprintf(stderr, "Palette buffer was drawn wrongly\n");
+        return 1;
+    }
+    
+    // Palettes and checksums survive every format, PPM expanding to RGB
+    for (int i = 0; i < 3; i++) {
+        bmi_buffer* loaded = NULL;
+        if (i == 2) {
+            FILE* file = tmpfile();
+            if (file != NULL && bmi_buffer_to_file(file, buffer)
+                == BMI_SUCCESS) {
+                rewind(file);
+                loaded = bmi_buffer_from_file(file);
+            }
+            if (file != NULL) {
+                fclose(file);
+            }
+        } else {
+            loaded = test_round_trip(buffer, i);
+        }
+        if (loaded == NULL) {
+            fprintf(stderr, "%s\n", bmi_last_error());
+            return 1;
+        }
+        bmi_pixel palette[BMI_PALETTE_CAPACITY];
+        if ((i != 0) != (bmi_buffer_get_palette(loaded, palette) != 0)) {
+            fprintf(stderr, "Palette was lost across a round trip\n");
+            return 1;
+        }
+        for (uint32_t y = 0; y < 20; y++) {
+            for (uint32_t x = 0; x < 40; x++) {
+                if (bmi_buffer_get_pixel(loaded, BMI_POINT(x, y))
+                    != bmi_buffer_get_pixel(buffer, BMI_POINT(x, y))) {
+                    fprintf(stderr, "Image changed across a round trip\n");
+                    return 1;
+                }
+            }
+        }
+        bmi_buffer_free(loaded);
+    }
+    bmi_buffer_free(buffer);
+    
+    // Images with few enough colors quantize exactly, and the rest closely
+    bmi_buffer* image = bmi_buffer_new(256, 128, BMI_FL_IS_TILED);
+    for (uint32_t y = 0; y < 128; y++) {
+        for (uint32_t x = 0; x < 256; x++) {
+            bmi_buffer_draw_point(image, BMI_POINT(x, y),
+                                  BMI_RGB(x & 0xF0, y & 0xE0, 77));
+        }
+    }
+    bmi_buffer* exact = bmi_buffer_quantize(image, 64);
+    int equal = 0;
+    bmi_buffer* expanded = exact ? bmi_buffer_convert(exact, 0) : NULL;
+    if (expanded == NULL
+        || bmi_buffer_compare(expanded, image, &equal, NULL) != BMI_SUCCESS
+        || !equal) {
+        fprintf(stderr, "Image was not quantized exactly\n");
+        return 1;
+    }
+    bmi_buffer_free(expanded);
+    bmi_buffer_free(exact);
+    
+    for (uint32_t y = 0; y < 128; y++) {
+        for (uint32_t x = 0; x < 256; x++) {
+            bmi_buffer_draw_point(image, BMI_POINT(x, y),
+                                  BMI_RGB(x, y * 2, 255 - x));
+        }
+    }
+    const uint32_t counts[] = { 16, 256 };
+    const double limits[] = { 400, 40 };
+    for (int i = 0; i < 2; i++) {
+        bmi_buffer* reduced = bmi_buffer_quantize(image, counts[i]);
+        bmi_pixel palette[BMI_PALETTE_CAPACITY];
+        double mse = 0;
+        expanded = reduced ? bmi_buffer_convert(reduced, 0) : NULL;
+        if (expanded == NULL
+            || bmi_buffer_get_palette(reduced, palette) != counts[i]
+            || bmi_buffer_mse(expanded, image, &mse) != BMI_SUCCESS
+            || mse > limits[i]) {
+            fprintf(stderr, "Image was quantized poorly\n");
+            return 1;
+        }
+        bmi_buffer_free(expanded);
+        bmi_buffer_free(reduced);
+    }
+    bmi_buffer_free(image);
+    
+    // Gray levels quantize to gray colors
+    image = bmi_buffer_new(256, 16, BMI_FL_IS_GRAYSCALE);
+    for (uint32_t x = 0; x < 256; x++) {
+        bmi_buffer_fill_rect(image, BMI_RECT(x, 0, 1, 16), BMI_GRY(x));
+    }
+    const uint32_t levels[] = { 256, 16 };
+    const double gray_limits[] = { 0, 40 };
+    for (int i = 0; i < 2; i++) {
+        bmi_buffer* reduced = bmi_buffer_quantize(image, levels[i]);
+        bmi_pixel palette[BMI_PALETTE_CAPACITY];
+        double mse = 0;
+        expanded = reduced
+            ? bmi_buffer_convert(reduced, BMI_FL_IS_GRAYSCALE) : NULL;
+        if (expanded == NULL
+            || bmi_buffer_get_palette(reduced, palette) != levels[i]
+            || bmi_buffer_mse(expanded, image, &mse) != BMI_SUCCESS
+            || mse > gray_limits[i]) {
+            fprintf(stderr, "Gray image was quantized poorly\n");
+            return 1;
+        }
+        for (uint32_t j = 0; j < levels[i]; j++) {
+            const bmi_pixel color = palette[j];
+            if ((color & 0xFF) != (color >> 8 & 0xFF)
+                || (color & 0xFF) != (color >> 16 & 0xFF)) {
+                fprintf(stderr, "Gray image was quantized to colors\n");
+                return 1;
+            }
+        }
+        bmi_buffer_free(expanded);
+        bmi_buffer_free(reduced);
+    }
+    bmi_buffer_free(image);
+    
+    return 0;
+}
+
+int test_mask() {
+    // Rows span several words, so runs cross word boundaries
+    bmi_mask* mask = bmi_mask_new(150, 40);
+    bmi_mask* other = bmi_mask_new(150, 40);
+    bmi_mask* small = bmi_mask_new(10, 10);
+    if (mask == NULL || other == NULL || small == NULL) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    bmi_mask_set_rect(mask, BMI_RECT(10, 5, 120, 20), 1);
+    bmi_mask_set_rect(mask, BMI_RECT(60, 10, 10, 5), 0);
+    bmi_mask_set_rect(other, BMI_RECT(100, 0, 200, 40), 1);
+    if (bmi_mask_count(mask) != 120 * 20 - 10 * 5
+        || bmi_mask_count(other) != 50 * 40
+        || !bmi_mask_get(mask, BMI_POINT(129, 24))
+        || bmi_mask_get(mask, BMI_POINT(130, 24))
+        || bmi_mask_get(mask, BMI_POINT(65, 12))
+        || bmi_mask_get(mask, BMI_POINT(500, 5))) {
+        fprintf(stderr, "Mask bits were set wrongly\n");
+        return 1;
+    }
+    
+    // Boolean operations agree with counting, and flipping keeps the padding
+    // clear
+    bmi_mask_not(other);
+    bmi_mask_not(other);
+    if (bmi_mask_count(other) != 50 * 40
+        || bmi_mask_and(mask, small) != BMI_FAILURE) {
+        fprintf(stderr, "Mask was flipped or combined wrongly\n");
+        return 1;
+    }
+    bmi_mask* both = bmi_mask_new(150, 40);
+    bmi_mask_or(both, mask);
+    bmi_mask_and(both, other);
+    bmi_mask* either = bmi_mask_new(150, 40);
+    bmi_mask_or(either, mask);
+    bmi_mask_xor(either, other);
+    if (bmi_mask_count(both) != 30 * 20
+        || bmi_mask_count(either) != bmi_mask_count(mask)
+                                     + bmi_mask_count(other)
+                                     - 2 * bmi_mask_count(both)) {
+        fprintf(stderr, "Masks were combined wrongly\n");
+        return 1;
+    }
+    bmi_mask_free(both);
+    bmi_mask_free(either);
+    bmi_mask_free(other);
+    bmi_mask_free(small);
+    
+    // Masks survive a trip through a grayscale buffer
+    bmi_buffer* gray = bmi_mask_to_buffer(mask);
+    bmi_mask* back = gray ? bmi_mask_from_buffer(gray, 128) : NULL;
+    if (back == NULL || bmi_mask_count(back) != bmi_mask_count(mask)) {
+        fprintf(stderr, "Mask changed across a buffer\n");
+        return 1;
+    }
+    bmi_mask_xor(back, mask);
+    if (bmi_mask_count(back) != 0) {
+        fprintf(stderr, "Mask changed across a buffer\n");
+        return 1;
+    }
+    bmi_mask_free(back);
+    bmi_buffer_free(gray);
+    
+    // Masked drawing touches exactly the set pixels, the mask being smaller
+    // than the tiled buffer
+    bmi_buffer* layer = bmi_buffer_new(200, 60, 0);
+    for (uint32_t y = 0; y < 60; y++) {
+        for (uint32_t x = 0; x < 200; x++) {
+            bmi_buffer_draw_point(layer, BMI_POINT(x, y),
+                                  BMI_RGB(x, y, x ^ y));
+        }
+    }
+    bmi_buffer* buffer = bmi_buffer_new(200, 60, BMI_FL_IS_TILED);
+    bmi_buffer_fill_rect(buffer, BMI_RECT(0, 0, 200, 60), BMI_RGB_BLACK());
+    bmi_buffer_fill_rect_masked(buffer, BMI_RECT(0, 0, 100, 60),
+                                BMI_RGB_RED(), mask);
+    if (bmi_buffer_overdraw_buffer_masked(buffer, BMI_RECT(100, 0, 100, 60),
+                                          layer, mask) != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    for (uint32_t y = 0; y < 60; y++) {
+        for (uint32_t x = 0; x < 200; x++) {
+            const bmi_point point = BMI_POINT(x, y);
+            bmi_pixel expected = BMI_RGB_BLACK();
+            if (bmi_mask_get(mask, point)) {
+                expected = x < 100 ? BMI_RGB_RED()
+                    : bmi_buffer_get_pixel(layer, BMI_POINT(x - 100, y));
+            }
+            if (bmi_buffer_get_pixel(buffer, point) != expected) {
+                fprintf(stderr, "Masked drawing touched the wrong pixels\n");
+                return 1;
+            }
+        }
+    }
+    bmi_buffer_free(buffer);
+    bmi_buffer_free(layer);
+    bmi_mask_free(mask);
+    
+    return 0;
+}
+
+int test_pyramid() {
+    // Odd sizes repeat their last row and column, and every level matches
+    // averaging the one before it pixel by pixel
+    const uint32_t flags[] = { 0, BMI_FL_IS_GRAYSCALE | BMI_FL_IS_TILED,
+                               BMI_FL_IS_PALETTE };
+    for (int i = 0; i < 3; i++) {
+        bmi_buffer* buffer = bmi_buffer_new(301, 150, flags[i]);
+        for (uint32_t y = 0; y < 150; y++) {
+            for (uint32_t x = 0; x < 301; x++) {
+                bmi_buffer_draw_point(buffer, BMI_POINT(x, y),
+                                      BMI_RGB(x * 7, y * 3, x ^ y));
+            }
+        }
+        bmi_pyramid* pyramid = bmi_buffer_build_pyramid(buffer);
+        if (pyramid == NULL || pyramid->count != 9
+            || pyramid->levels[0]->width != 151
+            || pyramid->levels[0]->height != 75
+            || pyramid->levels[8]->width != 1
+            || pyramid->levels[8]->height != 1) {
+            fprintf(stderr, "Pyramid has the wrong levels\n");
+            return 1;
+        }
+        const bmi_buffer* above = buffer;
+        for (uint32_t k = 0; k < pyramid->count; k++) {
+            const bmi_buffer* level = pyramid->levels[k];
+            for (uint32_t y = 0; y < level->height; y++) {
+                for (uint32_t x = 0; x < level->width; x++) {
+                    const uint32_t x1 = 2 * x + 1 < above->width ? 2 * x + 1
+                                                                 : 2 * x;
+                    const uint32_t y1 = 2 * y + 1 < above->height ? 2 * y + 1
+                                                                  : 2 * y;
+                    const bmi_pixel p[4] = {
+                        bmi_buffer_get_pixel(above, BMI_POINT(2 * x, 2 * y)),
+                        bmi_buffer_get_pixel(above, BMI_POINT(x1, 2 * y)),
+                        bmi_buffer_get_pixel(above, BMI_POINT(2 * x, y1)),
+                        bmi_buffer_get_pixel(above, BMI_POINT(x1, y1))
+                    };
+                    bmi_pixel expected = 0;
+                    for (uint32_t s = 0; s < 24; s += 8) {
+                        const uint32_t sum = (p[0] >> s & 0xFF)
+                            + (p[1] >> s & 0xFF) + (p[2] >> s & 0xFF)
+                            + (p[3] >> s & 0xFF);
+                        expected |= (sum + 2) >> 2 << s;
+                    }
+                    if (bmi_buffer_get_pixel(level, BMI_POINT(x, y))
+                        != expected) {
+                        fprintf(stderr, "Pyramid level was filtered "
+                                "wrongly\n");
+                        return 1;
+                    }
+                }
+            }
+            above = level;
+        }
+        bmi_pyramid_free(pyramid);
+        bmi_buffer_free(buffer);
+    }
+    
+    return 0;
+}
+
+int test_inline_fastpath() {
+    // Every format and layout agrees with the out-of-line functions, palette
+    // and shared buffers being passed on to them
+    const uint32_t flags[] = {
+        0, BMI_FL_IS_GRAYSCALE, BMI_FL_IS_TILED,
+        BMI_FL_IS_GRAYSCALE | BMI_FL_IS_TILED, BMI_FL_IS_PALETTE,
+        BMI_FL_IS_SHARED
+    };
+    for (int i = 0; i < 6; i++) {
+        bmi_buffer* fast = bmi_buffer_new(130, 70, flags[i]);
+        bmi_buffer* slow = bmi_buffer_new(130, 70, flags[i]);
+        if (bmi_inline_content_size(fast) != bmi_buffer_content_size(fast)) {
+            fprintf(stderr, "Inline content size differs\n");
+            return 1;
+        }
+        for (uint32_t y = 0; y < 70; y++) {
+            const bmi_pixel pixel = BMI_RGB(y * 3, 255 - y, y ^ 85);
+            bmi_inline_fill_span(fast, 0, y, 130, pixel);
+            bmi_buffer_fill_rect(slow, BMI_RECT(0, y, 130, 1), pixel);
+            for (uint32_t x = y; x < 130; x += 7) {
+                bmi_inline_draw_point(fast, BMI_POINT(x, y), BMI_RGB(x, y, 9));
+                bmi_buffer_draw_point(slow, BMI_POINT(x, y), BMI_RGB(x, y, 9));
+            }
+        }
+        bmi_pixel row[130];
+        for (uint32_t y = 0; y < 70; y++) {
+            bmi_inline_load_span(fast, 0, y, row, 130);
+            for (uint32_t x = 0; x < 130; x++) {
+                const bmi_point point = BMI_POINT(x, y);
+                const bmi_pixel expected = bmi_buffer_get_pixel(slow, point);
+                if (row[x] != expected
+                    || bmi_inline_get_pixel(fast, point) != expected) {
+                    fprintf(stderr, "Inline fast path drew wrongly\n");
+                    return 1;
+                }
+            }
+        }
+        bmi_buffer_free(fast);
+        bmi_buffer_free(slow);
+    }
+    
+    return 0;
+}
+
+// Reads the whole of a file into memory
+static uint8_t* test_slurp(FILE* file, long* size) {
+    fflush(file);
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+    uint8_t* data = malloc(*size ? (size_t)*size : 1);
+    if (data != NULL && fread(data, 1, (size_t)*size, file) != (size_t)*size) {
+        free(data);
+        data = NULL;
+    }
+    return data;
+}
+
+int test_encode() {
+    // The parallel encoder writes the same bytes as the serial writers, after
+    // whatever the stream already holds, and leaves the stream past the image
+    const uint32_t flags[] = {
+        0, BMI_FL_IS_GRAYSCALE | BMI_FL_HAS_CHECKSUM, BMI_FL_IS_TILED,
+        BMI_FL_IS_PALETTE | BMI_FL_IS_TILED | BMI_FL_HAS_CHECKSUM,
+        BMI_FL_IS_PALETTE, BMI_FL_IS_SHARED | BMI_FL_HAS_CHECKSUM
+    };
+    const uint32_t sizes[][2] = { { 1500, 1100 }, { 37, 5 } };
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < 6; i++) {
+            bmi_buffer* buffer = bmi_buffer_new(sizes[s][0], sizes[s][1],
+                                                flags[i]);
+            for (uint32_t y = 0; y < buffer->height; y += 3) {
+                bmi_buffer_fill_rect(buffer, BMI_RECT(0, y, buffer->width, 3),
+                                     BMI_RGB(y, 255 - y, y * 5));
+            }
+            bmi_buffer_fill_ellipse(buffer, BMI_RECT(2, 1, 30, 3),
+                                    BMI_RGB_RED());
+            for (int format = 0; format < 3; format++) {
+                FILE* serial = tmpfile();
+                FILE* parallel = tmpfile();
+                if (serial == NULL || parallel == NULL) {
+                    fprintf(stderr, "Failed to open temporary files\n");
+                    return 1;
+                }
+                fputs("prefix", serial);
+                fputs("prefix", parallel);
+                const int serial_status = format == BMI_ENCODE_PPM
+                    ? bmi_buffer_to_ppm(serial, buffer)
+                    : format == BMI_ENCODE_BMP
+                    ? bmi_buffer_to_bmp(serial, buffer)
+                    : bmi_buffer_to_file(serial, buffer);
+                if (serial_status != BMI_SUCCESS
+                    || bmi_buffer_encode(parallel, buffer,
+                                         (bmi_encode_format)format)
+                       != BMI_SUCCESS) {
+                    fprintf(stderr, "%s\n", bmi_last_error());
+                    return 1;
+                }
+                fputs("suffix", serial);
+                fputs("suffix", parallel);
+                long serial_size, parallel_size;
+                uint8_t* expected = test_slurp(serial, &serial_size);
+                uint8_t* actual = test_slurp(parallel, &parallel_size);
+                if (expected == NULL || actual == NULL
+                    || serial_size != parallel_size
+                    || memcmp(expected, actual, (size_t)serial_size) != 0) {
+                    fprintf(stderr, "Encoded file differs from the serial "
+                            "writer's\n");
+                    return 1;
+                }
+                free(expected);
+                free(actual);
+                fclose(serial);
+                fclose(parallel);
+            }
+            bmi_buffer_free(buffer);
+        }
+    }
+    
+    // Appending streams place every write at the end, so they are written in
+    // order rather than by offset
+    bmi_buffer* buffer = bmi_buffer_new(1500, 1100, BMI_FL_IS_TILED);
+    bmi_buffer_fill_ellipse(buffer, BMI_RECT(0, 0, 1500, 1100),
+                            BMI_RGB(20, 200, 90));
+    FILE* serial = tmpfile();
+    remove("test.ppm");
+    FILE* appended = fopen("test.ppm", "ab");
+    if (serial == NULL || appended == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fputs("prefix", serial);
+    fputs("prefix", appended);
+    if (bmi_buffer_to_ppm(serial, buffer) != BMI_SUCCESS
+        || bmi_buffer_encode(appended, buffer, BMI_ENCODE_PPM)
+           != BMI_SUCCESS) {
+        fprintf(stderr, "%s\n", bmi_last_error());
+        return 1;
+    }
+    fclose(appended);
+    appended = fopen("test.ppm", "rb");
+    long serial_size, appended_size;
+    uint8_t* expected = test_slurp(serial, &serial_size);
+    uint8_t* actual = appended ? test_slurp(appended, &appended_size) : NULL;
+    if (expected == NULL || actual == NULL || serial_size != appended_size
+        || memcmp(expected, actual, (size_t)serial_size) != 0) {
+        fprintf(stderr, "Encoded file differs when appended\n");
+        return 1;
+    }
+    free(expected);
+    free(actual);
+    fclose(serial);
+    fclose(appended);
+    remove("test.ppm");
+    bmi_buffer_free(buffer);
+    return 0;
+}
+
+int test_lut() {
+    // Builders reach their ends and keep to their ranges
+    bmi_lut lut;
+    const bmi_point curve[] = {
+        BMI_POINT(20, 0), BMI_POINT(128, 200), BMI_POINT(200, 220)
+    };
+    if (bmi_lut_gamma(lut.tables[0], 0) != BMI_FAILURE
+        || bmi_lut_levels(lut.tables[0], 10, 10, 1, 0, 255) != BMI_FAILURE
+        || bmi_lut_curve(lut.tables[0], curve + 1, 0) != BMI_FAILURE
+        || bmi_lut_gamma(lut.tables[0], 2.2) != BMI_SUCCESS
+        || bmi_lut_levels(lut.tables[1], 16, 235, 1, 255, 0) != BMI_SUCCESS
+        || bmi_lut_curve(lut.tables[2], curve, 3) != BMI_SUCCESS) {
+        fprintf(stderr, "Tables were built wrongly\n");
+        return 1;
+    }
+    if (lut.tables[0][0] != 0 || lut.tables[0][255] != 255
+        || lut.tables[0][64] <= 64 || lut.tables[1][10] != 255
+        || lut.tables[1][240] != 0 || lut.tables[1][125] != 128
+        || lut.tables[2][0] != 0 || lut.tables[2][128] != 200
+        || lut.tables[2][255] != 220) {
+        fprintf(stderr, "Tables have the wrong values\n");
+        return 1;
+    }
+    for (int i = 1; i < 256; i++) {
+        if (lut.tables[2][i] < lut.tables[2][i - 1]) {
+            fprintf(stderr, "Curve overshot its points\n");
+            return 1;
+        }
+    }
+    
+    // Every format matches looking the channels up one pixel at a time, both
+    // over the whole buffer and in a region
+    const uint32_t flags[] = {
+        0, BMI_FL_IS_GRAYSCALE, BMI_FL_IS_TILED, BMI_FL_IS_SHARED,
+        BMI_FL_IS_PALETTE
+    };
+    for (int i = 0; i < 5; i++) {
+        for (int whole = 0; whole < 2; whole++) {
+            bmi_buffer* buffer = bmi_buffer_new(150, 90, flags[i]);
+            for (uint32_t y = 0; y < 90; y++) {
+                for (uint32_t x = 0; x < 150; x++) {
+                    bmi_buffer_draw_point(buffer, BMI_POINT(x, y),
+                                          BMI_RGB(x, y * 2, x ^ y));
+                }
+            }
+            bmi_buffer* original = bmi_buffer_convert(buffer, 0);
+            const bmi_rect region = whole ? BMI_RECT(0, 0, 150, 90)
+                                          : BMI_RECT(70, 10, 200, 33);
+            const int status = whole
+                ? bmi_buffer_apply_lut(buffer, &lut)
+                : bmi_buffer_apply_lut_rect(buffer, region, &lut);
+            if (status != BMI_SUCCESS) {
+                fprintf(stderr, "%s\n", bmi_last_error());
+                return 1;
+            }
+            bmi_buffer* probe = bmi_buffer_new(1, 1, BMI_FL_IS_PALETTE);
+            bmi_pixel colors[BMI_PALETTE_CAPACITY];
+            if (flags[i] & BMI_FL_IS_PALETTE) {
+                bmi_buffer_set_palette(probe, colors,
+                                       bmi_buffer_get_palette(buffer, colors));
+            }
+            for (uint32_t y = 0; y < 90; y++) {
+                for (uint32_t x = 0; x < 150; x++) {
+                    const bmi_point point = BMI_POINT(x, y);
+                    const bmi_pixel before = bmi_buffer_get_pixel(original,
+                                                                  point);
+                    bmi_pixel expected = before;
+                    if (x >= region.x && y >= region.y
+                        && y < region.y + region.height) {
+                        expected = BMI_RGB(lut.tables[0][BMI_RGB_R(before)],
+                                           lut.tables[1][BMI_RGB_G(before)],
+                                           lut.tables[2][BMI_RGB_B(before)]);
+                        if (flags[i] & BMI_FL_IS_GRAYSCALE) {
+                            expected = lut.tables[0][before];
+                        }
+                    }
+                    const bmi_pixel actual = bmi_buffer_get_pixel(buffer,
+                                                                  point);
+                    
+                    // Colors transformed in a region of a palette buffer
+                    // are only matched to the nearest in the palette
+                    if ((flags[i] & BMI_FL_IS_PALETTE) && !whole) {
+                        bmi_buffer_draw_point(probe, BMI_POINT(0, 0),
+                                              expected);
+                        expected = bmi_buffer_get_pixel(probe,
+                                                        BMI_POINT(0, 0));
+                    }
+                    if (actual != expected) {
+                        fprintf(stderr, "Table was applied wrongly\n");
+                        return 1;
+                    }
+                }
+            }
+            bmi_buffer_free(probe);
+            bmi_buffer_free(original);
+            bmi_buffer_free(buffer);
+        }
+    }
+    
+    return 0;
+}
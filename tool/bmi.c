@@ -0,0 +1,678 @@
+// tool: bmi.c
+// Copyright (C) 2021 Ethan Uppal
+//
+// bmi is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// bmi is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with bmi. If not, see <https://www.gnu.org/licenses/>.
+
+// opendir, readdir, strdup, clock_gettime
+#define _POSIX_C_SOURCE 200809L
+
+#include "bmi.h"
+
+// fprintf, printf, fopen, fclose, setvbuf, tmpfile, snprintf, vsnprintf
+#include <stdio.h>
+
+// malloc, realloc, free, strtoul, qsort
+#include <stdlib.h>
+
+// strcmp, strlen, strrchr, strdup, memcmp
+#include <string.h>
+
+// pthread_create, pthread_join
+#include <pthread.h>
+
+// opendir, readdir, closedir
+#include <dirent.h>
+
+// stat, S_ISDIR, S_ISREG
+#include <sys/stat.h>
+
+// clock_gettime
+#include <time.h>
+
+// va_list, va_start, va_end
+#include <stdarg.h>
+
+// Files are read and written through stdio buffers of this size
+#define BMI_TOOL_BUFFER (1 << 20)
+
+// Load and save timings in bench are the best of this many runs
+#define BMI_BENCH_RUNS 3
+
+// Images processed at once, whatever -j asks for
+#define BMI_TOOL_MAX_THREADS 256
+
+typedef enum {
+    BMI_FORMAT_BMI,
+    BMI_FORMAT_PPM,
+    BMI_FORMAT_BMP,
+    BMI_FORMAT_UNKNOWN
+} bmi_format;
+
+static const char* const bmi_format_names[] = { "bmi", "ppm", "bmp" };
+
+typedef enum {
+    BMI_COMMAND_INFO,
+    BMI_COMMAND_CONVERT,
+    BMI_COMMAND_CROP,
+    BMI_COMMAND_RESIZE,
+    BMI_COMMAND_BENCH
+} bmi_command;
+
+typedef enum {
+    BMI_CHANNELS_KEEP,
+    BMI_CHANNELS_GRAY,
+    BMI_CHANNELS_RGB
+} bmi_channels;
+
+typedef struct {
+    bmi_command command;
+    const char* output;
+    bmi_format format;
+    bmi_channels channels;
+    bmi_rect region;
+    uint32_t width;
+    uint32_t height;
+    
+    char** inputs;
+    size_t count;
+    
+    // Filled in by the workers, and each report printed in order afterwards
+    char** reports;
+    char* errors;
+    size_t next;
+    uint64_t pixels;
+    uint64_t read;
+    uint64_t written;
+    uint32_t failures;
+} bmi_tool;
+
+static double bmi_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void bmi_usage(FILE* dest) {
+    fprintf(dest,
+        "usage: bmi [-j THREADS] COMMAND [OPTIONS] INPUT...\n"
+        "\n"
+        "Each input is an image or a directory of images in BMI, PPM, PGM or\n"
+        "BMP format.\n"
+        "\n"
+        "Commands:\n"
+        "  info                    Print the size and format of each image\n"
+        "  convert                 Write each image in another format\n"
+        "  crop X Y WIDTH HEIGHT   Cut a region out of each image\n"
+        "  resize WIDTH HEIGHT     Scale each image to the given size\n"
+        "  bench                   Time loading and saving each image\n"
+        "\n"
+        "Options:\n"
+        "  -o DIR      Write outputs to DIR rather than next to their inputs\n"
+        "  -f FORMAT   Write outputs as bmi, ppm or bmp\n"
+        "  -g          Write outputs in grayscale\n"
+        "  -c          Write outputs in RGB\n"
+        "  -j THREADS  Process up to this many images at once\n");
+}
+
+static int bmi_parse_number(const char* text, uint32_t* value) {
+    char* end;
+    const unsigned long number = strtoul(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || number > UINT32_MAX) {
+        return BMI_FAILURE;
+    }
+    *value = (uint32_t)number;
+    return BMI_SUCCESS;
+}
+
+static const char* bmi_extension(const char* path) {
+    const char* slash = strrchr(path, '/');
+    const char* dot = strrchr(path, '.');
+    return dot != NULL && (slash == NULL || dot > slash) ? dot + 1 : "";
+}
+
+static int bmi_is_image_name(const char* name) {
+    const char* extension = bmi_extension(name);
+    return strcmp(extension, "bmi") == 0 || strcmp(extension, "ppm") == 0
+        || strcmp(extension, "pgm") == 0 || strcmp(extension, "bmp") == 0;
+}
+
+static int bmi_add_input(bmi_tool* tool, char* path) {
+    char** inputs = realloc(tool->inputs, (tool->count + 1) * sizeof(char*));
+    if (inputs == NULL) {
+        free(path);
+        return BMI_FAILURE;
+    }
+    tool->inputs = inputs;
+    tool->inputs[tool->count++] = path;
+    return BMI_SUCCESS;
+}
+
+static int bmi_compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Adds a file, or every image directly inside a directory in name order
+static int bmi_collect(bmi_tool* tool, const char* path) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        fprintf(stderr, "bmi: %s: No such file or directory\n", path);
+        return BMI_FAILURE;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        char* copy = strdup(path);
+        return copy != NULL ? bmi_add_input(tool, copy) : BMI_FAILURE;
+    }
+    
+    DIR* directory = opendir(path);
+    if (directory == NULL) {
+        fprintf(stderr, "bmi: %s: Could not open directory\n", path);
+        return BMI_FAILURE;
+    }
+    const size_t start = tool->count;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (entry->d_name[0] == '.' || !bmi_is_image_name(entry->d_name)) {
+            continue;
+        }
+        const size_t length = strlen(path) + strlen(entry->d_name) + 2;
+        char* file = malloc(length);
+        if (file == NULL) {
+            closedir(directory);
+            return BMI_FAILURE;
+        }
+        snprintf(file, length, "%s/%s", path, entry->d_name);
+        if (stat(file, &info) != 0 || !S_ISREG(info.st_mode)) {
+            free(file);
+            continue;
+        }
+        if (bmi_add_input(tool, file) != BMI_SUCCESS) {
+            closedir(directory);
+            return BMI_FAILURE;
+        }
+    }
+    closedir(directory);
+    qsort(tool->inputs + start, tool->count - start, sizeof(char*),
+          bmi_compare_names);
+    return BMI_SUCCESS;
+}
+
+// Identifies an image by its first bytes rather than its name. BMI and BMP
+// both begin with "BM", but BMP has the low byte of its info header size at
+// byte 14, where BMI keeps an always clear byte of its flags.
+static bmi_format bmi_sniff(FILE* file) {
+    uint8_t magic[15] = { 0 };
+    const size_t length = fread(magic, 1, sizeof(magic), file);
+    rewind(file);
+    if (length >= 2 && magic[0] == 'P'
+        && (magic[1] == '5' || magic[1] == '6')) {
+        return BMI_FORMAT_PPM;
+    }
+    if (length == sizeof(magic) && magic[0] == 'B' && magic[1] == 'M'
+        && magic[14] != 0) {
+        return BMI_FORMAT_BMP;
+    }
+    return BMI_FORMAT_BMI;
+}
+
+static bmi_buffer* bmi_load(FILE* file, bmi_format format) {
+    switch (format) {
+        case BMI_FORMAT_PPM: return bmi_buffer_from_ppm(file);
+        case BMI_FORMAT_BMP: return bmi_buffer_from_bmp(file);
+        default: return bmi_buffer_from_file(file);
+    }
+}
+
+// Images are encoded in bands on the threads left to the library
+static int bmi_save(FILE* file, const bmi_buffer* buffer, bmi_format format) {
+    switch (format) {
+        case BMI_FORMAT_PPM: return bmi_buffer_encode(file, buffer,
+                                                      BMI_ENCODE_PPM);
+        case BMI_FORMAT_BMP: return bmi_buffer_encode(file, buffer,
+                                                      BMI_ENCODE_BMP);
+        default: return bmi_buffer_encode(file, buffer, BMI_ENCODE_BMI);
+    }
+}
+
+// Converts between grayscale and RGB by luma, or by repeating the gray level,
+// working directly on the row-major contents of loaded images, which never
+// carry memory layout flags. Palette images are expanded to RGB first.
+static bmi_buffer* bmi_recolor(bmi_buffer* buffer, bmi_channels channels) {
+    if (channels != BMI_CHANNELS_KEEP && (buffer->flags & BMI_FL_IS_PALETTE)) {
+        bmi_buffer* rgb = bmi_buffer_convert(buffer, buffer->flags
+                                             & ~(uint32_t)BMI_FL_IS_PALETTE);
+        bmi_buffer_free(buffer);
+        if (rgb == NULL) {
+            return NULL;
+        }
+        buffer = rgb;
+    }
+    const int gray = (buffer->flags & BMI_FL_IS_GRAYSCALE) != 0;
+    if (channels == BMI_CHANNELS_KEEP
+        || gray == (channels == BMI_CHANNELS_GRAY)) {
+        return buffer;
+    }
+    bmi_buffer* result = bmi_buffer_new(buffer->width, buffer->height,
+                                        buffer->flags ^ BMI_FL_IS_GRAYSCALE);
+    if (result == NULL) {
+        return NULL;
+    }
+    const size_t count = (size_t)buffer->width * buffer->height;
+    const uint8_t* src = buffer->contents;
+    uint8_t* dst = result->contents;
+    if (gray) {
+        for (size_t i = 0; i < count; i++, dst += 3) {
+            dst[0] = dst[1] = dst[2] = src[i];
+        }
+    } else {
+        for (size_t i = 0; i < count; i++, src += 3) {
+            dst[i] = (uint8_t)((77 * src[0] + 150 * src[1] + 29 * src[2]
+                                + 128) >> 8);
+        }
+    }
+    bmi_buffer_free(buffer);
+    return result;
+}
+
+// Names the output of an input, which goes to the output directory if given
+// and otherwise next to the input, under the extension of its format
+static char* bmi_output_path(const bmi_tool* tool, const char* input,
+                             bmi_format format) {
+    const char* slash = strrchr(input, '/');
+    const char* name = slash != NULL ? slash + 1 : input;
+    const char* extension = bmi_extension(name);
+    const size_t stem = *extension != '\0'
+        ? (size_t)(extension - name - 1) : strlen(name);
+    const size_t directory = tool->output != NULL ? strlen(tool->output) + 1
+        : (size_t)(name - input);
+    const size_t length = directory + stem + 5;
+    char* path = malloc(length);
+    if (path == NULL) {
+        return NULL;
+    }
+    if (tool->output != NULL) {
+        snprintf(path, length, "%s/%.*s.%s", tool->output, (int)stem, name,
+                 bmi_format_names[format]);
+    } else {
+        snprintf(path, length, "%.*s%.*s.%s", (int)directory, input,
+                 (int)stem, name, bmi_format_names[format]);
+    }
+    return path;
+}
+
+// Formats a report into allocated memory
+static char* bmi_report(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    char* report = length >= 0 ? malloc((size_t)length + 1) : NULL;
+    if (report != NULL) {
+        va_start(args, format);
+        vsnprintf(report, (size_t)length + 1, format, args);
+        va_end(args);
+    }
+    return report;
+}
+
+// Times loading an image and saving it in its own format, best of a few
+// runs, with throughput counted in the bytes each step read or wrote. On
+// failure the step that failed is given through reason.
+static char* bmi_bench(bmi_tool* tool, FILE* file, bmi_format format,
+                       const char* input, const char** reason) {
+    double load = 0;
+    double save = 0;
+    bmi_buffer* buffer = NULL;
+    long read = 0;
+    long written = 0;
+    for (int run = 0; run < BMI_BENCH_RUNS; run++) {
+        rewind(file);
+        double start = bmi_now();
+        bmi_buffer* loaded = bmi_load(file, format);
+        double elapsed = bmi_now() - start;
+        read = ftell(file);
+        if (loaded == NULL) {
+            bmi_buffer_free(buffer);
+            *reason = "Could not load image";
+            return NULL;
+        }
+        load = run == 0 || elapsed < load ? elapsed : load;
+        bmi_buffer_free(buffer);
+        buffer = loaded;
+        
+        FILE* scratch = tmpfile();
+        if (scratch == NULL) {
+            bmi_buffer_free(buffer);
+            *reason = "Could not create scratch file";
+            return NULL;
+        }
+        setvbuf(scratch, NULL, _IOFBF, BMI_TOOL_BUFFER);
+        start = bmi_now();
+        const int saved = bmi_save(scratch, buffer, format);
+        fflush(scratch);
+        elapsed = bmi_now() - start;
+        written = ftell(scratch);
+        fclose(scratch);
+        if (saved != BMI_SUCCESS) {
+            bmi_buffer_free(buffer);
+            *reason = "Could not save image";
+            return NULL;
+        }
+        save = run == 0 || elapsed < save ? elapsed : save;
+    }
+    
+    const double megapixels = (double)buffer->width * buffer->height / 1e6;
+    __atomic_add_fetch(&tool->pixels,
+                       (uint64_t)buffer->width * buffer->height,
+                       __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tool->written, (uint64_t)written, __ATOMIC_RELAXED);
+    bmi_buffer_free(buffer);
+    *reason = "Virtual memory exhausted";
+    return bmi_report("%s: load %.1f Mpx/s %.1f MB/s, save %.1f Mpx/s "
+                      "%.1f MB/s", input,
+                      megapixels / (load > 0 ? load : 1e-9),
+                      read / 1e6 / (load > 0 ? load : 1e-9),
+                      megapixels / (save > 0 ? save : 1e-9),
+                      written / 1e6 / (save > 0 ? save : 1e-9));
+}
+
+// Records an error for an input, which is printed with the reports
+static void bmi_fail(bmi_tool* tool, size_t index, const char* reason) {
+    tool->reports[index] = bmi_report("bmi: %s: %s", tool->inputs[index],
+                                      reason != NULL ? reason
+                                      : "Unknown error");
+    tool->errors[index] = 1;
+    __atomic_add_fetch(&tool->failures, 1, __ATOMIC_RELAXED);
+}
+
+static void bmi_process(bmi_tool* tool, size_t index) {
+    const char* input = tool->inputs[index];
+    FILE* file = fopen(input, "rb");
+    if (file == NULL) {
+        bmi_fail(tool, index, "Could not open file");
+        return;
+    }
+    setvbuf(file, NULL, _IOFBF, BMI_TOOL_BUFFER);
+    const bmi_format format = bmi_sniff(file);
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    rewind(file);
+    __atomic_add_fetch(&tool->read, (uint64_t)(size > 0 ? size : 0),
+                       __ATOMIC_RELAXED);
+    
+    if (tool->command == BMI_COMMAND_BENCH) {
+        const char* reason = NULL;
+        tool->reports[index] = bmi_bench(tool, file, format, input, &reason);
+        fclose(file);
+        if (tool->reports[index] == NULL) {
+            bmi_fail(tool, index, reason);
+        }
+        return;
+    }
+    
+    bmi_buffer* buffer = bmi_load(file, format);
+    fclose(file);
+    if (buffer == NULL) {
+        bmi_fail(tool, index, "Could not load image");
+        return;
+    }
+    
+    if (tool->command == BMI_COMMAND_INFO) {
+        __atomic_add_fetch(&tool->pixels,
+                           (uint64_t)buffer->width * buffer->height,
+                           __ATOMIC_RELAXED);
+        char colors[32] = "RGB";
+        if (buffer->flags & BMI_FL_IS_GRAYSCALE) {
+            snprintf(colors, sizeof(colors), "grayscale");
+        } else if (buffer->flags & BMI_FL_IS_PALETTE) {
+            bmi_pixel palette[BMI_PALETTE_CAPACITY];
+            snprintf(colors, sizeof(colors), "palette of %u colors",
+                     bmi_buffer_get_palette(buffer, palette));
+        }
+        tool->reports[index] = bmi_report(
+            "%s: %s, %u x %u, %s%s", input, bmi_format_names[format],
+            buffer->width, buffer->height, colors,
+            buffer->flags & BMI_FL_HAS_CHECKSUM ? ", checksummed" : "");
+        bmi_buffer_free(buffer);
+        return;
+    }
+    
+    bmi_buffer* result = buffer;
+    if (tool->command == BMI_COMMAND_CROP) {
+        result = bmi_buffer_crop(buffer, tool->region);
+    } else if (tool->command == BMI_COMMAND_RESIZE) {
+        result = bmi_buffer_resize(buffer, tool->width, tool->height);
+    }
+    if (result != buffer) {
+        bmi_buffer_free(buffer);
+        if (result == NULL) {
+            bmi_fail(tool, index, tool->command == BMI_COMMAND_CROP
+                     ? "Could not crop image" : "Could not resize image");
+            return;
+        }
+    }
+    result = bmi_recolor(result, tool->channels);
+    if (result == NULL) {
+        bmi_fail(tool, index, "Virtual memory exhausted");
+        return;
+    }
+    
+    const bmi_format output = tool->format != BMI_FORMAT_UNKNOWN
+        ? tool->format : format;
+    char* path = bmi_output_path(tool, input, output);
+    if (path == NULL || strcmp(path, input) == 0) {
+        bmi_fail(tool, index, path == NULL ? "Virtual memory exhausted"
+                 : "Output would overwrite the input, so give -o or -f");
+        free(path);
+        bmi_buffer_free(result);
+        return;
+    }
+    FILE* dest = fopen(path, "wb");
+    if (dest == NULL) {
+        bmi_fail(tool, index, "Could not create output file");
+        free(path);
+        bmi_buffer_free(result);
+        return;
+    }
+    setvbuf(dest, NULL, _IOFBF, BMI_TOOL_BUFFER);
+    const int saved = bmi_save(dest, result, output);
+    const long written = ftell(dest);
+    if (fclose(dest) != 0 || saved != BMI_SUCCESS) {
+        bmi_fail(tool, index, saved != BMI_SUCCESS ? "Could not save image"
+                 : "Could not finish writing output file");
+    } else {
+        __atomic_add_fetch(&tool->pixels,
+                           (uint64_t)result->width * result->height,
+                           __ATOMIC_RELAXED);
+        __atomic_add_fetch(&tool->written,
+                           (uint64_t)(written > 0 ? written : 0),
+                           __ATOMIC_RELAXED);
+        tool->reports[index] = bmi_report("%s -> %s", input, path);
+    }
+    free(path);
+    bmi_buffer_free(result);
+}
+
+// Workers take inputs in turn, so at most one image per worker is in memory
+static void* bmi_worker(void* context) {
+    bmi_tool* tool = context;
+    for (;;) {
+        const size_t index = __atomic_fetch_add(&tool->next, 1,
+                                                __ATOMIC_RELAXED);
+        if (index >= tool->count) {
+            return NULL;
+        }
+        bmi_process(tool, index);
+    }
+}
+
+static int bmi_parse_format(const char* name, bmi_format* format) {
+    for (int i = 0; i < BMI_FORMAT_UNKNOWN; i++) {
+        if (strcmp(name, bmi_format_names[i]) == 0) {
+            *format = (bmi_format)i;
+            return BMI_SUCCESS;
+        }
+    }
+    return BMI_FAILURE;
+}
+
+int main(int argc, const char* argv[]) {
+    bmi_tool tool = {
+        .format = BMI_FORMAT_UNKNOWN,
+        .channels = BMI_CHANNELS_KEEP
+    };
+    uint32_t jobs = 0;
+    const char* positional[argc > 0 ? argc : 1];
+    int positionals = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            bmi_usage(stdout);
+            return 0;
+        } else if (strcmp(arg, "-g") == 0) {
+            tool.channels = BMI_CHANNELS_GRAY;
+        } else if (strcmp(arg, "-c") == 0) {
+            tool.channels = BMI_CHANNELS_RGB;
+        } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "-f") == 0
+                   || strcmp(arg, "-j") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "bmi: %s needs a value\n", arg);
+                return 2;
+            }
+            const char* value = argv[++i];
+            if (arg[1] == 'o') {
+                tool.output = value;
+            } else if (arg[1] == 'f'
+                       && bmi_parse_format(value, &tool.format)
+                       != BMI_SUCCESS) {
+                fprintf(stderr, "bmi: Unknown format %s\n", value);
+                return 2;
+            } else if (arg[1] == 'j'
+                       && (bmi_parse_number(value, &jobs) != BMI_SUCCESS
+                           || jobs == 0)) {
+                fprintf(stderr, "bmi: Invalid thread count %s\n", value);
+                return 2;
+            }
+        } else if (arg[0] == '-' && arg[1] != '\0') {
+            fprintf(stderr, "bmi: Unknown option %s\n", arg);
+            bmi_usage(stderr);
+            return 2;
+        } else {
+            positional[positionals++] = arg;
+        }
+    }
+    if (positionals == 0) {
+        bmi_usage(stderr);
+        return 2;
+    }
+    
+    // Commands taking numbers read them before the inputs
+    const char* command = positional[0];
+    int first = 1;
+    uint32_t numbers[4];
+    int needed = 0;
+    if (strcmp(command, "info") == 0) {
+        tool.command = BMI_COMMAND_INFO;
+    } else if (strcmp(command, "convert") == 0) {
+        tool.command = BMI_COMMAND_CONVERT;
+    } else if (strcmp(command, "crop") == 0) {
+        tool.command = BMI_COMMAND_CROP;
+        needed = 4;
+    } else if (strcmp(command, "resize") == 0) {
+        tool.command = BMI_COMMAND_RESIZE;
+        needed = 2;
+    } else if (strcmp(command, "bench") == 0) {
+        tool.command = BMI_COMMAND_BENCH;
+    } else {
+        fprintf(stderr, "bmi: Unknown command %s\n", command);
+        bmi_usage(stderr);
+        return 2;
+    }
+    for (int i = 0; i < needed; i++, first++) {
+        if (first >= positionals
+            || bmi_parse_number(positional[first], &numbers[i])
+            != BMI_SUCCESS) {
+            fprintf(stderr, "bmi: %s needs %d numbers\n", command, needed);
+            return 2;
+        }
+    }
+    if (tool.command == BMI_COMMAND_CROP) {
+        tool.region = BMI_RECT(numbers[0], numbers[1], numbers[2], numbers[3]);
+    } else if (tool.command == BMI_COMMAND_RESIZE) {
+        tool.width = numbers[0];
+        tool.height = numbers[1];
+    }
+    
+    for (int i = first; i < positionals; i++) {
+        if (bmi_collect(&tool, positional[i]) != BMI_SUCCESS) {
+            return 1;
+        }
+    }
+    if (tool.count == 0) {
+        fprintf(stderr, "bmi: No input images\n");
+        return 2;
+    }
+    tool.reports = calloc(tool.count, sizeof(char*));
+    tool.errors = calloc(tool.count, 1);
+    if (tool.reports == NULL || tool.errors == NULL) {
+        fprintf(stderr, "bmi: Virtual memory exhausted\n");
+        return 1;
+    }
+    
+    // Images are spread across the workers, and the threads left over go to
+    // the library's parallel operations within each image
+    if (jobs == 0) {
+        jobs = bmi_thread_count();
+    }
+    uint32_t workers = jobs < BMI_TOOL_MAX_THREADS ? jobs
+                                                   : BMI_TOOL_MAX_THREADS;
+    if (workers > tool.count) {
+        workers = (uint32_t)tool.count;
+    }
+    bmi_set_thread_count(jobs / workers);
+    
+    const double start = bmi_now();
+    pthread_t threads[BMI_TOOL_MAX_THREADS];
+    uint32_t started = 0;
+    while (started + 1 < workers
+           && pthread_create(&threads[started], NULL, bmi_worker, &tool)
+           == 0) {
+        started++;
+    }
+    bmi_worker(&tool);
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    const double elapsed = bmi_now() - start;
+    
+    for (size_t i = 0; i < tool.count; i++) {
+        if (tool.reports[i] != NULL) {
+            fprintf(tool.errors[i] ? stderr : stdout, "%s\n",
+                    tool.reports[i]);
+        }
+        free(tool.reports[i]);
+        free(tool.inputs[i]);
+    }
+    fflush(stdout);
+    const double seconds = elapsed > 0 ? elapsed : 1e-9;
+    fprintf(stderr, "%zu images, %u failed, %.1f Mpx, %.1f MB read, %.1f MB "
+            "written in %.3f s: %.1f Mpx/s, %.1f MB/s\n", tool.count,
+            tool.failures, tool.pixels / 1e6, tool.read / 1e6,
+            tool.written / 1e6, elapsed, tool.pixels / 1e6 / seconds,
+            (tool.read + tool.written) / 1e6 / seconds);
+    
+    free(tool.reports);
+    free(tool.errors);
+    free(tool.inputs);
+    return tool.failures != 0;
+}